@@ -4,13 +4,37 @@
 #include "Arduino.h"                                                        // thư viện arduino
 #include <Udp.h>                                                            // thư viện UDP
 #include "types.h"
+#include "datetime.h"
+#include <esp_timer.h>
+#include <sys/time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include <functional>
 
 #define SEVENZYYEARS            2208988800UL                                //
 #define NTP_PACKET_SIZE         48                                          //
 #define NTP_DEFAULT_LOCAL_PORT  1337                                        //
+#define NTP_TIMEOUT_MS          1000                                        // Give up on an answer after this
+#define NTP_RETRY_INTERVAL      10000                                       // Between attempts until the first answer, in ms
+#define NTP_TASK_STACK          3072                                        //
+#define NTP_TASK_PRIORITY       2                                           //
+#define NTP_MAX_SERVERS         4                                           // Servers queried every poll
+#define NTP_FILTER_SIZE         8                                           // Samples kept per server for the clock filter
+#define NTP_MAX_POLL_SHIFT      4                                           // Poll interval grows up to updateInterval << this
+#define NTP_STABLE_US           2000                                        // Offsets below this count towards a longer poll
+#define NTP_UNSTABLE_US         20000                                       // An offset above this shortens the poll again
+#define NTP_STEP_US             128000                                      // Larger corrections step the clock, smaller ones slew
+#define NTP_SLEW_PPM            500                                         // Fastest slew, as in adjtime()
+#define NTP_MAX_FREQ_PPB        500000                                      // Drift estimate is clamped to +-500 ppm
+#define NTP_FREQ_GAIN           4                                           // Share of the observed frequency error corrected per poll
+#define NTP_DISPERSION_PPM      15                                          // Error growth of an aging sample
+#define NTP_SERVER_FAILURES     4                                           // Missed answers before a server name is resolved again
+
+typedef std::function<IPAddress(const char* host)> NTPResolver;             // Cached address of a server name, 0.0.0.0 if none
 
-const uint8_t daysArray[]    PROGMEM = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };// số ngày có trong tháng
-const uint8_t dowArray[]     PROGMEM = { 0,   3,  2,  5,  0,  3,  5,  1,  4,  6,  2,  4 };// mảng chuyển đổi thứ của tuần
 // const char*   strMonth[]     PROGMEM = {"Unknown", "January", "February", "March", "April", "May", "June", "July", "August", "September", "October", "November", "December"};
 // const char*   strDayOfWeek[] PROGMEM = {"Unknown", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday", "Sunday"};                                                                                                      //
 
@@ -60,6 +84,16 @@ class NTPClient {                                                           //
       this->_poolServerName = poolServerName;
     }
 
+    bool addServer(const char* serverName) {                 // Another server for the clock selection, call before begin()
+      if (this->_extraCount >= NTP_MAX_SERVERS - 1) return false;
+      this->_extraNames[this->_extraCount++] = serverName;
+      return true;
+    }
+
+    void setResolver(NTPResolver resolver) {                 // Server names are looked up here first, e.g. in a DNS cache;
+      this->_resolver = resolver;                            // hostByName() is used when it has none or that address stops answering
+    }
+
 
 
     void setRandomPort(unsigned int minValue = 49152, unsigned int maxValue = 65535) {//      Set random local port
@@ -71,51 +105,62 @@ class NTPClient {                                                           //
       this->begin(NTP_DEFAULT_LOCAL_PORT);
     }
 
-    void begin(unsigned int port) {//Starts the underlying UDP client with the specified local port
+    void begin(unsigned int port) {//Starts the UDP socket and the task that exchanges packets with the servers
       this->_port = port;
-      this->_udp->begin(this->_port);
+      // A socket of our own rather than the UDP object, so the task can block in select() for the answer
+      if (this->_socket < 0) {
+        this->_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in local = {};
+        local.sin_family      = AF_INET;
+        local.sin_port        = htons(this->_port);
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        bind(this->_socket, (struct sockaddr*)&local, sizeof(local));
+      }
       this->_udpSetup = true;
-    }
 
-    bool update() {                                                                                                           //  This should be called in the main loop of your application. By default an update from the NTP Server is only made every 60 seconds. This can be configured in the NTPClient constructor.
-      if ((millis() - this->_lastUpdate >= this->_updateInterval) || this->_lastUpdate == 0) {                                 // Update after _updateInterval  // Update if there was no update yet.
-        if (!this->_udpSetup || this->_port != NTP_DEFAULT_LOCAL_PORT) this->begin(this->_port); // setup the UDP client if needed
-        return this->forceUpdate();
+      // Server 0 is the one given to the constructor, by name or address
+      this->_serverCount = 0;
+      this->_servers[this->_serverCount].name = this->_poolServerName;
+      this->_servers[this->_serverCount].ip   = this->_poolServerName ? IPAddress() : this->_poolServerIP;
+      this->_serverCount++;
+      for (uint8_t i = 0; i < this->_extraCount; i++) {
+        this->_servers[this->_serverCount].name = this->_extraNames[i];
+        this->_servers[this->_serverCount].ip   = IPAddress();
+        this->_serverCount++;
+      }
+      for (uint8_t i = 0; i < this->_serverCount; i++) {
+        this->_servers[i].failures      = 0;
+        this->_servers[i].resolveDirect = false;
       }
-      return false;   // return false if update does not occur
-    }
-
-    bool forceUpdate() {                                                                      //       This will force the update from the NTP Server.
-
-      // flush any existing packets
-      while (this->_udp->parsePacket() != 0)
-        this->_udp->flush();
-
-      this->sendNTPPacket();
-
-      // Wait till data is there or timeout...
-      byte  timeout = 0;
-      int   cb      = 0;
-      do {
-        delay ( 10 );
-        cb = this->_udp->parsePacket();
-        if (timeout > 100) return false; // timeout after 1000 ms
-        timeout++;
-      } while (cb == 0);
-
-      this->_lastUpdate = millis() - (10 * (timeout + 1)); // Account for delay in reading the time
 
-      this->_udp->read(this->_packetBuffer, NTP_PACKET_SIZE);
+      if (this->_task == NULL) {
+        this->_samples = xQueueCreate(NTP_MAX_SERVERS, sizeof(Sample));
+        xTaskCreate(NTPClient::exchangeTask, "ntp", NTP_TASK_STACK, this, NTP_TASK_PRIORITY, &this->_task);
+      }
+    }
 
-      unsigned long highWord = word(this->_packetBuffer[40], this->_packetBuffer[41]);
-      unsigned long lowWord  = word(this->_packetBuffer[42], this->_packetBuffer[43]);
-      // combine the four bytes (two words) into a long integer
-      // this is NTP time (seconds since Jan 1 1900):
-      unsigned long secsSince1900 = highWord << 16 | lowWord;
+    // Call from the main loop. Never blocks: slews the clock, starts a poll of all
+    // servers when one is due and disciplines the clock once the answers are in.
+    // True when the time was updated.
+    bool update() {
+      this->slew();
+      bool updated = this->collectSamples();
+      if (this->_task == NULL || this->_requestPending) return updated;
 
-      this->_currentEpoc = secsSince1900 - SEVENZYYEARS;
+      unsigned long interval = this->isTimeSet() ? this->pollInterval() : NTP_RETRY_INTERVAL;
+      if (this->_lastRequest == 0 || millis() - this->_lastRequest >= interval) {
+        this->forceUpdate();
+      }
+      return updated;
+    }
 
-      return true;  // return true after successful update
+    // Starts a poll right away; the result is applied by a later update()
+    bool forceUpdate() {
+      if (this->_task == NULL || this->_requestPending) return false;
+      this->_requestPending = true;
+      this->_lastRequest = millis();
+      xTaskNotifyGive(this->_task);
+      return true;
     }
 
     bool isTimeSet() const {//       This allows to check if the NTPClient successfully received a NTP packet and set the time.       @return true if time has been set, else false
@@ -126,20 +171,29 @@ class NTPClient {                                                           //
       this->_timeOffset     = timeOffset;
     }
 
-    void setUpdateInterval(unsigned long updateInterval) {//       Set the update interval to another frequency. E.g. useful when the timeOffset should not be set in the constructor
+    void setUpdateInterval(unsigned long updateInterval) {//       Shortest poll interval; it widens up to << NTP_MAX_POLL_SHIFT as the clock settles
       this->_updateInterval = updateInterval;
     }
 
+    void setSystemClock(bool enabled) {                      // Also discipline the ESP32 system clock (gettimeofday)
+      this->_setSystemClock = enabled;
+    }
 
+    int64_t getEpochMicros() const {                         // UTC microseconds since 1970, 0 before the first update
+      if (!this->isTimeSet()) return 0;
+      return this->modelUtc(esp_timer_get_time());
+    }
 
+    int64_t getCorrectedMicros() const {                     // As getEpochMicros() with the pending slew applied, for other clocks to follow
+      if (!this->isTimeSet()) return 0;
+      return this->modelUtc(esp_timer_get_time()) + this->_slewUs;
+    }
 
-
-
-
-
-
-
-
+    int32_t lastOffsetUs() const { return this->_lastOffsetUs; }   // Combined offset of the last poll, before correction
+    uint32_t lastDelayUs() const { return this->_lastDelayUs; }    // Round trip to the best surviving server
+    int32_t driftPpb() const { return this->_freqPpb; }            // Estimated local oscillator error
+    uint8_t survivors() const { return this->_survivors; }         // Servers agreeing in the last poll
+    unsigned long pollInterval() const { return this->_updateInterval << this->_pollShift; }
 
     int getDay() const {
       return (((this->getEpochTime()  / 86400L) + 4 ) % 7); //0 is Sunday
@@ -155,7 +209,7 @@ class NTPClient {                                                           //
     }
 
     RTCDateTime getDateTime(void) {                                                                           // hàm đọc thời gian
-      return this->ConverterUnixtimeToDateTime(this->getEpochTime());                                                        // trả thời gian được tính toán
+      return this->_calendar.at(this->getEpochTime());                                                        // only fields that changed are recomputed
     }
 
     uint32_t ConverterDateTimeToUnixtime(RTCDateTime dt) {
@@ -163,81 +217,23 @@ class NTPClient {                                                           //
     }
 
     uint32_t ConverterDateTimeToUnixtime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
-      return time2long(date2days(year, month, day), hour, minute, second);
+      return unixFromDateTime(year, month, day, hour, minute, second);
     }
 
-
     RTCDateTime ConverterUnixtimeToDateTime(uint32_t ut) {
-      RTCDateTime t;
-
-      t.second = ut % 60;
-      ut /= 60;
-
-      t.minute = ut % 60;
-      ut /= 60;
-
-      t.hour = ut % 24;
-      uint16_t days = ut / 24;
-      uint8_t  leap;
-
-      for (t.year = 0; ; ++t.year) {
-        leap = (t.year + 2) % 4 == 0;
-        if (days < 365 + leap) break;
-        days -= 365 + leap;
-      }
-      t.year += 1970;
-
-      for (t.month = 1; ; ++t.month) {
-        uint8_t daysPerMonth = pgm_read_byte(daysArray + t.month - 1);
-        if (leap && t.month == 2) ++daysPerMonth;
-        if (days < daysPerMonth) break;
-        days -= daysPerMonth;
-      }
-
-      t.day = days + 1;
-
-      t.dayOfWeek = dow(t.year, t.month, t.day);
-      t.unixtime  = ConverterDateTimeToUnixtime(t);
-
-      return t;
-    }
-
-
-
-    long time2long(uint16_t days, uint8_t hours, uint8_t minutes, uint8_t seconds) {
-      return ((days * 24L + hours) * 60 + minutes) * 60 + seconds;
-    }
-
-    uint16_t date2days(uint16_t year, uint8_t month, uint8_t day) {
-      year = year - 1970;
-      uint16_t days16 = day;
-      for (uint8_t i = 1; i < month; ++i)
-        days16 += pgm_read_byte(daysArray + i - 1);
-      if ((month == 2) && isLeapYear(year)) ++days16;
-      return days16 + 365 * year + (year + 3) / 4 - 1;
+      return dateTimeFromUnix(ut);
     }
 
     uint8_t daysInMonth(uint16_t year, uint8_t month) {
-      uint8_t days;
-      days = pgm_read_byte(daysArray + month - 1);
-      if ((month == 2) && isLeapYear(year)) ++days;
-      return days;
+      return daysInMonthCivil(year, month);
     }
 
     uint16_t dayInYear(uint16_t year, uint8_t month, uint8_t day) {
-      uint16_t fromDate;
-      uint16_t toDate;
-      fromDate  = date2days(year, 1, 1);
-      toDate    = date2days(year, month, day);
-      return (toDate - fromDate);
+      return daysFromCivil(year, month, day) - daysFromCivil(year, 1, 1);
     }
 
-    uint8_t dow(uint16_t y, uint8_t m, uint8_t d) {
-      uint8_t dow;
-      y -= m < 3;
-      dow = ((y + y / 4 - y / 100 + y / 400 + pgm_read_byte(dowArray + (m - 1)) + d) % 7);
-      if (dow == 0) return 7;
-      return dow;
+    uint8_t dow(uint16_t y, uint8_t m, uint8_t d) {                                                           // 1 = Monday ... 7 = Sunday
+      return weekdayFromDays(daysFromCivil(y, m, d));
     }
 
     String getFormattedTime() const {//@return time formatted like `hh:mm:ss`
@@ -251,33 +247,342 @@ class NTPClient {                                                           //
       return          hoursStr + ":" + minuteStr + ":" + secondStr;
     }
 
-    unsigned long getEpochTime() const {                                                        //@return time in seconds since Jan. 1, 1970
-      return this->_timeOffset + this->_currentEpoc + ((millis() - this->_lastUpdate) / 1000);  // User offset // Epoch returned by the NTP server // Time since last update
+    unsigned long getEpochTime() const {                                                        //@return time in seconds since Jan. 1, 1970, plus the time offset
+      return this->_timeOffset + (unsigned long)(this->getEpochMicros() / 1000000LL);
     }
 
-    void end() {                                                                                // Stops the underlying UDP client
-      this->_udp->stop();
+    void end() {                                                                                // Stops the exchange task and the UDP client
+      if (this->_task != NULL) {
+        vTaskDelete(this->_task);
+        this->_task = NULL;
+      }
+      this->_requestPending = false;
+      if (this->_socket >= 0) close(this->_socket);
+      this->_socket = -1;
       this->_udpSetup = false;
     }
 
   private:                                                                                       // mảng lưu dữ liệu
 
-    UDP*          _udp;
+    UDP*          _udp;                       // Kept for the constructors, the exchanges use _socket
     bool          _udpSetup         = false;
+    int           _socket           = -1;
+    NTPResolver   _resolver;
 
     const char*   _poolServerName   = "pool.ntp.org"; // Default time server
     IPAddress     _poolServerIP;
     unsigned int  _port             = NTP_DEFAULT_LOCAL_PORT;
     long          _timeOffset       = 0;
 
-    unsigned long _updateInterval   = 60000;  // In ms
-
-    unsigned long _currentEpoc      = 0;      // In s
-    unsigned long _lastUpdate       = 0;      // In ms
+    unsigned long _updateInterval   = 60000;  // In ms, shortest poll
+
+    unsigned long _lastUpdate       = 0;      // millis() of the last clock update
+    unsigned long _lastRequest      = 0;      // millis() of the last poll
+    int32_t       _lastOffsetUs     = 0;
+    uint32_t      _lastDelayUs      = 0;
+    uint8_t       _survivors        = 0;
+    bool          _setSystemClock   = true;
+
+    // Clock model: UTC = base + elapsed * (1 + drift), elapsed on esp_timer_get_time().
+    // slew() moves the base forward and bleeds a pending phase correction into it.
+    int64_t       _baseLocalUs      = 0;
+    int64_t       _baseUtcUs        = 0;
+    int32_t       _freqPpb          = 0;
+    int64_t       _slewUs           = 0;      // Phase correction still to apply
+    int64_t       _lastDisciplineUs = 0;
+    uint8_t       _pollShift        = 0;
+    uint8_t       _stableCount      = 0;
+
+    // One answer, offset of UTC against the local clock at the middle of the exchange
+    struct Sample {
+      uint8_t     server;
+      int64_t     offsetUs;
+      int64_t     midUs;
+      uint32_t    delayUs;
+    };
+
+    struct Server {
+      const char* name;
+      IPAddress   ip;
+      uint8_t     failures;
+      bool        resolveDirect;              // The resolver's address stopped answering
+      Sample      filter[NTP_FILTER_SIZE];
+      uint8_t     count;
+      uint8_t     next;
+    };
+    Server        _servers[NTP_MAX_SERVERS];
+    uint8_t       _serverCount      = 0;
+    const char*   _extraNames[NTP_MAX_SERVERS - 1];
+    uint8_t       _extraCount       = 0;
+
+    TaskHandle_t  _task             = NULL;
+    QueueHandle_t _samples          = NULL;
+    volatile bool _requestPending   = false;
+    volatile bool _pollDone         = false;
 
     byte          _packetBuffer[NTP_PACKET_SIZE];
+    CachedDateTime _calendar;
+
+    int64_t modelUtc(int64_t localUs) const {
+      int64_t elapsed = localUs - this->_baseLocalUs;
+      return this->_baseUtcUs + elapsed + elapsed * this->_freqPpb / 1000000000LL;
+    }
+
+    // Re-bases the model at the current instant, slewing at most NTP_SLEW_PPM
+    void slew() {
+      if (!this->isTimeSet()) return;
+      int64_t now  = esp_timer_get_time();
+      int64_t base = this->modelUtc(now);
+      int64_t room = (now - this->_baseLocalUs) * NTP_SLEW_PPM / 1000000LL;
+      int64_t step = this->_slewUs;
+      if (step > room) step = room;
+      if (step < -room) step = -room;
+      this->_slewUs     -= step;
+      this->_baseLocalUs = now;
+      this->_baseUtcUs   = base + step;
+    }
+
+    // Offset of a sample against the current model
+    int64_t residual(const Sample& sample) const {
+      if (!this->isTimeSet()) return sample.offsetUs;
+      return sample.offsetUs - (this->modelUtc(sample.midUs) - sample.midUs);
+    }
+
+    bool collectSamples() {
+      Sample sample;
+      while (this->_samples != NULL && xQueueReceive(this->_samples, &sample, 0) == pdTRUE) {
+        Server& server = this->_servers[sample.server];
+        server.filter[server.next] = sample;
+        server.next = (server.next + 1) % NTP_FILTER_SIZE;
+        if (server.count < NTP_FILTER_SIZE) server.count++;
+      }
+      if (!this->_pollDone) return false;
+      this->_pollDone = false;
+      this->_requestPending = false;
+      return this->discipline();
+    }
+
+    // Clock filter, selection and combining over the servers' recent samples, then
+    // step, slew and frequency correction of the model
+    bool discipline() {
+      struct Candidate {
+        int64_t   offset;
+        int64_t   distance;     // Half-width of the interval the true time lies in
+        uint32_t  delay;
+      };
+      Candidate candidates[NTP_MAX_SERVERS];
+      uint8_t   candidateCount = 0;
+      int64_t   now = esp_timer_get_time();
+
+      for (uint8_t i = 0; i < this->_serverCount; i++) {
+        Server& server = this->_servers[i];
+        if (server.count == 0) continue;
+
+        // Clock filter: the minimum-delay sample is the least disturbed by queuing
+        const Sample* best = &server.filter[0];
+        for (uint8_t j = 1; j < server.count; j++) {
+          if (server.filter[j].delayUs < best->delayUs) best = &server.filter[j];
+        }
+        int64_t offset = this->residual(*best);
+        int64_t jitter = 0;
+        for (uint8_t j = 0; j < server.count; j++) {
+          int64_t difference = this->residual(server.filter[j]) - offset;
+          jitter += difference < 0 ? -difference : difference;
+        }
+        jitter /= server.count;
+
+        int64_t age = now - best->midUs;
+        Candidate& candidate = candidates[candidateCount++];
+        candidate.offset   = offset;
+        candidate.distance = best->delayUs / 2 + age * NTP_DISPERSION_PPM / 1000000LL + jitter + 1;
+        candidate.delay    = best->delayUs;
+      }
+      if (candidateCount == 0) return false;
+
+      // Selection: the point inside the most intervals; agreeing servers are truechimers
+      int64_t point = candidates[0].offset;
+      uint8_t most  = 0;
+      for (uint8_t i = 0; i < candidateCount; i++) {
+        int64_t edges[2] = { candidates[i].offset - candidates[i].distance, candidates[i].offset + candidates[i].distance };
+        for (int e = 0; e < 2; e++) {
+          uint8_t inside = 0;
+          for (uint8_t j = 0; j < candidateCount; j++) {
+            if (edges[e] >= candidates[j].offset - candidates[j].distance &&
+                edges[e] <= candidates[j].offset + candidates[j].distance) inside++;
+          }
+          if (inside > most) {
+            most  = inside;
+            point = edges[e];
+          }
+        }
+      }
+      if (candidateCount > 1 && most * 2 <= candidateCount) {
+        Serial.println("NTPClient - No majority among servers, clock left alone");
+        return false;
+      }
+
+      // Combine the survivors, weighted by how tight their intervals are
+      double weightSum = 0;
+      double offsetSum = 0;
+      uint32_t bestDelay = UINT32_MAX;
+      this->_survivors = 0;
+      for (uint8_t i = 0; i < candidateCount; i++) {
+        if (point < candidates[i].offset - candidates[i].distance ||
+            point > candidates[i].offset + candidates[i].distance) continue;
+        double weight = 1.0 / (double)candidates[i].distance;
+        weightSum += weight;
+        offsetSum += weight * (double)candidates[i].offset;
+        if (candidates[i].delay < bestDelay) bestDelay = candidates[i].delay;
+        this->_survivors++;
+      }
+      int64_t offset = (int64_t)(offsetSum / weightSum);
+
+      if (!this->isTimeSet()) {
+        // First fix: the offset is against the raw local clock
+        this->_baseLocalUs = now;
+        this->_baseUtcUs   = now + offset;
+        this->_slewUs      = 0;
+      } else if (offset > NTP_STEP_US || offset < -NTP_STEP_US) {
+        Serial.printf("NTPClient - Stepping clock by %d ms\n", (int)(offset / 1000));
+        this->_baseUtcUs += offset;
+        this->_slewUs     = 0;
+        this->_pollShift  = 0;
+        this->_stableCount = 0;
+      } else {
+        // Small error: slew it out and learn the part that comes from oscillator drift
+        this->_slewUs = offset;
+        int64_t interval = now - this->_lastDisciplineUs;
+        if (interval > 0) {
+          int64_t freq = this->_freqPpb + offset * 1000000000LL / interval / NTP_FREQ_GAIN;
+          if (freq > NTP_MAX_FREQ_PPB) freq = NTP_MAX_FREQ_PPB;
+          if (freq < -NTP_MAX_FREQ_PPB) freq = -NTP_MAX_FREQ_PPB;
+          this->_freqPpb = (int32_t)freq;
+        }
+
+        // Poll less often once the clock holds steady, more often when it wanders
+        int64_t magnitude = offset < 0 ? -offset : offset;
+        if (magnitude < NTP_STABLE_US) {
+          if (++this->_stableCount >= 4 && this->_pollShift < NTP_MAX_POLL_SHIFT) {
+            this->_pollShift++;
+            this->_stableCount = 0;
+          }
+        } else if (magnitude > NTP_UNSTABLE_US) {
+          if (this->_pollShift > 0) this->_pollShift--;
+          this->_stableCount = 0;
+        }
+      }
+
+      this->_lastDisciplineUs = now;
+      this->_lastOffsetUs     = (int32_t)offset;
+      this->_lastDelayUs      = bestDelay;
+      this->_lastUpdate       = millis() | 1;
+      this->syncSystemClock();
+      return true;
+    }
+
+    // Steps the system clock on large differences, otherwise lets adjtime() slew it
+    void syncSystemClock() {
+      if (!this->_setSystemClock) return;
+      struct timeval tv;
+      gettimeofday(&tv, NULL);
+      int64_t system     = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+      int64_t target     = this->getCorrectedMicros();
+      int64_t difference = target - system;
+      if (difference > NTP_STEP_US || difference < -NTP_STEP_US) {
+        struct timeval set = { (time_t)(target / 1000000LL), (suseconds_t)(target % 1000000LL) };
+        settimeofday(&set, NULL);
+      } else {
+        struct timeval delta = { (time_t)(difference / 1000000LL), (suseconds_t)(difference % 1000000LL) };
+        adjtime(&delta, NULL);
+      }
+    }
+
+    // Polls every server once per notification, off the main loop
+    static void exchangeTask(void* args) {
+      NTPClient* self = static_cast<NTPClient*>(args);
+      for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        for (uint8_t i = 0; i < self->_serverCount; i++) {
+          Server& server = self->_servers[i];
+          if (server.name != NULL && (uint32_t)server.ip == 0) {
+            // Pool names resolve to different hosts; keep one so its filter stays meaningful
+            if (self->_resolver && !server.resolveDirect) server.ip = self->_resolver(server.name);
+            if ((uint32_t)server.ip == 0 && !WiFi.hostByName(server.name, server.ip)) continue;
+          }
+
+          Sample sample;
+          if (self->exchange(server.ip, sample)) {
+            sample.server = i;
+            server.failures = 0;
+            xQueueSend(self->_samples, &sample, 0);
+          } else if (server.name != NULL && ++server.failures >= NTP_SERVER_FAILURES) {
+            server.ip = IPAddress();
+            server.failures = 0;
+            server.resolveDirect = true;
+          }
+        }
+        self->_pollDone = true;
+      }
+    }
+
+    bool exchange(IPAddress server, Sample& sample) {
+      // Drop answers to earlier requests that came in late
+      while (recv(this->_socket, this->_packetBuffer, NTP_PACKET_SIZE, MSG_DONTWAIT) > 0) {}
+
+      // T1: our clock when the request leaves, also sent as its transmit
+      // timestamp so the answer can be matched through its originate field
+      int64_t t1 = esp_timer_get_time();
+      if (!this->sendNTPPacket(server, (uint64_t)t1)) return false;
+
+      int64_t deadline = t1 + NTP_TIMEOUT_MS * 1000LL;
+      while (true) {
+        int64_t remaining = deadline - esp_timer_get_time();
+        if (remaining <= 0) return false;
+        fd_set readable;
+        FD_ZERO(&readable);
+        FD_SET(this->_socket, &readable);
+        struct timeval timeout = { (time_t)(remaining / 1000000LL), (suseconds_t)(remaining % 1000000LL) };
+        if (select(this->_socket + 1, &readable, NULL, NULL, &timeout) <= 0) return false;
+        // T4: taken as select() returns, the task runs above loop() so nothing comes in between
+        int64_t t4 = esp_timer_get_time();
+
+        struct sockaddr_in from = {};
+        socklen_t fromLength = sizeof(from);
+        int length = recvfrom(this->_socket, this->_packetBuffer, NTP_PACKET_SIZE, 0,
+                              (struct sockaddr*)&from, &fromLength);
+        if (length < NTP_PACKET_SIZE || from.sin_addr.s_addr != (uint32_t)server) continue;
+        if (readTimestamp(24) != (uint64_t)t1) continue;                             // Answer to another request
+
+        uint8_t mode    = this->_packetBuffer[0] & 0x07;
+        uint8_t leap    = this->_packetBuffer[0] >> 6;
+        uint8_t stratum = this->_packetBuffer[1];
+        if (mode != 4 || leap == 3 || stratum == 0 || stratum > 15) return false;   // Not a usable server answer
+
+        int64_t t2 = ntpToUnixMicros(readTimestamp(32));   // Server receive
+        int64_t t3 = ntpToUnixMicros(readTimestamp(40));   // Server transmit
+
+        // theta = ((T2 - T1) + (T3 - T4)) / 2, delta = (T4 - T1) - (T3 - T2)
+        sample.offsetUs = ((t2 - t1) + (t3 - t4)) / 2;
+        sample.midUs    = t1 + (t4 - t1) / 2;
+        int64_t delay   = (t4 - t1) - (t3 - t2);
+        sample.delayUs  = delay > 0 ? (uint32_t)delay : 0;
+        return true;
+      }
+    }
 
-    void sendNTPPacket() {
+    uint64_t readTimestamp(int index) const {
+      uint64_t value = 0;
+      for (int i = 0; i < 8; i++) value = (value << 8) | this->_packetBuffer[index + i];
+      return value;
+    }
+
+    static int64_t ntpToUnixMicros(uint64_t timestamp) {
+      int64_t seconds  = (int64_t)(timestamp >> 32) - SEVENZYYEARS;
+      int64_t fraction = (int64_t)(((timestamp & 0xFFFFFFFFULL) * 1000000ULL) >> 32);
+      return seconds * 1000000LL + fraction;
+    }
+
+    bool sendNTPPacket(IPAddress server, uint64_t transmit) {
       // set all bytes in the buffer to 0
       memset(this->_packetBuffer, 0, NTP_PACKET_SIZE);
       // Initialize values needed to form NTP request
@@ -290,21 +595,15 @@ class NTPClient {                                                           //
       this->_packetBuffer[13]   = 0x4E;
       this->_packetBuffer[14]   = 49;
       this->_packetBuffer[15]   = 52;
+      for (int i = 0; i < 8; i++) this->_packetBuffer[47 - i] = (transmit >> (8 * i)) & 0xFF;
 
       // all NTP fields have been given values, now
       // you can send a packet requesting a timestamp:
-      if  (this->_poolServerName) {
-        this->_udp->beginPacket(this->_poolServerName, 123);
-      } else {
-        this->_udp->beginPacket(this->_poolServerIP, 123);
-      }
-      this->_udp->write(this->_packetBuffer, NTP_PACKET_SIZE);
-      this->_udp->endPacket();
-    }
-
-
-    bool isLeapYear(uint16_t year) {
-      return ((year + 2) % 4 == 0);
+      struct sockaddr_in to = {};
+      to.sin_family      = AF_INET;
+      to.sin_port        = htons(123);
+      to.sin_addr.s_addr = (uint32_t)server;
+      return sendto(this->_socket, this->_packetBuffer, NTP_PACKET_SIZE, 0, (struct sockaddr*)&to, sizeof(to)) == NTP_PACKET_SIZE;
     }
 
 
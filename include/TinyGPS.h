@@ -479,6 +479,8 @@ class TinyGPS {
 #ifndef GPS_time_h                                                                                            // 
 #define GPS_time_h                                                                                            // đánh dấu đẫ đọc
 
+#include "datetime.h"
+
 #define UUNIXDATE_BASE 946684800                                                                              // thời gian bù trừ từ ngày 1/1/1970 đến ngày 1/1/2000
 class GPS_time: public TinyGPS {                                                                              // thư viện GPS time được sử dụng hàm của TinyGPS
   public:
@@ -510,7 +512,7 @@ class GPS_time: public TinyGPS {
 
    //   lcd.setCursor(0, 1);                                                                      // đặt con trỏ
    //   lcd.print(30000 / Time_scale, 6);                                                           // hiển thị số đt
-      return ConverterUnixtimeToDateTime(Time_long + int((millis() - Time_read) / 1000.0 * Time_scale)); // trả thời gian được tính toán
+      return _calendar.at(Time_long + int((millis() - Time_read) / 1000.0 * Time_scale));                   // trả thời gian được tính toán
     }                                                                                                         //
 
     ///////////////////////////////////////////////////////////////////////////////////////////////////////////////converter time
@@ -520,21 +522,7 @@ class GPS_time: public TinyGPS {
     }
 
     uint32_t ConverterDateTimeToUnixtime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) { // hàm chuyển về Unixtime
-      int32_t days = day - 1;                                                                                 // trừ đi một ngày
-      for (int i = 1; i < month; ++i) {                                                                       // lặp các thàng
-        if (i == 2)  {                                                                                        // nếu là thàng 2
-          days += (28 + isLeapYear(year));                                                                    // có 28 hoặc 29 ngày
-        } else if (i == 4 || i == 6 || i == 9 || i == 11) {                                                   // nếu là thàng 4,6,9,11
-          days += 30;                                                                                         // có 30 ngày
-        } else {                                                                                              // các thàng còn lại
-          days += 31;                                                                                         // 31 ngày
-        }                                                                                                     //
-      }                                                                                                       //
-      for (int i = 2000; i < year; ++i) {                                                                     // lặp các năm từ năm 2000
-        days += (365 + isLeapYear(i));                                                                        // tính số ngày từng năm
-      }                                                                                                       //
-
-      return UUNIXDATE_BASE + (((days * 24 + hour) * 60 + minute) * 60) + second;                             // chuyển về Unixtime
+      return unixFromDateTime(year, month, day, hour, minute, second);                                        // 0 khi GPS chưa có ngày hợp lệ
     }                                                                                                         //
 
     RTCDateTime ConverterDateTimeToRTCDateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) { // hàm chuyển kiểu dữ liệu
@@ -551,43 +539,7 @@ class GPS_time: public TinyGPS {
 
 
     RTCDateTime ConverterUnixtimeToDateTime(uint32_t ut) {                                                    // hàm chuyển Unixtime về Date Time
-      RTCDateTime t;                                                                                          // biến đệm lưu dữ liệu
-
-      t.unixtime = ut;                                                                                        // lưu Unixtime
-      t.dayOfWeek = ((ut / 86400) + 4) % 7;                                                                   // tính thứ của tuần
-      uint32_t tt = ut - UUNIXDATE_BASE;                                                                      // chuyển Unixtime từ 1970 về 2000
-      t.second = tt % 60;                                                                                     // tính số giây
-      tt /= 60;                                                                                               // chia 60
-      t.minute = tt % 60;                                                                                     // tính số phút
-      tt /= 60;                                                                                               // chia 60
-      t.hour = tt % 24;                                                                                       // tính số giờ
-      int16_t days = tt / 24;                                                                                 // tính tổng số ngày
-      bool leap;                                                                                              // biến đệm kiểm tra năm nhuận
-      t.year = 2000;                                                                                          // năm bắt đầu từ năm 2000
-      while (true) {                                                                                          // lặp đến khi đủ điều kiện
-        leap = isLeapYear(t.year);                                                                            // tính xem có phải năm nhuận không
-        if (days < 365 + leap) {                                                                              // nếu số ngày còn lại nhỏ hơn một năm
-          break;                                                                                              // thoát while
-        }                                                                                                     //
-        days -= (365 + leap);                                                                                 // trừ đi số ngày của năm
-        ++t.year;                                                                                             // cộng năm thêm 1
-      }                                                                                                       //
-
-      for (t.month = 1; t.month < 12; ++t.month) {                                                            // lặp các tháng
-        int8_t daysPerMonth = 31;                                                                             // mặc định là 31 ngày
-        if (t.month == 2)  {                                                                                  // nếu là thàng 2
-          daysPerMonth = leap ? 29 : 28;                                                                      // có 28 hoặc 29 ngày
-        } else if (t.month == 4 || t.month == 6 || t.month == 9 || t.month == 11) {                           // nếu là thàng 4,6,9,11
-          daysPerMonth = 30;                                                                                  // có 30 ngày
-        }                                                                                                     //
-        if (days < daysPerMonth) {                                                                            // nếu số ngày còn lại nhỏ hơn một thàng
-          break;                                                                                              // thoát for
-        }                                                                                                     //
-        days -= daysPerMonth;                                                                                 // trừ đi số ngày của tháng
-      }                                                                                                       //
-      t.day = days + 1;                                                                                       // tính ngày của tháng
-
-      return t;                                                                                               // trả về kết quả
+      return dateTimeFromUnix(ut);                                                                            //
     }                                                                                                         //
 
 
@@ -626,7 +578,7 @@ class GPS_time: public TinyGPS {
     }
 
     bool isLeapYear(uint16_t year) {
-      return  ((year % 4 == 0 && (year % 100 != 0 || year % 400 == 0)) ? 1 : 0);
+      return isLeapYearCivil(year);
     }
 
     byte isERRO() {
@@ -645,6 +597,7 @@ class GPS_time: public TinyGPS {
     unsigned long Time_read_offset  = 0;
     unsigned long Time_long_offset  = 0;
 
+    CachedDateTime _calendar;
 };
 
 #endif
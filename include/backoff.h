@@ -0,0 +1,47 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+// Spreading a fleet's broker traffic: status publishes in per-device slots and
+// jittered exponential backoff for reconnects. Pure arithmetic, the caller
+// supplies the clock and the random numbers.
+
+// Reconnect backoff: random delay in [c/2, c] with c = min(MAX, BASE * 2^failures)
+#ifndef MQTT_RECONNECT_BASE_MS
+#define MQTT_RECONNECT_BASE_MS    2000
+#endif
+#ifndef MQTT_RECONNECT_MAX_MS
+#define MQTT_RECONNECT_MAX_MS     60000
+#endif
+// The first attempt after boot or a lost broker is spread over this window. A
+// broker restart or a power cut drops the whole fleet at once, so it should be
+// at least the fleet size over the connects per second the broker can take
+// (5000 devices at 250/s: 20 s).
+#ifndef MQTT_RECONNECT_JITTER_MS
+#define MQTT_RECONNECT_JITTER_MS  30000
+#endif
+
+// This device's phase inside the status interval, from a hash of its MAC
+inline uint32_t statusSlotOffset(uint32_t slotHash, uint32_t interval) {
+  return interval ? slotHash % interval : 0;
+}
+
+// Number of the slot a wall-clock time falls in; a new slot starts at k * interval + offset
+inline uint64_t statusSlotIndex(uint64_t wallMs, uint32_t offset, uint32_t interval) {
+  return (wallMs - offset) / interval;
+}
+
+// Delay before the first attempt after boot or after losing the broker
+inline uint32_t reconnectJitter(uint32_t random, uint32_t windowMs = MQTT_RECONNECT_JITTER_MS) {
+  return windowMs ? random % windowMs : 0;
+}
+
+// Delay before the next attempt after `failures` attempts without success
+inline uint32_t reconnectDelay(uint8_t failures, uint32_t random) {
+  uint32_t ceiling = (uint32_t)MQTT_RECONNECT_BASE_MS << (failures < 5 ? failures : 5);
+  if (ceiling > MQTT_RECONNECT_MAX_MS) ceiling = MQTT_RECONNECT_MAX_MS;
+  return ceiling / 2 + random % (ceiling / 2 + 1);
+}
+
+#endif // BACKOFF_H
@@ -0,0 +1,95 @@
+#ifndef DATETIME_H
+#define DATETIME_H
+
+#include <stdint.h>
+#include "types.h"
+
+// Calendar arithmetic on Unix time without year or month loops, after
+// H. Hinnant's days_from_civil / civil_from_days. Exact for every uint32_t
+// time, 1970-01-01 up to 2106-02-07.
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+inline int32_t daysFromCivil(int32_t year, uint8_t month, uint8_t day) {
+  year -= month <= 2;
+  const int32_t  era = (year >= 0 ? year : year - 399) / 400;
+  const uint32_t yoe = (uint32_t)(year - era * 400);                                   // [0, 399]
+  const uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;  // [0, 365], from March 1st
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;                          // [0, 146096]
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+inline void civilFromDays(int32_t days, uint16_t& year, uint8_t& month, uint8_t& day) {
+  days += 719468;
+  const int32_t  era = (days >= 0 ? days : days - 146096) / 146097;
+  const uint32_t doe = (uint32_t)(days - era * 146097);
+  const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const uint32_t mp  = (5 * doy + 2) / 153;
+  day   = (uint8_t)(doy - (153 * mp + 2) / 5 + 1);
+  month = (uint8_t)(mp < 10 ? mp + 3 : mp - 9);
+  year  = (uint16_t)((int32_t)yoe + era * 400 + (month <= 2));
+}
+
+// 1 = Monday ... 7 = Sunday, the numbering strDayOfWeek() uses. 1970-01-01 was a Thursday.
+inline uint8_t weekdayFromDays(uint32_t days) {
+  return (uint8_t)((days + 3) % 7 + 1);
+}
+
+inline bool isLeapYearCivil(uint16_t year) {
+  return (year % 4 == 0) && (year % 100 != 0 || year % 400 == 0);
+}
+
+inline uint8_t daysInMonthCivil(uint16_t year, uint8_t month) {
+  if (month == 2) return isLeapYearCivil(year) ? 29 : 28;
+  return (month == 4 || month == 6 || month == 9 || month == 11) ? 30 : 31;
+}
+
+// 0 for dates before 1970 or out of range fields, e.g. a GPS without a fix
+inline uint32_t unixFromDateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second) {
+  if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31) return 0;
+  return (uint32_t)daysFromCivil(year, month, day) * 86400UL + hour * 3600UL + minute * 60UL + second;
+}
+
+inline RTCDateTime dateTimeFromUnix(uint32_t unixtime) {
+  RTCDateTime t;
+  uint32_t days    = unixtime / 86400UL;
+  uint32_t seconds = unixtime % 86400UL;
+  civilFromDays((int32_t)days, t.year, t.month, t.day);
+  t.hour      = seconds / 3600;
+  t.minute    = seconds / 60 % 60;
+  t.second    = seconds % 60;
+  t.dayOfWeek = weekdayFromDays(days);
+  t.unixtime  = unixtime;
+  return t;
+}
+
+// Broken-down time of a running clock. Asking again within the same second
+// costs a compare; a new second only redoes the time of day, the date is
+// recomputed when the day changes.
+class CachedDateTime {
+  public:
+    const RTCDateTime& at(uint32_t unixtime) {
+      if (_valid && unixtime == _time.unixtime) return _time;
+
+      uint32_t days = unixtime / 86400UL;
+      if (!_valid || days != _days) {
+        civilFromDays((int32_t)days, _time.year, _time.month, _time.day);
+        _time.dayOfWeek = weekdayFromDays(days);
+        _days = days;
+      }
+      uint32_t seconds = unixtime % 86400UL;
+      _time.hour     = seconds / 3600;
+      _time.minute   = seconds / 60 % 60;
+      _time.second   = seconds % 60;
+      _time.unixtime = unixtime;
+      _valid = true;
+      return _time;
+    }
+
+  private:
+    RTCDateTime _time;
+    uint32_t    _days  = 0;
+    bool        _valid = false;
+};
+
+#endif // DATETIME_H
@@ -0,0 +1,26 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 32-bit FNV-1a, used for topic and command lookups
+
+#define FNV_OFFSET_BASIS 2166136261UL
+#define FNV_PRIME        16777619UL
+
+// Usable in constant expressions, e.g. case labels and static tables
+constexpr uint32_t hashString(const char* str, uint32_t hash = FNV_OFFSET_BASIS) {
+  return *str ? hashString(str + 1, (uint32_t)((hash ^ (uint8_t)*str) * FNV_PRIME)) : hash;
+}
+
+inline uint32_t hashBytes(const char* data, size_t length) {
+  uint32_t hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+#endif // HASH_H
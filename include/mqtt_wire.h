@@ -0,0 +1,25 @@
+#ifndef MQTT_WIRE_H
+#define MQTT_WIRE_H
+
+#include <stdint.h>
+
+// Sizes of MQTT packets on the wire, for the transport's byte counters
+
+// Bytes of a Variable Byte Integer (remaining length, property length)
+inline uint32_t mqttVarintSize(uint32_t value) {
+  return value < 128 ? 1 : value < 16384 ? 2 : value < 2097152 ? 3 : 4;
+}
+
+// PUBLISH with fixed header. topicLength is 0 when an MQTT 5 topic alias stands
+// in for the topic; expirySec and alias only count with v5.
+inline uint32_t mqttPublishSize(uint32_t topicLength, uint32_t payloadLength, uint8_t qos,
+                                bool v5, uint32_t expirySec = 0, uint16_t alias = 0) {
+  uint32_t remaining = 2 + topicLength + (qos > 0 ? 2 : 0) + payloadLength;
+  if (v5) {
+    uint32_t properties = (expirySec > 0 ? 5 : 0) + (alias > 0 ? 3 : 0);
+    remaining += mqttVarintSize(properties) + properties;
+  }
+  return 1 + mqttVarintSize(remaining) + remaining;
+}
+
+#endif // MQTT_WIRE_H
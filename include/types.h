@@ -2,13 +2,29 @@
 #ifndef SETTINGS_DATA_H
 #define SETTINGS_DATA_H
 
+// Largest astronomical schedule offset from dusk or dawn, in minutes
+#ifndef ASTRO_MAX_OFFSET_MIN
+#define ASTRO_MAX_OFFSET_MIN 180
+#endif
+
 struct SettingsData {
   int hour_on;
   int minute_on;
   int hour_off;
   int minute_off;
+  int astro;        // 1: on at civil dusk + on_offset, off at civil dawn + off_offset
+  int on_offset;    // Minutes, negative switches earlier
+  int off_offset;
 };
 
+// The one range check for a schedule, whether it came as a command or through the twin
+inline bool validSettings(const SettingsData& settings) {
+  return settings.hour_on >= 0 && settings.hour_on <= 23 && settings.hour_off >= 0 && settings.hour_off <= 23 &&
+         settings.minute_on >= 0 && settings.minute_on <= 59 && settings.minute_off >= 0 && settings.minute_off <= 59 &&
+         settings.on_offset >= -ASTRO_MAX_OFFSET_MIN && settings.on_offset <= ASTRO_MAX_OFFSET_MIN &&
+         settings.off_offset >= -ASTRO_MAX_OFFSET_MIN && settings.off_offset <= ASTRO_MAX_OFFSET_MIN;
+}
+
 #endif // SETTINGS_DATA_H
 
 // Define a data structure to hold power meter readings
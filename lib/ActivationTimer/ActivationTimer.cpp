@@ -0,0 +1,165 @@
+#include "ActivationTimer.h"
+
+// Constructor
+ActivationTimer::ActivationTimer()
+    : pin(0),
+      timer(nullptr),
+      firedPending(false),
+      firedState(false),
+      lastSkew(0),
+      maxSkew(0)
+{
+    memset(slots, 0, sizeof(slots));
+}
+
+void ActivationTimer::begin(uint8_t pin) {
+    this->pin = pin;
+
+    esp_timer_create_args_t args = {};
+    args.callback = onTimer;
+    args.arg = this;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "activation";
+    if (esp_timer_create(&args, &timer) != ESP_OK) {
+        Serial.println("ActivationTimer - Failed to create timer");
+        timer = nullptr;
+    }
+}
+
+bool ActivationTimer::schedule(int64_t targetUs, bool state, uint32_t at, uint16_t atMs) {
+    if (timer == nullptr) return false;
+
+    portENTER_CRITICAL(&lock);
+    Activation* slot = nullptr;
+    for (int i = 0; i < ACTIVATION_SLOTS; i++) {
+        if (!slots[i].used) {
+            slot = &slots[i];
+            break;
+        }
+    }
+    if (slot != nullptr) {
+        slot->used     = true;
+        slot->fired    = false;
+        slot->state    = state;
+        slot->at       = at;
+        slot->atMs     = atMs;
+        slot->targetUs = targetUs;
+        slot->firedUs  = 0;
+    }
+    portEXIT_CRITICAL(&lock);
+    if (slot == nullptr) return false;
+
+    // Re-arm outside the spinlock, esp_timer takes its own
+    fireDue();
+    return true;
+}
+
+void ActivationTimer::retarget(const ActivationMapper& map) {
+    if (timer == nullptr) return;
+
+    // Copy the requests out, the mapping is not run under the spinlock
+    Activation requested[ACTIVATION_SLOTS];
+    portENTER_CRITICAL(&lock);
+    memcpy(requested, slots, sizeof(slots));
+    portEXIT_CRITICAL(&lock);
+
+    int64_t targets[ACTIVATION_SLOTS];
+    for (int i = 0; i < ACTIVATION_SLOTS; i++) {
+        targets[i] = requested[i].used && !requested[i].fired ? map(requested[i].at, requested[i].atMs) : 0;
+    }
+
+    // Only slots still holding the same request, one may have fired or been replaced meanwhile
+    portENTER_CRITICAL(&lock);
+    for (int i = 0; i < ACTIVATION_SLOTS; i++) {
+        if (targets[i] != 0 && slots[i].used && !slots[i].fired &&
+            slots[i].at == requested[i].at && slots[i].atMs == requested[i].atMs) {
+            slots[i].targetUs = targets[i];
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+
+    fireDue();
+}
+
+bool ActivationTimer::writeOutput(bool& state, bool force) {
+    bool adopted = false;
+    portENTER_CRITICAL(&lock);
+    if (firedPending && !force) {
+        state = firedState;
+        adopted = true;
+    }
+    firedPending = false;
+    digitalWrite(pin, state ? HIGH : LOW);
+    portEXIT_CRITICAL(&lock);
+    return adopted;
+}
+
+bool ActivationTimer::takeFired(Activation& activation) {
+    bool found = false;
+    portENTER_CRITICAL(&lock);
+    for (int i = 0; i < ACTIVATION_SLOTS; i++) {
+        if (slots[i].used && slots[i].fired) {
+            activation = slots[i];
+            slots[i].used = false;
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    return found;
+}
+
+uint8_t ActivationTimer::pending() {
+    uint8_t count = 0;
+    portENTER_CRITICAL(&lock);
+    for (int i = 0; i < ACTIVATION_SLOTS; i++) {
+        if (slots[i].used && !slots[i].fired) count++;
+    }
+    portEXIT_CRITICAL(&lock);
+    return count;
+}
+
+// Runs in the esp_timer task
+void ActivationTimer::onTimer(void* args) {
+    static_cast<ActivationTimer*>(args)->fireDue();
+}
+
+// Switch everything that is due, oldest target first, then arm for the next one
+void ActivationTimer::fireDue() {
+    int64_t next = INT64_MAX;
+
+    portENTER_CRITICAL(&lock);
+    for (;;) {
+        Activation* due = nullptr;
+        for (int i = 0; i < ACTIVATION_SLOTS; i++) {
+            if (slots[i].used && !slots[i].fired &&
+                (due == nullptr || slots[i].targetUs < due->targetUs)) {
+                due = &slots[i];
+            }
+        }
+        if (due == nullptr) break;
+
+        int64_t now = esp_timer_get_time();
+        if (due->targetUs > now) {
+            next = due->targetUs;
+            break;
+        }
+
+        digitalWrite(pin, due->state ? HIGH : LOW);
+        due->firedUs = esp_timer_get_time();
+        due->fired   = true;
+        firedState   = due->state;
+        firedPending = true;
+
+        int32_t skew = (int32_t)(due->firedUs - due->targetUs);
+        lastSkew = skew;
+        if (abs(skew) > maxSkew) maxSkew = abs(skew);
+    }
+    portEXIT_CRITICAL(&lock);
+
+    esp_timer_stop(timer);   // Not running is fine
+    if (next != INT64_MAX) {
+        int64_t delay = next - esp_timer_get_time();
+        esp_timer_start_once(timer, delay > 0 ? delay : 1);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef ACTIVATIONTIMER_H
+#define ACTIVATIONTIMER_H
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <functional>
+
+// Timed output changes held at once
+#ifndef ACTIVATION_SLOTS
+#define ACTIVATION_SLOTS          4
+#endif
+
+// One pending or fired output change
+struct Activation {
+    bool     used;
+    bool     fired;
+    bool     state;           // Output level to switch to
+    uint32_t at;              // Requested time, DayTime.unixtime seconds
+    uint16_t atMs;            // and milliseconds into that second
+    int64_t  targetUs;        // esp_timer time the output should switch at
+    int64_t  firedUs;         // esp_timer time it actually switched
+};
+
+// esp_timer time of a requested DayTime instant, 0 when it cannot be mapped
+typedef std::function<int64_t(uint32_t at, uint16_t atMs)> ActivationMapper;
+
+// Switches the relay output at an absolute time from an esp_timer one-shot,
+// independent of how long loop() takes. All writes of the output pin go
+// through writeOutput() so loop() never undoes a switch it has not seen yet.
+class ActivationTimer {
+public:
+    ActivationTimer();
+
+    void begin(uint8_t pin);
+
+    // Queue a switch at targetUs (esp_timer_get_time() base). False when full.
+    bool schedule(int64_t targetUs, bool state, uint32_t at, uint16_t atMs);
+
+    // Map every pending switch again, after the wall clock was re-based.
+    // A switch that cannot be mapped keeps its target.
+    void retarget(const ActivationMapper& map);
+
+    // Drive the output from state. Unless force is set, an action fired since
+    // the last call takes precedence and is copied into state; returns true then.
+    bool writeOutput(bool& state, bool force = false);
+
+    // Next fired action for reporting, frees its slot
+    bool takeFired(Activation& activation);
+
+    uint8_t pending();
+    int32_t lastSkewUs() const { return lastSkew; }
+    int32_t maxSkewUs() const { return maxSkew; }
+
+private:
+    static void onTimer(void* args);
+    void fireDue();
+
+    uint8_t pin;
+    esp_timer_handle_t timer;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+    Activation slots[ACTIVATION_SLOTS];
+    bool firedPending;        // A fired state loop() has not adopted yet
+    bool firedState;
+    volatile int32_t lastSkew;
+    volatile int32_t maxSkew; // Largest absolute skew seen
+};
+
+#endif
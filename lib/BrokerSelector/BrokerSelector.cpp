@@ -0,0 +1,225 @@
+#include "BrokerSelector.h"
+#include "secrets.h"
+#include <lwip/sockets.h>
+#include <fcntl.h>
+#include <errno.h>
+
+// Constructor
+BrokerSelector::BrokerSelector(NetworkCache& cache)
+    : cache(cache),
+      brokerCount(0),
+      current(0),
+      attemptPending(false),
+      racerCount(0),
+      racing(false),
+      resolving(false),
+      raceStarted(0),
+      leader(-1),
+      leaderAt(0)
+{
+    winnerAddress[0] = '\0';
+}
+
+void BrokerSelector::begin() {
+#ifdef MQTT_BROKERS
+    String list = MQTT_BROKERS;
+    int start = 0;
+    while (start < (int)list.length()) {
+        int end = list.indexOf(',', start);
+        if (end < 0) end = list.length();
+        String entry = list.substring(start, end);
+        entry.trim();
+        int colon = entry.lastIndexOf(':');
+        if (colon > 0) add(entry.substring(0, colon).c_str(), entry.substring(colon + 1).toInt());
+        else if (entry.length() > 0) add(entry.c_str(), MQTT_PORT);
+        start = end + 1;
+    }
+#endif
+    if (brokerCount == 0) add(MQTT_SERVER, MQTT_PORT);
+}
+
+void BrokerSelector::add(const char* host, uint16_t port) {
+    if (brokerCount >= BROKER_MAX) return;
+    Broker& broker = brokers[brokerCount++];
+    broker.host = host;
+    broker.port = port;
+    broker.score = 0;
+    broker.failures = 0;
+    cache.addHost(broker.host.c_str());
+}
+
+const char* BrokerSelector::selectedAddress() const {
+    return winnerAddress[0] != '\0' ? winnerAddress : cache.address(brokers[current].host.c_str());
+}
+
+BrokerRace BrokerSelector::race() {
+    if (brokerCount <= 1) {
+        // Nothing to race, let the MQTT connect itself be the probe
+        winnerAddress[0] = '\0';
+        attemptPending = true;
+        return BROKER_RACE_WON;
+    }
+    if (!racing && !startRace()) return resolving ? BROKER_RACE_PENDING : BROKER_RACE_FAILED;
+
+    fd_set writable;
+    FD_ZERO(&writable);
+    int maxFd = -1;
+    for (uint8_t i = 0; i < racerCount; i++) {
+        if (racers[i].fd < 0) continue;
+        FD_SET(racers[i].fd, &writable);
+        if (racers[i].fd > maxFd) maxFd = racers[i].fd;
+    }
+    struct timeval noWait = {0, 0};
+    if (maxFd >= 0 && select(maxFd + 1, NULL, &writable, NULL, &noWait) > 0) {
+        for (uint8_t i = 0; i < racerCount; i++) {
+            if (racers[i].fd < 0 || !FD_ISSET(racers[i].fd, &writable)) continue;
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(racers[i].fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0) {
+                // Refused or unreachable
+                penalise(racers[i].broker);
+                close(racers[i].fd);
+                racers[i].fd = -1;
+                continue;
+            }
+            if (leader < 0) {
+                leader = i;
+                leaderAt = millis();
+            }
+            if (racers[i].broker == current) leader = i;   // The current broker answered, stay
+        }
+    }
+
+    bool currentRacing = false;
+    bool anyOpen = false;
+    for (uint8_t i = 0; i < racerCount; i++) {
+        if (racers[i].fd < 0) continue;
+        anyOpen = true;
+        if (racers[i].broker == current) currentRacing = true;
+    }
+
+    if (leader >= 0) {
+        bool leaderIsCurrent = racers[leader].broker == current;
+        if (leaderIsCurrent || !currentRacing || millis() - leaderAt >= BROKER_STICKY_GRACE_MS) {
+            if (!leaderIsCurrent) {
+                Serial.print("BrokerSelector - Switching to ");
+                Serial.println(brokers[racers[leader].broker].host);
+            }
+            current = racers[leader].broker;
+            strlcpy(winnerAddress, racers[leader].address, sizeof(winnerAddress));
+            closeRace();
+            attemptPending = true;
+            return BROKER_RACE_WON;
+        }
+        return BROKER_RACE_PENDING;
+    }
+
+    if (!anyOpen || millis() - raceStarted > BROKER_RACE_TIMEOUT_MS) {
+        for (uint8_t i = 0; i < racerCount; i++) {
+            if (racers[i].fd >= 0) penalise(racers[i].broker);
+        }
+        closeRace();
+        Serial.println("BrokerSelector - No broker reachable");
+        return BROKER_RACE_FAILED;
+    }
+    return BROKER_RACE_PENDING;
+}
+
+// Opens non-blocking connects to the current broker and the best scored others
+bool BrokerSelector::startRace() {
+    // Only brokers with an address race. The others are looked up in the
+    // background through the cache and join a later race, loop() never waits on DNS.
+    IPAddress addresses[BROKER_MAX];
+    resolving = false;
+    for (uint8_t i = 0; i < brokerCount; i++) {
+        const char* host = brokers[i].host.c_str();
+        addresses[i] = cache.cachedIp(host);
+        if ((uint32_t)addresses[i] != 0 || addresses[i].fromString(host)) continue;
+        bool running = cache.resolve(host);
+        addresses[i] = cache.cachedIp(host);   // lwIP may have answered at once
+        if ((uint32_t)addresses[i] == 0) resolving |= running;
+    }
+
+    uint8_t order[BROKER_MAX];
+    uint8_t ordered = 0;
+    if (brokers[current].failures < BROKER_DNS_RETRY_FAILURES && (uint32_t)addresses[current] != 0) {
+        order[ordered++] = current;
+    }
+    while (ordered < BROKER_RACE_WIDTH) {
+        int best = -1;
+        for (uint8_t i = 0; i < brokerCount; i++) {
+            bool taken = (uint32_t)addresses[i] == 0;
+            for (uint8_t j = 0; j < ordered; j++) taken |= order[j] == i;
+            if (!taken && (best < 0 || brokers[i].score < brokers[best].score)) best = i;
+        }
+        if (best < 0) break;
+        order[ordered++] = best;
+    }
+    if (ordered == 0) return false;
+
+    // Old penalties fade, so a broker that was down gets another chance eventually
+    for (uint8_t i = 0; i < brokerCount; i++) brokers[i].score -= brokers[i].score / 8;
+
+    racerCount = 0;
+    leader = -1;
+    for (uint8_t i = 0; i < ordered; i++) {
+        Broker& broker = brokers[order[i]];
+        IPAddress ip = addresses[order[i]];
+
+        int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(broker.port);
+        addr.sin_addr.s_addr = (uint32_t)ip;
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+            close(fd);
+            penalise(order[i]);
+            continue;
+        }
+
+        Racer& racer = racers[racerCount++];
+        racer.fd = fd;
+        racer.broker = order[i];
+        strlcpy(racer.address, ip.toString().c_str(), sizeof(racer.address));
+    }
+
+    racing = racerCount > 0;
+    raceStarted = millis();
+    return racing;
+}
+
+// The probes only establish reachability, the MQTT session opens its own socket
+void BrokerSelector::closeRace() {
+    for (uint8_t i = 0; i < racerCount; i++) {
+        if (racers[i].fd >= 0) close(racers[i].fd);
+        racers[i].fd = -1;
+    }
+    racerCount = 0;
+    racing = false;
+    leader = -1;
+}
+
+void BrokerSelector::reportConnected(uint32_t connectMs) {
+    if (!attemptPending) return;
+    attemptPending = false;
+    Broker& broker = brokers[current];
+    broker.failures = 0;
+    broker.score = broker.score == 0 ? connectMs : (broker.score * 3 + connectMs) / 4;
+}
+
+void BrokerSelector::reportFailed() {
+    if (!attemptPending) return;
+    attemptPending = false;
+    penalise(current);
+}
+
+void BrokerSelector::penalise(uint8_t index) {
+    Broker& broker = brokers[index];
+    broker.score += BROKER_FAILURE_PENALTY;
+    if (broker.failures < 255) broker.failures++;
+    // The cached address may be stale, go back to the name
+    if (broker.failures == BROKER_DNS_RETRY_FAILURES) cache.forget(broker.host.c_str());
+}
@@ -0,0 +1,78 @@
+#ifndef BROKERSELECTOR_H
+#define BROKERSELECTOR_H
+
+#include <Arduino.h>
+#include "NetworkCache.h"
+
+// Brokers known to the device, from MQTT_BROKERS ("host:port,host:port") or MQTT_SERVER
+#define BROKER_MAX                4
+// Candidates raced against each other per connection attempt
+#define BROKER_RACE_WIDTH         2
+#define BROKER_RACE_TIMEOUT_MS    3000
+// How long a faster broker waits for the current one before taking over
+#define BROKER_STICKY_GRACE_MS    250
+// Score penalty for a failed attempt, in ms of connect time
+#define BROKER_FAILURE_PENALTY    5000
+// Failures in a row before a cached broker address is looked up again
+#define BROKER_DNS_RETRY_FAILURES 3
+
+enum BrokerRace {
+    BROKER_RACE_PENDING,    // Still connecting or looking brokers up, call race() again
+    BROKER_RACE_WON,        // selected() is reachable
+    BROKER_RACE_FAILED      // No candidate answered
+};
+
+struct Broker {
+    String   host;
+    uint16_t port;
+    uint32_t score;         // Smoothed connect time in ms plus failure penalties, lower is better
+    uint8_t  failures;      // In a row
+};
+
+// Picks the broker to connect to. With more than one configured it races TCP
+// connects to the best candidates without blocking loop() and keeps the first
+// to answer, but stays on the current broker when it answers within the grace time.
+class BrokerSelector {
+public:
+    BrokerSelector(NetworkCache& cache);
+
+    void begin();
+    void add(const char* host, uint16_t port);   // Up to BROKER_MAX, begin() adds the configured ones
+    BrokerRace race();
+
+    const Broker& selected() const { return brokers[current]; }
+    const char* selectedAddress() const;   // Address the race reached, the host name without a race
+    uint8_t count() const { return brokerCount; }
+
+    // Outcome of the MQTT connection to selected()
+    void reportConnected(uint32_t connectMs);
+    void reportFailed();
+
+private:
+    struct Racer {
+        int      fd;
+        uint8_t  broker;
+        char     address[16];
+    };
+
+    void penalise(uint8_t index);
+    bool startRace();
+    void closeRace();
+
+    NetworkCache& cache;
+    Broker brokers[BROKER_MAX];
+    uint8_t brokerCount;
+    uint8_t current;
+    bool attemptPending;      // selected() handed out, outcome not reported yet
+
+    Racer racers[BROKER_RACE_WIDTH];
+    uint8_t racerCount;
+    bool racing;
+    bool resolving;           // No broker had an address yet, lookups are running
+    unsigned long raceStarted;
+    int leader;               // Racer that answered first while waiting for the current broker
+    unsigned long leaderAt;
+    char winnerAddress[16];
+};
+
+#endif
@@ -5,7 +5,9 @@
 #include <Udp.h>
 #include <LiquidCrystal.h>
 #include <WiFiUdp.h>
+#include <WiFi.h>
 #include "secrets.h"
+#include "hash.h"
 
 // Constants and definitions
 #define LED_BUILTIN               27
@@ -24,13 +26,15 @@
 byte Serial2_Using;
 
 // #include "NTPClient.h"
-#include "TinyGPS.h"
+#include "NmeaParser.h"
+#include "GnssReceiver.h"
 #include "Modbus.h"
 #include "button.h"
 // Instantiate hardware components
 WiFiUDP ntpUDP;
 NTPClient timeClient(ntpUDP, "europe.pool.ntp.org", 7 * 3600, 60000);  // Adjust timezone as needed
-GPS_time gps;
+NmeaParser gps;
+GnssReceiver gnss;
 Modbus modbus(Serial2);  // Using Serial2 for Modbus and GPS
 // Button Button_UP(36, BUTTON_ANALOG, 1000, 2200);
 // Button Button_DN(36, BUTTON_ANALOG, 1000, 470);
@@ -43,21 +47,50 @@ LiquidCrystal glcd(15 /*rs*/, 2 /*en*/, 0/*d4*/, 4 /*d5*/, 5 /*d6*/, 19 /*d7*/);
 
 #include "BusinessLogicHandler.h"
 
+// The first one is the NTP client's own, the others are added in beginNetwork()
+static const char* const NTP_SERVERS[] = { "europe.pool.ntp.org", "pool.ntp.org", "time.google.com" };
+
 // Constructor
-BusinessLogicHandler::BusinessLogicHandler(PubSubClient& client, const String& mac)
+BusinessLogicHandler::BusinessLogicHandler(MqttTransport& client, const String& mac)
     : mqttClient(client),
       macAddress(mac),
-      timeClient(ntpUDP, "europe.pool.ntp.org", 7 * 3600, 60000),
+      timeClient(ntpUDP, NTP_SERVERS[0], 7 * 3600, 60000),
       settings({0, 0, 0, 0}),
       isAlive("1"),
       deviceLCD(DayTime, glcd),
       deviceState(false),
       gpsLatitude(0.0),
       gpsLongitude(0.0),
-      isAuto(true)
+      lastGpsTimeFix(0),
+      lastGpsSurveyFix(0),
+      sunPositionChanged(false),
+      timeService(LOCAL_TIME_OFFSET),
+      isAuto(true),
+      powerMeterData(),
+      groups(client),
+      recentSequences(),
+      recentSequenceNext(0),
+      activationGeneration(0),
+      wifiConnectMs(0),
+      wifiFastConnect(false),
+      brokerOutageMs(0),
+      lastCommandMicros(0),
+      maxCommandMicros(0),
+      twin(client)
       {
-    // Initialize devices
+    statusTopic = MQTT_STATUS_TOPIC_PREFIX + macAddress + MQTT_STATUS_TOPIC_SUFFIX;
+    historyTopic = statusTopic + "/history";
+    responseTopic = statusTopic + "/response";
+    activationTopic = statusTopic + "/activation";
+    rebootRequestedAt = 0;
+    historyQuery.active = false;
+    twin.setTopics(macAddress);
+    scheduler.setSunTable(&sunTable);
+    link.begin(status_interval, STATUS_INTERVAL_MIN_MS, STATUS_INTERVAL_MAX_MS, HISTORY_MESSAGES_PER_LOOP);
+
+    // Initialize devices, then put the output back where it was before the reset
     initializeDevices();
+    restoreState();
 }
 
 void BusinessLogicHandler::initializeDevices() {
@@ -70,61 +103,504 @@ void BusinessLogicHandler::initializeDevices() {
 
     pinMode(OUTPUT_CRT, OUTPUT);
     digitalWrite(OUTPUT_CRT, LOW);
+    activations.begin(OUTPUT_CRT);
 
     pinMode(PWM_AUTO_RESET, OUTPUT);
     digitalWrite(PWM_AUTO_RESET, LOW);
     // Initialize LCD
 
-    // Initialize NTP Client
-    timeClient.begin();
-
-    // Initialize GPS (using HardwareSerial)
-    Serial1.begin(9600, SERIAL_8N1, GPS_RX_PIN, GPS_TX_PIN);
+    // Initialize GPS (UART events, the receiver is told to send RMC/GGA only)
+    survey.begin();
+    if (gnss.begin(UART_NUM_1, GPS_RX_PIN, GPS_TX_PIN, 9600)) {
+        gnss.setPositionOutput(survey.wantsPosition());
+        gnss.configure();
+    }
 
     // Initialize Modbus (using HardwareSerial) 
     Serial2.begin(9600, SERIAL_8N1, RX_PIN, TX_PIN);
     power_meter_begin();
 
     deviceLCD.begin();
+
+    // Mount the on-device history partition
+    history.begin();
+
+    // Restore group membership
+    groups.begin();
     // Initialize other components
     // if (power_meter_read(powerMeterData) == PowerMeterResponse::TIMEOUT) isAlive = "0";
     // else isAlive = "1";
     // Any additional setup...
 }
 
+void BusinessLogicHandler::beginNetwork(NetworkCache& cache) {
+    // Initialize NTP Client, more servers let a wrong one be outvoted
+    for (uint8_t i = 1; i < sizeof(NTP_SERVERS) / sizeof(NTP_SERVERS[0]); i++) timeClient.addServer(NTP_SERVERS[i]);
+    // The names go through the DNS cache, so a reboot polls without waiting for a lookup
+    for (const char* server : NTP_SERVERS) cache.addHost(server);
+    timeClient.setResolver([&cache](const char* host) { return cache.cachedIp(host); });
+    timeClient.setSystemClock(false);   // TimeService sets it from whichever source is best
+    timeClient.begin();
+}
+
+// Runs before Wi-Fi is started, so the lamp does not wait for the backend to resend anything
+void BusinessLogicHandler::restoreState() {
+    PersistedState state = persistedState();
+    if (store.begin(state, scheduler)) {
+        settings = state.settings;
+        isAuto = state.isAuto;
+        deviceState = state.deviceState;
+        twin.restoreVersion(state.twinVersion);
+        if (state.statusMinMs != 0) link.setBounds(state.statusMinMs, state.statusMaxMs);
+        if (scheduler.revision() == 0) loadScheduleWindow();   // Saved without the engine block
+    }
+    writeOutput();
+}
+
 // Public methods
 
-void BusinessLogicHandler::handleCommand(const String& command) {
-    StaticJsonDocument<256> jsonDoc;
-    DeserializationError error = deserializeJson(jsonDoc, command);
+const BusinessLogicHandler::CommandEntry BusinessLogicHandler::commandTable[] = {
+    {hashString("TOGGLE"),     "TOGGLE",     &BusinessLogicHandler::commandToggle,    COMMAND_PRIORITY_CONTROL, false},
+    {hashString("GET_STATUS"), "GET_STATUS", &BusinessLogicHandler::commandGetStatus, COMMAND_PRIORITY_CONTROL, false},
+    {hashString("REBOOT"),     "REBOOT",     &BusinessLogicHandler::commandReboot,    COMMAND_PRIORITY_CONTROL, false},
+    {hashString("AUTO"),       "AUTO",       &BusinessLogicHandler::commandAuto,      COMMAND_PRIORITY_CONFIG,  true},
+    {hashString("SCHEDULE"),   "SCHEDULE",   &BusinessLogicHandler::commandSchedule,  COMMAND_PRIORITY_CONFIG,  true},
+    {hashString("GROUPS"),     "GROUPS",     &BusinessLogicHandler::commandGroups,    COMMAND_PRIORITY_CONFIG,  false},
+    {hashString("TELEMETRY"),  "TELEMETRY",  &BusinessLogicHandler::commandTelemetry, COMMAND_PRIORITY_CONFIG,  true},
+    {hashString("WEEKLY"),     "WEEKLY",     &BusinessLogicHandler::commandWeekly,    COMMAND_PRIORITY_CONFIG,  false},
+    {hashString("OVERRIDE"),   "OVERRIDE",   &BusinessLogicHandler::commandOverride,  COMMAND_PRIORITY_CONFIG,  false},
+    {hashString("HISTORY"),    "HISTORY",    &BusinessLogicHandler::commandHistory,   COMMAND_PRIORITY_BULK,    true},
+};
 
-    if (error) {
+const BusinessLogicHandler::CommandEntry* BusinessLogicHandler::findCommand(uint32_t hash, const char* name) {
+    for (const CommandEntry& entry : commandTable) {
+        if (entry.hash == hash && strcmp(entry.name, name) == 0) return &entry;
+    }
+    return nullptr;
+}
+
+// Called from the MQTT callback: only a header scan and a copy, the command
+// itself runs later from update() in priority order within a time budget.
+void BusinessLogicHandler::enqueueCommand(const char* payload, unsigned int length) {
+    StaticJsonDocument<192> headerDoc;
+    CommandHeader header;
+    if (!parseHeader(payload, length, headerDoc, header)) {
         Serial.println("Failed to parse command JSON.");
+        commands.countDrop();
+        return;
+    }
+    if (length > COMMAND_MAX_LENGTH) {
+        Serial.println("Command too long, dropped.");
+        commands.countDrop();
+        sendResponse(header, RPC_BAD_REQUEST);
         return;
     }
 
-    String commandType = jsonDoc["command"];
+    // The same command may arrive on a group topic and on the device topic
+    if (header.seq != 0 && isDuplicateSequence(header.seq)) {
+        Serial.println("Duplicate command sequence, dropped.");
+        return;
+    }
 
-    if (commandType == "REBOOT") {
-        Serial.println("Rebooting device...");
-        ESP.restart();
-    } else if (commandType == "TOGGLE") {
-        String payloadStr = jsonDoc["payload"];
-        handleToggle(payloadStr);
-    } else if (commandType == "SCHEDULE") {
-        JsonObject payload = jsonDoc["payload"];
-        int hourOn = payload["hour_on"];
-        int minuteOn = payload["minute_on"];
-        int hourOff = payload["hour_off"];
-        int minuteOff = payload["minute_off"];
-        handleSchedule(hourOn, minuteOn, hourOff, minuteOff);
-    } else if (commandType == "AUTO") {
-        String payloadStr = jsonDoc["payload"];
-        handleAuto(payloadStr);
+    const char* commandType = headerDoc["command"] | "";
+    uint32_t commandHash = hashString(commandType);
+    const CommandEntry* entry = findCommand(commandHash, commandType);
+    uint8_t priority = entry != nullptr ? entry->priority : COMMAND_PRIORITY_CONFIG;
+
+    QueuedCommand* slot = nullptr;
+    if (entry != nullptr && entry->coalesce) {
+        slot = commands.findPending(commandHash);
+        if (slot != nullptr) {
+            // A newer SCHEDULE/AUTO makes the queued one pointless, take over its slot
+            supersede(slot);
+            commands.countMerge();
+        }
+    }
+    if (slot == nullptr) slot = commands.acquire(priority);
+    if (slot == nullptr) {
+        // Full: a lower priority command gives up its slot, and is told so
+        QueuedCommand* victim = commands.victimFor(priority);
+        if (victim != nullptr) {
+            evict(victim);
+            slot = commands.acquire(priority);
+        }
+    }
+    if (slot == nullptr) {
+        Serial.println("Command queue full, dropped.");
+        commands.countDrop();
+        sendResponse(header, RPC_BUSY);
+        return;
+    }
+
+    if (header.seq != 0) rememberSequence(header.seq);
+
+    slot->commandHash = commandHash;
+    slot->header = header;
+    slot->length = length;
+    memcpy(slot->payload, payload, length);
+    slot->payload[length] = '\0';
+}
+
+// Only the fields needed to queue and answer a command, strings copied so the
+// payload stays intact. The answer fields are kept in header for the queue; an
+// id or reply_to too long for it fails like a parse error.
+bool BusinessLogicHandler::parseHeader(const char* payload, unsigned int length, JsonDocument& headerDoc,
+                                       CommandHeader& header) {
+    StaticJsonDocument<48> filter;
+    filter["command"] = true;
+    filter["seq"] = true;
+    filter["id"] = true;
+    filter["reply_to"] = true;
+    if (deserializeJson(headerDoc, payload, length, DeserializationOption::Filter(filter))) return false;
+
+    header.seq = headerDoc["seq"] | 0UL;
+    header.id[0] = '\0';
+    JsonVariantConst id = headerDoc["id"];
+    if (!id.isNull()) {
+        if (measureJson(id) > COMMAND_ID_LENGTH) return false;
+        serializeJson(id, header.id, sizeof(header.id));
+    }
+    const char* replyTo = headerDoc["reply_to"] | "";
+    return strlcpy(header.replyTo, replyTo, sizeof(header.replyTo)) < sizeof(header.replyTo);
+}
+
+// Answer a queued request that will never run
+void BusinessLogicHandler::supersede(QueuedCommand* command) {
+    sendResponse(command->header, RPC_SUPERSEDED);
+}
+
+// Make room for a more important command: the dropped one is answered as if it
+// never got a slot, and its sequence forgotten so the retry is not a duplicate
+void BusinessLogicHandler::evict(QueuedCommand* command) {
+    Serial.println("Command queue full, lower priority command dropped.");
+    if (command->header.seq != 0) forgetSequence(command->header.seq);
+    sendResponse(command->header, RPC_BUSY);
+    commands.release(command);
+    commands.countDrop();
+}
+
+void BusinessLogicHandler::processCommands() {
+    unsigned long started = micros();
+    for (int processed = 0; processed < COMMANDS_PER_LOOP; processed++) {
+        QueuedCommand* command = commands.next();
+        if (command == nullptr) break;
+        handleCommand(*command);
+        commands.release(command);
+        if (micros() - started > COMMAND_BUDGET_US) break;
+    }
+}
+
+// The payload buffer is parsed in place: strings in jsonDoc point into it.
+// A request carrying an "id" is answered on its "reply_to" topic, or on
+// responseTopic, with {"id", "code", "result"}. Both were taken on arrival.
+void BusinessLogicHandler::handleCommand(QueuedCommand& command) {
+    unsigned long started = micros();
+
+    // Heap rather than stack: a full WEEKLY payload needs well over a kilobyte
+    DynamicJsonDocument jsonDoc(COMMAND_DOC_SIZE);
+    DeserializationError error = deserializeJson(jsonDoc, command.payload, command.length);
+
+    if (error) {
+        Serial.print("Failed to parse command JSON: ");
+        Serial.println(error.c_str());
+        sendResponse(command.header, RPC_BAD_REQUEST);
+        return;
+    }
+
+    const char* commandType = jsonDoc["command"] | "";
+    const CommandEntry* entry = findCommand(command.commandHash, commandType);
+
+    // The handler writes its result straight into the response
+    outboundDoc.clear();
+    JsonObject result = outboundDoc.createNestedObject("result");
+    int code = RPC_UNKNOWN_COMMAND;
+
+    if (entry != nullptr) {
+        code = (this->*entry->handler)(jsonDoc["payload"], result);
+
+        lastCommandMicros = micros() - started;
+        if (lastCommandMicros > maxCommandMicros) maxCommandMicros = lastCommandMicros;
     } else {
         Serial.print("Unknown command type: ");
         Serial.println(commandType);
     }
+    sendResponse(command.header, code);
+}
+
+// Sends outboundDoc with id and code added, whatever result a handler left in it
+void BusinessLogicHandler::sendResponse(const CommandHeader& request, int code) {
+    if (request.id[0] == '\0') {
+        outboundDoc.clear();
+        return;  // Fire-and-forget command, e.g. a group broadcast
+    }
+
+    if (outboundDoc["result"].size() == 0) outboundDoc.remove("result");
+    outboundDoc["id"] = serialized((const char*)request.id);
+    outboundDoc["code"] = code;
+
+    String response;
+    serializeJson(outboundDoc, response);
+    outboundDoc.clear();
+    const char* replyTo = request.replyTo[0] != '\0' ? request.replyTo : responseTopic.c_str();
+    mqttClient.publish(replyTo, response.c_str(), 1, false, MQTT_LANE_CONTROL);
+}
+
+int BusinessLogicHandler::commandReboot(JsonVariant payload, JsonObject result) {
+    // Restart from update() once the response had a chance to leave
+    Serial.println("Rebooting device...");
+    rebootRequestedAt = millis() | 1;
+    return RPC_OK;
+}
+
+int BusinessLogicHandler::commandToggle(JsonVariant payload, JsonObject result) {
+    // {"state": "on", "at": <DayTime.unixtime>, "at_ms": 250} switches at that instant
+    if (payload.is<JsonObject>()) return scheduleToggle(payload.as<JsonObject>(), result);
+    if (!handleToggle(payload | "")) return RPC_INVALID_ARGUMENT;
+    result["toggle"] = deviceState ? 1 : 0;
+    return RPC_OK;
+}
+
+int BusinessLogicHandler::commandSchedule(JsonVariant payload, JsonObject result) {
+    // "astro": 1 follows civil dusk/dawn, the hours stay as the fallback until the site is known
+    SettingsData schedule = { payload["hour_on"].as<int>(), payload["minute_on"].as<int>(),
+                              payload["hour_off"].as<int>(), payload["minute_off"].as<int>(),
+                              (payload["astro"] | 0) != 0 ? 1 : 0, payload["on_offset"] | 0, payload["off_offset"] | 0 };
+    if (!validSettings(schedule)) return RPC_INVALID_ARGUMENT;
+    handleSchedule(schedule);
+    return RPC_OK;
+}
+
+int BusinessLogicHandler::commandAuto(JsonVariant payload, JsonObject result) {
+    if (!handleAuto(payload | "")) return RPC_INVALID_ARGUMENT;
+    result["auto"] = isAuto ? 1 : 0;
+    return RPC_OK;
+}
+
+int BusinessLogicHandler::commandHistory(JsonVariant payload, JsonObject result) {
+    int rows = handleHistory(payload.as<JsonObject>());
+    if (rows < 0) return RPC_INVALID_ARGUMENT;
+    result["rows"] = rows;
+    return RPC_OK;
+}
+
+int BusinessLogicHandler::commandGroups(JsonVariant payload, JsonObject result) {
+    if (!payload.is<JsonObject>()) return RPC_BAD_REQUEST;
+    groups.assign(payload.as<JsonObject>());
+    return RPC_OK;
+}
+
+// {"min_ms": 5000, "max_ms": 120000} bounds the adaptive status interval
+int BusinessLogicHandler::commandTelemetry(JsonVariant payload, JsonObject result) {
+    uint32_t minMs = payload["min_ms"] | link.minInterval();
+    uint32_t maxMs = payload["max_ms"] | link.maxInterval();
+    if (minMs < 1000 || maxMs < minMs) return RPC_INVALID_ARGUMENT;
+    link.setBounds(minMs, maxMs);
+    result["interval_ms"] = link.interval();
+    return RPC_OK;
+}
+
+// Minutes after midnight, or "dusk"/"dawn" with an optional offset such as "dusk-15"
+static bool parseScheduleTime(JsonVariant value, ScheduleTime& time) {
+    time.offset = 0;
+    if (value.is<int>()) {
+        time.ref = SCHEDULE_REF_CLOCK;
+        time.minute = value.as<int>();
+        return time.minute >= 0 && time.minute < 1440;
+    }
+
+    const char* text = value | "";
+    int fallback;
+    if (strncmp(text, "dusk", 4) == 0) {
+        time.ref = SCHEDULE_REF_DUSK;
+        fallback = SCHEDULE_FALLBACK_DUSK;
+    } else if (strncmp(text, "dawn", 4) == 0) {
+        time.ref = SCHEDULE_REF_DAWN;
+        fallback = SCHEDULE_FALLBACK_DAWN;
+    } else {
+        return false;
+    }
+    int offset = atoi(text + 4);
+    if (offset < -ASTRO_MAX_OFFSET_MIN || offset > ASTRO_MAX_OFFSET_MIN) return false;
+    time.offset = offset;
+    time.minute = fallback + offset;
+    return true;
+}
+
+// [mmdd or yyyymmdd, "on" | "off" | weekday 1..7]
+static bool parseScheduleException(JsonVariant entry, ScheduleException& exception) {
+    uint32_t date = entry[0] | 0UL;
+    exception.year  = date >= 10000 ? date / 10000 : 0;
+    exception.month = date / 100 % 100;
+    exception.day   = date % 100;
+
+    JsonVariant program = entry[1];
+    if (program.is<int>()) {
+        int weekday = program.as<int>();
+        if (weekday < 1 || weekday > 7) return false;
+        exception.program = weekday;
+    } else if (strcmp(program | "", "on") == 0) {
+        exception.program = SCHEDULE_DAY_ON;
+    } else if (strcmp(program | "", "off") == 0) {
+        exception.program = SCHEDULE_DAY_OFF;
+    } else {
+        return false;
+    }
+    return exception.month >= 1 && exception.month <= 12 && exception.day >= 1 && exception.day <= 31;
+}
+
+// {"windows": [[31, 1080, 360], [96, "dusk-15", "dawn+10"]], "exceptions": [[1225, "on"], [20260902, 7]]}
+// Windows are [weekday mask, bit 0 = Monday, on, off]. A list that is left out stays as it is;
+// nothing changes unless every entry is valid.
+int BusinessLogicHandler::commandWeekly(JsonVariant payload, JsonObject result) {
+    if (!payload.is<JsonObject>()) return RPC_BAD_REQUEST;
+    JsonArray windowArray = payload["windows"];
+    JsonArray exceptionArray = payload["exceptions"];
+    if (windowArray.size() > SCHEDULE_MAX_WINDOWS || exceptionArray.size() > SCHEDULE_MAX_EXCEPTIONS) {
+        return RPC_INVALID_ARGUMENT;
+    }
+
+    ScheduleWindow windows[SCHEDULE_MAX_WINDOWS];
+    uint8_t windowCount = 0;
+    for (JsonVariant entry : windowArray) {
+        ScheduleWindow& window = windows[windowCount++];
+        int days = entry[0] | 0;
+        window.days = days & SCHEDULE_ALL_DAYS;
+        if (days != window.days || days == 0 ||
+            !parseScheduleTime(entry[1], window.on) || !parseScheduleTime(entry[2], window.off)) {
+            return RPC_INVALID_ARGUMENT;
+        }
+    }
+    ScheduleException exceptions[SCHEDULE_MAX_EXCEPTIONS];
+    uint8_t exceptionCount = 0;
+    for (JsonVariant entry : exceptionArray) {
+        if (!parseScheduleException(entry, exceptions[exceptionCount++])) return RPC_INVALID_ARGUMENT;
+    }
+
+    if (!windowArray.isNull()) {
+        scheduler.clearWindows();
+        for (uint8_t i = 0; i < windowCount; i++) scheduler.addWindow(windows[i]);
+    }
+    if (!exceptionArray.isNull()) {
+        scheduler.clearExceptions();
+        for (uint8_t i = 0; i < exceptionCount; i++) scheduler.addException(exceptions[i]);
+    }
+    result["windows"] = scheduler.windows();
+    result["exceptions"] = scheduler.exceptions();
+    return RPC_OK;
+}
+
+// {"state": "off", "start": <DayTime.unixtime>, "end": <DayTime.unixtime>, "priority": 2}
+// holds the output in auto mode, start defaults to now; {"clear": 1} drops all overrides
+int BusinessLogicHandler::commandOverride(JsonVariant payload, JsonObject result) {
+    if ((payload["clear"] | 0) != 0) {
+        scheduler.clearOverrides();
+        result["overrides"] = 0;
+        return RPC_OK;
+    }
+
+    const char* state = payload["state"] | "";
+    if (strcmp(state, "on") != 0 && strcmp(state, "off") != 0) return RPC_INVALID_ARGUMENT;
+    ScheduleOverride entry;
+    entry.state    = strcmp(state, "on") == 0;
+    entry.start    = payload["start"] | DayTime.unixtime;
+    entry.end      = payload["end"] | 0UL;
+    entry.priority = payload["priority"] | 0;
+    if (!scheduler.addOverride(entry)) return RPC_INVALID_ARGUMENT;
+    result["overrides"] = scheduler.overrides();
+    return RPC_OK;
+}
+
+// Answers from current state right away instead of waiting for the periodic publish
+int BusinessLogicHandler::commandGetStatus(JsonVariant payload, JsonObject result) {
+    fillStatus(result);
+    return RPC_OK;
+}
+
+bool BusinessLogicHandler::isDuplicateSequence(uint32_t seq) {
+    for (int i = 0; i < RECENT_SEQUENCES; i++) {
+        if (recentSequences[i] == seq) return true;
+    }
+    return false;
+}
+
+// Only for commands that were queued, so a retry after RPC_BUSY is not taken for a duplicate
+void BusinessLogicHandler::rememberSequence(uint32_t seq) {
+    recentSequences[recentSequenceNext] = seq;
+    recentSequenceNext = (recentSequenceNext + 1) % RECENT_SEQUENCES;
+}
+
+void BusinessLogicHandler::forgetSequence(uint32_t seq) {
+    for (int i = 0; i < RECENT_SEQUENCES; i++) {
+        if (recentSequences[i] == seq) recentSequences[i] = 0;
+    }
+}
+
+bool BusinessLogicHandler::isCommandTopic(const char* topic, uint32_t topicHash) const {
+    return groups.matches(topic, topicHash);
+}
+
+bool BusinessLogicHandler::isTwinTopic(const char* topic, uint32_t topicHash) const {
+    return twin.isDesiredTopic(topic, topicHash);
+}
+
+void BusinessLogicHandler::setLinkStats(uint32_t wifiConnectMs, bool fastConnect) {
+    this->wifiConnectMs = wifiConnectMs;
+    wifiFastConnect = fastConnect;
+}
+
+void BusinessLogicHandler::setBrokerStats(const char* host, uint32_t outageMs) {
+    brokerHost = host;
+    brokerOutageMs = outageMs;
+}
+
+void BusinessLogicHandler::onDelivery(bool delivered) {
+    link.onDelivery(delivered);
+}
+
+void BusinessLogicHandler::onConnected(bool resumed) {
+    if (!resumed) groups.subscribeAll();
+    twin.onConnected(twinState(), !resumed);
+}
+
+PersistedState BusinessLogicHandler::persistedState() const {
+    PersistedState state;
+    memset(&state, 0, sizeof(state));
+    state.settings = settings;
+    state.twinVersion = twin.version();
+    // Telemetry bounds only once changed, so new defaults in an update still apply
+    if (link.minInterval() != STATUS_INTERVAL_MIN_MS || link.maxInterval() != STATUS_INTERVAL_MAX_MS) {
+        state.statusMinMs = link.minInterval();
+        state.statusMaxMs = link.maxInterval();
+    }
+    state.layout = CONTROL_LAYOUT;
+    state.isAuto = isAuto;
+    state.deviceState = deviceState;
+    return state;
+}
+
+TwinState BusinessLogicHandler::twinState() const {
+    TwinState state;
+    state.settings = settings;
+    state.isAuto = isAuto;
+    state.deviceState = deviceState;
+    return state;
+}
+
+// Apply a newer desired state, touching only the fields that drifted
+void BusinessLogicHandler::handleTwinDesired(char* payload, unsigned int length) {
+    TwinState desired;
+    uint8_t fields = twin.diffDesired(payload, length, twinState(), desired);
+
+    if (fields & TWIN_FIELD_AUTO) {
+        handleAuto(desired.isAuto ? "on" : "off");
+    }
+    if (fields & TWIN_FIELD_SCHEDULE) {
+        handleSchedule(desired.settings);
+    }
+    if ((fields & TWIN_FIELD_TOGGLE) && !desired.isAuto) {
+        handleToggle(desired.deviceState ? "on" : "off");
+    }
+    twin.report(twinState(), false);
 }
 
 String cutShort(double value) {
@@ -134,8 +610,15 @@ String cutShort(double value) {
 }
 
 String BusinessLogicHandler::getStatus() {
-    StaticJsonDocument<1024> jsonDoc;
+    fillStatus(outboundDoc.to<JsonObject>());
 
+    String status;
+    serializeJson(outboundDoc, status);
+    outboundDoc.clear();
+    return status;
+}
+
+void BusinessLogicHandler::fillStatus(JsonObject jsonDoc) {
     // Include time
     jsonDoc["time"] = DayTime.unixtime;
 
@@ -145,6 +628,13 @@ String BusinessLogicHandler::getStatus() {
     // Include GPS data
     jsonDoc["gps_log"] = gpsLongitude;
     jsonDoc["gps_lat"] = gpsLatitude;
+    jsonDoc["gps_parse_us"] = gnss.parseMicrosPerSecond();
+    jsonDoc["gps_sentences"] = gnss.sentences();
+    jsonDoc["gps_dropped"] = gnss.dropped();
+    jsonDoc["gps_bad"] = gps.failed();
+    jsonDoc["gps_sats"] = gps.fix().satellites;
+    jsonDoc["gps_survey"] = PositionSurvey::stateName(survey.state());
+    jsonDoc["gps_acc_cm"] = survey.accuracyCm();
 
     // Include power meter data
     jsonDoc["voltage"] = cutShort(powerMeterData.voltage);
@@ -160,53 +650,286 @@ String BusinessLogicHandler::getStatus() {
     jsonDoc["minute_on"] = settings.minute_on;
     jsonDoc["hour_off"] = settings.hour_off;
     jsonDoc["minute_off"] = settings.minute_off;
-    
-    String status;
-    serializeJson(jsonDoc, status);
-    return status;
+    jsonDoc["astro"] = settings.astro;
+    jsonDoc["on_offset"] = settings.on_offset;
+    jsonDoc["off_offset"] = settings.off_offset;
+    jsonDoc["sched_windows"] = scheduler.windows();
+    jsonDoc["sched_overrides"] = scheduler.overrides();
+    jsonDoc["sched_next"] = scheduler.nextTransition();
+    jsonDoc["nvs_writes"] = store.writes();
+    if (sunTable.validFor(DayTime.year)) {
+        uint16_t day = SunTable::dayOfYear(DayTime.year, DayTime.month, DayTime.day);
+        jsonDoc["sun_dawn"] = sunTable.dawn(day);   // Local minutes after midnight, 65534/65535 on polar days
+        jsonDoc["sun_dusk"] = sunTable.dusk(day);
+    }
+
+    // Command parse-to-actuation time in microseconds
+    jsonDoc["cmd_us"] = lastCommandMicros;
+    jsonDoc["cmd_us_max"] = maxCommandMicros;
+
+    // Command queue health
+    jsonDoc["cmd_queued"] = commands.size();
+    jsonDoc["cmd_dropped"] = commands.dropped();
+    jsonDoc["cmd_merged"] = commands.merged();
+
+    // Publish-to-delivery latency per send lane
+    MqttLaneStats control = mqttClient.laneStats(MQTT_LANE_CONTROL);
+    MqttLaneStats telemetry = mqttClient.laneStats(MQTT_LANE_TELEMETRY);
+    jsonDoc["ctl_us"] = control.avgUs;
+    jsonDoc["ctl_us_max"] = control.maxUs;
+    jsonDoc["tlm_us"] = telemetry.avgUs;
+    jsonDoc["tlm_us_max"] = telemetry.maxUs;
+    // Link quality and the reporting rate it allows
+    jsonDoc["interval_ms"] = link.interval();
+    jsonDoc["rssi"] = link.rssi();
+    jsonDoc["pub_ok_pct"] = link.successPercent();
+    jsonDoc["rtt_ms"] = link.rttMillis();
+    jsonDoc["wifi_connect_ms"] = wifiConnectMs;
+    jsonDoc["wifi_fast"] = wifiFastConnect ? 1 : 0;
+    jsonDoc["mqtt_connect_ms"] = mqttClient.connectMillis();
+    // TLS share of it, against mqtt_connect_ms of a plaintext unit; tls_session is 1 when resuming was offered
+    jsonDoc["tls_ms"] = mqttClient.tlsHandshakeMillis();
+    jsonDoc["tls_session"] = mqttClient.tlsSessionOffered() ? 1 : 0;
+    jsonDoc["broker"] = brokerHost;
+    jsonDoc["broker_outage_ms"] = brokerOutageMs;
+    uint32_t publishes = mqttClient.publishCount();
+    jsonDoc["mqtt_pub_bytes"] = publishes > 0 ? mqttClient.publishBytes() / publishes : 0;
+    jsonDoc["mqtt_pub_us"] = publishes > 0 ? mqttClient.publishMicros() / publishes : 0;
+    // Clock discipline
+    jsonDoc["ntp_offset_us"] = timeClient.lastOffsetUs();
+    jsonDoc["ntp_delay_us"] = timeClient.lastDelayUs();
+    jsonDoc["ntp_drift_ppb"] = timeClient.driftPpb();
+    jsonDoc["ntp_servers"] = timeClient.survivors();
+    jsonDoc["ntp_poll_s"] = timeClient.pollInterval() / 1000;
+    jsonDoc["time_src"] = TimeService::sourceName(timeService.source());
+    jsonDoc["time_err_us"] = timeService.errorUs();
+    jsonDoc["time_drift_ppb"] = timeService.driftPpb();
+    jsonDoc["time_holdover_s"] = timeService.holdoverSeconds();
+    jsonDoc["time_ntp_age_s"] = timeService.sourceAgeSeconds(TIME_SOURCE_NTP);
+    jsonDoc["time_gps_age_s"] = timeService.sourceAgeSeconds(TIME_SOURCE_GPS);
+
+    // Timed switching
+    jsonDoc["act_pending"] = activations.pending();
+    jsonDoc["act_skew_us"] = activations.lastSkewUs();
+    jsonDoc["act_skew_us_max"] = activations.maxSkewUs();
 }
 
-void BusinessLogicHandler::handleToggle(const String& state) {
-    if (state == "on") {
+bool BusinessLogicHandler::handleToggle(const char* state) {
+    if (strcmp(state, "on") == 0) {
         Serial.println("Toggling device ON...");
         deviceState = true;
         isAuto = false;
-    } else if (state == "off") {
+    } else if (strcmp(state, "off") == 0) {
         Serial.println("Toggling device OFF...");
         deviceState = false;
         isAuto = false;
     } else {
         Serial.print("Unknown toggle state: ");
         Serial.println(state);
+        return false;
+    }
+    // Update the OUTPUT_CRT pin based on deviceState, overriding a timed switch not yet seen
+    activations.writeOutput(deviceState, true);
+    return true;
+}
+
+int BusinessLogicHandler::scheduleToggle(JsonObject payload, JsonObject result) {
+    const char* state = payload["state"] | "";
+    uint32_t at = payload["at"] | 0UL;
+    uint16_t atMs = payload["at_ms"] | 0;
+    if (at == 0) return handleToggle(state) ? RPC_OK : RPC_INVALID_ARGUMENT;
+    if ((strcmp(state, "on") != 0 && strcmp(state, "off") != 0) || atMs > 999) return RPC_INVALID_ARGUMENT;
+
+    int64_t targetUs = activationTargetUs(at, atMs);
+    int64_t now = esp_timer_get_time();
+    if (targetUs == 0 || targetUs < now - ACTIVATION_MAX_LATE_MS * 1000LL ||
+        targetUs > now + ACTIVATION_MAX_AHEAD_SEC * 1000000LL) {
+        Serial.println("Activation time out of range.");
+        return RPC_INVALID_ARGUMENT;
     }
-    // Update the OUTPUT_CRT pin based on deviceState
-    digitalWrite(OUTPUT_CRT, deviceState ? HIGH : LOW);
+    if (!activations.schedule(targetUs, strcmp(state, "on") == 0, at, atMs)) return RPC_BUSY;
+
+    Serial.printf("Toggle %s scheduled at %u.%03u\n", state, (unsigned)at, (unsigned)atMs);
+    result["at"] = at;
+    result["at_ms"] = atMs;
+    return RPC_ACCEPTED;
+}
+
+// Maps a DayTime instant onto the esp_timer clock, 0 if there is no wall clock yet
+int64_t BusinessLogicHandler::activationTargetUs(uint32_t at, uint16_t atMs) {
+    if (!timeService.valid() || DayTime.unixtime < HISTORY_MIN_VALID_TIME) return 0;
+    return timeService.localFromUtc(((int64_t)at - LOCAL_TIME_OFFSET) * 1000000LL + atMs * 1000LL);
+}
+
+// All output writes go here, a timed switch that already fired wins over deviceState
+void BusinessLogicHandler::writeOutput() {
+    if (activations.writeOutput(deviceState)) isAuto = false;
 }
 
-void BusinessLogicHandler::handleSchedule(int hourOn, int minuteOn, int hourOff, int minuteOff) {
-    Serial.printf("Scheduling ON: %02d:%02d, OFF: %02d:%02d\n", hourOn, minuteOn, hourOff, minuteOff);
-    settings.hour_on = hourOn;
-    settings.minute_on = minuteOn;
-    settings.hour_off = hourOff;
-    settings.minute_off = minuteOff;
+// Tell the backend when each timed switch actually happened
+void BusinessLogicHandler::reportActivations() {
+    Activation activation;
+    while (activations.takeFired(activation)) {
+        StaticJsonDocument<128> jsonDoc;
+        jsonDoc["at"] = activation.at;
+        jsonDoc["at_ms"] = activation.atMs;
+        jsonDoc["toggle"] = activation.state ? 1 : 0;
+        jsonDoc["skew_us"] = (int32_t)(activation.firedUs - activation.targetUs);
+        // Against disciplined UTC, which the time service is itself only this sure of
+        int64_t requestedUtcUs = ((int64_t)activation.at - LOCAL_TIME_OFFSET) * 1000000LL + activation.atMs * 1000LL;
+        if (timeService.valid()) {
+            jsonDoc["utc_skew_us"] = (int32_t)(timeService.utcMicros(activation.firedUs) - requestedUtcUs);
+        }
+        jsonDoc["time_err_us"] = timeService.errorUs();
+
+        String report;
+        serializeJson(jsonDoc, report);
+        mqttClient.publish(activationTopic.c_str(), report.c_str(), 1, false, MQTT_LANE_CONTROL);
+    }
+}
+
+void BusinessLogicHandler::handleSchedule(const SettingsData& schedule) {
+    Serial.printf("Scheduling ON: %02d:%02d, OFF: %02d:%02d\n",
+                  schedule.hour_on, schedule.minute_on, schedule.hour_off, schedule.minute_off);
+    if (schedule.astro) {
+        Serial.printf("Scheduling ON: dusk %+d min, OFF: dawn %+d min\n", schedule.on_offset, schedule.off_offset);
+    }
+    settings = schedule;
+    loadScheduleWindow();
     deviceLCD.print("Schedule updated");
 }
 
-void BusinessLogicHandler::handleAuto(const String& state) {
-    if (state == "on") {
+// SCHEDULE sets one window for every day of the week, replacing any weekly windows.
+// Equal fixed on and off times disable it, as they always have.
+void BusinessLogicHandler::loadScheduleWindow() {
+    scheduler.clearWindows();
+    ScheduleWindow window;
+    window.days = SCHEDULE_ALL_DAYS;
+    window.on  = { SCHEDULE_REF_CLOCK, (int16_t)(settings.hour_on * 60 + settings.minute_on), 0 };
+    window.off = { SCHEDULE_REF_CLOCK, (int16_t)(settings.hour_off * 60 + settings.minute_off), 0 };
+    if (settings.astro) {
+        // The fixed times stand in for dusk and dawn until the sun table is built
+        if (window.on.minute == window.off.minute) {
+            window.on.minute  = SCHEDULE_FALLBACK_DUSK;
+            window.off.minute = SCHEDULE_FALLBACK_DAWN;
+        }
+        window.on.ref     = SCHEDULE_REF_DUSK;
+        window.on.offset  = settings.on_offset;
+        window.off.ref    = SCHEDULE_REF_DAWN;
+        window.off.offset = settings.off_offset;
+    } else if (window.on.minute == window.off.minute) {
+        return;
+    }
+    scheduler.addWindow(window);
+}
+
+bool BusinessLogicHandler::handleAuto(const char* state) {
+    if (strcmp(state, "on") == 0) {
         Serial.println("Auto mode ON...");
         isAuto = true;
-    } else if (state == "off") {
+    } else if (strcmp(state, "off") == 0) {
         Serial.println("Auto mode OFF...");
         isAuto = false;
     } else {
         Serial.print("Unknown auto state: ");
         Serial.println(state);
+        return false;
+    }
+    return true;
+}
+
+// Starts streaming a history range, returns the number of rows or -1 on a bad request
+int BusinessLogicHandler::handleHistory(JsonObject payload) {
+    HistoryStore::Resolution resolution;
+    if (!HistoryStore::parseResolution(payload["resolution"].as<const char*>(), resolution)) {
+        Serial.println("Unknown history resolution.");
+        return -1;
+    }
+    uint32_t from = payload["from"] | 0UL;
+    uint32_t to   = payload["to"] | 0xFFFFFFFFUL;
+
+    uint32_t first;
+    uint32_t rows = history.find(resolution, from, to, first);
+    if (rows > HISTORY_MAX_ROWS) {
+        // Keep the newest rows of an oversized range
+        first += rows - HISTORY_MAX_ROWS;
+        rows = HISTORY_MAX_ROWS;
+        from = history.at(resolution, first)->time;
+    }
+
+    // A new query replaces one still in progress
+    historyQuery.active     = true;
+    historyQuery.resolution = resolution;
+    historyQuery.from       = from;
+    historyQuery.to         = to;
+    historyQuery.remaining  = rows;
+    historyQuery.part       = 0;
+    historyQuery.id         = payload["id"] | "";
+    Serial.printf("History query: %s, %u rows\n", HistoryStore::resolutionName(resolution), (unsigned)rows);
+    return rows;
+}
+
+void BusinessLogicHandler::serviceHistoryQuery() {
+    for (int sent = 0; historyQuery.active && sent < link.batch(); sent++) {
+        StaticJsonDocument<HISTORY_DOC_SIZE> jsonDoc;
+        jsonDoc["id"] = historyQuery.id;
+        jsonDoc["res"] = HistoryStore::resolutionName(historyQuery.resolution);
+        jsonDoc["part"] = historyQuery.part;
+
+        // Find the place again for every message, records may have been appended or dropped since
+        uint32_t index;
+        uint32_t available = history.find(historyQuery.resolution, historyQuery.from, historyQuery.to, index);
+        if (available < historyQuery.remaining) historyQuery.remaining = available;   // Oldest erased meanwhile
+        uint32_t nextFrom = historyQuery.from;
+
+        // Rows are [time, samples, flags, voltage, current, power, power_factor, frequency, total_energy]
+        JsonArray rows = jsonDoc.createNestedArray("rows");
+        for (int i = 0; i < HISTORY_ROWS_PER_MESSAGE && historyQuery.remaining > 0; i++) {
+            const HistoryRecord* record = history.at(historyQuery.resolution, index++);
+            if (record == nullptr) {
+                historyQuery.remaining = 0;
+                break;
+            }
+            JsonArray row = rows.createNestedArray();
+            row.add(record->time);
+            row.add(record->samples);
+            row.add(record->flags);
+            row.add(serialized(cutShort(record->voltage)));
+            row.add(serialized(cutShort(record->current)));
+            row.add(serialized(cutShort(record->power)));
+            row.add(serialized(cutShort(record->powerFactor)));
+            row.add(serialized(cutShort(record->frequency)));
+            row.add(serialized(cutShort(record->totalEnergy)));
+            nextFrom = record->time + 1;
+            historyQuery.remaining--;
+        }
+        jsonDoc["last"] = historyQuery.remaining == 0 ? 1 : 0;
+
+        String response;
+        serializeJson(jsonDoc, response);
+        if (!mqttClient.publish(historyTopic.c_str(), response.c_str())) {
+            // Retry the same rows on the next update
+            historyQuery.remaining += rows.size();
+            return;
+        }
+        historyQuery.from = nextFrom;
+        historyQuery.part++;
+        if (historyQuery.remaining == 0) historyQuery.active = false;
     }
 }
 
 void BusinessLogicHandler::update() {
-    timeClient.update();
+    if (rebootRequestedAt != 0 && millis() - rebootRequestedAt > REBOOT_DELAY_MS) {
+        store.flush(persistedState(), scheduler);
+        ESP.restart();
+    }
+
+    // Adopt timed switches fired since the last pass before commands can override them
+    writeOutput();
+    reportActivations();
+
+    // Run queued commands, control first, within the per-loop budget
+    processCommands();
 
     unsigned long currentMillis = millis();
     // Update time from NTP client periodically
@@ -221,64 +944,120 @@ void BusinessLogicHandler::update() {
     digitalWrite(PR_LED, millis() % 1000 < 500);
     digitalWrite(PWM_AUTO_RESET, !digitalRead(PWM_AUTO_RESET));
 
-    // Update GPS data
+    // Update GPS data and the time
     updateGPS();
+    updateTime();
     deviceLCD.setDayTime(DayTime);
 
     // Handle scheduling
     updateScheduling();
-    digitalWrite(OUTPUT_CRT, deviceState ? HIGH : LOW);
+    writeOutput();
     // Update LCD display
     // Intialize new settings
-    
+    SettingsData shown = settings;
     deviceLCD.print(settings);
+    if (memcmp(&shown, &settings, sizeof(settings)) != 0) loadScheduleWindow();   // Edited on the LCD
     digitalWrite(LED_BUILTIN, !LED_BUILTIN_ON_STATE);
       
     // Read power meter data
     power_meter_read(powerMeterData);
+
+    // Log history and answer pending range queries
+    history.record(DayTime.unixtime, powerMeterData, deviceState, isAuto);
+    serviceHistoryQuery();
+
+    // Re-evaluate the reporting rate against the current link
+    if (WiFi.status() == WL_CONNECTED) {
+        link.update(WiFi.RSSI(), mqttClient.laneStats(MQTT_LANE_TELEMETRY).avgUs);
+    }
+
+    // Report local changes (LCD edits, schedule switching) to the twin
+    twin.report(twinState(), false);
+
+    // Save them too, once they have settled
+    store.update(persistedState(), scheduler);
 }
 
+// Whole RMC/GGA sentences arrive from the GNSS task, everything else never reaches the parser
 void processGPSData() {
-    while (Serial1.available()) {
-        char c = Serial1.read();
-        gps.encode(c);
+    GnssSentence sentence;
+    while (gnss.read(sentence)) {
+        unsigned long started = micros();
+        gps.parse(sentence.text, sentence.length, sentence.receivedUs);
+        gnss.recordParse(micros() - started);
     }
 }
 
 void BusinessLogicHandler::updateGPS() {
-    RTCDateTime DayTime_net = timeClient.getDateTime();                                       // lưu thời gian vào biến DayTime
     processGPSData();
-    RTCDateTime DayTime_gps = gps.getDateTime(); 
 
-    float flat, flon;
-    unsigned long age;
-    gps.f_get_position(&flat, &flon, &age);
-    if (flat != GPS_INVALID_F_ANGLE) gpsLatitude = flat;
-    if (flon != GPS_INVALID_F_ANGLE) gpsLongitude = flon;
+    // Offer each GPS time fix once, stamped when its RMC sentence arrived
+    RTCDateTime fix;
+    uint8_t hundredths;
+    if (gps.timeFixUs() != lastGpsTimeFix && gps.dateTime(fix, hundredths)) {
+        lastGpsTimeFix = gps.timeFixUs();
+        uint32_t utc = unixFromDateTime(fix.year, fix.month, fix.day, fix.hour, fix.minute, fix.second);
+        if (utc >= HISTORY_MIN_VALID_TIME) {
+            timeService.offer(TIME_SOURCE_GPS, utc * 1000000LL + hundredths * 10000LL,
+                              lastGpsTimeFix, TIME_GPS_ERROR_US);
+        }
+    }
+
+    // Average GGA fixes until the site is surveyed in; after that the receiver only serves time
+    if (gps.qualityFixUs() != lastGpsSurveyFix) {
+        lastGpsSurveyFix = gps.qualityFixUs();
+        const NmeaFix& fix = gps.fix();
+        if (survey.addFix(fix.latitude, fix.longitude, fix.altitude, fix.hdop)) sunPositionChanged = true;
+    }
+    survey.update();
+    gnss.setPositionOutput(survey.wantsPosition());
+
+    if (survey.hasPosition()) {
+        gpsLatitude = survey.latitude();
+        gpsLongitude = survey.longitude();
+    }
+}
+
+// DayTime only ever comes from the time service, which weighs NTP against GPS
+void BusinessLogicHandler::updateTime() {
+    if (timeClient.update()) {
+        timeService.offer(TIME_SOURCE_NTP, timeClient.getCorrectedMicros(), esp_timer_get_time(),
+                          timeClient.lastDelayUs() / 2 + TIME_NTP_ERROR_US);
+    }
+    timeService.update();
+    DayTime = timeService.dateTime();
 
-    if (DayTime_net.unixtime > DayTime_gps.unixtime) DayTime = DayTime_net;
-    else DayTime = DayTime_gps;   
+    // Timed switches were mapped onto esp_timer with the old base, move them with the clock
+    if (timeService.generation() != activationGeneration) {
+        activationGeneration = timeService.generation();
+        if (activations.pending() > 0) {
+            activations.retarget([this](uint32_t at, uint16_t atMs) { return activationTargetUs(at, atMs); });
+        }
+    }
 }
 // Implement LCD_print() and any other required methods
 
+// The table is built once the site and the year are known, again for a new year or a new survey lock
+void BusinessLogicHandler::updateSunTable() {
+    if (!timeService.valid() || !survey.hasPosition()) return;
+    if (sunTable.validFor(DayTime.year) && !sunPositionChanged) return;
+    sunTable.build(survey.latitude(), survey.longitude(), LOCAL_TIME_OFFSET, DayTime.year);
+    sunPositionChanged = false;
+    scheduler.invalidate();
+}
+
 void BusinessLogicHandler::updateScheduling() {
-    // Get current time in seconds since midnight
-    int currentSeconds = DayTime.hour * 3600 + DayTime.minute * 60 + DayTime.second;
-    int onTimeSeconds = settings.hour_on * 3600 + settings.minute_on * 60;
-    int offTimeSeconds = settings.hour_off * 3600 + settings.minute_off * 60;
-
-    // Handle device state based on schedule
-    if ((onTimeSeconds != offTimeSeconds) && isAuto) { // Valid schedule and auto mode
-        if ((currentSeconds >= onTimeSeconds && currentSeconds < offTimeSeconds) ||
-            (offTimeSeconds < onTimeSeconds && (currentSeconds >= onTimeSeconds || currentSeconds < offTimeSeconds))) {
-            deviceState = true;
-        } else {
-            deviceState = false;
-        }
+    updateSunTable();
+
+    // The engine knows its next transition, between transitions this is one compare.
+    // Until the clock is set the restored output stands.
+    bool scheduledOn;
+    if (isAuto && timeService.valid() && scheduler.stateAt(DayTime.unixtime, scheduledOn)) {
+        deviceState = scheduledOn;
     }
 
     // Update output
-    digitalWrite(OUTPUT_CRT, deviceState ? HIGH : LOW);
+    writeOutput();
 }
 
 // Add any additional methods required for your application
\ No newline at end of file
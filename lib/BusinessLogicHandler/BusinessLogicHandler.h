@@ -3,33 +3,149 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h>
-#include <PubSubClient.h>
+#include "MqttTransport.h"
 #include <NTPClient.h>
 #include <WiFiUdp.h>
 #include <LiquidCrystal.h>
 #include "types.h"
 #include "ESP32LCD.h"
+#include "HistoryStore.h"
+#include "GroupMembership.h"
+#include "DeviceTwin.h"
+#include "CommandQueue.h"
+#include "ActivationTimer.h"
+#include "LinkMonitor.h"
+#include "TimeService.h"
+#include "PositionSurvey.h"
+#include "SunTable.h"
+#include "ScheduleEngine.h"
+#include "ControlStore.h"
+#include "NetworkCache.h"
+
+// Rows of history sent per MQTT message. A row prints to at most 84 characters,
+// so a message stays under 600 bytes, far inside the 2048 byte MQTT buffer;
+// the count is kept low so a message still gets through on a poor link.
+#define HISTORY_ROWS_PER_MESSAGE  6
+// Document of one history message: the envelope, the request id and per row
+// 9 values, 6 of them copied as 10 byte strings
+#define HISTORY_DOC_SIZE          (JSON_OBJECT_SIZE(5) + 64 + JSON_ARRAY_SIZE(HISTORY_ROWS_PER_MESSAGE) + \
+                                   HISTORY_ROWS_PER_MESSAGE * (JSON_ARRAY_SIZE(9) + 6 * 10))
+// Most messages sent per update() while a history query is running, lowered on a poor link
+#define HISTORY_MESSAGES_PER_LOOP 2
+// Default bounds of the adaptive status interval, in ms; the TELEMETRY command changes them
+#ifndef STATUS_INTERVAL_MIN_MS
+#define STATUS_INTERVAL_MIN_MS    (status_interval / 2)
+#endif
+#ifndef STATUS_INTERVAL_MAX_MS
+#define STATUS_INTERVAL_MAX_MS    (status_interval * 8)
+#endif
+// JSON document holding the full status report, RPC responses wrap it
+#define STATUS_DOC_SIZE           1408
+// Upper bound on rows returned by one query
+#define HISTORY_MAX_ROWS          1440
+// Command sequence numbers remembered to drop group/device duplicates
+#define RECENT_SEQUENCES          16
+// Delay between answering REBOOT and restarting, lets the response go out
+#define REBOOT_DELAY_MS           500
+// Parse document of one command: the envelope and a payload object, plus a WEEKLY
+// payload at its limits, windows as arrays of 3 and exceptions as arrays of 2
+#define COMMAND_DOC_SIZE          (JSON_OBJECT_SIZE(8) + JSON_OBJECT_SIZE(4) + \
+                                   JSON_ARRAY_SIZE(SCHEDULE_MAX_WINDOWS) + SCHEDULE_MAX_WINDOWS * JSON_ARRAY_SIZE(3) + \
+                                   JSON_ARRAY_SIZE(SCHEDULE_MAX_EXCEPTIONS) + SCHEDULE_MAX_EXCEPTIONS * JSON_ARRAY_SIZE(2))
+// Per-update() budget for queued commands
+#define COMMANDS_PER_LOOP         2
+#define COMMAND_BUDGET_US         20000
+// Offset of DayTime from UTC, as applied by the NTP client and the GPS
+#define LOCAL_TIME_OFFSET         (7 * 3600)
+// Timed TOGGLE bounds: how far ahead it may be set, how late it still runs
+#define ACTIVATION_MAX_AHEAD_SEC  3600
+#define ACTIVATION_MAX_LATE_MS    5000
+
+// RPC result codes, HTTP-like so the backend can map them directly
+#define RPC_OK                    200
+#define RPC_ACCEPTED              202   // Timed command queued, runs at its activation time
+#define RPC_BAD_REQUEST           400
+#define RPC_UNKNOWN_COMMAND       404
+#define RPC_SUPERSEDED            409   // Replaced by a newer command of the same kind before it ran
+#define RPC_INVALID_ARGUMENT      422
+#define RPC_BUSY                  503   // Command queue full
 
 class BusinessLogicHandler {
 public:
     // Constructor
-    BusinessLogicHandler(PubSubClient& client, const String& mac);
+    BusinessLogicHandler(MqttTransport& client, const String& mac);
 
     // Public methods
-    void handleCommand(const String& command);
+    void enqueueCommand(const char* payload, unsigned int length);  // Queue an inbound command for update()
+    void handleCommand(QueuedCommand& command);  // Parses the payload in place
     String getStatus();
+    void fillStatus(JsonObject status);
     String isAlive;
     ESP32LCD deviceLCD;
     void update(); // Method to be called in main loop
     void initializeDevices(); // Device initialization
+    void beginNetwork(NetworkCache& cache);   // Starts what needs Wi-Fi, call once it is up
+    bool isCommandTopic(const char* topic, uint32_t topicHash) const; // Group or broadcast command topic
+    bool isTwinTopic(const char* topic, uint32_t topicHash) const;    // Desired-state topic of the device twin
+    void handleTwinDesired(char* payload, unsigned int length);
+    void setLinkStats(uint32_t wifiConnectMs, bool fastConnect);   // Last Wi-Fi join, for status
+    void setBrokerStats(const char* host, uint32_t outageMs);     // Broker in use, last time without one
+    void onConnected(bool resumed);   // Call after every MQTT (re)connect, resumed if the session was kept
+    void onDelivery(bool delivered);  // Outcome of every publish, feeds the link monitor
+    uint32_t statusInterval() const { return link.interval(); }   // Current status period in ms, set by the link monitor
 
 private:
+    // Command table entry, keyed by the compile-time hash of the command name
+    // Handlers return an RPC_* code and may fill result for the response
+    typedef int (BusinessLogicHandler::*CommandHandler)(JsonVariant payload, JsonObject result);
+    struct CommandEntry {
+        uint32_t hash;
+        const char* name;
+        CommandHandler handler;
+        uint8_t priority;       // COMMAND_PRIORITY_*
+        bool coalesce;          // A newer one replaces one still queued
+    };
+    static const CommandEntry commandTable[];
+    static const CommandEntry* findCommand(uint32_t hash, const char* name);
+    void processCommands();
+    void supersede(QueuedCommand* command);
+    void evict(QueuedCommand* command);
+
+    int commandReboot(JsonVariant payload, JsonObject result);
+    int commandToggle(JsonVariant payload, JsonObject result);
+    int commandSchedule(JsonVariant payload, JsonObject result);
+    int commandAuto(JsonVariant payload, JsonObject result);
+    int commandHistory(JsonVariant payload, JsonObject result);
+    int commandGroups(JsonVariant payload, JsonObject result);
+    int commandGetStatus(JsonVariant payload, JsonObject result);
+    int commandTelemetry(JsonVariant payload, JsonObject result);
+    int commandWeekly(JsonVariant payload, JsonObject result);
+    int commandOverride(JsonVariant payload, JsonObject result);
+    static bool parseHeader(const char* payload, unsigned int length, JsonDocument& headerDoc,
+                            CommandHeader& header);
+    void sendResponse(const CommandHeader& request, int code);
+
     // Private methods for internal logic
-    void handleToggle(const String& state);
-    void handleSchedule(int hourOn, int minuteOn, int hourOff, int minuteOff);
-    void handleAuto(const String& state);
+    bool handleToggle(const char* state);
+    int scheduleToggle(JsonObject payload, JsonObject result);
+    int64_t activationTargetUs(uint32_t at, uint16_t atMs);
+    void writeOutput();
+    void reportActivations();
+    void handleSchedule(const SettingsData& schedule);
+    void loadScheduleWindow();
+    bool handleAuto(const char* state);
+    int handleHistory(JsonObject payload);
+    void serviceHistoryQuery();
+    bool isDuplicateSequence(uint32_t seq);
+    void rememberSequence(uint32_t seq);
+    void forgetSequence(uint32_t seq);
+    TwinState twinState() const;
+    PersistedState persistedState() const;
+    void restoreState();
     
+    void updateTime();
     void updateGPS();
+    void updateSunTable();
     void updateScheduling();
     // Hardware components
     WiFiUDP ntpUDP;
@@ -43,9 +159,75 @@ private:
     // GPS data
     float gpsLatitude;
     float gpsLongitude;
+    int64_t lastGpsTimeFix;         // Arrival of the last RMC offered to the time service
+    int64_t lastGpsSurveyFix;       // Arrival of the last GGA fed to the survey
+
+    // Averaged, persisted site position
+    PositionSurvey survey;
+
+    // Civil dawn and dusk of the surveyed site for the current year
+    SunTable sunTable;
+    bool sunPositionChanged;
+
+    // Weekly windows, exceptions and overrides behind auto mode
+    ScheduleEngine scheduler;
+
+    // Settings and control state kept across resets
+    ControlStore store;
+
+    // NTP and GPS fused into DayTime
+    TimeService timeService;
+
+    // On-device history
+    HistoryStore history;
+    struct HistoryQuery {
+        bool active;
+        HistoryStore::Resolution resolution;
+        uint32_t from;          // Time of the next record to send. Tracked by time, not index:
+        uint32_t to;            // erasing a sector shifts the indices between two messages.
+        uint32_t remaining;     // Rows left to send
+        uint16_t part;          // Sequence number of the next response message
+        String id;              // Request id echoed in every response
+    } historyQuery;
+    String historyTopic;
+    String responseTopic;     // Default RPC response topic when a request has no reply_to
+    unsigned long rebootRequestedAt;
+
+    // Group command topics
+    GroupMembership groups;
+    uint32_t recentSequences[RECENT_SEQUENCES];
+    uint8_t recentSequenceNext;
+
+    // Inbound commands waiting for update()
+    CommandQueue commands;
+    // Responses and the status report are built here, one at a time from loop(), off the stack
+    StaticJsonDocument<STATUS_DOC_SIZE + 256> outboundDoc;
+
+    // Timed output switching
+    ActivationTimer activations;
+    String activationTopic;
+    uint32_t activationGeneration;   // TimeService base the pending targets were mapped with
+
+    // Last Wi-Fi join
+    uint32_t wifiConnectMs;
+    bool wifiFastConnect;
+
+    // Link quality and the reporting rate derived from it
+    LinkMonitor link;
+
+    // Broker failover
+    String brokerHost;
+    uint32_t brokerOutageMs;
+
+    // Command parse-to-actuation time
+    unsigned long lastCommandMicros;
+    unsigned long maxCommandMicros;
+
+    // Versioned configuration shadow
+    DeviceTwin twin;
 
     // Member variables
-    PubSubClient& mqttClient;
+    MqttTransport& mqttClient;
     String macAddress;
     String statusTopic;
     String commandTopic;
@@ -0,0 +1,67 @@
+#include "CommandQueue.h"
+
+// Constructor
+CommandQueue::CommandQueue()
+    : count(0),
+      nextOrder(0),
+      droppedCount(0),
+      mergedCount(0)
+{
+    memset(slots, 0, sizeof(slots));
+}
+
+QueuedCommand* CommandQueue::acquire(uint8_t priority) {
+    QueuedCommand* slot = nullptr;
+    for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        if (!slots[i].used) {
+            slot = &slots[i];
+            break;
+        }
+    }
+    if (slot == nullptr) return nullptr;
+
+    slot->used = true;
+    slot->priority = priority;
+    slot->order = nextOrder++;
+    count++;
+    return slot;
+}
+
+// The newest of the least important commands, if it ranks below
+QueuedCommand* CommandQueue::victimFor(uint8_t priority) {
+    if (count < COMMAND_QUEUE_SIZE) return nullptr;
+    QueuedCommand* victim = nullptr;
+    for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        if (victim == nullptr || slots[i].priority > victim->priority ||
+            (slots[i].priority == victim->priority && slots[i].order > victim->order)) {
+            victim = &slots[i];
+        }
+    }
+    if (victim == nullptr || victim->priority <= priority) return nullptr;
+    return victim;
+}
+
+QueuedCommand* CommandQueue::findPending(uint32_t commandHash) {
+    for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        if (slots[i].used && slots[i].commandHash == commandHash) return &slots[i];
+    }
+    return nullptr;
+}
+
+QueuedCommand* CommandQueue::next() {
+    QueuedCommand* best = nullptr;
+    for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        if (!slots[i].used) continue;
+        if (best == nullptr || slots[i].priority < best->priority ||
+            (slots[i].priority == best->priority && slots[i].order < best->order)) {
+            best = &slots[i];
+        }
+    }
+    return best;
+}
+
+void CommandQueue::release(QueuedCommand* command) {
+    if (command == nullptr || !command->used) return;
+    command->used = false;
+    count--;
+}
@@ -0,0 +1,75 @@
+#ifndef COMMANDQUEUE_H
+#define COMMANDQUEUE_H
+
+#include <Arduino.h>
+
+// Slots for inbound commands waiting for update()
+#ifndef COMMAND_QUEUE_SIZE
+#define COMMAND_QUEUE_SIZE        8
+#endif
+// Longest command payload accepted, room for a WEEKLY command at its limits
+#ifndef COMMAND_MAX_LENGTH
+#define COMMAND_MAX_LENGTH        767
+#endif
+
+// Longest request id (as JSON text) and reply_to topic kept with a queued command
+#ifndef COMMAND_ID_LENGTH
+#define COMMAND_ID_LENGTH         40
+#endif
+#ifndef COMMAND_REPLY_TO_LENGTH
+#define COMMAND_REPLY_TO_LENGTH   96
+#endif
+
+// Priorities, lower runs first
+#define COMMAND_PRIORITY_CONTROL  0   // Relay switching and immediate reads
+#define COMMAND_PRIORITY_CONFIG   1   // Schedule, mode and membership changes
+#define COMMAND_PRIORITY_BULK     2   // Long-running work such as history queries
+
+// What answering a command takes, read once when it arrives
+struct CommandHeader {
+    uint32_t seq;                                    // 0 when the request has none
+    char     id[COMMAND_ID_LENGTH + 1];              // JSON text of "id", empty for fire-and-forget
+    char     replyTo[COMMAND_REPLY_TO_LENGTH + 1];   // Empty for the device response topic
+};
+
+struct QueuedCommand {
+    bool     used;
+    uint8_t  priority;
+    uint32_t order;           // Enqueue order, FIFO within a priority
+    uint32_t commandHash;     // hashString() of the command name
+    CommandHeader header;
+    uint16_t length;
+    char     payload[COMMAND_MAX_LENGTH + 1];
+};
+
+// Bounded priority queue with fixed slots, no heap use
+class CommandQueue {
+public:
+    CommandQueue();
+
+    // Free slot for a new command, nullptr when full
+    QueuedCommand* acquire(uint8_t priority);
+    // When full, the newest command of a lower priority. The caller answers it and
+    // release()s it to make room; nullptr if everything queued outranks priority.
+    QueuedCommand* victimFor(uint8_t priority);
+    // Pending command with this name, for coalescing superseded updates
+    QueuedCommand* findPending(uint32_t commandHash);
+    // Highest priority, oldest first. The slot stays taken until release().
+    QueuedCommand* next();
+    void release(QueuedCommand* command);
+
+    uint8_t size() const { return count; }
+    uint32_t dropped() const { return droppedCount; }
+    uint32_t merged() const { return mergedCount; }
+    void countDrop() { droppedCount++; }
+    void countMerge() { mergedCount++; }
+
+private:
+    QueuedCommand slots[COMMAND_QUEUE_SIZE];
+    uint8_t count;
+    uint32_t nextOrder;
+    uint32_t droppedCount;
+    uint32_t mergedCount;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "ControlStore.h"
+#include <Preferences.h>
+
+// Constructor
+ControlStore::ControlStore()
+    : savedRevision(0),
+      seenRevision(0),
+      dirty(false),
+      firstChangeAt(0),
+      lastChangeAt(0),
+      writeCount(0)
+{
+    memset(&saved, 0, sizeof(saved));
+    memset(&seen, 0, sizeof(seen));
+}
+
+bool ControlStore::begin(PersistedState& state, ScheduleEngine& schedule) {
+    Preferences prefs;
+    prefs.begin(CONTROL_NAMESPACE, true);
+    PersistedState stored;
+    bool restored = prefs.getBytes("state", &stored, sizeof(stored)) == sizeof(stored) &&
+                    stored.layout == CONTROL_LAYOUT;
+    if (restored) state = stored;
+
+    ScheduleData data;
+    if (restored && prefs.getBytes("schedule", &data, sizeof(data)) == sizeof(data)) {
+        schedule.restore(data);
+    }
+    prefs.end();
+
+    state.layout = CONTROL_LAYOUT;
+    memcpy(&saved, &state, sizeof(saved));
+    memcpy(&seen, &state, sizeof(seen));
+    savedRevision = seenRevision = schedule.revision();
+
+    if (restored) {
+        Serial.printf("ControlStore - Restored auto %d, output %d, %u windows\n",
+                      state.isAuto, state.deviceState, (unsigned)schedule.windows());
+    }
+    return restored;
+}
+
+void ControlStore::update(const PersistedState& state, const ScheduleEngine& schedule) {
+    unsigned long now = millis();
+    if (memcmp(&state, &seen, sizeof(seen)) != 0 || schedule.revision() != seenRevision) {
+        memcpy(&seen, &state, sizeof(seen));
+        seenRevision = schedule.revision();
+        if (!dirty) firstChangeAt = now;
+        lastChangeAt = now;
+        // Changed back to what is stored: nothing to write
+        dirty = memcmp(&seen, &saved, sizeof(saved)) != 0 || seenRevision != savedRevision;
+    }
+
+    if (!dirty) return;
+    if (now - lastChangeAt < CONTROL_QUIET_MS && now - firstChangeAt < CONTROL_MAX_DELAY_MS) return;
+    write(seen, schedule);
+}
+
+void ControlStore::flush(const PersistedState& state, const ScheduleEngine& schedule) {
+    if (memcmp(&state, &saved, sizeof(saved)) == 0 && schedule.revision() == savedRevision) return;
+    write(state, schedule);
+}
+
+void ControlStore::write(const PersistedState& state, const ScheduleEngine& schedule) {
+    Preferences prefs;
+    prefs.begin(CONTROL_NAMESPACE, false);
+    if (memcmp(&state, &saved, sizeof(saved)) != 0) {
+        prefs.putBytes("state", &state, sizeof(state));
+        memcpy(&saved, &state, sizeof(saved));
+        writeCount++;
+    }
+    if (schedule.revision() != savedRevision) {
+        prefs.putBytes("schedule", &schedule.data(), sizeof(ScheduleData));
+        savedRevision = schedule.revision();
+        writeCount++;
+    }
+    prefs.end();
+
+    memcpy(&seen, &state, sizeof(seen));
+    seenRevision = savedRevision;
+    dirty = false;
+}
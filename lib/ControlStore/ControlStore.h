@@ -0,0 +1,65 @@
+#ifndef CONTROLSTORE_H
+#define CONTROLSTORE_H
+
+#include <Arduino.h>
+#include "types.h"
+#include "ScheduleEngine.h"
+
+#define CONTROL_NAMESPACE         "control"
+// Bump when PersistedState or ScheduleData change shape, older blobs are then ignored
+#define CONTROL_LAYOUT            1
+// Write once changes have stopped for this long...
+#ifndef CONTROL_QUIET_MS
+#define CONTROL_QUIET_MS          5000
+#endif
+// ...but never hold a change back for longer than this
+#ifndef CONTROL_MAX_DELAY_MS
+#define CONTROL_MAX_DELAY_MS      60000
+#endif
+
+// Settings and control state that survive a reset. No padding, so two
+// snapshots compare byte for byte.
+struct PersistedState {
+    SettingsData settings;
+    uint32_t twinVersion;         // Desired-state version the settings came from
+    uint32_t statusMinMs;         // TELEMETRY bounds, 0 for the defaults
+    uint32_t statusMaxMs;
+    uint8_t  layout;
+    bool     isAuto;
+    bool     deviceState;
+    uint8_t  reserved;
+};
+
+// Keeps the control state and the schedule engine configuration in NVS.
+// update() sees every loop's snapshot but writes only after the changes
+// have settled, so a burst of LCD presses or commands costs one write, and
+// nothing at all if it ends where it started. Each blob is rewritten only
+// when it actually differs from what is stored.
+class ControlStore {
+public:
+    ControlStore();
+
+    // Restores what was saved; false on a fresh device or after a layout change
+    bool begin(PersistedState& state, ScheduleEngine& schedule);
+    // Call every loop with the current state
+    void update(const PersistedState& state, const ScheduleEngine& schedule);
+    // Writes a pending change right away, e.g. before a restart
+    void flush(const PersistedState& state, const ScheduleEngine& schedule);
+
+    bool pending() const { return dirty; }
+    uint32_t writes() const { return writeCount; }
+
+private:
+    void write(const PersistedState& state, const ScheduleEngine& schedule);
+
+    PersistedState saved;         // As stored in NVS
+    PersistedState seen;          // As of the last change seen
+    uint32_t savedRevision;
+    uint32_t seenRevision;
+    bool dirty;                   // seen differs from saved
+    unsigned long firstChangeAt;
+    unsigned long lastChangeAt;
+    uint32_t writeCount;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "DeviceTwin.h"
+#include "hash.h"
+
+// Constructor
+DeviceTwin::DeviceTwin(MqttTransport& client)
+    : mqttClient(client),
+      desiredTopicHash(0),
+      appliedVersion(0),
+      reportedVersion(0),
+      lastReported(),
+      hasReported(false),
+      lastReportAt(0)
+{
+}
+
+void DeviceTwin::setTopics(const String& mac) {
+    desiredTopic = MQTT_TWIN_TOPIC_PREFIX + mac + "/twin/desired";
+    reportedTopic = MQTT_TWIN_TOPIC_PREFIX + mac + "/twin/reported";
+    desiredTopicHash = hashBytes(desiredTopic.c_str(), desiredTopic.length());
+}
+
+void DeviceTwin::onConnected(const TwinState& current, bool subscribe) {
+    // The broker replays the retained desired state right after subscribing.
+    // On a resumed session changes made meanwhile arrive as queued messages instead.
+    if (subscribe) {
+        mqttClient.subscribe(desiredTopic.c_str(), 1);
+        Serial.print("DeviceTwin - Subscribed to: ");
+        Serial.println(desiredTopic);
+    }
+
+    report(current, true);
+}
+
+bool DeviceTwin::isDesiredTopic(const char* topic, uint32_t topicHash) const {
+    return topicHash == desiredTopicHash && desiredTopic == topic;
+}
+
+uint8_t DeviceTwin::diffDesired(char* payload, unsigned int length, const TwinState& current, TwinState& desired) {
+    StaticJsonDocument<384> jsonDoc;
+    if (deserializeJson(jsonDoc, payload, length)) {
+        Serial.println("DeviceTwin - Failed to parse desired state.");
+        return 0;
+    }
+
+    uint32_t version = jsonDoc["version"] | 0UL;
+    if (version <= appliedVersion) return 0;  // Already in sync, nothing to do
+
+    desired = current;
+    uint8_t fields = 0;
+    JsonObject state = jsonDoc["state"];
+
+    JsonObject schedule = state["schedule"];
+    if (!schedule.isNull()) {
+        desired.settings.hour_on    = schedule["hour_on"]    | current.settings.hour_on;
+        desired.settings.minute_on  = schedule["minute_on"]  | current.settings.minute_on;
+        desired.settings.hour_off   = schedule["hour_off"]   | current.settings.hour_off;
+        desired.settings.minute_off = schedule["minute_off"] | current.settings.minute_off;
+        desired.settings.astro      = (schedule["astro"]     | current.settings.astro) != 0 ? 1 : 0;
+        desired.settings.on_offset  = schedule["on_offset"]  | current.settings.on_offset;
+        desired.settings.off_offset = schedule["off_offset"] | current.settings.off_offset;
+        // Rejected as a whole, the version stays behind so the backend sees it was not applied
+        if (!validSettings(desired.settings)) {
+            Serial.println("DeviceTwin - Desired schedule out of range, ignored.");
+            return 0;
+        }
+        fields |= TWIN_FIELD_SCHEDULE;
+    }
+    if (state.containsKey("auto")) {
+        desired.isAuto = state["auto"].as<int>() != 0;
+        fields |= TWIN_FIELD_AUTO;
+    }
+    if (state.containsKey("toggle")) {
+        desired.deviceState = state["toggle"].as<int>() != 0;
+        fields |= TWIN_FIELD_TOGGLE;
+    }
+
+    appliedVersion = version;
+    // Only what actually drifted is applied
+    return fields & changedFields(desired, current);
+}
+
+void DeviceTwin::report(const TwinState& current, bool force) {
+    uint8_t fields = hasReported ? changedFields(current, lastReported) : TWIN_FIELD_ALL;
+    if (!force) {
+        if (fields == 0 && reportedVersion == appliedVersion) return;
+        if (millis() - lastReportAt < TWIN_REPORT_INTERVAL_MS) return;
+    }
+    if (!mqttClient.connected()) return;
+
+    StaticJsonDocument<384> jsonDoc;
+    jsonDoc["version"] = appliedVersion;
+    writeFields(jsonDoc.createNestedObject("state"), current, fields);
+
+    String payload;
+    serializeJson(jsonDoc, payload);
+    if (!mqttClient.publish(reportedTopic.c_str(), payload.c_str(), 1, false, MQTT_LANE_CONTROL)) return;  // Outbox full, retry later
+
+    lastReported = current;
+    reportedVersion = appliedVersion;
+    hasReported = true;
+    lastReportAt = millis();
+}
+
+uint8_t DeviceTwin::changedFields(const TwinState& a, const TwinState& b) const {
+    uint8_t fields = 0;
+    if (a.settings.hour_on   != b.settings.hour_on   || a.settings.minute_on  != b.settings.minute_on ||
+        a.settings.hour_off  != b.settings.hour_off  || a.settings.minute_off != b.settings.minute_off ||
+        a.settings.astro     != b.settings.astro     || a.settings.on_offset  != b.settings.on_offset ||
+        a.settings.off_offset != b.settings.off_offset) {
+        fields |= TWIN_FIELD_SCHEDULE;
+    }
+    if (a.isAuto != b.isAuto) fields |= TWIN_FIELD_AUTO;
+    if (a.deviceState != b.deviceState) fields |= TWIN_FIELD_TOGGLE;
+    return fields;
+}
+
+void DeviceTwin::writeFields(JsonObject state, const TwinState& source, uint8_t fields) const {
+    if (fields & TWIN_FIELD_SCHEDULE) {
+        JsonObject schedule = state.createNestedObject("schedule");
+        schedule["hour_on"]    = source.settings.hour_on;
+        schedule["minute_on"]  = source.settings.minute_on;
+        schedule["hour_off"]   = source.settings.hour_off;
+        schedule["minute_off"] = source.settings.minute_off;
+        schedule["astro"]      = source.settings.astro;
+        schedule["on_offset"]  = source.settings.on_offset;
+        schedule["off_offset"] = source.settings.off_offset;
+    }
+    if (fields & TWIN_FIELD_AUTO) state["auto"] = source.isAuto ? 1 : 0;
+    if (fields & TWIN_FIELD_TOGGLE) state["toggle"] = source.deviceState ? 1 : 0;
+}
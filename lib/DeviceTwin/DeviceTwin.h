@@ -0,0 +1,66 @@
+#ifndef DEVICETWIN_H
+#define DEVICETWIN_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "MqttTransport.h"
+#include "types.h"
+
+// Twin topics are <prefix><mac>/twin/desired and <prefix><mac>/twin/reported
+#ifndef MQTT_TWIN_TOPIC_PREFIX
+#define MQTT_TWIN_TOPIC_PREFIX    "unit/"
+#endif
+
+// Fields of the twin, one bit each. New settings get the next bit.
+#define TWIN_FIELD_SCHEDULE       0x01
+#define TWIN_FIELD_AUTO           0x02
+#define TWIN_FIELD_TOGGLE         0x04
+#define TWIN_FIELD_ALL            0x07
+
+// Minimum time between two unsolicited reports of local changes
+#define TWIN_REPORT_INTERVAL_MS   1000
+
+// Configuration state mirrored between device and backend
+struct TwinState {
+    SettingsData settings;
+    bool isAuto;
+    bool deviceState;
+};
+
+// Versioned shadow of the configuration state. The backend keeps the desired
+// state as a retained message carrying a version; the device applies it only
+// when the version is newer and only for the fields that differ, and reports
+// back its applied version plus the fields that changed since its last report.
+class DeviceTwin {
+public:
+    DeviceTwin(MqttTransport& client);
+
+    void setTopics(const String& mac);
+    void onConnected(const TwinState& current, bool subscribe);   // Subscribe to desired, report version and drift
+    bool isDesiredTopic(const char* topic, uint32_t topicHash) const;
+
+    // Fills desired from a desired-state document parsed in place, returns the fields to apply
+    uint8_t diffDesired(char* payload, unsigned int length, const TwinState& current, TwinState& desired);
+    // Publishes the fields changed since the last report, at most once per interval unless forced
+    void report(const TwinState& current, bool force);
+
+    uint32_t version() const { return appliedVersion; }
+    void restoreVersion(uint32_t version) { appliedVersion = version; }   // Saved with the settings it produced
+
+private:
+    uint8_t changedFields(const TwinState& a, const TwinState& b) const;
+    void writeFields(JsonObject state, const TwinState& source, uint8_t fields) const;
+
+    MqttTransport& mqttClient;
+    String desiredTopic;
+    String reportedTopic;
+    uint32_t desiredTopicHash;
+
+    uint32_t appliedVersion;      // Version of the last desired state applied
+    uint32_t reportedVersion;
+    TwinState lastReported;
+    bool hasReported;             // False until the first report after boot
+    unsigned long lastReportAt;
+};
+
+#endif
@@ -137,7 +137,7 @@ void ESP32LCD::setTimeOn(SettingsData& settings) {
         } else {
             Cursor_index = 100;
             display_set  = 0;
-            // eepromUpdate();  // Uncomment if EEPROM update is needed
+            // Saved to NVS by the ControlStore once the edits settle
         }
     }
 
@@ -196,7 +196,7 @@ void ESP32LCD::setTimeOff(SettingsData& settings) {
         } else {
             Cursor_index = 100;
             display_set = 0;
-            // eepromUpdate();  // Uncomment if EEPROM update is needed
+            // Saved to NVS by the ControlStore once the edits settle
         }
     }
 
@@ -287,11 +287,7 @@ void ESP32LCD::print(SettingsData& settings) {
     auto_back_home();  // Check if need to return to main screen automatically
     if (!display_set) {  // If not in setup mode
         display_index_function();         // Update cursor position
-        SettingsData newSetting;
-        newSetting.hour_on = settings.hour_on;
-        newSetting.minute_on = settings.minute_on;
-        newSetting.hour_off = settings.hour_off;
-        newSetting.minute_off = settings.minute_off;
+        SettingsData newSetting = settings;
         display_print_index(newSetting);    // Display content based on cursor position
         settings = newSetting;
     } else {  // If in setup mode
@@ -6,7 +6,6 @@
 #include <LiquidCrystal.h>
 #include "button.h"
 #include "types.h"
-#include <PubSubClient.h>
 #include "NTPClient.h"
 
 class ESP32LCD {
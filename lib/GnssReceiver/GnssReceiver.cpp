@@ -0,0 +1,185 @@
+#include "GnssReceiver.h"
+#include <esp_timer.h>
+#include <string.h>
+
+// Constructor
+GnssReceiver::GnssReceiver()
+    : port(UART_NUM_1),
+      events(nullptr),
+      queue(nullptr),
+      task(nullptr),
+      ggaEnabled(true),
+      received(0),
+      skipped(0),
+      lost(0),
+      parseTotal(0),
+      parseRate(0),
+      parseWindow(0)
+{
+}
+
+bool GnssReceiver::begin(uart_port_t port, int rxPin, int txPin, uint32_t baud) {
+    this->port = port;
+
+    uart_config_t config = {};
+    config.baud_rate = baud;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity    = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+    config.source_clk = UART_SCLK_APB;
+
+    if (uart_driver_install(port, GNSS_RX_BUFFER, 0, GNSS_EVENT_QUEUE, &events, 0) != ESP_OK ||
+        uart_param_config(port, &config) != ESP_OK ||
+        uart_set_pin(port, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) {
+        Serial.println("GnssReceiver - UART setup failed");
+        return false;
+    }
+
+    // One pattern event per line ending, the positions are queued by the driver
+    uart_enable_pattern_det_baud_intr(port, '\n', 1, 9, 0, 0);
+    uart_pattern_queue_reset(port, GNSS_PATTERN_QUEUE);
+
+    queue = xQueueCreate(GNSS_SENTENCE_QUEUE, sizeof(GnssSentence));
+    xTaskCreate(eventTask, "gnss", GNSS_TASK_STACK, this, GNSS_TASK_PRIORITY, &task);
+    return true;
+}
+
+void GnssReceiver::configure() {
+    sendMessageRates();
+
+    // Fix rate: PMTK220 for MediaTek, UBX CFG-RATE (one solution per measurement, UTC) for u-blox
+    char rate[16];
+    snprintf(rate, sizeof(rate), "PMTK220,%u", (unsigned)GNSS_RATE_MS);
+    sendPmtk(rate);
+    uint8_t payload[6] = { (uint8_t)(GNSS_RATE_MS & 0xFF), (uint8_t)(GNSS_RATE_MS >> 8), 1, 0, 0, 0 };
+    sendUbx(0x06, 0x08, payload, sizeof(payload));
+}
+
+void GnssReceiver::setPositionOutput(bool enabled) {
+    if (enabled == ggaEnabled) return;
+    ggaEnabled = enabled;
+    sendMessageRates();
+}
+
+void GnssReceiver::sendMessageRates() {
+    uint8_t gga = ggaEnabled ? 1 : 0;
+
+    // MediaTek: RMC on every fix, GGA if wanted, nothing else
+    char output[56];
+    snprintf(output, sizeof(output), "PMTK314,0,1,0,%u,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0", (unsigned)gga);
+    sendPmtk(output);
+
+    // u-blox: CFG-MSG per standard NMEA message on the current port
+    const uint8_t nmeaRates[][2] = {
+        { 0x00, gga },  // GGA
+        { 0x01, 0 },    // GLL
+        { 0x02, 0 },    // GSA
+        { 0x03, 0 },    // GSV
+        { 0x04, 1 },    // RMC
+        { 0x05, 0 },    // VTG
+    };
+    for (size_t i = 0; i < sizeof(nmeaRates) / sizeof(nmeaRates[0]); i++) {
+        uint8_t payload[3] = { 0xF0, nmeaRates[i][0], nmeaRates[i][1] };
+        sendUbx(0x06, 0x01, payload, sizeof(payload));
+    }
+}
+
+bool GnssReceiver::read(GnssSentence& sentence) {
+    return queue != nullptr && xQueueReceive(queue, &sentence, 0) == pdTRUE;
+}
+
+void GnssReceiver::recordParse(uint32_t micros) {
+    parseTotal += micros;
+    if (millis() - parseWindow >= 1000) {
+        parseRate   = parseTotal * 1000 / (millis() - parseWindow);
+        parseTotal  = 0;
+        parseWindow = millis();
+    }
+}
+
+void GnssReceiver::eventTask(void* args) {
+    GnssReceiver* self = static_cast<GnssReceiver*>(args);
+    uart_event_t event;
+    for (;;) {
+        if (xQueueReceive(self->events, &event, portMAX_DELAY) != pdTRUE) continue;
+        switch (event.type) {
+            case UART_PATTERN_DET: {
+                int position = uart_pattern_pop_pos(self->port);
+                if (position < 0) {
+                    // More lines than the position queue holds, resynchronise
+                    uart_flush_input(self->port);
+                    self->lost++;
+                } else {
+                    self->readLine(position + 1);
+                }
+                break;
+            }
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                uart_flush_input(self->port);
+                xQueueReset(self->events);
+                self->lost++;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Moves one line out of the driver buffer and passes it on if it is RMC or GGA
+void GnssReceiver::readLine(size_t length) {
+    if (length >= GNSS_SENTENCE_MAX) {
+        discard(length);
+        lost++;
+        return;
+    }
+
+    GnssSentence sentence;
+    int count = uart_read_bytes(port, (uint8_t*)sentence.text, length, 0);
+    if (count <= 0) return;
+    sentence.text[count] = '\0';
+    sentence.length      = count;
+    sentence.receivedUs  = esp_timer_get_time();
+
+    // "$ttRMC" or "$ttGGA", any two-letter talker
+    bool wanted = count > 6 && sentence.text[0] == '$' &&
+                  (strncmp(sentence.text + 3, "RMC", 3) == 0 || (ggaEnabled && strncmp(sentence.text + 3, "GGA", 3) == 0));
+    if (!wanted) {
+        skipped++;
+        return;
+    }
+    received++;
+    if (xQueueSend(queue, &sentence, 0) != pdTRUE) lost++;
+}
+
+void GnssReceiver::discard(size_t length) {
+    uint8_t scratch[32];
+    while (length > 0) {
+        int count = uart_read_bytes(port, scratch, length < sizeof(scratch) ? length : sizeof(scratch), 0);
+        if (count <= 0) break;
+        length -= count;
+    }
+}
+
+void GnssReceiver::sendPmtk(const char* body) {
+    uint8_t checksum = 0;
+    for (const char* c = body; *c; c++) checksum ^= (uint8_t)*c;
+    char line[64];
+    int length = snprintf(line, sizeof(line), "$%s*%02X\r\n", body, checksum);
+    uart_write_bytes(port, line, length);
+}
+
+void GnssReceiver::sendUbx(uint8_t messageClass, uint8_t messageId, const uint8_t* payload, uint16_t length) {
+    uint8_t header[6] = { 0xB5, 0x62, messageClass, messageId, (uint8_t)(length & 0xFF), (uint8_t)(length >> 8) };
+
+    // 8-bit Fletcher checksum over class, id, length and payload
+    uint8_t a = 0, b = 0;
+    for (int i = 2; i < 6; i++) { a += header[i]; b += a; }
+    for (uint16_t i = 0; i < length; i++) { a += payload[i]; b += a; }
+    uint8_t checksum[2] = { a, b };
+
+    uart_write_bytes(port, (const char*)header, sizeof(header));
+    uart_write_bytes(port, (const char*)payload, length);
+    uart_write_bytes(port, (const char*)checksum, sizeof(checksum));
+}
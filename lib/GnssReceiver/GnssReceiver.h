@@ -0,0 +1,81 @@
+#ifndef GNSSRECEIVER_H
+#define GNSSRECEIVER_H
+
+#include <Arduino.h>
+#include <driver/uart.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+// Longest NMEA sentence kept, 82 characters by the standard plus slack
+#define GNSS_SENTENCE_MAX         100
+// Complete sentences waiting for loop()
+#define GNSS_SENTENCE_QUEUE       4
+#define GNSS_RX_BUFFER            1024
+#define GNSS_EVENT_QUEUE          16
+#define GNSS_PATTERN_QUEUE        16
+#define GNSS_TASK_STACK           3072
+#define GNSS_TASK_PRIORITY        5
+// Fix rate requested from the receiver
+#ifndef GNSS_RATE_MS
+#define GNSS_RATE_MS              1000
+#endif
+
+// One line from the receiver, NUL-terminated, line ending included
+struct GnssSentence {
+    char     text[GNSS_SENTENCE_MAX];
+    uint8_t  length;
+    int64_t  receivedUs;      // esp_timer time the line ending arrived
+};
+
+// Reads the GNSS UART from the driver's event queue instead of polling it:
+// the UART raises a pattern interrupt on every line ending and a task moves
+// the finished line out of the ring buffer. Only RMC and GGA, from any talker,
+// reach loop(); the rest is dropped in the task. configure() asks the
+// receiver (MediaTek PMTK and u-blox UBX, each ignores the other) to send
+// only those two sentences in the first place, GGA only while the position
+// is wanted.
+class GnssReceiver {
+public:
+    GnssReceiver();
+
+    bool begin(uart_port_t port, int rxPin, int txPin, uint32_t baud);
+    void configure();
+    // GGA on or off; RMC alone still carries the time
+    void setPositionOutput(bool enabled);
+    bool positionOutput() const { return ggaEnabled; }
+
+    // Next complete sentence, false when none is waiting
+    bool read(GnssSentence& sentence);
+
+    // Loop-side time spent parsing, reported per second
+    void recordParse(uint32_t micros);
+    uint32_t parseMicrosPerSecond() const { return parseRate; }
+    uint32_t sentences() const { return received; }
+    uint32_t filtered() const { return skipped; }
+    uint32_t dropped() const { return lost; }
+
+private:
+    static void eventTask(void* args);
+    void readLine(size_t length);
+    void discard(size_t length);
+    void sendMessageRates();
+    void sendPmtk(const char* body);
+    void sendUbx(uint8_t messageClass, uint8_t messageId, const uint8_t* payload, uint16_t length);
+
+    uart_port_t port;
+    QueueHandle_t events;
+    QueueHandle_t queue;
+    TaskHandle_t task;
+
+    volatile bool ggaEnabled;
+    volatile uint32_t received;
+    volatile uint32_t skipped;
+    volatile uint32_t lost;         // Queue full, over-long line or UART overflow
+
+    uint32_t parseTotal;
+    uint32_t parseRate;
+    unsigned long parseWindow;
+};
+
+#endif
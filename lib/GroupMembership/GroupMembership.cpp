@@ -0,0 +1,78 @@
+#include "GroupMembership.h"
+#include <Preferences.h>
+#include "hash.h"
+
+static const char* const GROUP_KINDS[GROUP_KIND_COUNT] = {"district", "feeder", "cabinet"};
+
+// Constructor
+GroupMembership::GroupMembership(MqttTransport& client)
+    : mqttClient(client),
+      topicHashes(),
+      broadcastHash(hashString(MQTT_BROADCAST_TOPIC))
+{
+}
+
+void GroupMembership::begin() {
+    Preferences prefs;
+    prefs.begin(GROUP_PREFS_NAMESPACE, true);
+    for (uint8_t kind = 0; kind < GROUP_KIND_COUNT; kind++) {
+        names[kind] = prefs.getString(GROUP_KINDS[kind], "");
+        topics[kind] = topicFor(kind);
+        topicHashes[kind] = hashBytes(topics[kind].c_str(), topics[kind].length());
+    }
+    prefs.end();
+}
+
+void GroupMembership::subscribeAll() {
+    mqttClient.subscribe(MQTT_BROADCAST_TOPIC, 1);
+    for (uint8_t kind = 0; kind < GROUP_KIND_COUNT; kind++) {
+        if (topics[kind].length() == 0) continue;
+        mqttClient.subscribe(topics[kind].c_str(), 1);
+        Serial.print("GroupMembership - Subscribed to: ");
+        Serial.println(topics[kind]);
+    }
+}
+
+// Keys present in the payload replace that membership, an empty name leaves the group
+void GroupMembership::assign(JsonObject payload) {
+    Preferences prefs;
+    prefs.begin(GROUP_PREFS_NAMESPACE, false);
+    for (uint8_t kind = 0; kind < GROUP_KIND_COUNT; kind++) {
+        if (!payload.containsKey(GROUP_KINDS[kind])) continue;
+
+        String name = payload[GROUP_KINDS[kind]] | "";
+        if (name.length() > GROUP_NAME_MAX || name.indexOf('/') >= 0 || name.indexOf('+') >= 0 || name.indexOf('#') >= 0) {
+            Serial.print("GroupMembership - Invalid group name: ");
+            Serial.println(name);
+            continue;
+        }
+        if (name == names[kind]) continue;  // Unchanged, no flash write
+
+        if (topics[kind].length() > 0) mqttClient.unsubscribe(topics[kind].c_str());
+        names[kind] = name;
+        topics[kind] = topicFor(kind);
+        topicHashes[kind] = hashBytes(topics[kind].c_str(), topics[kind].length());
+        if (topics[kind].length() > 0) mqttClient.subscribe(topics[kind].c_str(), 1);
+        prefs.putString(GROUP_KINDS[kind], name);
+
+        Serial.print("GroupMembership - ");
+        Serial.print(GROUP_KINDS[kind]);
+        Serial.print(" set to: ");
+        Serial.println(name);
+    }
+    prefs.end();
+}
+
+// Hashes reject almost every topic, strcmp only confirms a hit
+bool GroupMembership::matches(const char* topic, uint32_t topicHash) const {
+    if (topicHash == broadcastHash && strcmp(topic, MQTT_BROADCAST_TOPIC) == 0) return true;
+    for (uint8_t kind = 0; kind < GROUP_KIND_COUNT; kind++) {
+        if (topicHashes[kind] == topicHash && topics[kind].length() > 0 && topics[kind] == topic) return true;
+    }
+    return false;
+}
+
+String GroupMembership::topicFor(uint8_t kind) const {
+    if (names[kind].length() == 0) return String();
+    return String(MQTT_GROUP_TOPIC_PREFIX) + GROUP_KINDS[kind] + "/" + names[kind] + MQTT_GROUP_TOPIC_SUFFIX;
+}
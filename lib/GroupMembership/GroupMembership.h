@@ -0,0 +1,44 @@
+#ifndef GROUPMEMBERSHIP_H
+#define GROUPMEMBERSHIP_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "MqttTransport.h"
+
+// Group command topics are <prefix><kind>/<name><suffix>, e.g. unit/group/district/d7/command
+#ifndef MQTT_GROUP_TOPIC_PREFIX
+#define MQTT_GROUP_TOPIC_PREFIX   "unit/group/"
+#endif
+#ifndef MQTT_GROUP_TOPIC_SUFFIX
+#define MQTT_GROUP_TOPIC_SUFFIX   "/command"
+#endif
+// Every device listens here
+#ifndef MQTT_BROADCAST_TOPIC
+#define MQTT_BROADCAST_TOPIC      "unit/broadcast/command"
+#endif
+
+#define GROUP_KIND_COUNT          3
+#define GROUP_NAME_MAX            32
+#define GROUP_PREFS_NAMESPACE     "groups"
+
+// District / feeder / cabinet membership, assigned by the GROUPS command and kept in NVS
+class GroupMembership {
+public:
+    GroupMembership(MqttTransport& client);
+
+    void begin();           // Restore membership from NVS
+    void subscribeAll();    // Call after every (re)connect
+    void assign(JsonObject payload);
+    bool matches(const char* topic, uint32_t topicHash) const;
+
+private:
+    String topicFor(uint8_t kind) const;
+
+    MqttTransport& mqttClient;
+    String names[GROUP_KIND_COUNT];
+    String topics[GROUP_KIND_COUNT];  // Empty when not a member of that kind
+    uint32_t topicHashes[GROUP_KIND_COUNT];
+    uint32_t broadcastHash;
+};
+
+#endif
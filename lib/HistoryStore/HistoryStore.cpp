@@ -0,0 +1,237 @@
+#include "HistoryStore.h"
+#include <stddef.h>
+#include <string.h>
+
+#define HISTORY_EMPTY_TIME 0xFFFFFFFFUL
+
+uint8_t historyChecksum(const HistoryRecord& record) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+    uint8_t check = 0x5A;
+    for (size_t i = 0; i < sizeof(HistoryRecord); i++) {
+        if (i != offsetof(HistoryRecord, check)) check ^= bytes[i];
+    }
+    return check;
+}
+
+static bool isValid(const HistoryRecord& record) {
+    return record.time != HISTORY_EMPTY_TIME && record.check == historyChecksum(record);
+}
+
+// HistoryTier
+
+HistoryTier::HistoryTier()
+    : partition(nullptr),
+      records(nullptr),
+      offset(0),
+      capacity(0),
+      head(0),
+      used(0)
+{
+}
+
+void HistoryTier::begin(const esp_partition_t* partition, const HistoryRecord* mapped, uint32_t offset, uint32_t capacity) {
+    this->partition = partition;
+    this->records   = mapped;
+    this->offset    = offset;
+    this->capacity  = capacity;
+
+    // Recover the write head: the newest valid record, valid ones run backwards from it
+    uint32_t newest = 0;
+    bool found = false;
+    used = 0;
+    for (uint32_t i = 0; i < capacity; i++) {
+        if (!isValid(records[i])) continue;
+        used++;
+        if (!found || records[i].time > records[newest].time) {
+            newest = i;
+            found  = true;
+        }
+    }
+    head = found ? (newest + 1) % capacity : 0;
+}
+
+bool HistoryTier::append(const HistoryRecord& record) {
+    if (records == nullptr) return false;
+    if (used > 0 && record.time <= lastTime()) return false;  // Clock stepped back, keep the ring ordered
+
+    // Entering a new sector: erase it, dropping the oldest records it held
+    if (head % HISTORY_RECORDS_PER_SECTOR == 0) {
+        uint32_t sectorOffset = offset + head * sizeof(HistoryRecord);
+        if (esp_partition_erase_range(partition, sectorOffset, SPI_FLASH_SEC_SIZE) != ESP_OK) {
+            Serial.println("HistoryStore - Sector erase failed");
+            return false;
+        }
+        if (used > capacity - HISTORY_RECORDS_PER_SECTOR) used = capacity - HISTORY_RECORDS_PER_SECTOR;
+    }
+
+    HistoryRecord stored = record;
+    stored.check = historyChecksum(stored);
+    if (esp_partition_write(partition, offset + head * sizeof(HistoryRecord), &stored, sizeof(stored)) != ESP_OK) {
+        Serial.println("HistoryStore - Record write failed");
+        return false;
+    }
+
+    head = (head + 1) % capacity;
+    used++;
+    return true;
+}
+
+const HistoryRecord* HistoryTier::at(uint32_t index) const {
+    if (index >= used) return nullptr;
+    return &records[(head + capacity - used + index) % capacity];
+}
+
+uint32_t HistoryTier::lowerBound(uint32_t time) const {
+    uint32_t low = 0;
+    uint32_t high = used;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (at(mid)->time < time) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+uint32_t HistoryTier::lastTime() const {
+    return used > 0 ? at(used - 1)->time : 0;
+}
+
+// HistoryStore
+
+HistoryStore::HistoryStore()
+    : ready(false),
+      mapped(nullptr),
+      mapHandle(0),
+      lastRawTime(0)
+{
+    memset(&minuteRollup, 0, sizeof(minuteRollup));
+    memset(&quarterRollup, 0, sizeof(quarterRollup));
+}
+
+bool HistoryStore::begin() {
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, HISTORY_PARTITION_LABEL);
+    if (partition == nullptr) {
+        Serial.println("HistoryStore - No history partition, history disabled");
+        return false;
+    }
+
+    const uint32_t rawBytes     = HISTORY_RAW_RECORDS * sizeof(HistoryRecord);
+    const uint32_t minuteBytes  = HISTORY_MINUTE_RECORDS * sizeof(HistoryRecord);
+    const uint32_t quarterBytes = HISTORY_QUARTER_RECORDS * sizeof(HistoryRecord);
+    const uint32_t totalBytes   = rawBytes + minuteBytes + quarterBytes;
+    if (partition->size < totalBytes) {
+        Serial.println("HistoryStore - History partition too small");
+        return false;
+    }
+
+    // Map the whole history once; queries read records straight out of flash
+#if ESP_IDF_VERSION_MAJOR >= 5
+    esp_err_t err = esp_partition_mmap(partition, 0, totalBytes, ESP_PARTITION_MMAP_DATA, &mapped, &mapHandle);
+#else
+    esp_err_t err = esp_partition_mmap(partition, 0, totalBytes, SPI_FLASH_MMAP_DATA, &mapped, &mapHandle);
+#endif
+    if (err != ESP_OK) {
+        Serial.println("HistoryStore - Failed to map history partition");
+        return false;
+    }
+
+    const HistoryRecord* base = static_cast<const HistoryRecord*>(mapped);
+    rawTier.begin(partition, base, 0, HISTORY_RAW_RECORDS);
+    minuteTier.begin(partition, base + HISTORY_RAW_RECORDS, rawBytes, HISTORY_MINUTE_RECORDS);
+    quarterTier.begin(partition, base + HISTORY_RAW_RECORDS + HISTORY_MINUTE_RECORDS, rawBytes + minuteBytes, HISTORY_QUARTER_RECORDS);
+    lastRawTime = rawTier.lastTime();
+
+    Serial.printf("HistoryStore - Restored %u raw, %u 1m, %u 15m records\n",
+                  (unsigned)rawTier.count(), (unsigned)minuteTier.count(), (unsigned)quarterTier.count());
+    ready = true;
+    return true;
+}
+
+void HistoryStore::record(uint32_t now, const PowerMeterData& data, bool toggle, bool autoMode) {
+    if (!ready || now < HISTORY_MIN_VALID_TIME) return;
+    if (now - lastRawTime < HISTORY_RAW_INTERVAL && now >= lastRawTime) return;
+    lastRawTime = now;
+
+    HistoryRecord sample;
+    sample.time        = now;
+    sample.samples     = 1;
+    sample.flags       = (toggle ? HISTORY_FLAG_TOGGLE : 0) | (autoMode ? HISTORY_FLAG_AUTO : 0);
+    sample.check       = 0;
+    sample.voltage     = data.voltage;
+    sample.current     = data.current;
+    sample.power       = data.power;
+    sample.powerFactor = data.power_factor;
+    sample.frequency   = data.frequency;
+    sample.totalEnergy = data.total_energy;
+    rawTier.append(sample);
+
+    accumulate(minuteRollup, sample, now / 60, 60, minuteTier);
+    accumulate(quarterRollup, sample, now / 900, 900, quarterTier);
+}
+
+void HistoryStore::accumulate(Rollup& rollup, const HistoryRecord& sample, uint32_t bucket, uint32_t width, HistoryTier& tier) {
+    if (rollup.samples > 0 && rollup.bucket != bucket) flush(rollup, width, tier);
+
+    rollup.bucket       = bucket;
+    rollup.samples++;
+    rollup.flags        = sample.flags;
+    rollup.voltage     += sample.voltage;
+    rollup.current     += sample.current;
+    rollup.power       += sample.power;
+    rollup.powerFactor += sample.powerFactor;
+    rollup.frequency   += sample.frequency;
+    rollup.totalEnergy  = sample.totalEnergy;
+}
+
+void HistoryStore::flush(Rollup& rollup, uint32_t width, HistoryTier& tier) {
+    HistoryRecord record;
+    record.time        = rollup.bucket * width;
+    record.samples     = rollup.samples;
+    record.flags       = rollup.flags;
+    record.check       = 0;
+    record.voltage     = rollup.voltage / rollup.samples;
+    record.current     = rollup.current / rollup.samples;
+    record.power       = rollup.power / rollup.samples;
+    record.powerFactor = rollup.powerFactor / rollup.samples;
+    record.frequency   = rollup.frequency / rollup.samples;
+    record.totalEnergy = rollup.totalEnergy;
+    tier.append(record);
+
+    memset(&rollup, 0, sizeof(rollup));
+}
+
+HistoryTier& HistoryStore::tier(Resolution resolution) {
+    switch (resolution) {
+        case MINUTE:  return minuteTier;
+        case QUARTER: return quarterTier;
+        default:      return rawTier;
+    }
+}
+
+uint32_t HistoryStore::find(Resolution resolution, uint32_t from, uint32_t to, uint32_t& first) {
+    HistoryTier& t = tier(resolution);
+    first = t.lowerBound(from);
+    if (to == HISTORY_EMPTY_TIME) return t.count() - first;
+    uint32_t end = t.lowerBound(to + 1);
+    return end > first ? end - first : 0;
+}
+
+const HistoryRecord* HistoryStore::at(Resolution resolution, uint32_t index) {
+    return tier(resolution).at(index);
+}
+
+bool HistoryStore::parseResolution(const char* name, Resolution& resolution) {
+    if (name == nullptr || strcmp(name, "raw") == 0) resolution = RAW;
+    else if (strcmp(name, "1m") == 0)                resolution = MINUTE;
+    else if (strcmp(name, "15m") == 0)               resolution = QUARTER;
+    else return false;
+    return true;
+}
+
+const char* HistoryStore::resolutionName(Resolution resolution) {
+    switch (resolution) {
+        case MINUTE:  return "1m";
+        case QUARTER: return "15m";
+        default:      return "raw";
+    }
+}
@@ -0,0 +1,123 @@
+#ifndef HISTORYSTORE_H
+#define HISTORYSTORE_H
+
+#include <Arduino.h>
+#include <esp_partition.h>
+#include "types.h"
+
+// Label of the data partition holding the history (see partitions.csv)
+#define HISTORY_PARTITION_LABEL      "history"
+
+// Seconds between two raw samples
+#ifndef HISTORY_RAW_INTERVAL
+#define HISTORY_RAW_INTERVAL         10
+#endif
+
+// Ring sizes in records, each a whole number of flash sectors.
+// One extra sector per tier keeps the full retention window readable
+// while the sector in front of the write head is being erased.
+#define HISTORY_RECORDS_PER_SECTOR   (SPI_FLASH_SEC_SIZE / sizeof(HistoryRecord))
+#define HISTORY_RAW_RECORDS          8192    // ~22 h at 10 s
+#define HISTORY_MINUTE_RECORDS       1664    // 1 day of 1-minute rollups + 1 sector
+#define HISTORY_QUARTER_RECORDS      3328    // 31 days of 15-minute rollups + 1 sector
+
+// Samples stamped before this are treated as "clock not set yet" and dropped
+#define HISTORY_MIN_VALID_TIME       1577836800UL   // 2020-01-01
+
+// Fixed-size record, stored as-is in flash and read back through the mmap
+struct HistoryRecord {
+    uint32_t time;          // Sample time, or bucket start for rollups
+    uint16_t samples;       // Raw samples aggregated into this record
+    uint8_t  flags;         // HISTORY_FLAG_* state at the end of the bucket
+    uint8_t  check;         // XOR of all other bytes, rejects torn writes
+    float    voltage;       // Averages over the bucket
+    float    current;
+    float    power;
+    float    powerFactor;
+    float    frequency;
+    float    totalEnergy;   // Last reading in the bucket
+};
+static_assert(sizeof(HistoryRecord) == 32, "HistoryRecord must stay 32 bytes");
+
+#define HISTORY_FLAG_TOGGLE          0x01
+#define HISTORY_FLAG_AUTO            0x02
+
+// One ring buffer of records inside the history partition
+class HistoryTier {
+public:
+    HistoryTier();
+
+    void begin(const esp_partition_t* partition, const HistoryRecord* mapped, uint32_t offset, uint32_t capacity);
+    bool append(const HistoryRecord& record);
+
+    uint32_t count() const { return used; }
+    const HistoryRecord* at(uint32_t index) const;   // 0 is the oldest record
+    uint32_t lowerBound(uint32_t time) const;        // First index with record time >= time
+    uint32_t lastTime() const;
+
+private:
+    const esp_partition_t* partition;
+    const HistoryRecord* records;   // Points into the memory-mapped partition
+    uint32_t offset;                // Byte offset of the tier inside the partition
+    uint32_t capacity;
+    uint32_t head;                  // Next slot to write
+    uint32_t used;                  // Valid records ending just before head
+};
+
+class HistoryStore {
+public:
+    enum Resolution {
+        RAW,
+        MINUTE,
+        QUARTER
+    };
+
+    HistoryStore();
+
+    bool begin();
+    bool isReady() const { return ready; }
+
+    // Called every loop, writes raw samples and closes rollup buckets as time passes
+    void record(uint32_t now, const PowerMeterData& data, bool toggle, bool autoMode);
+
+    // Locates [from, to] in a tier. Records are read in place with at().
+    uint32_t find(Resolution resolution, uint32_t from, uint32_t to, uint32_t& first);
+    const HistoryRecord* at(Resolution resolution, uint32_t index);
+
+    static bool parseResolution(const char* name, Resolution& resolution);
+    static const char* resolutionName(Resolution resolution);
+
+private:
+    // Running average of the samples falling into one rollup bucket
+    struct Rollup {
+        uint32_t bucket;
+        uint16_t samples;
+        uint8_t  flags;
+        double   voltage;
+        double   current;
+        double   power;
+        double   powerFactor;
+        double   frequency;
+        float    totalEnergy;
+    };
+
+    void accumulate(Rollup& rollup, const HistoryRecord& sample, uint32_t bucket, uint32_t width, HistoryTier& tier);
+    void flush(Rollup& rollup, uint32_t width, HistoryTier& tier);
+    HistoryTier& tier(Resolution resolution);
+
+    bool ready;
+    const void* mapped;
+    spi_flash_mmap_handle_t mapHandle;
+
+    HistoryTier rawTier;
+    HistoryTier minuteTier;
+    HistoryTier quarterTier;
+
+    uint32_t lastRawTime;
+    Rollup minuteRollup;
+    Rollup quarterRollup;
+};
+
+uint8_t historyChecksum(const HistoryRecord& record);
+
+#endif
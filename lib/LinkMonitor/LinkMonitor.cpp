@@ -0,0 +1,61 @@
+#include "LinkMonitor.h"
+
+// Constructor
+LinkMonitor::LinkMonitor()
+    : currentInterval(0),
+      lowerBound(0),
+      upperBound(0),
+      currentBatch(1),
+      batchLimit(1),
+      successRate(100 << 8),
+      lastRssi(0),
+      lastRttMs(0),
+      lastEvaluation(0)
+{
+}
+
+void LinkMonitor::begin(uint32_t baseInterval, uint32_t minInterval, uint32_t maxInterval, uint8_t maxBatch) {
+    batchLimit = maxBatch > 0 ? maxBatch : 1;
+    currentBatch = batchLimit;
+    currentInterval = baseInterval;
+    setBounds(minInterval, maxInterval);
+}
+
+void LinkMonitor::setBounds(uint32_t minInterval, uint32_t maxInterval) {
+    lowerBound = minInterval;
+    upperBound = maxInterval > minInterval ? maxInterval : minInterval;
+    if (currentInterval < lowerBound) currentInterval = lowerBound;
+    if (currentInterval > upperBound) currentInterval = upperBound;
+}
+
+void LinkMonitor::onDelivery(bool delivered) {
+    // Exponential average over roughly the last 16 publishes
+    successRate = successRate - successRate / 16 + (delivered ? (100 << 8) / 16 : 0);
+}
+
+void LinkMonitor::update(int rssi, uint32_t rttUs) {
+    lastRssi = rssi;
+    lastRttMs = rttUs / 1000;
+    if (millis() - lastEvaluation < LINK_EVAL_MS) return;
+    lastEvaluation = millis();
+
+    uint8_t success = successPercent();
+    bool poor = success < LINK_SUCCESS_POOR || rssi < LINK_RSSI_POOR || lastRttMs > LINK_RTT_POOR_MS;
+    bool good = success >= LINK_SUCCESS_GOOD && rssi >= LINK_RSSI_GOOD && lastRttMs < LINK_RTT_GOOD_MS;
+
+    uint32_t previous = currentInterval;
+    if (poor) {
+        currentInterval = currentInterval * 2;
+        currentBatch = 1;
+    } else if (good) {
+        currentInterval = currentInterval - currentInterval / 8;
+        if (currentBatch < batchLimit) currentBatch++;
+    }
+    if (currentInterval < lowerBound) currentInterval = lowerBound;
+    if (currentInterval > upperBound) currentInterval = upperBound;
+
+    if (currentInterval != previous) {
+        Serial.printf("LinkMonitor - Status interval %u ms (rssi %d, %u%% delivered, rtt %u ms)\n",
+                      (unsigned)currentInterval, rssi, (unsigned)success, (unsigned)lastRttMs);
+    }
+}
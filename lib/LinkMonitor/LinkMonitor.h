@@ -0,0 +1,52 @@
+#ifndef LINKMONITOR_H
+#define LINKMONITOR_H
+
+#include <Arduino.h>
+
+// How often the reporting rate is re-evaluated
+#define LINK_EVAL_MS              10000
+// Thresholds between a good, a fair and a poor link
+#define LINK_RSSI_GOOD            -67
+#define LINK_RSSI_POOR            -80
+#define LINK_SUCCESS_GOOD         99     // % of publishes delivered
+#define LINK_SUCCESS_POOR         90
+#define LINK_RTT_GOOD_MS          500
+#define LINK_RTT_POOR_MS          2000
+
+// Tracks RSSI, publish delivery rate and broker round trip, and derives the
+// status interval and history batch size from them: back off quickly on a
+// poor link, speed up gradually on a good one, always within the bounds.
+class LinkMonitor {
+public:
+    LinkMonitor();
+
+    // Bounds and starting point of the status interval, in ms, and the largest batch
+    void begin(uint32_t baseInterval, uint32_t minInterval, uint32_t maxInterval, uint8_t maxBatch);
+    void setBounds(uint32_t minInterval, uint32_t maxInterval);
+
+    void onDelivery(bool delivered);
+    // Call every loop with the current RSSI and the smoothed publish-to-ack time
+    void update(int rssi, uint32_t rttUs);
+
+    uint32_t interval() const { return currentInterval; }
+    uint8_t batch() const { return currentBatch; }
+    uint32_t minInterval() const { return lowerBound; }
+    uint32_t maxInterval() const { return upperBound; }
+    int rssi() const { return lastRssi; }
+    uint8_t successPercent() const { return (successRate + 128) >> 8; }
+    uint32_t rttMillis() const { return lastRttMs; }
+
+private:
+    uint32_t currentInterval;
+    uint32_t lowerBound;
+    uint32_t upperBound;
+    uint8_t currentBatch;
+    uint8_t batchLimit;
+
+    uint16_t successRate;       // Delivered share in 1/256 %, smoothed
+    int lastRssi;
+    uint32_t lastRttMs;
+    unsigned long lastEvaluation;
+};
+
+#endif
@@ -0,0 +1,786 @@
+#include "MqttTransport.h"
+#include "mqtt_wire.h"
+#include "hash.h"
+#if MQTT_TLS_RESUMPTION
+#include <mbedtls/ssl.h>
+#include <lwip/sockets.h>
+
+// The last TLS session, serialized. RTC memory outlives resets and deep sleep
+// but not a power cycle, so the contents are only trusted with a matching check.
+#define TLS_SESSION_MAGIC 0x544c5331UL   // "TLS1"
+static RTC_NOINIT_ATTR struct {
+    uint32_t magic;
+    uint32_t host;
+    uint16_t port;
+    uint16_t length;
+    uint32_t check;
+    unsigned char data[MQTT_TLS_SESSION_CACHE_SIZE];
+} tlsSessionCache;
+#endif
+
+// Constructor
+MqttTransport::MqttTransport()
+    : host(nullptr),
+      port(1883),
+      bufferSize(512),
+      inflightWindow(MQTT_DEFAULT_INFLIGHT),
+      client(nullptr),
+      task(nullptr),
+      lock(nullptr),
+      inbox(nullptr),
+      deliveries(nullptr),
+      isConnected(false),
+      connectPending(false),
+      lastState(MQTT_TRANSPORT_DISCONNECTED),
+      inflightCount(0),
+      nextToken(1),
+      earlyAckNext(0),
+      aliasCount(0),
+      aliasesEnabled(true),
+      resumedSession(false),
+      connectStartedAt(0),
+      connectDuration(0),
+      publishedCount(0),
+      publishedBytes(0),
+      publishedMicros(0),
+      useTls(false),
+      caCert(nullptr),
+      clientCert(nullptr),
+      clientKey(nullptr),
+#if defined(CONFIG_ESP_TLS_PSK_VERIFICATION)
+      psk(nullptr),
+#endif
+      tlsHandshakeDuration(0),
+      tlsOffered(false),
+#if MQTT_TLS_RESUMPTION
+      tlsTransport(nullptr),
+      tls(nullptr),
+      tlsSession(nullptr),
+      tlsSessionHost(0),
+      tlsSessionPort(0),
+#endif
+      partial{nullptr, nullptr, 0}
+{
+    for (int i = 0; i < MQTT_LANES; i++) {
+        lanes[i].head = 0;
+        lanes[i].count = 0;
+        memset(&lanes[i].stats, 0, sizeof(lanes[i].stats));
+    }
+    memset(inflight, 0, sizeof(inflight));
+    memset(earlyAcks, 0, sizeof(earlyAcks));
+}
+
+void MqttTransport::setServer(const char* host, uint16_t port) {
+    this->host = host;
+    this->port = port;
+    if (client != nullptr) {
+        String uri = String(useTls ? "mqtts://" : "mqtt://") + host + ":" + port;
+        esp_mqtt_client_set_uri(client, uri.c_str());
+    }
+}
+
+void MqttTransport::setCallback(MqttMessageCallback callback) {
+    messageCallback = callback;
+}
+
+void MqttTransport::setDeliveryCallback(MqttDeliveryCallback callback) {
+    deliveryCallback = callback;
+}
+
+void MqttTransport::setConnectCallback(MqttConnectCallback callback) {
+    connectCallback = callback;
+}
+
+void MqttTransport::setBufferSize(uint16_t size) {
+    bufferSize = size;
+}
+
+bool MqttTransport::setTopicAlias(const char* topic) {
+#if MQTT_TRANSPORT_V5
+    for (uint8_t i = 0; i < aliasCount; i++) {
+        if (aliases[i].topic == topic) return true;
+    }
+    if (aliasCount >= MQTT_TOPIC_ALIASES) return false;
+    aliases[aliasCount].topic = topic;
+    aliases[aliasCount].announced = false;
+    aliasCount++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void MqttTransport::setTls(const char* caCert, const char* clientCert, const char* clientKey) {
+    useTls = true;
+    this->caCert = caCert;
+    this->clientCert = clientCert;
+    this->clientKey = clientKey;
+#if !defined(CONFIG_MBEDTLS_HARDWARE_AES) || !defined(CONFIG_MBEDTLS_HARDWARE_SHA)
+    // The handshake and record encryption rely on the accelerators the Arduino core enables in mbedTLS
+    Serial.println("MqttTransport - mbedTLS hardware AES/SHA is disabled, TLS will be slow");
+#endif
+}
+
+#if defined(CONFIG_ESP_TLS_PSK_VERIFICATION)
+void MqttTransport::setTlsPsk(const psk_hint_key_t* psk) {
+    useTls = true;
+    this->psk = psk;
+}
+#endif
+
+void MqttTransport::setInflightWindow(uint8_t window) {
+    if (window < 1) window = 1;
+    if (window > MQTT_MAX_INFLIGHT) window = MQTT_MAX_INFLIGHT;
+    inflightWindow = window;
+}
+
+// The strings only need to live for the call, esp-mqtt copies them
+void MqttTransport::buildConfig(esp_mqtt_client_config_t& config, const char* clientId, const char* user,
+                                const char* pass, const char* willTopic, uint8_t willQos, bool willRetain,
+                                const char* willMessage) {
+#if ESP_IDF_VERSION_MAJOR >= 5
+    config.broker.address.hostname = host;
+    config.broker.address.port = port;
+    config.broker.address.transport = useTls ? MQTT_TRANSPORT_OVER_SSL : MQTT_TRANSPORT_OVER_TCP;
+    if (useTls) {
+        config.broker.verification.certificate = caCert;
+        config.credentials.authentication.certificate = clientCert;
+        config.credentials.authentication.key = clientKey;
+#if defined(CONFIG_ESP_TLS_PSK_VERIFICATION)
+        config.broker.verification.psk_hint_key = psk;
+#endif
+        config.task.stack_size = MQTT_TLS_TASK_STACK;
+#if MQTT_TLS_RESUMPTION
+        // Certificates go through the resuming transport, PSK stays with esp-mqtt's own
+        if (caCert != nullptr) config.network.transport = resumingTransport();
+#endif
+    }
+    config.credentials.client_id = clientId;
+    config.credentials.username = user;
+    config.credentials.authentication.password = pass;
+    config.session.last_will.topic = willTopic;
+    config.session.last_will.msg = willMessage;
+    config.session.last_will.qos = willQos;
+    config.session.last_will.retain = willRetain;
+    config.network.disable_auto_reconnect = true;
+    config.buffer.size = bufferSize;
+#if MQTT_TRANSPORT_V5
+    // Keep the session on the broker so a short drop needs no re-subscribing
+    config.session.protocol_ver = MQTT_PROTOCOL_V_5;
+    config.session.disable_clean_session = true;
+#endif
+#else
+    config.host = host;
+    config.port = port;
+    config.transport = useTls ? MQTT_TRANSPORT_OVER_SSL : MQTT_TRANSPORT_OVER_TCP;
+    if (useTls) {
+        config.cert_pem = caCert;
+        config.client_cert_pem = clientCert;
+        config.client_key_pem = clientKey;
+#if defined(CONFIG_ESP_TLS_PSK_VERIFICATION)
+        config.psk_hint_key = psk;
+#endif
+        config.task_stack = MQTT_TLS_TASK_STACK;
+    }
+    config.client_id = clientId;
+    config.username = user;
+    config.password = pass;
+    config.lwt_topic = willTopic;
+    config.lwt_msg = willMessage;
+    config.lwt_qos = willQos;
+    config.lwt_retain = willRetain;
+    config.disable_auto_reconnect = true;
+    config.buffer_size = bufferSize;
+#endif
+}
+
+bool MqttTransport::connect(const char* clientId, const char* user, const char* pass,
+                            const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+    esp_mqtt_client_config_t config = {};
+    buildConfig(config, clientId, user, pass, willTopic, willQos, willRetain, willMessage);
+
+    connectStartedAt = millis();
+    if (client != nullptr) {
+        // Already set up: end whatever is left of the last connection, then start
+        // over with this call's client id and will
+        esp_mqtt_client_stop(client);
+        isConnected = false;
+        releaseInflight();
+        if (esp_mqtt_set_config(client, &config) != ESP_OK) {
+            lastState = MQTT_TRANSPORT_CONNECT_FAILED;
+            return false;
+        }
+        lastState = MQTT_TRANSPORT_CONNECTING;
+        return esp_mqtt_client_start(client) == ESP_OK;
+    }
+
+    client = esp_mqtt_client_init(&config);
+    if (client == nullptr) {
+        Serial.println("MqttTransport - Failed to create MQTT client");
+        lastState = MQTT_TRANSPORT_CONNECT_FAILED;
+        return false;
+    }
+
+    // Only once the client exists, so a failed init leaves nothing behind for the next try
+    lock = xSemaphoreCreateMutex();
+    inbox = xQueueCreate(MQTT_INBOX_SIZE, sizeof(InboundMessage));
+    deliveries = xQueueCreate(MQTT_DELIVERY_QUEUE_SIZE, sizeof(Delivery));
+    if (lock == nullptr || inbox == nullptr || deliveries == nullptr ||
+        xTaskCreate(transportTask, "mqtt_transport", MQTT_TRANSPORT_STACK, this, MQTT_TRANSPORT_PRIORITY, &task) != pdPASS) {
+        Serial.println("MqttTransport - Failed to create transport task");
+        releaseResources();
+        lastState = MQTT_TRANSPORT_CONNECT_FAILED;
+        return false;
+    }
+    esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, eventHandler, this);
+
+#if MQTT_TRANSPORT_V5
+    esp_mqtt5_connection_property_config_t property = {};
+    property.session_expiry_interval = MQTT_SESSION_EXPIRY_SEC;
+    property.receive_maximum = MQTT_INBOX_SIZE;
+    esp_mqtt5_client_set_connect_property(client, &property);
+#endif
+
+    lastState = MQTT_TRANSPORT_CONNECTING;
+    return esp_mqtt_client_start(client) == ESP_OK;
+}
+
+void MqttTransport::releaseResources() {
+    esp_mqtt_client_destroy(client);
+    client = nullptr;
+    if (lock != nullptr) vSemaphoreDelete(lock);
+    if (inbox != nullptr) vQueueDelete(inbox);
+    if (deliveries != nullptr) vQueueDelete(deliveries);
+    lock = nullptr;
+    inbox = nullptr;
+    deliveries = nullptr;
+    task = nullptr;
+}
+
+uint32_t MqttTransport::publish(const char* topic, const char* payload, bool retain) {
+    return publish(topic, payload, 0, retain);
+}
+
+uint32_t MqttTransport::publish(const char* topic, const char* payload, uint8_t qos, bool retain,
+                                uint8_t lane, uint32_t expirySec) {
+    if (lock == nullptr || lane >= MQTT_LANES) return 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    Lane& l = lanes[lane];
+    if (l.count >= MQTT_OUTBOX_SIZE) {
+        xSemaphoreGive(lock);
+        return 0;
+    }
+    OutboxEntry& entry = l.entries[(l.head + l.count) % MQTT_OUTBOX_SIZE];
+    entry.token    = nextToken++;
+    if (nextToken == 0) nextToken = 1;
+    entry.qos      = qos > 1 ? 1 : qos;
+    entry.retain   = retain;
+    entry.queuedAt = micros();
+    entry.expiry   = expirySec;
+    entry.topic    = topic;
+    entry.payload  = payload;
+    l.count++;
+    uint32_t token = entry.token;
+    xSemaphoreGive(lock);
+
+    xTaskNotifyGive(task);
+    return token;
+}
+
+bool MqttTransport::subscribe(const char* topic, uint8_t qos) {
+    if (client == nullptr || !isConnected) return false;
+    // Non-blocking: esp-mqtt queues the SUBSCRIBE for its own task
+    return esp_mqtt_client_subscribe(client, topic, qos) >= 0;
+}
+
+bool MqttTransport::unsubscribe(const char* topic) {
+    if (client == nullptr || !isConnected) return false;
+    return esp_mqtt_client_unsubscribe(client, topic) >= 0;
+}
+
+void MqttTransport::loop() {
+    if (connectPending) {
+        connectPending = false;
+        if (connectCallback) connectCallback();
+    }
+
+    InboundMessage message;
+    while (inbox != nullptr && xQueueReceive(inbox, &message, 0) == pdTRUE) {
+        if (messageCallback) messageCallback(message.topic, message.payload, message.length);
+        free(message.topic);
+    }
+
+    Delivery delivery;
+    while (deliveries != nullptr && xQueueReceive(deliveries, &delivery, 0) == pdTRUE) {
+        if (deliveryCallback) deliveryCallback(delivery.token, delivery.delivered);
+    }
+}
+
+uint8_t MqttTransport::outboxUsed() {
+    return lanes[MQTT_LANE_CONTROL].count + lanes[MQTT_LANE_TELEMETRY].count;
+}
+
+uint8_t MqttTransport::outboxUsed(uint8_t lane) {
+    return lane < MQTT_LANES ? lanes[lane].count : 0;
+}
+
+MqttLaneStats MqttTransport::laneStats(uint8_t lane) {
+    MqttLaneStats stats = {};
+    if (lane >= MQTT_LANES || lock == nullptr) return stats;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    stats = lanes[lane].stats;
+    xSemaphoreGive(lock);
+    return stats;
+}
+
+uint8_t MqttTransport::inflightUsed() {
+    return inflightCount;
+}
+
+// Transport task: moves the outbox into esp-mqtt within the in-flight window
+
+void MqttTransport::transportTask(void* args) {
+    MqttTransport* self = static_cast<MqttTransport*>(args);
+    for (;;) {
+        // Woken by publish() and by acknowledgements, or every 100 ms for timeouts
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+        self->expireConnect();
+        self->expireInflight();
+        self->drainOutbox();
+    }
+}
+
+// Called with the lock held. Control whenever it has something and the window
+// has room; telemetry only while the reserved control slots stay free.
+int MqttTransport::nextLane() {
+    if (lanes[MQTT_LANE_CONTROL].count > 0) {
+        return inflightCount < inflightWindow ? MQTT_LANE_CONTROL : -1;
+    }
+    uint8_t telemetryWindow = inflightWindow > MQTT_CONTROL_RESERVED ? inflightWindow - MQTT_CONTROL_RESERVED : 1;
+    if (lanes[MQTT_LANE_TELEMETRY].count > 0 && inflightCount < telemetryWindow) {
+        return MQTT_LANE_TELEMETRY;
+    }
+    return -1;
+}
+
+void MqttTransport::drainOutbox() {
+    while (isConnected) {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        int laneIndex = nextLane();
+        if (laneIndex < 0) {
+            xSemaphoreGive(lock);
+            return;
+        }
+        Lane& lane = lanes[laneIndex];
+        OutboxEntry entry = lane.entries[lane.head];
+        xSemaphoreGive(lock);
+
+        // Blocks this task, not loop(), while the socket drains
+        int msgId = writePublish(entry);
+        if (msgId < 0) return;  // Not writable right now, retry on the next wake-up
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        lane.entries[lane.head].topic = String();
+        lane.entries[lane.head].payload = String();
+        lane.head = (lane.head + 1) % MQTT_OUTBOX_SIZE;
+        lane.count--;
+        bool tracked = false;
+        if (entry.qos > 0 && msgId > 0 && !takeEarlyAck(msgId)) {
+            for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+                if (inflight[i].msgId == 0) {
+                    inflight[i].msgId    = msgId;
+                    inflight[i].token    = entry.token;
+                    inflight[i].lane     = laneIndex;
+                    inflight[i].sentAt   = millis();
+                    inflight[i].queuedAt = entry.queuedAt;
+                    inflightCount++;
+                    tracked = true;
+                    break;
+                }
+            }
+        }
+        if (!tracked) recordLatency(laneIndex, entry.queuedAt);
+        xSemaphoreGive(lock);
+
+        // QoS0 is done once written
+        if (!tracked) postDelivery(entry.token, true);
+    }
+}
+
+int MqttTransport::writePublish(const OutboxEntry& entry) {
+    const char* topic = entry.topic.c_str();
+    uint16_t aliasUsed = 0;
+
+#if MQTT_TRANSPORT_V5
+    esp_mqtt5_publish_property_config_t property = {};
+    property.message_expiry_interval = entry.expiry;
+
+    // Only QoS0 goes through an alias: esp-mqtt may resend a QoS1 packet as-is
+    // on the next connection, where the alias is no longer known, so a QoS1
+    // publish would have to carry the topic anyway and the alias saves nothing
+    int alias = -1;
+    if (aliasesEnabled && entry.qos == 0) {
+        for (uint8_t i = 0; i < aliasCount; i++) {
+            if (aliases[i].topic == entry.topic) alias = i;
+        }
+    }
+    if (alias >= 0) {
+        property.topic_alias = alias + 1;
+        if (aliases[alias].announced) topic = "";
+    }
+    esp_mqtt5_client_set_publish_property(client, &property);
+#endif
+
+    unsigned long started = micros();
+    int msgId = esp_mqtt_client_publish(client, topic, entry.payload.c_str(),
+                                        entry.payload.length(), entry.qos, entry.retain);
+
+#if MQTT_TRANSPORT_V5
+    if (msgId < 0 && alias >= 0) {
+        // Broker allows fewer aliases than we use, carry on with full topics
+        Serial.println("MqttTransport - Topic alias refused, aliases disabled");
+        aliasesEnabled = false;
+        property.topic_alias = 0;
+        topic = entry.topic.c_str();
+        esp_mqtt5_client_set_publish_property(client, &property);
+        msgId = esp_mqtt_client_publish(client, topic, entry.payload.c_str(),
+                                        entry.payload.length(), entry.qos, entry.retain);
+    } else if (msgId >= 0 && alias >= 0) {
+        aliases[alias].announced = true;
+        aliasUsed = property.topic_alias;
+    }
+#endif
+
+    if (msgId >= 0) {
+        publishedCount++;
+        publishedBytes += mqttPublishSize(strlen(topic), entry.payload.length(), entry.qos,
+                                          MQTT_TRANSPORT_V5, entry.expiry, aliasUsed);
+        publishedMicros += micros() - started;
+    }
+    return msgId;
+}
+
+// esp-mqtt gives up on its own after its network timeout; this bounds the whole
+// attempt, TLS handshake and CONNACK included, in case it does not
+void MqttTransport::expireConnect() {
+    if (lastState != MQTT_TRANSPORT_CONNECTING || millis() - connectStartedAt < MQTT_CONNECT_TIMEOUT_MS) return;
+    Serial.println("MqttTransport - Connect timed out");
+    esp_mqtt_client_stop(client);
+    lastState = MQTT_TRANSPORT_CONNECT_FAILED;
+}
+
+void MqttTransport::expireInflight() {
+    if (lock == nullptr) return;
+    unsigned long now = millis();
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (inflight[i].msgId != 0 && now - inflight[i].sentAt > MQTT_INFLIGHT_TIMEOUT_MS) {
+            postDelivery(inflight[i].token, false);
+            inflight[i].msgId = 0;
+            inflightCount--;
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+// Called on disconnect and before a restart. The PUBACKs for these will not
+// come on this connection, so report them undelivered and free the window now
+// rather than holding the window shut until the in-flight timeout.
+void MqttTransport::releaseInflight() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (inflight[i].msgId != 0) {
+            postDelivery(inflight[i].token, false);
+            inflight[i].msgId = 0;
+        }
+    }
+    inflightCount = 0;
+    memset(earlyAcks, 0, sizeof(earlyAcks));
+    xSemaphoreGive(lock);
+}
+
+void MqttTransport::acknowledge(int msgId) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool matched = false;
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (inflight[i].msgId == msgId) {
+            postDelivery(inflight[i].token, true);
+            recordLatency(inflight[i].lane, inflight[i].queuedAt);
+            inflight[i].msgId = 0;
+            inflightCount--;
+            matched = true;
+            break;
+        }
+    }
+    // PUBACK beat drainOutbox() to recording the message, let it match later
+    if (!matched) {
+        earlyAcks[earlyAckNext] = msgId;
+        earlyAckNext = (earlyAckNext + 1) % MQTT_EARLY_ACKS;
+    }
+    xSemaphoreGive(lock);
+    xTaskNotifyGive(task);  // A window slot opened up
+}
+
+// Called with the lock held
+bool MqttTransport::takeEarlyAck(int msgId) {
+    for (int i = 0; i < MQTT_EARLY_ACKS; i++) {
+        if (earlyAcks[i] == msgId) {
+            earlyAcks[i] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Called with the lock held
+void MqttTransport::recordLatency(uint8_t lane, unsigned long queuedAt) {
+    MqttLaneStats& stats = lanes[lane].stats;
+    uint32_t latency = micros() - queuedAt;
+    stats.lastUs = latency;
+    if (latency > stats.maxUs) stats.maxUs = latency;
+    if (stats.delivered == 0) stats.avgUs = latency;
+    else stats.avgUs = stats.avgUs - stats.avgUs / 8 + latency / 8;
+    stats.delivered++;
+}
+
+void MqttTransport::postDelivery(uint32_t token, bool delivered) {
+    Delivery delivery = {token, delivered};
+    xQueueSend(deliveries, &delivery, 0);
+}
+
+#if MQTT_TLS_RESUMPTION
+// TLS transport with session resumption, run in the esp-mqtt task. esp-tls does
+// the handshake; the session it hands back after a successful one is offered on
+// the next connect, which then costs a round trip and no public-key operations.
+
+esp_transport_handle_t MqttTransport::resumingTransport() {
+    if (tlsTransport != nullptr) return tlsTransport;
+    tlsTransport = esp_transport_init();
+    if (tlsTransport == nullptr) return nullptr;
+    esp_transport_set_func(tlsTransport, tlsConnect, tlsRead, tlsWrite, tlsClose, tlsPollRead, tlsPollWrite, tlsDestroy);
+    esp_transport_set_context_data(tlsTransport, this);
+    return tlsTransport;
+}
+
+int MqttTransport::tlsConnect(esp_transport_handle_t t, const char* host, int port, int timeoutMs) {
+    MqttTransport* self = static_cast<MqttTransport*>(esp_transport_get_context_data(t));
+    tlsClose(t);
+    self->restoreTlsSession(host, port);
+
+    esp_tls_cfg_t cfg = {};
+    cfg.cacert_buf = reinterpret_cast<const unsigned char*>(self->caCert);
+    cfg.cacert_bytes = strlen(self->caCert) + 1;
+    if (self->clientCert != nullptr && self->clientKey != nullptr) {
+        cfg.clientcert_buf = reinterpret_cast<const unsigned char*>(self->clientCert);
+        cfg.clientcert_bytes = strlen(self->clientCert) + 1;
+        cfg.clientkey_buf = reinterpret_cast<const unsigned char*>(self->clientKey);
+        cfg.clientkey_bytes = strlen(self->clientKey) + 1;
+    }
+    cfg.timeout_ms = timeoutMs;
+    cfg.client_session = self->tlsSession;   // A server that no longer knows it falls back to a full handshake
+
+    self->tls = esp_tls_init();
+    if (self->tls == nullptr) return -1;
+    unsigned long started = millis();
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, self->tls) != 1) {
+        tlsClose(t);
+        return -1;
+    }
+    self->tlsHandshakeDuration = millis() - started;
+    self->tlsOffered = cfg.client_session != nullptr;
+    self->keepTlsSession(host, port);
+    return 0;
+}
+
+// Replaces the session to offer with the one just negotiated and copies it to RTC memory.
+// On mbedTLS esp_tls_client_session_t holds an mbedtls_ssl_session and nothing else.
+void MqttTransport::keepTlsSession(const char* host, int port) {
+    esp_tls_client_session_t* session = esp_tls_get_client_session(tls);
+    if (session == nullptr) return;
+    if (tlsSession != nullptr) esp_tls_free_client_session(tlsSession);
+    tlsSession = session;
+    tlsSessionHost = hashString(host);
+    tlsSessionPort = port;
+
+    size_t length = 0;
+    tlsSessionCache.magic = 0;
+    if (mbedtls_ssl_session_save(reinterpret_cast<mbedtls_ssl_session*>(session), tlsSessionCache.data,
+                                 sizeof(tlsSessionCache.data), &length) != 0) {
+        return;   // Peer certificate kept in the session, too large for the cache
+    }
+    tlsSessionCache.host = tlsSessionHost;
+    tlsSessionCache.port = port;
+    tlsSessionCache.length = length;
+    tlsSessionCache.check = hashBytes(reinterpret_cast<const char*>(tlsSessionCache.data), length);
+    tlsSessionCache.magic = TLS_SESSION_MAGIC;
+}
+
+// Drops a session for another broker and, after a reset, loads the one in RTC memory
+void MqttTransport::restoreTlsSession(const char* host, int port) {
+    uint32_t hostHash = hashString(host);
+    if (tlsSession != nullptr && (tlsSessionHost != hostHash || tlsSessionPort != port)) {
+        esp_tls_free_client_session(tlsSession);
+        tlsSession = nullptr;
+    }
+    if (tlsSession != nullptr || tlsSessionCache.magic != TLS_SESSION_MAGIC) return;
+    if (tlsSessionCache.host != hostHash || tlsSessionCache.port != port ||
+        tlsSessionCache.length > sizeof(tlsSessionCache.data) ||
+        tlsSessionCache.check != hashBytes(reinterpret_cast<const char*>(tlsSessionCache.data),
+                                           tlsSessionCache.length)) {
+        return;
+    }
+
+    mbedtls_ssl_session* session = static_cast<mbedtls_ssl_session*>(calloc(1, sizeof(mbedtls_ssl_session)));
+    if (session == nullptr) return;
+    mbedtls_ssl_session_init(session);
+    if (mbedtls_ssl_session_load(session, tlsSessionCache.data, tlsSessionCache.length) != 0) {
+        mbedtls_ssl_session_free(session);
+        free(session);
+        tlsSessionCache.magic = 0;
+        return;
+    }
+    tlsSession = reinterpret_cast<esp_tls_client_session_t*>(session);
+    tlsSessionHost = hostHash;
+    tlsSessionPort = port;
+}
+
+// Same return values as esp-mqtt's own SSL transport: bytes, 0 on timeout, negative on error
+int MqttTransport::tlsRead(esp_transport_handle_t t, char* buffer, int length, int timeoutMs) {
+    MqttTransport* self = static_cast<MqttTransport*>(esp_transport_get_context_data(t));
+    int ready = tlsPollRead(t, timeoutMs);
+    if (ready < 0) return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+    if (ready == 0) return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    int read = esp_tls_conn_read(self->tls, buffer, length);
+    if (read == ESP_TLS_ERR_SSL_WANT_READ || read == ESP_TLS_ERR_SSL_WANT_WRITE) return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    if (read == 0) return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    return read < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : read;
+}
+
+int MqttTransport::tlsWrite(esp_transport_handle_t t, const char* buffer, int length, int timeoutMs) {
+    MqttTransport* self = static_cast<MqttTransport*>(esp_transport_get_context_data(t));
+    int ready = tlsPollWrite(t, timeoutMs);
+    if (ready <= 0) return ready;
+    int written = esp_tls_conn_write(self->tls, buffer, length);
+    if (written == ESP_TLS_ERR_SSL_WANT_READ || written == ESP_TLS_ERR_SSL_WANT_WRITE) return 0;
+    return written;
+}
+
+// 1 when ready, 0 on timeout, -1 on a socket error or no connection
+static int pollSocket(esp_tls_t* tls, int timeoutMs, bool write) {
+    int fd;
+    if (tls == nullptr || esp_tls_get_conn_sockfd(tls, &fd) != ESP_OK) return -1;
+    fd_set ready, errors;
+    FD_ZERO(&ready);
+    FD_ZERO(&errors);
+    FD_SET(fd, &ready);
+    FD_SET(fd, &errors);
+    struct timeval timeout = { timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+    int result = select(fd + 1, write ? nullptr : &ready, write ? &ready : nullptr, &errors,
+                        timeoutMs < 0 ? nullptr : &timeout);
+    if (result > 0 && FD_ISSET(fd, &errors)) return -1;
+    return result < 0 ? -1 : result;
+}
+
+int MqttTransport::tlsPollRead(esp_transport_handle_t t, int timeoutMs) {
+    MqttTransport* self = static_cast<MqttTransport*>(esp_transport_get_context_data(t));
+    // Decrypted bytes mbedTLS already holds never show up on the socket
+    if (self->tls != nullptr && esp_tls_get_bytes_avail(self->tls) > 0) return 1;
+    return pollSocket(self->tls, timeoutMs, false);
+}
+
+int MqttTransport::tlsPollWrite(esp_transport_handle_t t, int timeoutMs) {
+    MqttTransport* self = static_cast<MqttTransport*>(esp_transport_get_context_data(t));
+    return pollSocket(self->tls, timeoutMs, true);
+}
+
+int MqttTransport::tlsClose(esp_transport_handle_t t) {
+    MqttTransport* self = static_cast<MqttTransport*>(esp_transport_get_context_data(t));
+    if (self->tls != nullptr) esp_tls_conn_destroy(self->tls);
+    self->tls = nullptr;
+    return 0;
+}
+
+// esp_mqtt_client_destroy() takes the transport with it; the session stays for the next client
+int MqttTransport::tlsDestroy(esp_transport_handle_t t) {
+    MqttTransport* self = static_cast<MqttTransport*>(esp_transport_get_context_data(t));
+    tlsClose(t);
+    self->tlsTransport = nullptr;
+    return 0;
+}
+#endif
+
+// esp-mqtt events, run in the esp-mqtt task
+
+void MqttTransport::eventHandler(void* args, esp_event_base_t base, int32_t eventId, void* eventData) {
+    static_cast<MqttTransport*>(args)->onEvent(static_cast<esp_mqtt_event_handle_t>(eventData));
+}
+
+void MqttTransport::onEvent(esp_mqtt_event_handle_t event) {
+    switch (event->event_id) {
+        case MQTT_EVENT_CONNECTED:
+            for (uint8_t i = 0; i < aliasCount; i++) aliases[i].announced = false;
+            resumedSession = event->session_present;
+            connectDuration = millis() - connectStartedAt;
+            isConnected = true;
+            lastState = MQTT_TRANSPORT_CONNECTED;
+            connectPending = true;
+            xTaskNotifyGive(task);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            isConnected = false;
+            if (lastState == MQTT_TRANSPORT_CONNECTING) lastState = MQTT_TRANSPORT_CONNECT_FAILED;
+            else lastState = MQTT_TRANSPORT_DISCONNECTED;
+            releaseInflight();
+            break;
+        case MQTT_EVENT_ERROR:
+            if (event->error_handle != nullptr && event->error_handle->connect_return_code != 0) {
+                lastState = event->error_handle->connect_return_code;
+            }
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            acknowledge(event->msg_id);
+            break;
+        case MQTT_EVENT_DATA:
+            onData(event);
+            break;
+        default:
+            break;
+    }
+}
+
+void MqttTransport::onData(esp_mqtt_event_handle_t event) {
+    // The first fragment carries the topic and the total length
+    if (event->current_data_offset == 0) {
+        free(partial.topic);
+        partial.topic = nullptr;
+        // The sender decides the length, so it is bounded before anything is allocated
+        if (event->total_data_len > bufferSize) {
+            Serial.printf("MqttTransport - Message of %d bytes dropped, limit %u\n",
+                          event->total_data_len, (unsigned)bufferSize);
+            return;
+        }
+        partial.topic = static_cast<char*>(malloc(event->topic_len + 1 + event->total_data_len + 1));
+        if (partial.topic == nullptr) return;
+        memcpy(partial.topic, event->topic, event->topic_len);
+        partial.topic[event->topic_len] = '\0';
+        partial.payload = reinterpret_cast<byte*>(partial.topic + event->topic_len + 1);
+        partial.length = event->total_data_len;
+    }
+    if (partial.topic == nullptr) return;
+    if (event->current_data_offset + event->data_len > (int)partial.length) {
+        free(partial.topic);
+        partial.topic = nullptr;
+        return;
+    }
+
+    memcpy(partial.payload + event->current_data_offset, event->data, event->data_len);
+    if (event->current_data_offset + event->data_len < event->total_data_len) return;
+
+    partial.payload[partial.length] = '\0';
+    if (xQueueSend(inbox, &partial, 0) != pdTRUE) {
+        Serial.println("MqttTransport - Inbox full, message dropped");
+        free(partial.topic);
+    }
+    partial.topic = nullptr;
+}
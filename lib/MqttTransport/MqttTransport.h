@@ -0,0 +1,294 @@
+#ifndef MQTTTRANSPORT_H
+#define MQTTTRANSPORT_H
+
+#include <Arduino.h>
+#include <functional>
+#include <mqtt_client.h>
+#include <esp_attr.h>
+#if defined(CONFIG_ESP_TLS_PSK_VERIFICATION) || (ESP_IDF_VERSION_MAJOR >= 5 && defined(CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS))
+#include <esp_tls.h>
+#endif
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// Pending publishes per lane held by the transport before they reach the socket
+#ifndef MQTT_OUTBOX_SIZE
+#define MQTT_OUTBOX_SIZE          16
+#endif
+// Upper bound of the QoS1 in-flight window (unacknowledged publishes)
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT         8
+#endif
+#ifndef MQTT_DEFAULT_INFLIGHT
+#define MQTT_DEFAULT_INFLIGHT     4
+#endif
+// In-flight slots telemetry may never take, so a control publish always has room
+#define MQTT_CONTROL_RESERVED     1
+// A QoS1 publish not acknowledged within this time is reported as failed
+#ifndef MQTT_INFLIGHT_TIMEOUT_MS
+#define MQTT_INFLIGHT_TIMEOUT_MS  30000
+#endif
+// Longest a connection attempt may take, TCP or TLS handshake up to CONNACK
+#ifndef MQTT_CONNECT_TIMEOUT_MS
+#define MQTT_CONNECT_TIMEOUT_MS   30000
+#endif
+// MQTT 5 needs an esp-mqtt built with CONFIG_MQTT_PROTOCOL_5 (IDF 5), 3.1.1 otherwise
+#if ESP_IDF_VERSION_MAJOR >= 5 && defined(CONFIG_MQTT_PROTOCOL_5)
+#define MQTT_TRANSPORT_V5         1
+#else
+#define MQTT_TRANSPORT_V5         0
+#endif
+// MQTT 5: how long the broker keeps subscriptions and queued QoS1 messages after a drop
+#ifndef MQTT_SESSION_EXPIRY_SEC
+#define MQTT_SESSION_EXPIRY_SEC   300
+#endif
+// MQTT 5: outgoing topic aliases, must not exceed the broker's Topic Alias Maximum
+#define MQTT_TOPIC_ALIASES        4
+
+// TLS session resumption: certificate connections go through an esp-tls transport
+// of our own that offers the last session, so a reconnect skips the public-key
+// handshake. Needs custom esp-mqtt transports (IDF 5), esp-tls on mbedTLS and
+// CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS.
+#if ESP_IDF_VERSION_MAJOR >= 5 && defined(CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS) && defined(CONFIG_ESP_TLS_USING_MBEDTLS)
+#define MQTT_TLS_RESUMPTION       1
+#include <esp_transport.h>
+#else
+#define MQTT_TLS_RESUMPTION       0
+#endif
+// Serialized session kept in RTC memory across resets, larger sessions stay in RAM only
+#ifndef MQTT_TLS_SESSION_CACHE_SIZE
+#define MQTT_TLS_SESSION_CACHE_SIZE 1024
+#endif
+
+// esp-mqtt task stack, TLS needs room for the mbedTLS handshake
+#define MQTT_TLS_TASK_STACK       8192
+
+// Received messages waiting for loop()
+#define MQTT_INBOX_SIZE           8
+#define MQTT_EARLY_ACKS           4
+#define MQTT_DELIVERY_QUEUE_SIZE  (MQTT_LANES * MQTT_OUTBOX_SIZE + MQTT_MAX_INFLIGHT)
+#define MQTT_TRANSPORT_STACK      4096
+#define MQTT_TRANSPORT_PRIORITY   4
+
+// Send lanes. Control is always drained first and never waits behind telemetry.
+#define MQTT_LANE_CONTROL         0   // Command responses, presence, twin reports
+#define MQTT_LANE_TELEMETRY       1   // Status and history streams
+#define MQTT_LANES                2
+
+// Connection states, reported by state()
+#define MQTT_TRANSPORT_CONNECTED       0
+#define MQTT_TRANSPORT_DISCONNECTED   -1
+#define MQTT_TRANSPORT_CONNECT_FAILED -2
+#define MQTT_TRANSPORT_CONNECTING     -3
+
+// Same shape as the PubSubClient callback so existing handlers keep working.
+// The payload is writable and NUL-terminated at payload[length], so it can be parsed in place.
+typedef std::function<void(char* topic, byte* payload, unsigned int length)> MqttMessageCallback;
+// Called from loop() once a publish is acknowledged (QoS1), written (QoS0) or given up
+typedef std::function<void(uint32_t token, bool delivered)> MqttDeliveryCallback;
+typedef std::function<void()> MqttConnectCallback;
+
+// Publish-to-delivery latency of one lane: until PUBACK for QoS1, until written for QoS0
+struct MqttLaneStats {
+    uint32_t delivered;
+    uint32_t lastUs;
+    uint32_t avgUs;       // Moving average over roughly the last 8 deliveries
+    uint32_t maxUs;
+};
+
+// Event-driven MQTT client: esp-mqtt owns the socket in its own task, a
+// transport task drains bounded per-lane outboxes into it keeping up to the
+// in-flight window of QoS1 publishes unacknowledged. The control lane goes
+// first and has in-flight slots of its own. Received messages, delivery
+// results and connection changes are handed back to loop() through queues.
+class MqttTransport {
+public:
+    MqttTransport();
+
+    void setServer(const char* host, uint16_t port);   // Also valid after connect(), for the next attempt
+    void setCallback(MqttMessageCallback callback);
+    void setDeliveryCallback(MqttDeliveryCallback callback);
+    void setConnectCallback(MqttConnectCallback callback);
+    void setBufferSize(uint16_t size);   // Also the largest message accepted from the broker
+    void setInflightWindow(uint8_t window);
+    // Connect over TLS, verifying the broker against caCert (PEM). Client
+    // certificate and key are optional, for brokers that require mutual TLS.
+    void setTls(const char* caCert, const char* clientCert = nullptr, const char* clientKey = nullptr);
+#if defined(CONFIG_ESP_TLS_PSK_VERIFICATION)
+    // TLS-PSK instead of certificates: no public-key operations in the handshake
+    void setTlsPsk(const psk_hint_key_t* psk);
+#endif
+
+    // Starts a connection attempt and returns at once; the connect callback fires on success.
+    // state() stays MQTT_TRANSPORT_CONNECTING until CONNACK, a failure or MQTT_CONNECT_TIMEOUT_MS.
+    bool connect(const char* clientId, const char* user, const char* pass,
+                 const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage);
+    bool connected() const { return isConnected; }
+    int state() const { return lastState; }
+    // True when the broker kept the previous session, subscriptions are still in place
+    bool sessionPresent() const { return resumedSession; }
+    // Time from connect() to CONNACK of the last successful connection
+    uint32_t connectMillis() const { return connectDuration; }
+    // TCP connect and TLS handshake of the last connection, 0 without resumption support
+    uint32_t tlsHandshakeMillis() const { return tlsHandshakeDuration; }
+    // True when the last handshake offered a cached session
+    bool tlsSessionOffered() const { return tlsOffered; }
+
+    // MQTT 5: publish this topic through a topic alias, QoS0 publishes only. No-op on 3.1.1.
+    bool setTopicAlias(const char* topic);
+
+    // Queue a publish. Returns a delivery token, 0 if the lane's outbox is full.
+    uint32_t publish(const char* topic, const char* payload, bool retain = false);
+    // expirySec drops the message at the broker if not delivered in time (MQTT 5 only)
+    uint32_t publish(const char* topic, const char* payload, uint8_t qos, bool retain,
+                     uint8_t lane = MQTT_LANE_TELEMETRY, uint32_t expirySec = 0);
+    bool subscribe(const char* topic, uint8_t qos = 0);
+    bool unsubscribe(const char* topic);
+
+    // Dispatches received messages and delivery results, call from loop()
+    void loop();
+
+    uint8_t outboxUsed();
+    uint8_t outboxUsed(uint8_t lane);
+    uint8_t inflightUsed();
+    MqttLaneStats laneStats(uint8_t lane);
+    // PUBLISH packets written and their approximate size on the wire
+    uint32_t publishCount() const { return publishedCount; }
+    uint32_t publishBytes() const { return publishedBytes; }
+    // Transport task time spent handing PUBLISH packets to the socket, TLS encryption included
+    uint32_t publishMicros() const { return publishedMicros; }
+
+private:
+    struct OutboxEntry {
+        uint32_t      token;
+        uint8_t       qos;
+        bool          retain;
+        unsigned long queuedAt;   // micros() at publish()
+        uint32_t      expiry;     // Message expiry interval in seconds, 0 for none
+        String        topic;
+        String        payload;
+    };
+
+    struct Lane {
+        OutboxEntry   entries[MQTT_OUTBOX_SIZE];
+        uint8_t       head;
+        uint8_t       count;
+        MqttLaneStats stats;
+    };
+
+    struct InflightEntry {
+        int           msgId;      // esp-mqtt message id, 0 when free
+        uint32_t      token;
+        uint8_t       lane;
+        unsigned long sentAt;
+        unsigned long queuedAt;
+    };
+
+    struct InboundMessage {
+        char*        topic;       // Points into the same allocation as payload
+        byte*        payload;
+        unsigned int length;
+    };
+
+    struct Delivery {
+        uint32_t token;
+        bool     delivered;
+    };
+
+    static void eventHandler(void* args, esp_event_base_t base, int32_t eventId, void* eventData);
+    static void transportTask(void* args);
+    void onEvent(esp_mqtt_event_handle_t event);
+    void onData(esp_mqtt_event_handle_t event);
+    void buildConfig(esp_mqtt_client_config_t& config, const char* clientId, const char* user, const char* pass,
+                     const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage);
+    void drainOutbox();
+    int writePublish(const OutboxEntry& entry);
+    int nextLane();
+    void recordLatency(uint8_t lane, unsigned long queuedAt);
+    void expireConnect();
+    void expireInflight();
+    void releaseInflight();
+    void releaseResources();
+    void acknowledge(int msgId);
+    bool takeEarlyAck(int msgId);
+    void postDelivery(uint32_t token, bool delivered);
+#if MQTT_TLS_RESUMPTION
+    esp_transport_handle_t resumingTransport();
+    void keepTlsSession(const char* host, int port);
+    void restoreTlsSession(const char* host, int port);
+    static int tlsConnect(esp_transport_handle_t t, const char* host, int port, int timeoutMs);
+    static int tlsRead(esp_transport_handle_t t, char* buffer, int length, int timeoutMs);
+    static int tlsWrite(esp_transport_handle_t t, const char* buffer, int length, int timeoutMs);
+    static int tlsPollRead(esp_transport_handle_t t, int timeoutMs);
+    static int tlsPollWrite(esp_transport_handle_t t, int timeoutMs);
+    static int tlsClose(esp_transport_handle_t t);
+    static int tlsDestroy(esp_transport_handle_t t);
+#endif
+
+    const char* host;
+    uint16_t port;
+    uint16_t bufferSize;
+    uint8_t inflightWindow;
+
+    esp_mqtt_client_handle_t client;
+    TaskHandle_t task;
+    SemaphoreHandle_t lock;
+    QueueHandle_t inbox;
+    QueueHandle_t deliveries;
+
+    volatile bool isConnected;
+    volatile bool connectPending;
+    volatile int lastState;
+
+    Lane lanes[MQTT_LANES];
+    InflightEntry inflight[MQTT_MAX_INFLIGHT];
+    uint8_t inflightCount;
+    uint32_t nextToken;
+    int earlyAcks[MQTT_EARLY_ACKS];   // Acknowledgements that arrived before their publish was recorded
+    uint8_t earlyAckNext;
+
+    // Topic aliases, index + 1 is the alias. announced is reset on every connection
+    // since alias mappings do not outlive it.
+    struct TopicAlias {
+        String topic;
+        bool   announced;
+    };
+    TopicAlias aliases[MQTT_TOPIC_ALIASES];
+    uint8_t aliasCount;
+    bool aliasesEnabled;
+
+    volatile bool resumedSession;
+    unsigned long connectStartedAt;
+    volatile uint32_t connectDuration;
+    uint32_t publishedCount;
+    uint32_t publishedBytes;
+    uint32_t publishedMicros;
+
+    bool useTls;
+    const char* caCert;
+    const char* clientCert;
+    const char* clientKey;
+#if defined(CONFIG_ESP_TLS_PSK_VERIFICATION)
+    const psk_hint_key_t* psk;
+#endif
+    volatile uint32_t tlsHandshakeDuration;
+    volatile bool tlsOffered;
+#if MQTT_TLS_RESUMPTION
+    esp_transport_handle_t tlsTransport;   // Owned by the esp-mqtt client once handed over
+    esp_tls_t* tls;
+    esp_tls_client_session_t* tlsSession;  // Offered on the next handshake, nullptr for a full one
+    uint32_t tlsSessionHost;               // hashString() of the host the session belongs to
+    uint16_t tlsSessionPort;
+#endif
+
+    // Reassembly of a message esp-mqtt delivers in several fragments
+    InboundMessage partial;
+
+    MqttMessageCallback messageCallback;
+    MqttDeliveryCallback deliveryCallback;
+    MqttConnectCallback connectCallback;
+};
+
+#endif
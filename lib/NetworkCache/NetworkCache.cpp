@@ -0,0 +1,222 @@
+#include "NetworkCache.h"
+#include <Preferences.h>
+#include "hash.h"
+
+// Wall clock before this is "not set", a lease is not reused without one
+#define WIFI_LEASE_MIN_VALID_TIME   1577836800UL   // 2020-01-01
+
+// Constructor
+NetworkCache::NetworkCache()
+    : linkValid(false),
+      onReusedLease(false),
+      hostCount(0),
+      refreshAll(false),
+      lastConnectMs(0),
+      lastConnectFast(false)
+{
+    memset(&link, 0, sizeof(link));
+    memset(hosts, 0, sizeof(hosts));
+}
+
+void NetworkCache::begin() {
+    Preferences prefs;
+    prefs.begin(NETWORK_CACHE_NAMESPACE, true);
+    linkValid = prefs.getBytes("link", &link, sizeof(link)) == sizeof(link) && link.channel != 0;
+    prefs.end();
+
+    // The SDK would otherwise rewrite its own copy of the credentials on every begin()
+    WiFi.persistent(false);
+}
+
+bool NetworkCache::connect(const char* ssid, const char* password) {
+    unsigned long started = millis();
+    WiFi.mode(WIFI_STA);
+
+    if (linkValid) {
+#if WIFI_REUSE_LEASE
+        // Within the reuse window only, which needs a wall clock that survived the reset
+        time_t now = time(nullptr);
+        bool reuse = link.leaseUntil != 0 && now >= (time_t)(link.leaseUntil - WIFI_LEASE_REUSE_SEC) &&
+                     now < (time_t)link.leaseUntil;
+        if (reuse) {
+            WiFi.config(IPAddress(link.ip), IPAddress(link.gateway), IPAddress(link.subnet),
+                        IPAddress(link.dns1), IPAddress(link.dns2));
+        } else if (onReusedLease) {
+            WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+        }
+        onReusedLease = reuse;
+#endif
+        WiFi.begin(ssid, password, link.channel, link.bssid, true);
+        if (waitConnected(WIFI_FAST_CONNECT_MS)) {
+            lastConnectMs = millis() - started;
+            lastConnectFast = true;
+#if WIFI_REUSE_LEASE
+            if (!onReusedLease) rememberLink();   // A fresh lease, the reuse window starts over
+#endif
+            return true;
+        }
+
+        // Access point moved or went away: forget it and do the full join
+        Serial.println("NetworkCache - Cached access point failed, scanning");
+        WiFi.disconnect();
+        linkValid = false;
+    }
+
+    WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));  // Back to DHCP
+    onReusedLease = false;
+    WiFi.begin(ssid, password);
+    if (!waitConnected(WIFI_FULL_CONNECT_ATTEMPTS * 500UL)) return false;
+
+    lastConnectMs = millis() - started;
+    lastConnectFast = false;
+    refreshAll = true;   // Possibly another network, its DNS answers may differ
+    rememberLink();
+    return true;
+}
+
+bool NetworkCache::waitConnected(unsigned long timeoutMs) {
+    unsigned long started = millis();
+    while (WiFi.status() != WL_CONNECTED) {
+        if (millis() - started > timeoutMs) return false;
+        delay(10);
+    }
+    return true;
+}
+
+// Only writes when something changed, reconnecting to the same AP costs no flash
+void NetworkCache::rememberLink() {
+    Link current = {};
+    memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+    current.channel = WiFi.channel();
+    current.ip      = (uint32_t)WiFi.localIP();
+    current.gateway = (uint32_t)WiFi.gatewayIP();
+    current.subnet  = (uint32_t)WiFi.subnetMask();
+    current.dns1    = (uint32_t)WiFi.dnsIP(0);
+    current.dns2    = (uint32_t)WiFi.dnsIP(1);
+#if WIFI_REUSE_LEASE
+    time_t now = time(nullptr);
+    current.leaseUntil = now >= (time_t)WIFI_LEASE_MIN_VALID_TIME ? now + WIFI_LEASE_REUSE_SEC : 0;
+#endif
+
+    linkValid = true;
+    if (memcmp(&current, &link, sizeof(link)) == 0) return;
+    link = current;
+
+    Preferences prefs;
+    prefs.begin(NETWORK_CACHE_NAMESPACE, false);
+    prefs.putBytes("link", &link, sizeof(link));
+    prefs.end();
+}
+
+void NetworkCache::addHost(const char* host) {
+    if (host == nullptr || find(host) != nullptr || hostCount >= NETWORK_CACHE_HOSTS) return;
+
+    HostEntry& entry = hosts[hostCount++];
+    entry.host = host;
+    entry.recheckMs = 0;   // An answer from NVS is of unknown age, it is used but looked up again
+    entry.lookup = LOOKUP_IDLE;
+    Preferences prefs;
+    prefs.begin(NETWORK_CACHE_NAMESPACE, true);
+    entry.ip = prefs.getUInt(hostKey(host).c_str(), 0);
+    prefs.end();
+    if (entry.ip != 0) strlcpy(entry.text, IPAddress(entry.ip).toString().c_str(), sizeof(entry.text));
+}
+
+const char* NetworkCache::address(const char* host) {
+    HostEntry* entry = find(host);
+    return entry != nullptr && entry->ip != 0 ? entry->text : host;
+}
+
+// One aligned 32-bit read, a lookup finishing at the same time cannot tear it
+IPAddress NetworkCache::cachedIp(const char* host) {
+    HostEntry* entry = find(host);
+    return IPAddress(entry != nullptr ? entry->ip : 0);
+}
+
+void NetworkCache::refresh() {
+#if WIFI_REUSE_LEASE
+    if (onReusedLease && time(nullptr) >= (time_t)link.leaseUntil) {
+        Serial.println("NetworkCache - Reused lease window over, back to DHCP");
+        WiFi.config(IPAddress((uint32_t)0), IPAddress((uint32_t)0), IPAddress((uint32_t)0));
+        onReusedLease = false;
+    }
+#endif
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < hostCount; i++) {
+        HostEntry& entry = hosts[i];
+        if (entry.lookup == LOOKUP_DONE) {
+            finishLookup(entry, entry.answer);
+            continue;
+        }
+        if (refreshAll) entry.recheckMs = 0;
+        if (lookupDue(entry, now)) startLookup(entry);
+    }
+    refreshAll = false;
+}
+
+bool NetworkCache::resolve(const char* host) {
+    HostEntry* entry = find(host);
+    if (entry == nullptr) return false;
+    if (entry->lookup == LOOKUP_DONE) finishLookup(*entry, entry->answer);
+    if (lookupDue(*entry, millis())) startLookup(*entry);
+    return entry->lookup != LOOKUP_IDLE;
+}
+
+bool NetworkCache::lookupDue(const HostEntry& entry, unsigned long now) const {
+    return entry.lookup == LOOKUP_IDLE && (entry.recheckMs == 0 || now - entry.checkedAt >= entry.recheckMs);
+}
+
+// lwIP answers at once from its own table or an IP literal, otherwise through onResolved()
+void NetworkCache::startLookup(HostEntry& entry) {
+    ip_addr_t resolved;
+    entry.lookup = LOOKUP_PENDING;
+    err_t result = dns_gethostbyname(entry.host, &resolved, onResolved, &entry);
+    if (result == ERR_OK) finishLookup(entry, ip_addr_get_ip4_u32(&resolved));
+    else if (result != ERR_INPROGRESS) finishLookup(entry, 0);
+}
+
+// Runs in the lwIP thread, refresh() picks the answer up
+void NetworkCache::onResolved(const char*, const ip_addr_t* ipaddr, void* arg) {
+    HostEntry* entry = static_cast<HostEntry*>(arg);
+    entry->answer = ip_addr_get_ip4_u32(ipaddr);
+    entry->lookup = LOOKUP_DONE;
+}
+
+// A failed lookup keeps the old address in use and is tried again later
+void NetworkCache::finishLookup(HostEntry& entry, uint32_t ip) {
+    entry.lookup = LOOKUP_IDLE;
+    entry.checkedAt = millis();
+    entry.recheckMs = ip != 0 ? NETWORK_CACHE_DNS_MAX_AGE_MS : NETWORK_CACHE_DNS_RETRY_MS;
+    if (ip == 0 || ip == entry.ip) return;
+    entry.ip = ip;
+    strlcpy(entry.text, IPAddress(ip).toString().c_str(), sizeof(entry.text));
+    Preferences prefs;
+    prefs.begin(NETWORK_CACHE_NAMESPACE, false);
+    prefs.putUInt(hostKey(entry.host).c_str(), ip);
+    prefs.end();
+}
+
+void NetworkCache::forget(const char* host) {
+    HostEntry* entry = find(host);
+    if (entry == nullptr || entry->ip == 0) return;
+    entry->ip = 0;
+    entry->recheckMs = 0;
+    Preferences prefs;
+    prefs.begin(NETWORK_CACHE_NAMESPACE, false);
+    prefs.remove(hostKey(host).c_str());
+    prefs.end();
+}
+
+NetworkCache::HostEntry* NetworkCache::find(const char* host) {
+    for (uint8_t i = 0; i < hostCount; i++) {
+        if (strcmp(hosts[i].host, host) == 0) return &hosts[i];
+    }
+    return nullptr;
+}
+
+// NVS keys are limited to 15 characters, hostnames are not
+String NetworkCache::hostKey(const char* host) {
+    char key[12];
+    snprintf(key, sizeof(key), "h%08x", (unsigned)hashString(host));
+    return String(key);
+}
@@ -0,0 +1,113 @@
+#ifndef NETWORKCACHE_H
+#define NETWORKCACHE_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <lwip/dns.h>
+
+#define NETWORK_CACHE_NAMESPACE     "netcache"
+// Hostnames whose addresses are kept
+#define NETWORK_CACHE_HOSTS         6
+// Time allowed for the cached BSSID/channel/IP path before falling back to a full scan
+#ifndef WIFI_FAST_CONNECT_MS
+#define WIFI_FAST_CONNECT_MS        3000
+#endif
+// Full scan with DHCP, in 500 ms steps
+#define WIFI_FULL_CONNECT_ATTEMPTS  20
+// Reuse the last DHCP lease as a static configuration on the fast path. Off by
+// default: the device cannot learn the lease time, so the address is only reused
+// for WIFI_LEASE_REUSE_SEC of wall-clock time after the DHCP join, which must stay
+// below half the network's lease time. Past that the interface goes back to DHCP.
+#ifndef WIFI_REUSE_LEASE
+#define WIFI_REUSE_LEASE            0
+#endif
+#ifndef WIFI_LEASE_REUSE_SEC
+#define WIFI_LEASE_REUSE_SEC        3600
+#endif
+// Cached DNS answers are looked up again after this long, or on every boot for
+// those read back from NVS. lwIP does not pass the record TTL on.
+#ifndef NETWORK_CACHE_DNS_MAX_AGE_MS
+#define NETWORK_CACHE_DNS_MAX_AGE_MS  3600000UL
+#endif
+// Wait before trying a failed lookup again
+#ifndef NETWORK_CACHE_DNS_RETRY_MS
+#define NETWORK_CACHE_DNS_RETRY_MS    30000UL
+#endif
+
+// Last good access point, IP configuration and DNS answers, kept in NVS so
+// a power cycle can reconnect without scanning, DHCP or name lookups.
+class NetworkCache {
+public:
+    NetworkCache();
+
+    void begin();
+
+    // Joins the network: cached BSSID/channel (and lease) first, full scan
+    // with DHCP if that fails. Blocks until connected or out of attempts.
+    bool connect(const char* ssid, const char* password);
+    uint32_t connectMillis() const { return lastConnectMs; }
+    bool connectedFast() const { return lastConnectFast; }
+
+    // Track a hostname; address() then returns its cached dotted IP, or the
+    // hostname itself until it has been resolved once. The pointer stays valid.
+    void addHost(const char* host);
+    const char* address(const char* host);
+    // The cached address, 0.0.0.0 if there is none. Also safe from other tasks.
+    IPAddress cachedIp(const char* host);
+    // Starts lookups for tracked hosts that are missing, older than
+    // NETWORK_CACHE_DNS_MAX_AGE_MS or, after a full connect, all of them, and
+    // stores the answers that came in. Never blocks: the cached address stays
+    // in use until the new answer is there. Call from loop().
+    void refresh();
+    // Starts the lookup for a tracked host now if one is due instead of on the
+    // next refresh(). True while a lookup is running; never blocks.
+    bool resolve(const char* host);
+    // Drop a cached address that stopped working
+    void forget(const char* host);
+
+private:
+    struct Link {
+        uint8_t  bssid[6];
+        uint8_t  channel;
+        uint32_t ip;
+        uint32_t gateway;
+        uint32_t subnet;
+        uint32_t dns1;
+        uint32_t dns2;
+        uint32_t leaseUntil;   // Wall-clock seconds the lease may be reused until, 0 for never
+    };
+
+    // Lookup states, written by the lwIP callback
+    enum Lookup : uint8_t { LOOKUP_IDLE, LOOKUP_PENDING, LOOKUP_DONE };
+
+    struct HostEntry {
+        const char*       host;
+        uint32_t          ip;
+        char              text[16];
+        unsigned long     checkedAt;   // millis() of the last lookup that ended
+        uint32_t          recheckMs;   // Time after checkedAt the next lookup is due, 0 for now
+        volatile Lookup   lookup;
+        volatile uint32_t answer;      // 0 when the lookup failed
+    };
+
+    bool waitConnected(unsigned long timeoutMs);
+    void rememberLink();
+    bool lookupDue(const HostEntry& entry, unsigned long now) const;
+    void startLookup(HostEntry& entry);
+    void finishLookup(HostEntry& entry, uint32_t ip);
+    static void onResolved(const char* name, const ip_addr_t* ipaddr, void* arg);
+    HostEntry* find(const char* host);
+    static String hostKey(const char* host);
+
+    Link link;
+    bool linkValid;
+    bool onReusedLease;
+    HostEntry hosts[NETWORK_CACHE_HOSTS];
+    uint8_t hostCount;
+    bool refreshAll;
+
+    uint32_t lastConnectMs;
+    bool lastConnectFast;
+};
+
+#endif
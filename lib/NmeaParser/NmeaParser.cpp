@@ -0,0 +1,239 @@
+#include "NmeaParser.h"
+#include <string.h>
+
+// What a term holds, by position in the sentence
+enum NmeaField : uint8_t {
+    NMEA_SKIP = 0,
+    NMEA_TIME,
+    NMEA_STATUS,
+    NMEA_LAT,
+    NMEA_NS,
+    NMEA_LON,
+    NMEA_EW,
+    NMEA_SPEED,
+    NMEA_COURSE,
+    NMEA_DATE,
+    NMEA_QUALITY,
+    NMEA_SATS,
+    NMEA_HDOP,
+    NMEA_ALT
+};
+
+#define NMEA_RMC 0
+#define NMEA_GGA 1
+
+struct NmeaSentenceType {
+    char    code[4];
+    uint8_t kind;
+    uint8_t fields[NMEA_MAX_FIELDS];   // Term 1 onwards, unlisted terms are skipped
+};
+
+static const NmeaSentenceType sentenceTypes[] = {
+    { "RMC", NMEA_RMC, { NMEA_TIME, NMEA_STATUS, NMEA_LAT, NMEA_NS, NMEA_LON, NMEA_EW, NMEA_SPEED, NMEA_COURSE, NMEA_DATE } },
+    { "GGA", NMEA_GGA, { NMEA_TIME, NMEA_LAT, NMEA_NS, NMEA_LON, NMEA_EW, NMEA_QUALITY, NMEA_SATS, NMEA_HDOP, NMEA_ALT } },
+};
+
+// Integer digits a term may have: 7 covers every field (ddmm, hhmmss, ddmmyy,
+// altitude) and keeps the scaled value inside the int32_t and uint32_t fields
+#define NMEA_MAX_INT_DIGITS 7
+
+// Decimal term as an integer scaled by 10^decimals, further digits are truncated.
+// A term with more integer digits than NMEA_MAX_INT_DIGITS is rejected.
+static bool parseFixed(const char* term, const char* end, uint8_t decimals, int64_t& value) {
+    bool negative = *term == '-';
+    if (negative) term++;
+
+    value = 0;
+    uint8_t digits = 0;              // Integer digits taken
+    int8_t fraction = -1;            // Fraction digits taken, -1 before the point
+    for (; term < end; term++) {
+        if (*term == '.' && fraction < 0) {
+            fraction = 0;
+        } else if (*term >= '0' && *term <= '9') {
+            if (fraction >= decimals) continue;
+            if (fraction < 0 && ++digits > NMEA_MAX_INT_DIGITS) return false;
+            value = value * 10 + (*term - '0');
+            if (fraction >= 0) fraction++;
+        } else {
+            return false;
+        }
+    }
+    for (int8_t i = fraction < 0 ? 0 : fraction; i < decimals; i++) value *= 10;
+    if (negative) value = -value;
+    return true;
+}
+
+// ddmm.mmmmm or dddmm.mmmmm to degrees * 1e7
+static bool parseAngle(const char* term, const char* end, int32_t& angle) {
+    int64_t value;
+    if (!parseFixed(term, end, 5, value) || value < 0) return false;
+    int64_t degrees = value / 10000000;
+    int64_t minutes = value % 10000000;          // Minutes * 1e5
+    if (minutes >= 6000000 || degrees > 180) return false;
+    angle = (int32_t)(degrees * 10000000 + minutes * 5 / 3);
+    return true;
+}
+
+static int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Constructor
+NmeaParser::NmeaParser()
+    : positionUs(0),
+      timeUs(0),
+      qualityUs(0),
+      passedCount(0),
+      failedCount(0),
+      ignoredCount(0)
+{
+    memset(&current, 0, sizeof(current));
+}
+
+bool NmeaParser::parse(const char* text, size_t length, int64_t receivedUs) {
+    const char* end = text + length;
+    while (end > text && (end[-1] == '\n' || end[-1] == '\r')) end--;
+    if (end - text < 7 || text[0] != '$') {
+        failedCount++;
+        return false;
+    }
+
+    // "$ttXXX," - any two-letter talker, the type picks the table row
+    const NmeaSentenceType* type = nullptr;
+    for (size_t i = 0; i < sizeof(sentenceTypes) / sizeof(sentenceTypes[0]); i++) {
+        if (memcmp(text + 3, sentenceTypes[i].code, 3) == 0 && text[6] == ',') {
+            type = &sentenceTypes[i];
+            break;
+        }
+    }
+    if (type == nullptr) {
+        ignoredCount++;
+        return false;
+    }
+
+    // One pass: checksum and term conversion together, into a scratch fix
+    NmeaFix fix;
+    memset(&fix, 0, sizeof(fix));
+    char status = 'V';
+    uint8_t checksum = 0;
+    uint8_t field = 0;               // Term being read, 0 is the address
+    const char* term = text + 1;
+    const char* p = text + 1;
+    for (; p < end && *p != '*'; p++) {
+        checksum ^= (uint8_t)*p;
+        if (*p != ',') continue;
+        if (field > 0 && field <= NMEA_MAX_FIELDS && !store(type->fields[field - 1], term, p, fix, status)) {
+            failedCount++;
+            return false;
+        }
+        field++;
+        term = p + 1;
+    }
+    if (end - p < 3 || field == 0 ||
+        (field <= NMEA_MAX_FIELDS && !store(type->fields[field - 1], term, p, fix, status))) {
+        failedCount++;
+        return false;
+    }
+    int high = hexDigit(p[1]);
+    int low  = hexDigit(p[2]);
+    if (high < 0 || low < 0 || ((high << 4) | low) != checksum) {
+        failedCount++;
+        return false;
+    }
+    passedCount++;
+
+    // Commit what the sentence is authoritative for, and only with a fix
+    if (type->kind == NMEA_RMC) {
+        if (status != 'A') return false;
+        current.date      = fix.date;
+        current.time      = fix.time;
+        current.speed     = fix.speed;
+        current.course    = fix.course;
+        timeUs            = receivedUs;
+    } else {
+        current.quality   = fix.quality;
+        if (fix.quality == 0) return false;
+        current.altitude  = fix.altitude;
+        current.hdop      = fix.hdop;
+        current.satellites = fix.satellites;
+        qualityUs         = receivedUs;
+    }
+    current.latitude  = fix.latitude;
+    current.longitude = fix.longitude;
+    current.talker[0] = text[1];
+    current.talker[1] = text[2];
+    current.talker[2] = '\0';
+    positionUs        = receivedUs;
+    return true;
+}
+
+bool NmeaParser::store(uint8_t field, const char* term, const char* end, NmeaFix& fix, char& status) {
+    if (term == end || field == NMEA_SKIP) return true;   // Empty, e.g. no course while standing still
+
+    int64_t value;
+    switch (field) {
+        case NMEA_TIME:
+            if (!parseFixed(term, end, 2, value) || value < 0) return false;
+            fix.time = (uint32_t)value;
+            return true;
+        case NMEA_STATUS:
+            status = *term;
+            return true;
+        case NMEA_LAT:
+            return parseAngle(term, end, fix.latitude);
+        case NMEA_NS:
+            if (*term == 'S') fix.latitude = -fix.latitude;
+            return true;
+        case NMEA_LON:
+            return parseAngle(term, end, fix.longitude);
+        case NMEA_EW:
+            if (*term == 'W') fix.longitude = -fix.longitude;
+            return true;
+        case NMEA_SPEED:
+            if (!parseFixed(term, end, 2, value) || value < 0) return false;
+            fix.speed = (uint32_t)value;
+            return true;
+        case NMEA_COURSE:
+            if (!parseFixed(term, end, 2, value) || value < 0) return false;
+            fix.course = (uint32_t)value;
+            return true;
+        case NMEA_DATE:
+            if (!parseFixed(term, end, 0, value) || value < 0) return false;
+            fix.date = (uint32_t)value;
+            return true;
+        case NMEA_QUALITY:
+            if (!parseFixed(term, end, 0, value) || value < 0) return false;
+            fix.quality = (uint8_t)value;
+            return true;
+        case NMEA_SATS:
+            if (!parseFixed(term, end, 0, value) || value < 0) return false;
+            fix.satellites = (uint8_t)value;
+            return true;
+        case NMEA_HDOP:
+            if (!parseFixed(term, end, 2, value) || value < 0) return false;
+            fix.hdop = (uint16_t)value;
+            return true;
+        case NMEA_ALT:
+            if (!parseFixed(term, end, 2, value)) return false;
+            fix.altitude = (int32_t)value;
+            return true;
+        default:
+            return true;
+    }
+}
+
+bool NmeaParser::dateTime(RTCDateTime& time, uint8_t& hundredths) const {
+    if (!hasTime()) return false;
+    time.year   = current.date % 100;
+    time.year  += time.year > 80 ? 1900 : 2000;
+    time.month  = (current.date / 100) % 100;
+    time.day    = current.date / 10000;
+    time.hour   = current.time / 1000000;
+    time.minute = (current.time / 10000) % 100;
+    time.second = (current.time / 100) % 100;
+    hundredths  = current.time % 100;
+    return true;
+}
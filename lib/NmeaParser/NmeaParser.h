@@ -0,0 +1,65 @@
+#ifndef NMEAPARSER_H
+#define NMEAPARSER_H
+
+#include <Arduino.h>
+#include "types.h"
+
+#define NMEA_MAX_FIELDS           12
+
+// Last valid fix, fixed point throughout
+struct NmeaFix {
+    uint32_t date;            // ddmmyy, from RMC
+    uint32_t time;            // hhmmsscc
+    int32_t  latitude;        // Degrees * 1e7, north positive
+    int32_t  longitude;       // Degrees * 1e7, east positive
+    int32_t  altitude;        // Centimetres above mean sea level, from GGA
+    uint32_t speed;           // Knots * 100, from RMC
+    uint32_t course;          // Degrees * 100, from RMC
+    uint16_t hdop;            // * 100, from GGA
+    uint8_t  satellites;      // From GGA
+    uint8_t  quality;         // GGA fix quality, 0 without fix
+    char     talker[3];       // GP, GN, GL, GA, BD... of the last sentence used
+};
+
+// Parses whole NMEA sentences in place. The sentence type after the talker
+// ID selects a row of a field table; every term is converted straight out
+// of the sentence buffer as the checksum is accumulated over it, into a
+// scratch fix that is only committed once the checksum matches and the
+// receiver reports a valid fix. Any talker ID is accepted.
+class NmeaParser {
+public:
+    NmeaParser();
+
+    // One sentence from '$' up to the line ending; receivedUs is when it arrived.
+    // True when it was valid and updated the fix.
+    bool parse(const char* text, size_t length, int64_t receivedUs);
+
+    const NmeaFix& fix() const { return current; }
+    bool hasPosition() const { return positionUs != 0; }
+    bool hasTime() const { return timeUs != 0; }
+    int64_t positionFixUs() const { return positionUs; }   // Arrival of the sentence the position came from
+    int64_t timeFixUs() const { return timeUs; }           // Arrival of the RMC the date and time came from
+    int64_t qualityFixUs() const { return qualityUs; }     // Arrival of the GGA altitude, HDOP and satellites came from
+
+    // Date and time of the last RMC
+    bool dateTime(RTCDateTime& time, uint8_t& hundredths) const;
+    float latitude() const { return current.latitude / 1e7f; }
+    float longitude() const { return current.longitude / 1e7f; }
+
+    uint32_t passed() const { return passedCount; }
+    uint32_t failed() const { return failedCount; }        // Bad checksum or malformed
+    uint32_t ignored() const { return ignoredCount; }      // Sentence types without a table row
+
+private:
+    bool store(uint8_t field, const char* term, const char* end, NmeaFix& fix, char& status);
+
+    NmeaFix current;
+    int64_t positionUs;
+    int64_t timeUs;
+    int64_t qualityUs;
+    uint32_t passedCount;
+    uint32_t failedCount;
+    uint32_t ignoredCount;
+};
+
+#endif
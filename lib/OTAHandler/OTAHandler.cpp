@@ -1,9 +1,8 @@
 #include "OTAHandler.h"
 #include "secrets.h"
 
-OTAHandler::OTAHandler(PubSubClient& client) : mqttClient(client) {
+OTAHandler::OTAHandler(MqttTransport& client) : mqttClient(client) {
     // Constructor
-    this->mqttClient = client;
 }
 
 void OTAHandler::setupOTA() {
@@ -20,8 +19,8 @@ void OTAHandler::setupOTA() {
     }
 }
 
-void OTAHandler::handleOtaMessage(const String& message) {
-    if (message == "update_firmware") {
+void OTAHandler::handleOtaMessage(const char* message) {
+    if (strcmp(message, "update_firmware") == 0) {
         Serial.println("OTAHandler - Initiating OTA update...");
         performOTA();
     }
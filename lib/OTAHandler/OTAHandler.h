@@ -4,17 +4,17 @@
 #include <WiFi.h>
 #include <HTTPClient.h>
 #include <Update.h>
-#include <PubSubClient.h>
+#include "MqttTransport.h"
 
 class OTAHandler {
 public:
-    OTAHandler(PubSubClient& client);
+    OTAHandler(MqttTransport& client);
     void setupOTA();
     void performOTA();
-    void handleOtaMessage(const String& message);
+    void handleOtaMessage(const char* message);
 
 private:
-    PubSubClient& mqttClient;
+    MqttTransport& mqttClient;
     const int maxRetries = 10; // Maximum number of OTA retry attempts
 };
 
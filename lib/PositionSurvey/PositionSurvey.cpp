@@ -0,0 +1,156 @@
+#include "PositionSurvey.h"
+#include <Preferences.h>
+#include <math.h>
+
+#define METRES_PER_DEGREE_E7  0.0111320   // Metres per 1e-7 degree of latitude
+
+// Constructor
+PositionSurvey::PositionSurvey()
+    : surveyState(SURVEY_ACQUIRING),
+      locked(false),
+      lockedLatitude(0),
+      lockedLongitude(0),
+      lockedAltitude(0),
+      lockedAccuracy(0),
+      lockedAt(0)
+{
+    restart(SURVEY_ACQUIRING);
+}
+
+void PositionSurvey::begin() {
+    Preferences prefs;
+    prefs.begin(SURVEY_NAMESPACE, true);
+    locked = prefs.getBool("locked", false);
+    lockedLatitude  = prefs.getInt("lat", 0);
+    lockedLongitude = prefs.getInt("lon", 0);
+    lockedAltitude  = prefs.getInt("alt", 0);
+    lockedAccuracy  = prefs.getUInt("acc", 0);
+    prefs.end();
+
+    if (locked) {
+        Serial.printf("PositionSurvey - Restored %.7f, %.7f (+-%u cm)\n",
+                      lockedLatitude / 1e7, lockedLongitude / 1e7, (unsigned)lockedAccuracy);
+        surveyState = SURVEY_LOCKED;
+        lockedAt = millis();
+    }
+}
+
+void PositionSurvey::restart(uint8_t state) {
+    surveyState = state;
+    count = 0;
+    originLatitude = 0;
+    originLongitude = 0;
+    metresPerLongitude = 0;
+    meanNorth = meanEast = meanUp = 0;
+    spreadNorth = spreadEast = 0;
+}
+
+bool PositionSurvey::addFix(int32_t latitude, int32_t longitude, int32_t altitude, uint16_t hdop) {
+    if (surveyState == SURVEY_LOCKED || hdop == 0 || hdop > SURVEY_MAX_HDOP) return false;
+
+    if (count == 0) {
+        originLatitude = latitude;
+        originLongitude = longitude;
+        metresPerLongitude = METRES_PER_DEGREE_E7 * cos(latitude / 1e7 * M_PI / 180.0);
+    }
+    double north = (latitude - originLatitude) * METRES_PER_DEGREE_E7;
+    double east  = (longitude - originLongitude) * metresPerLongitude;
+    double up    = altitude / 100.0;
+
+    count++;
+    double deltaNorth = north - meanNorth;
+    double deltaEast  = east - meanEast;
+    meanNorth += deltaNorth / count;
+    meanEast  += deltaEast / count;
+    meanUp    += (up - meanUp) / count;
+    spreadNorth += deltaNorth * (north - meanNorth);
+    spreadEast  += deltaEast * (east - meanEast);
+
+    if (surveyState == SURVEY_CHECKING) {
+        if (count < SURVEY_RECHECK_FIXES) return false;
+        double lockedNorth = (lockedLatitude - originLatitude) * METRES_PER_DEGREE_E7;
+        double lockedEast  = (lockedLongitude - originLongitude) * metresPerLongitude;
+        double moved = hypot(meanNorth - lockedNorth, meanEast - lockedEast);
+        if (moved > SURVEY_MOVED_M) {
+            Serial.printf("PositionSurvey - Moved %.0f m, surveying again\n", moved);
+            // The old position no longer holds, not even across a reboot mid-survey
+            locked = false;
+            Preferences prefs;
+            prefs.begin(SURVEY_NAMESPACE, false);
+            prefs.putBool("locked", false);
+            prefs.end();
+            restart(SURVEY_ACQUIRING);
+        } else {
+            surveyState = SURVEY_LOCKED;
+            lockedAt = millis();
+        }
+        return false;
+    }
+
+    if (count < SURVEY_MIN_FIXES || standardErrorM() * 100 > SURVEY_TARGET_CM) return false;
+    lock();
+    return true;
+}
+
+void PositionSurvey::lock() {
+    lockedLatitude  = originLatitude + (int32_t)lround(meanNorth / METRES_PER_DEGREE_E7);
+    lockedLongitude = originLongitude + (int32_t)lround(meanEast / metresPerLongitude);
+    lockedAltitude  = (int32_t)lround(meanUp * 100);
+    lockedAccuracy  = (uint32_t)lround(standardErrorM() * 100);
+    locked   = true;
+    lockedAt = millis();
+
+    Preferences prefs;
+    prefs.begin(SURVEY_NAMESPACE, false);
+    prefs.putBool("locked", true);
+    prefs.putInt("lat", lockedLatitude);
+    prefs.putInt("lon", lockedLongitude);
+    prefs.putInt("alt", lockedAltitude);
+    prefs.putUInt("acc", lockedAccuracy);
+    prefs.end();
+
+    Serial.printf("PositionSurvey - Locked %.7f, %.7f (+-%u cm) from %u fixes\n",
+                  lockedLatitude / 1e7, lockedLongitude / 1e7, (unsigned)lockedAccuracy, (unsigned)count);
+    restart(SURVEY_LOCKED);
+}
+
+void PositionSurvey::update() {
+    if (surveyState == SURVEY_LOCKED && millis() - lockedAt >= SURVEY_RECHECK_MS) {
+        restart(SURVEY_CHECKING);
+    }
+}
+
+double PositionSurvey::standardErrorM() const {
+    if (count < 2) return INFINITY;
+    return sqrt((spreadNorth + spreadEast) / (count - 1) / count);
+}
+
+float PositionSurvey::latitude() const {
+    if (locked) return lockedLatitude / 1e7f;
+    return (originLatitude + meanNorth / METRES_PER_DEGREE_E7) / 1e7;
+}
+
+float PositionSurvey::longitude() const {
+    if (locked) return lockedLongitude / 1e7f;
+    if (count == 0) return 0;
+    return (originLongitude + meanEast / metresPerLongitude) / 1e7;
+}
+
+int32_t PositionSurvey::altitudeCm() const {
+    if (locked) return lockedAltitude;
+    return (int32_t)lround(meanUp * 100);
+}
+
+uint32_t PositionSurvey::accuracyCm() const {
+    if (locked) return lockedAccuracy;
+    double error = standardErrorM();
+    return isinf(error) ? UINT32_MAX : (uint32_t)lround(error * 100);
+}
+
+const char* PositionSurvey::stateName(uint8_t state) {
+    switch (state) {
+        case SURVEY_LOCKED:   return "locked";
+        case SURVEY_CHECKING: return "checking";
+        default:              return "acquiring";
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef POSITIONSURVEY_H
+#define POSITIONSURVEY_H
+
+#include <Arduino.h>
+
+#define SURVEY_NAMESPACE          "survey"
+// Lock once the standard error of the mean is below this
+#ifndef SURVEY_TARGET_CM
+#define SURVEY_TARGET_CM          200
+#endif
+// Consecutive fixes are correlated over minutes, so a floor on the count
+// matters as much as the standard error
+#define SURVEY_MIN_FIXES          300
+// Fixes with a worse HDOP (* 100) are left out of the average
+#define SURVEY_MAX_HDOP           300
+// Locked: look again this often, with this many fixes
+#define SURVEY_RECHECK_MS         (24UL * 3600UL * 1000UL)
+#define SURVEY_RECHECK_FIXES      30
+// A re-check further off than this means the device was moved, survey again
+#define SURVEY_MOVED_M            50
+
+#define SURVEY_ACQUIRING          0
+#define SURVEY_LOCKED             1
+#define SURVEY_CHECKING           2
+
+// Survey-in for a device that never moves: averages fixes until the mean is
+// precise enough, then freezes it in NVS. While locked the receiver only has
+// to provide time; a short re-check once a day catches a relocated device.
+class PositionSurvey {
+public:
+    PositionSurvey();
+
+    void begin();   // Restores a locked position
+
+    // Feed every new position fix. True when the locked position changed.
+    bool addFix(int32_t latitude, int32_t longitude, int32_t altitude, uint16_t hdop);
+    // Call every loop, starts the periodic re-check
+    void update();
+
+    uint8_t state() const { return surveyState; }
+    static const char* stateName(uint8_t state);
+    bool wantsPosition() const { return surveyState != SURVEY_LOCKED; }
+    bool hasPosition() const { return locked || count > 0; }
+
+    // Locked position, or the running mean while the first survey goes on
+    float latitude() const;
+    float longitude() const;
+    int32_t altitudeCm() const;
+    uint32_t accuracyCm() const;       // Standard error of the mean
+    uint32_t fixes() const { return count; }
+
+private:
+    void restart(uint8_t state);
+    double standardErrorM() const;
+    void lock();
+
+    uint8_t surveyState;
+
+    // Locked position, degrees * 1e7 and cm
+    bool locked;
+    int32_t lockedLatitude;
+    int32_t lockedLongitude;
+    int32_t lockedAltitude;
+    uint32_t lockedAccuracy;
+    unsigned long lockedAt;
+
+    // Running mean (Welford) in metres north/east of the first fix of the run
+    uint32_t count;
+    int32_t originLatitude;
+    int32_t originLongitude;
+    double metresPerLongitude;
+    double meanNorth, meanEast, meanUp;
+    double spreadNorth, spreadEast;
+};
+
+#endif
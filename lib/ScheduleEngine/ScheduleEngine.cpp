@@ -0,0 +1,180 @@
+#include "ScheduleEngine.h"
+#include "datetime.h"
+
+// Constructor
+ScheduleEngine::ScheduleEngine()
+    : editCount(0),
+      sun(nullptr),
+      state(false),
+      applies(false),
+      validFrom(0),
+      validSpan(0)
+{
+    memset(&config, 0, sizeof(config));
+}
+
+bool ScheduleEngine::addWindow(const ScheduleWindow& window) {
+    if (config.windowCount >= SCHEDULE_MAX_WINDOWS || (window.days & SCHEDULE_ALL_DAYS) == 0) return false;
+    const ScheduleTime* times[2] = { &window.on, &window.off };
+    for (const ScheduleTime* time : times) {
+        if (time->ref > SCHEDULE_REF_DAWN || time->minute < 0 || time->minute >= 1440) return false;
+    }
+    config.windows[config.windowCount++] = window;
+    changed();
+    return true;
+}
+
+bool ScheduleEngine::addException(const ScheduleException& exception) {
+    if (config.exceptionCount >= SCHEDULE_MAX_EXCEPTIONS || exception.program > SCHEDULE_DAY_ON ||
+        exception.month < 1 || exception.month > 12 || exception.day < 1 || exception.day > 31) {
+        return false;
+    }
+    config.exceptions[config.exceptionCount++] = exception;
+    changed();
+    return true;
+}
+
+bool ScheduleEngine::addOverride(const ScheduleOverride& entry) {
+    if (entry.end <= entry.start) return false;
+    uint8_t slot = config.overrideCount;
+    for (uint8_t i = 0; i < config.overrideCount; i++) {
+        if (config.overrides[i].priority == entry.priority) slot = i;
+    }
+    if (slot >= SCHEDULE_MAX_OVERRIDES) return false;
+    config.overrides[slot] = entry;
+    if (slot == config.overrideCount) config.overrideCount++;
+    changed();
+    return true;
+}
+
+bool ScheduleEngine::restore(const ScheduleData& data) {
+    if (data.windowCount > SCHEDULE_MAX_WINDOWS || data.exceptionCount > SCHEDULE_MAX_EXCEPTIONS ||
+        data.overrideCount > SCHEDULE_MAX_OVERRIDES) {
+        return false;
+    }
+    config = data;
+    changed();
+    return true;
+}
+
+// Works out the state at now and the first time after it that anything can change
+void ScheduleEngine::evaluate(uint32_t now) {
+    // Finished overrides are dropped, as an edit so the saved copy follows
+    uint8_t kept = 0;
+    for (uint8_t i = 0; i < config.overrideCount; i++) {
+        if (config.overrides[i].end > now) config.overrides[kept++] = config.overrides[i];
+    }
+    if (kept != config.overrideCount) {
+        config.overrideCount = kept;
+        changed();
+    }
+
+    // Yesterday is included for windows running past midnight
+    uint32_t today = now / 86400UL;
+    uint32_t first = today > 0 ? today - 1 : 0;
+    uint32_t horizon = (today + SCHEDULE_HORIZON_DAYS) * 86400UL;
+    uint8_t programs[SCHEDULE_HORIZON_DAYS + 1];
+    uint8_t days = today + SCHEDULE_HORIZON_DAYS - first;
+    for (uint8_t d = 0; d < days; d++) programs[d] = dayProgram(first + d);
+
+    // Extend over every window that overlaps or touches the run containing now;
+    // if there is none, the schedule is off until the earliest later start
+    uint32_t until = now;
+    uint32_t nextStart = horizon;
+    bool grew = true;
+    while (grew) {
+        grew = false;
+        for (uint8_t d = 0; d < days; d++) {
+            uint8_t count = programs[d] == SCHEDULE_DAY_ON ? 1 : config.windowCount;
+            for (uint8_t i = 0; i < count; i++) {
+                uint32_t start, end;
+                if (!interval(first + d, programs[d], i, start, end)) continue;
+                if (start <= until && end > until) {
+                    until = end;
+                    grew = true;
+                } else if (start > now && start < nextStart) {
+                    nextStart = start;
+                }
+            }
+        }
+    }
+    bool scheduled = until > now;
+    uint32_t next = scheduled ? (until < horizon ? until : horizon) : nextStart;
+
+    // The highest priority override in force beats the windows
+    const ScheduleOverride* winner = nullptr;
+    for (uint8_t i = 0; i < config.overrideCount; i++) {
+        const ScheduleOverride& entry = config.overrides[i];
+        if (entry.start <= now) {
+            if (winner == nullptr || entry.priority > winner->priority) winner = &entry;
+        } else if (entry.start < next) {
+            next = entry.start;
+        }
+        if (entry.end < next) next = entry.end;
+    }
+
+    applies   = winner != nullptr || config.windowCount > 0 || config.exceptionCount > 0;
+    state     = winner != nullptr ? winner->state : scheduled;
+    validFrom = now;
+    validSpan = next - now;
+}
+
+// Weekday 1..7 whose windows run on a day, or the program of an exception for it.
+// An exception for that exact year wins over a yearly one.
+uint8_t ScheduleEngine::dayProgram(uint32_t day) const {
+    if (config.exceptionCount > 0) {
+        uint16_t year;
+        uint8_t month, date;
+        civilFromDays((int32_t)day, year, month, date);
+        const ScheduleException* match = nullptr;
+        for (uint8_t i = 0; i < config.exceptionCount; i++) {
+            const ScheduleException& exception = config.exceptions[i];
+            if (exception.month != month || exception.day != date) continue;
+            if (exception.year == year) return exception.program;
+            if (exception.year == 0 && match == nullptr) match = &exception;
+        }
+        if (match != nullptr) return match->program;
+    }
+    return weekdayFromDays(day);
+}
+
+// Window index of a day as local seconds, false when it does not run that day
+bool ScheduleEngine::interval(uint32_t day, uint8_t program, uint8_t index, uint32_t& start, uint32_t& end) const {
+    int64_t midnight = (int64_t)day * 86400;
+    if (program == SCHEDULE_DAY_ON) {
+        start = (uint32_t)midnight;
+        end   = (uint32_t)(midnight + 86400);
+        return true;
+    }
+    if (program == SCHEDULE_DAY_OFF) return false;
+
+    const ScheduleWindow& window = config.windows[index];
+    if ((window.days & (1 << (program - 1))) == 0) return false;
+    int32_t on  = resolve(window.on, day);
+    int32_t off = resolve(window.off, day);
+    if (on == SCHEDULE_NO_EVENT || off == SCHEDULE_NO_EVENT) return false;
+    if (off <= on) off += 1440;   // Ends the next day
+
+    int64_t from = midnight + on * 60;
+    if (from < 0) from = 0;
+    start = (uint32_t)from;
+    end   = (uint32_t)(midnight + off * 60);
+    return end > start;
+}
+
+// Minutes after the day's midnight. A table built for another year is off by a
+// minute or so at most, so it serves for the days around New Year.
+int32_t ScheduleEngine::resolve(const ScheduleTime& time, uint32_t day) const {
+    if (time.ref == SCHEDULE_REF_CLOCK || sun == nullptr || sun->year() == 0) return time.minute;
+
+    uint16_t year;
+    uint8_t month, date;
+    civilFromDays((int32_t)day, year, month, date);
+    uint16_t dayOfYear = SunTable::dayOfYear(year, month, date);
+    uint16_t event = time.ref == SCHEDULE_REF_DUSK ? sun->dusk(dayOfYear) : sun->dawn(dayOfYear);
+
+    // Polar night: dark from midnight to midnight; polar day: no dusk or dawn to switch at
+    if (event == SUN_NEVER_LIGHT) return time.ref == SCHEDULE_REF_DUSK ? 0 : 1440;
+    if (event == SUN_NEVER_DARK) return SCHEDULE_NO_EVENT;
+    return event + time.offset;
+}
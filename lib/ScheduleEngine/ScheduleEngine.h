@@ -0,0 +1,132 @@
+#ifndef SCHEDULEENGINE_H
+#define SCHEDULEENGINE_H
+
+#include <Arduino.h>
+#include "SunTable.h"
+
+#ifndef SCHEDULE_MAX_WINDOWS
+#define SCHEDULE_MAX_WINDOWS      12
+#endif
+#ifndef SCHEDULE_MAX_EXCEPTIONS
+#define SCHEDULE_MAX_EXCEPTIONS   16
+#endif
+#define SCHEDULE_MAX_OVERRIDES    4
+// Days looked ahead for the next transition; a schedule without one is re-evaluated then
+#define SCHEDULE_HORIZON_DAYS     8
+// Stand-ins for dusk and dawn until the sun table exists, minutes after midnight
+#define SCHEDULE_FALLBACK_DUSK    (18 * 60)
+#define SCHEDULE_FALLBACK_DAWN    (6 * 60)
+
+// What a switching time is measured from
+#define SCHEDULE_REF_CLOCK        0
+#define SCHEDULE_REF_DUSK         1
+#define SCHEDULE_REF_DAWN         2
+
+// Program of an exception day: off, on, or 1..7 to run that weekday's windows
+#define SCHEDULE_DAY_OFF          0
+#define SCHEDULE_DAY_ON           8
+
+#define SCHEDULE_ALL_DAYS         0x7F
+// resolve() result for a dusk or dawn that does not happen that day
+#define SCHEDULE_NO_EVENT         INT32_MIN
+
+// A switching time: clock minutes, or an offset from civil dusk or dawn
+// with the clock minutes used until the sun table is built
+struct ScheduleTime {
+    uint8_t ref;              // SCHEDULE_REF_*
+    int16_t minute;           // After local midnight
+    int16_t offset;           // From dusk or dawn
+};
+
+// On from on to off on each day in the mask. An off time at or before the
+// on time ends the window the next day; the window belongs to the day it
+// starts on.
+struct ScheduleWindow {
+    uint8_t days;             // Bit 0 = Monday ... bit 6 = Sunday
+    ScheduleTime on;
+    ScheduleTime off;
+};
+
+// Replaces the windows starting on one date, holidays and the like
+struct ScheduleException {
+    uint16_t year;            // 0 repeats every year
+    uint8_t  month;
+    uint8_t  day;
+    uint8_t  program;         // SCHEDULE_DAY_*, or 1..7
+};
+
+// Forces the output between two times regardless of the windows; the
+// highest priority active one wins
+struct ScheduleOverride {
+    uint32_t start;           // Local time, DayTime.unixtime seconds
+    uint32_t end;
+    uint8_t  priority;
+    bool     state;
+};
+
+// Everything the engine is configured with, one block so it can be saved as is
+struct ScheduleData {
+    ScheduleWindow windows[SCHEDULE_MAX_WINDOWS];
+    ScheduleException exceptions[SCHEDULE_MAX_EXCEPTIONS];
+    ScheduleOverride overrides[SCHEDULE_MAX_OVERRIDES];
+    uint8_t windowCount;
+    uint8_t exceptionCount;
+    uint8_t overrideCount;
+};
+
+// Weekly windows, date exceptions and priority overrides, all in local
+// time. Whenever the state is evaluated the engine also works out when it
+// next changes, so between transitions stateAt() is a single compare. Any
+// edit, a new sun table or the clock jumping backwards forces a fresh
+// evaluation.
+class ScheduleEngine {
+public:
+    ScheduleEngine();
+
+    void setSunTable(const SunTable* table) { sun = table; invalidate(); }
+    void invalidate() { validSpan = 0; }
+
+    void clearWindows() { config.windowCount = 0; changed(); }
+    bool addWindow(const ScheduleWindow& window);
+    void clearExceptions() { config.exceptionCount = 0; changed(); }
+    bool addException(const ScheduleException& exception);
+    // Replaces an override of the same priority; false when all slots are taken
+    bool addOverride(const ScheduleOverride& entry);
+    void clearOverrides() { config.overrideCount = 0; changed(); }
+
+    // Configuration for persisting; revision() moves on with every edit
+    const ScheduleData& data() const { return config; }
+    bool restore(const ScheduleData& data);
+    uint32_t revision() const { return editCount; }
+
+    // State at local time now; false when nothing applies and the output is left alone
+    bool stateAt(uint32_t now, bool& on) {
+        if (now - validFrom >= validSpan) evaluate(now);   // Also true after a backwards jump
+        on = state;
+        return applies;
+    }
+    uint32_t nextTransition() const { return validFrom + validSpan; }
+
+    uint8_t windows() const { return config.windowCount; }
+    uint8_t exceptions() const { return config.exceptionCount; }
+    uint8_t overrides() const { return config.overrideCount; }
+
+private:
+    void changed() { editCount++; invalidate(); }
+    void evaluate(uint32_t now);
+    uint8_t dayProgram(uint32_t day) const;
+    bool interval(uint32_t day, uint8_t program, uint8_t index, uint32_t& start, uint32_t& end) const;
+    int32_t resolve(const ScheduleTime& time, uint32_t day) const;
+
+    ScheduleData config;
+    uint32_t editCount;
+    const SunTable* sun;
+
+    // Result of the last evaluation, good for [validFrom, validFrom + validSpan)
+    bool state;
+    bool applies;
+    uint32_t validFrom;
+    uint32_t validSpan;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#include "SunTable.h"
+#include "datetime.h"
+#include <math.h>
+
+#define DEG_TO_RADF               0.017453293f
+
+// Constructor
+SunTable::SunTable()
+    : days(),
+      builtYear(0)
+{
+}
+
+void SunTable::build(float latitude, float longitude, int32_t zoneOffset, uint16_t year) {
+    uint16_t length = isLeapYearCivil(year) ? 366 : 365;
+    int32_t firstDay = daysFromCivil(year, 1, 1);
+    float latitudeRad = latitude * DEG_TO_RADF;
+    int32_t zoneMinutes = zoneOffset / 60;
+
+    for (uint16_t day = 0; day < SUN_TABLE_DAYS; day++) {
+        uint16_t index = day < length ? day : length - 1;   // 31 December again in common years
+
+        // Start from local solar noon, then once more at the event itself
+        float dawn = 720.0f - 4.0f * longitude;
+        float dusk = dawn;
+        uint16_t polar = 0;
+        for (int pass = 0; pass < 2 && polar == 0; pass++) {
+            polar = eventUtc(firstDay + index, latitudeRad, longitude, true, dawn);
+            if (polar == 0) polar = eventUtc(firstDay + index, latitudeRad, longitude, false, dusk);
+        }
+        if (polar != 0) {
+            days[day].dawn = days[day].dusk = polar;
+            continue;
+        }
+        days[day].dawn = wrapMinutes(lroundf(dawn) + zoneMinutes);
+        days[day].dusk = wrapMinutes(lroundf(dusk) + zoneMinutes);
+    }
+
+    builtYear = year;
+    Serial.printf("SunTable - Built %u for %.4f, %.4f\n", (unsigned)year, latitude, longitude);
+}
+
+// Refines minutes (UTC after midnight) to the twilight event near it.
+// Returns 0, or SUN_NEVER_* when the sun does not cross the zenith that day.
+uint16_t SunTable::eventUtc(int32_t days, float latitudeRad, float longitude, bool rising, float& minutes) {
+    // Days from J2000.0, 2000-01-01 12:00 UTC
+    float n = (float)(days - 10957) + (minutes - 720.0f) / 1440.0f;
+
+    float meanLongitude = fmodf(280.46646f + 0.98564736f * n, 360.0f) * DEG_TO_RADF;
+    float meanAnomaly   = fmodf(357.52911f + 0.98560028f * n, 360.0f) * DEG_TO_RADF;
+    float node          = fmodf(125.04f - 0.05295377f * n, 360.0f) * DEG_TO_RADF;
+    float centre = 1.914602f * sinf(meanAnomaly) + 0.019993f * sinf(2 * meanAnomaly)
+                 + 0.000289f * sinf(3 * meanAnomaly);
+    float apparent  = meanLongitude + (centre - 0.00569f - 0.00478f * sinf(node)) * DEG_TO_RADF;
+    float obliquity = (23.43929f - 0.0000003563f * n + 0.00256f * cosf(node)) * DEG_TO_RADF;
+    float declination = asinf(sinf(obliquity) * sinf(apparent));
+
+    const float e = 0.016708634f;
+    float y = tanf(obliquity / 2);
+    y *= y;
+    float equation = 4.0f / DEG_TO_RADF * (y * sinf(2 * meanLongitude) - 2 * e * sinf(meanAnomaly)
+                     + 4 * e * y * sinf(meanAnomaly) * cosf(2 * meanLongitude)
+                     - 0.5f * y * y * sinf(4 * meanLongitude) - 1.25f * e * e * sinf(2 * meanAnomaly));   // Minutes
+
+    float cosHourAngle = cosf(SUN_CIVIL_ZENITH * DEG_TO_RADF) / (cosf(latitudeRad) * cosf(declination))
+                       - tanf(latitudeRad) * tanf(declination);
+    if (cosHourAngle < -1.0f) return SUN_NEVER_DARK;
+    if (cosHourAngle > 1.0f) return SUN_NEVER_LIGHT;
+
+    float hourAngle = acosf(cosHourAngle) / DEG_TO_RADF;
+    minutes = 720.0f - 4.0f * (longitude + (rising ? hourAngle : -hourAngle)) - equation;
+    return 0;
+}
+
+uint16_t SunTable::wrapMinutes(int32_t minutes) {
+    return (uint16_t)(((minutes % 1440) + 1440) % 1440);
+}
+
+uint16_t SunTable::dayOfYear(uint16_t year, uint8_t month, uint8_t day) {
+    return (uint16_t)(daysFromCivil(year, month, day) - daysFromCivil(year, 1, 1));
+}
@@ -0,0 +1,47 @@
+#ifndef SUNTABLE_H
+#define SUNTABLE_H
+
+#include <Arduino.h>
+
+// One entry per day of the year, leap years included
+#define SUN_TABLE_DAYS            366
+// Civil twilight: the sun's centre 6 degrees below the horizon
+#define SUN_CIVIL_ZENITH          96.0f
+// Stored instead of a time on days without that twilight event
+#define SUN_NEVER_DARK            0xFFFE   // Sun stays above the twilight zenith all day
+#define SUN_NEVER_LIGHT           0xFFFF   // Sun stays below it all day
+
+// Civil dawn and dusk for one site, precomputed for a whole year so a lookup
+// is an index into the table. Built from the NOAA solar calculator equations
+// (mean orbit plus equation of centre, nutation-corrected obliquity), each
+// event solved twice so the sun position is taken at the event rather than
+// at noon; within a minute of the full algorithm outside the polar circles.
+class SunTable {
+public:
+    SunTable();
+
+    // Fills the table for a year, in local minutes after midnight
+    void build(float latitude, float longitude, int32_t zoneOffset, uint16_t year);
+    void clear() { builtYear = 0; }
+    uint16_t year() const { return builtYear; }   // 0 until built
+    bool validFor(uint16_t year) const { return builtYear != 0 && builtYear == year; }
+
+    // dayOfYear counts from 0 on 1 January; SUN_NEVER_* on polar days
+    uint16_t dawn(uint16_t dayOfYear) const { return days[dayOfYear].dawn; }
+    uint16_t dusk(uint16_t dayOfYear) const { return days[dayOfYear].dusk; }
+
+    static uint16_t dayOfYear(uint16_t year, uint8_t month, uint8_t day);
+
+private:
+    static uint16_t eventUtc(int32_t days, float latitudeRad, float longitude, bool rising, float& minutes);
+    static uint16_t wrapMinutes(int32_t minutes);
+
+    struct Day {
+        uint16_t dawn;
+        uint16_t dusk;
+    };
+    Day days[SUN_TABLE_DAYS];
+    uint16_t builtYear;
+};
+
+#endif
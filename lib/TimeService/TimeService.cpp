@@ -0,0 +1,245 @@
+#include "TimeService.h"
+#include <esp_timer.h>
+#include <sys/time.h>
+#include <math.h>
+
+// Constructor
+TimeService::TimeService(int32_t zoneOffset)
+    : zoneOffset(zoneOffset),
+      haveTime(false),
+      baseLocalUs(0),
+      baseUtcUs(0),
+      freqPpb(0),
+      freqKnown(false),
+      slewUs(0),
+      baseGeneration(0),
+      baseErrorUs(0),
+      current(TIME_FROM_NONE),
+      holdoverSinceUs(0),
+      pending(false),
+      lastEvaluation(0),
+      syncClock(true)
+{
+    memset(sources, 0, sizeof(sources));
+}
+
+void TimeService::offer(uint8_t index, int64_t utcUs, int64_t localUs, uint32_t errorUs) {
+    if (index >= TIME_SOURCES) return;
+    Source& source = sources[index];
+    int64_t offset = utcUs - localUs;
+
+    bool restart = !source.valid;
+    if (source.valid) {
+        // Far off what the source itself predicts: it stepped or lost its fix, learn afresh
+        int64_t surprise = offset - (sourceUtc(source, localUs) - localUs);
+        if (surprise < 0) surprise = -surprise;
+        restart = surprise > (int64_t)sourceError(source, localUs) + errorUs;
+    }
+
+    if (restart) {
+        source.anchorLocalUs  = localUs;
+        source.anchorOffsetUs = offset;
+        source.anchorErrorUs  = errorUs;
+    } else {
+        // The two samples' errors over the span bound the drift's error
+        int64_t span = localUs - source.anchorLocalUs;
+        int64_t needed = ((int64_t)source.anchorErrorUs + errorUs) * 1000000000LL / TIME_DRIFT_MAX_ERROR_PPB;
+        if (span >= TIME_DRIFT_MIN_SPAN_US && span >= needed) {
+            int64_t drift = (offset - source.anchorOffsetUs) * 1000000000LL / span;
+            if (drift > TIME_MAX_DRIFT_PPB) drift = TIME_MAX_DRIFT_PPB;
+            if (drift < -TIME_MAX_DRIFT_PPB) drift = -TIME_MAX_DRIFT_PPB;
+            source.driftPpb   = (int32_t)drift;
+            source.driftKnown = true;
+        }
+        if (span > TIME_DRIFT_MAX_SPAN_US) {
+            source.anchorLocalUs  = localUs;
+            source.anchorOffsetUs = offset;
+            source.anchorErrorUs  = errorUs;
+        }
+    }
+
+    source.valid    = true;
+    source.localUs  = localUs;
+    source.offsetUs = offset;
+    source.errorUs  = errorUs;
+    pending = true;
+}
+
+void TimeService::update() {
+    if (!pending && millis() - lastEvaluation < TIME_EVAL_MS) return;
+    pending = false;
+    lastEvaluation = millis();
+
+    int64_t now = esp_timer_get_time();
+    uint8_t best = TIME_SOURCES;
+    uint32_t bestError = TIME_MAX_ERROR_US;
+    for (uint8_t i = 0; i < TIME_SOURCES; i++) {
+        const Source& source = sources[i];
+        if (!source.valid || now - source.localUs > (int64_t)TIME_SOURCE_STALE_MS * 1000) continue;
+        uint32_t error = sourceError(source, now);
+        if (error < bestError) {
+            best = i;
+            bestError = error;
+        }
+    }
+
+    if (best == TIME_SOURCES) {
+        // Nothing usable: keep running on the learned drift
+        if (haveTime && current != TIME_FROM_HOLDOVER) {
+            Serial.println("TimeService - All sources lost, holding over");
+            current = TIME_FROM_HOLDOVER;
+            holdoverSinceUs = now;
+        }
+        return;
+    }
+
+    const Source& chosen = sources[best];
+    int64_t utc = sourceUtc(chosen, now);
+    double weight = 1.0 / ((double)bestError * bestError);
+    double drift  = chosen.driftKnown ? chosen.driftPpb : freqPpb;
+    bool known    = chosen.driftKnown || freqKnown;
+    uint32_t error = bestError;
+    uint8_t from = best == TIME_SOURCE_NTP ? TIME_FROM_NTP : TIME_FROM_GPS;
+
+    // Blend in the other sources that agree within their errors; one that
+    // does not is simply outranked, whichever of the two is later.
+    for (uint8_t i = 0; i < TIME_SOURCES; i++) {
+        const Source& other = sources[i];
+        if (i == best || !other.valid || now - other.localUs > (int64_t)TIME_SOURCE_STALE_MS * 1000) continue;
+        uint32_t otherError = sourceError(other, now);
+        if (otherError >= TIME_MAX_ERROR_US) continue;
+        int64_t difference = sourceUtc(other, now) - utc;
+        if (difference > (int64_t)bestError + otherError || difference < -((int64_t)bestError + otherError)) continue;
+
+        double otherWeight = 1.0 / ((double)otherError * otherError);
+        utc   += (int64_t)((double)difference * otherWeight / (weight + otherWeight));
+        if (other.driftKnown) {
+            drift = known ? (drift * weight + other.driftPpb * otherWeight) / (weight + otherWeight) : other.driftPpb;
+            known = true;
+        }
+        weight += otherWeight;
+        error  = (uint32_t)(1.0 / sqrt(weight));
+        from   = TIME_FROM_BLEND;
+    }
+
+    freqKnown = known;
+    adopt(now, utc, error, (int32_t)drift, from);
+}
+
+// Re-bases the output where it is now and slews toward utcUs, so DayTime and
+// the timed switching never see it jump; only the first time and differences
+// over TIME_STEP_US are stepped
+void TimeService::adopt(int64_t localUs, int64_t utcUs, uint32_t errorUs, int32_t driftPpb, uint8_t from) {
+    if (from != current) {
+        Serial.printf("TimeService - Time from %s, error %u us\n", sourceName(from), (unsigned)errorUs);
+    }
+    int64_t output = haveTime ? utcMicros(localUs) : utcUs;
+    int64_t phase  = utcUs - output;
+    if (phase > TIME_STEP_US || phase < -TIME_STEP_US) {
+        output = utcUs;
+        phase  = 0;
+    }
+    baseLocalUs     = localUs;
+    baseUtcUs       = output;
+    slewUs          = phase;
+    baseErrorUs     = errorUs;
+    freqPpb         = driftPpb;
+    current         = from;
+    holdoverSinceUs = 0;
+    haveTime        = true;
+    baseGeneration++;
+    syncSystemClock();
+}
+
+// Share of slewUs applied elapsedUs after the base
+int64_t TimeService::slewAt(int64_t elapsedUs) const {
+    int64_t room = elapsedUs * TIME_SLEW_PPM / 1000000LL;
+    if (slewUs > room) return room;
+    if (slewUs < -room) return -room;
+    return slewUs;
+}
+
+int64_t TimeService::sourceUtc(const Source& source, int64_t localUs) const {
+    int64_t elapsed = localUs - source.localUs;
+    return localUs + source.offsetUs + elapsed * source.driftPpb / 1000000000LL;
+}
+
+uint32_t TimeService::sourceError(const Source& source, int64_t localUs) const {
+    int64_t age = localUs - source.localUs;
+    int64_t wander = age * (source.driftKnown ? TIME_LEARNED_WANDER_PPM : TIME_WANDER_PPM) / 1000000LL;
+    int64_t error = source.errorUs + wander;
+    return error > UINT32_MAX ? UINT32_MAX : (uint32_t)error;
+}
+
+int64_t TimeService::utcMicros() const {
+    return utcMicros(esp_timer_get_time());
+}
+
+int64_t TimeService::utcMicros(int64_t localUs) const {
+    if (!haveTime) return 0;
+    int64_t elapsed = localUs - baseLocalUs;
+    return baseUtcUs + elapsed + elapsed * freqPpb / 1000000000LL + slewAt(elapsed);
+}
+
+// The inverse to well under a microsecond: drift and slew are taken at the UTC
+// distance instead of the local one, which differs by at most their ppm share
+int64_t TimeService::localFromUtc(int64_t utcUs) const {
+    if (!haveTime) return 0;
+    int64_t delta = utcUs - baseUtcUs;
+    return baseLocalUs + delta - delta * freqPpb / 1000000000LL - slewAt(delta);
+}
+
+uint32_t TimeService::unixtime() const {
+    return (uint32_t)(utcMicros() / 1000000LL);
+}
+
+const RTCDateTime& TimeService::dateTime() {
+    if (!haveTime) return noTime;
+    return calendar.at(unixtime() + zoneOffset);
+}
+
+uint32_t TimeService::errorUs() const {
+    if (!haveTime) return UINT32_MAX;
+    int64_t age = esp_timer_get_time() - baseLocalUs;
+    int64_t remaining = slewUs - slewAt(age);
+    if (remaining < 0) remaining = -remaining;
+    int64_t error = baseErrorUs + remaining + age * (freqKnown ? TIME_LEARNED_WANDER_PPM : TIME_WANDER_PPM) / 1000000LL;
+    return error > UINT32_MAX ? UINT32_MAX : (uint32_t)error;
+}
+
+uint32_t TimeService::holdoverSeconds() const {
+    if (current != TIME_FROM_HOLDOVER) return 0;
+    return (uint32_t)((esp_timer_get_time() - holdoverSinceUs) / 1000000LL);
+}
+
+int32_t TimeService::sourceAgeSeconds(uint8_t source) const {
+    if (source >= TIME_SOURCES || !sources[source].valid) return -1;
+    return (int32_t)((esp_timer_get_time() - sources[source].localUs) / 1000000LL);
+}
+
+const char* TimeService::sourceName(uint8_t source) {
+    switch (source) {
+        case TIME_FROM_NTP:      return "ntp";
+        case TIME_FROM_GPS:      return "gps";
+        case TIME_FROM_BLEND:    return "blend";
+        case TIME_FROM_HOLDOVER: return "holdover";
+        default:                 return "none";
+    }
+}
+
+// Steps the system clock on large differences, otherwise lets adjtime() slew it
+void TimeService::syncSystemClock() {
+    if (!syncClock) return;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t system     = (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+    int64_t target     = utcMicros();
+    int64_t difference = target - system;
+    if (difference > TIME_STEP_US || difference < -TIME_STEP_US) {
+        struct timeval set = { (time_t)(target / 1000000LL), (suseconds_t)(target % 1000000LL) };
+        settimeofday(&set, NULL);
+    } else {
+        struct timeval delta = { (time_t)(difference / 1000000LL), (suseconds_t)(difference % 1000000LL) };
+        adjtime(&delta, NULL);
+    }
+}
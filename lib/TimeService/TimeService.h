@@ -0,0 +1,127 @@
+#ifndef TIMESERVICE_H
+#define TIMESERVICE_H
+
+#include <Arduino.h>
+#include "types.h"
+#include "datetime.h"
+
+// Time sources offered to the service
+#define TIME_SOURCE_NTP           0
+#define TIME_SOURCE_GPS           1
+#define TIME_SOURCES              2
+
+// What the current time comes from, reported by source()
+#define TIME_FROM_NONE            0
+#define TIME_FROM_NTP             1
+#define TIME_FROM_GPS             2
+#define TIME_FROM_BLEND           3
+#define TIME_FROM_HOLDOVER        4
+
+// Error of a GPS time without PPS: the NMEA sentence trails the second it stamps
+#ifndef TIME_GPS_ERROR_US
+#define TIME_GPS_ERROR_US         200000
+#endif
+// Added to half the NTP round trip for the error of an NTP time
+#define TIME_NTP_ERROR_US         1000
+// Error growth since the last sample, before and after the drift is learned
+#define TIME_WANDER_PPM           50
+#define TIME_LEARNED_WANDER_PPM   5
+// A source is dropped once its error grows past this or it stays silent this long
+#define TIME_MAX_ERROR_US         2000000
+#define TIME_SOURCE_STALE_MS      3600000UL
+// Span of samples drift is learned over. The span also has to be long enough
+// for the two samples' errors to leave at most TIME_DRIFT_MAX_ERROR_PPB, which
+// for a GPS time without PPS (2 x 200 ms) takes about a day, for NTP an hour or so.
+#define TIME_DRIFT_MIN_SPAN_US    60000000LL
+#define TIME_DRIFT_MAX_SPAN_US    (14LL * 24 * 3600 * 1000000LL)
+#ifndef TIME_DRIFT_MAX_ERROR_PPB
+#define TIME_DRIFT_MAX_ERROR_PPB  5000
+#endif
+#define TIME_MAX_DRIFT_PPB        500000
+// How often sources are re-evaluated without new samples
+#define TIME_EVAL_MS              1000
+// Output and system clock: larger differences are stepped, smaller ones slewed
+#define TIME_STEP_US              128000
+// Fastest slew of the output clock, as in adjtime()
+#define TIME_SLEW_PPM             500
+
+// Fuses NTP and GPS into one clock. Every source keeps its last sample, an
+// error that grows with its age and a drift learned from its samples. The
+// source with the smallest error wins; two that agree within their errors
+// are blended. When both are lost the clock holds over on the local
+// oscillator with the learned drift. Runs on esp_timer and slews toward a
+// new estimate instead of jumping, so the result is monotonic and immune to
+// loop stalls; only differences over TIME_STEP_US are stepped.
+class TimeService {
+public:
+    TimeService(int32_t zoneOffset);
+
+    // A source's UTC time in microseconds, read at localUs (esp_timer_get_time())
+    void offer(uint8_t source, int64_t utcUs, int64_t localUs, uint32_t errorUs);
+    // Call every loop, cheap between samples
+    void update();
+
+    bool valid() const { return haveTime; }
+    int64_t utcMicros() const;                    // 0 until a source was seen
+    int64_t utcMicros(int64_t localUs) const;     // At an esp_timer time
+    int64_t localFromUtc(int64_t utcUs) const;    // esp_timer time of a UTC instant, 0 without time
+    uint32_t unixtime() const;                    // UTC seconds
+    // Local broken-down time, zeroed until a source was seen
+    const RTCDateTime& dateTime();
+
+    uint8_t source() const { return current; }
+    static const char* sourceName(uint8_t source);
+    uint32_t errorUs() const;                     // Includes the correction still being slewed in
+    int32_t driftPpb() const { return freqPpb; }
+    bool driftKnown() const { return freqKnown; }
+    // Counts re-bases of the output clock (every evaluation with a source); a
+    // change means times mapped through localFromUtc() before may have moved
+    uint32_t generation() const { return baseGeneration; }
+    uint32_t holdoverSeconds() const;
+    int32_t sourceAgeSeconds(uint8_t source) const;   // -1 if the source never answered
+    void setSystemClock(bool enabled) { syncClock = enabled; }
+
+private:
+    struct Source {
+        bool     valid;
+        int64_t  localUs;         // Last sample: local time and UTC - local at that instant
+        int64_t  offsetUs;
+        uint32_t errorUs;
+        int64_t  anchorLocalUs;   // Start of the span drift is learned over
+        int64_t  anchorOffsetUs;
+        uint32_t anchorErrorUs;
+        int32_t  driftPpb;
+        bool     driftKnown;
+    };
+
+    int64_t sourceUtc(const Source& source, int64_t localUs) const;
+    uint32_t sourceError(const Source& source, int64_t localUs) const;
+    void adopt(int64_t localUs, int64_t utcUs, uint32_t errorUs, int32_t driftPpb, uint8_t from);
+    void syncSystemClock();
+    int64_t slewAt(int64_t elapsedUs) const;
+
+    int32_t zoneOffset;
+    Source sources[TIME_SOURCES];
+
+    // Output clock: UTC = baseUtcUs + elapsed * (1 + freqPpb) + slewAt(elapsed), elapsed
+    // since baseLocalUs. slewUs is the phase correction still to bleed in from the base.
+    bool haveTime;
+    int64_t baseLocalUs;
+    int64_t baseUtcUs;
+    int32_t freqPpb;
+    bool freqKnown;
+    int64_t slewUs;
+    uint32_t baseGeneration;
+    uint32_t baseErrorUs;
+    uint8_t current;
+    int64_t holdoverSinceUs;
+
+    bool pending;                 // A sample arrived since the last evaluation
+    unsigned long lastEvaluation;
+    bool syncClock;
+
+    CachedDateTime calendar;
+    RTCDateTime noTime;
+};
+
+#endif
@@ -1,14 +1,32 @@
 #include <WiFi.h>
-#include <PubSubClient.h>
+#include "MqttTransport.h"
 #include <ArduinoJson.h> // JSON library for handling status in JSON format
 #include "secrets.h"
 #include "OTAHandler.h"
 #include <time.h>  // For time management
+#include <sys/time.h>
 #include "BusinessLogicHandler.h"
+#include "hash.h"
+#include "backoff.h"
+#include "NetworkCache.h"
+#include "BrokerSelector.h"
+
+// Wall clock before this is "not synchronised yet", publish slots fall back to millis()
+#define WALL_CLOCK_VALID_SEC      1577836800UL   // 2020-01-01
+// With MQTT 5 status goes at QoS0 so its topic alias can replace the topic (aliases
+// only apply to QoS0, see MqttTransport); with 3.1.1 it is QoS1 and counted as delivered
+#ifndef MQTT_STATUS_QOS
+#if MQTT_TRANSPORT_V5
+#define MQTT_STATUS_QOS           0
+#else
+#define MQTT_STATUS_QOS           1
+#endif
+#endif
 
 // Global objects
-WiFiClient wifiClient;
-PubSubClient mqttClient(wifiClient);
+MqttTransport mqttClient;
+NetworkCache networkCache;   // Last good AP, lease and DNS answers
+BrokerSelector brokers(networkCache);
 
 // Instantiate OTAHandler with the existing mqttClient
 OTAHandler otaHandler(mqttClient);
@@ -19,7 +37,11 @@ BusinessLogicHandler* businessLogicHandler;
 // Function prototypes
 void setup_wifi();
 bool connectToMQTT();
+unsigned long mqttAttemptFailed();
+void onMQTTConnected();
+void onMQTTDelivery(uint32_t token, bool delivered);
 String getFormattedMAC();
+bool statusSlotDue(uint32_t interval);
 void mqttCallback(char* topic, byte* payload, unsigned int length);
 
 // Abstract business logic function prototypes
@@ -31,33 +53,60 @@ String macAddress;
 String commandTopic;
 String statusTopic;
 String aliveTopic;
+uint32_t commandTopicHash = 0;    // Precomputed so incoming topics are matched by hash
+const uint32_t firmwareTopicHash = hashString(MQTT_FIRMWARE_UPDATE_TOPIC);
+uint32_t publishSlotHash = 0;     // Picks this device's phase inside the status interval
+uint8_t mqttFailures = 0;         // Consecutive connection attempts without success
+bool mqttJitterPending = true;    // Next connection attempt starts with a random delay
+bool mqttAttempting = false;      // connect() started, waiting for the transport's outcome
+unsigned long mqttDownSince = 0;  // millis() when the broker connection was lost, 0 while connected
 
 void setup() {
     Serial.begin(115200);
     Serial.println("Booting...");
 
-    // Connect to Wi-Fi
+    // Restore settings and drive the output before anything waits for the network.
+    // The MAC comes from eFuse, Wi-Fi does not have to be started for it.
+    macAddress = getFormattedMAC();
+    businessLogicHandler = new BusinessLogicHandler(mqttClient, macAddress);
+
+    // Connect to Wi-Fi, through the cached access point and lease when possible
+    networkCache.begin();
+    brokers.begin();   // Adds the broker hosts to the cache
     setup_wifi();
-    configTime(25200, 0, "pool.ntp.org", "time.nist.gov");
-    Serial.println("Waiting for time synchronization...");
+    // The system clock is set by the business logic's time service; its NTP
+    // server names are looked up through the cache like the brokers
+    businessLogicHandler->beginNetwork(networkCache);
 
-    // Set MQTT server and callback function
+    // Set MQTT server and callback functions
+    // The broker is chosen per attempt in connectToMQTT()
     mqttClient.setServer(MQTT_SERVER, MQTT_PORT);
     mqttClient.setCallback(mqttCallback);
-    mqttClient.setBufferSize(512);
+    mqttClient.setConnectCallback(onMQTTConnected);
+    mqttClient.setDeliveryCallback(onMQTTDelivery);
+    mqttClient.setBufferSize(2048);
+    mqttClient.setInflightWindow(MQTT_DEFAULT_INFLIGHT);
+#ifdef MQTT_CA_CERT
+    // TLS when secrets.h provides the broker CA (MQTT_PORT is then usually 8883)
+#if defined(MQTT_CLIENT_CERT) && defined(MQTT_CLIENT_KEY)
+    mqttClient.setTls(MQTT_CA_CERT, MQTT_CLIENT_CERT, MQTT_CLIENT_KEY);
+#else
+    mqttClient.setTls(MQTT_CA_CERT);
+#endif
+#endif
 
-    // Connect to MQTT broker
-    if (connectToMQTT()) {
-        // Initialize OTA functionality (subscribe to OTA topic)
-        otaHandler.setupOTA();
-    } else {
-        Serial.println("Failed to connect to MQTT broker in setup.");
-    }
+    // Connecting to the MQTT broker starts from loop() after a random delay,
+    // subscriptions follow in onMQTTConnected()
 
     // Additional setup code if needed
-    // Instantiate business logic handler after Wi-Fi is connected
-    macAddress = getFormattedMAC();
-    businessLogicHandler = new BusinessLogicHandler(mqttClient, macAddress);
+    commandTopic = MQTT_COMMAND_TOPIC_PREFIX + macAddress + MQTT_COMMAND_TOPIC_SUFFIX;
+    statusTopic = MQTT_STATUS_TOPIC_PREFIX + macAddress + MQTT_STATUS_TOPIC_SUFFIX;
+    aliveTopic = MQTT_ALIVE_TOPIC_PREFIX + macAddress + MQTT_ALIVE_TOPIC_SUFFIX;
+    commandTopicHash = hashBytes(commandTopic.c_str(), commandTopic.length());
+    // MQTT 5: status goes out through a topic alias. Alive is QoS1 and sent once
+    // per connection, an alias would only add its announcement.
+    mqttClient.setTopicAlias(statusTopic.c_str());
+    publishSlotHash = hashBytes(macAddress.c_str(), macAddress.length());
 }
 
 void loop() {
@@ -65,26 +114,72 @@ void loop() {
     if (WiFi.status() != WL_CONNECTED) {
         setup_wifi();
     }
+    // Takes in DNS answers and looks up cached addresses that got old
+    networkCache.refresh();
 
     // Reconnect to MQTT if disconnected
     if (!mqttClient.connected()) {
-        if (connectToMQTT()) {
-            // Resubscribe to necessary topics
-            mqttClient.subscribe(commandTopic.c_str());
-            otaHandler.setupOTA(); // Resubscribe to OTA topic
-        }
+        if (mqttDownSince == 0) mqttDownSince = millis() | 1;
+        connectToMQTT();
     }
-    
+
+    // Deliver received commands and publish results queued by the transport task
     mqttClient.loop();
     businessLogicHandler->update();  // Call update method in BusinessLogicHandler
-    // Business logic: Publish device status at regular intervals
+    // Business logic: Publish device status once per interval, in this device's slot.
+    // The interval follows link quality, see LinkMonitor.
+    uint32_t interval = businessLogicHandler->statusInterval();
+    if (statusSlotDue(interval)) {
+        String status = businessLogicHandler->getStatus();  // Use getStatus from BusinessLogicHandler
+        // A status older than two intervals is not worth delivering after a reconnect
+        uint32_t expirySec = 2 * interval / 1000;
+        uint32_t token = mqttClient.publish(statusTopic.c_str(), status.c_str(), MQTT_STATUS_QOS, false,
+                                            MQTT_LANE_TELEMETRY, expirySec > 0 ? expirySec : 1);
+        if (token == 0) businessLogicHandler->onDelivery(false);  // Outbox full counts as lost
+    }
+}
+
+// True once per interval, at wall-clock time k * interval + offset, where FNV-1a of
+// the MAC picks the offset. Devices therefore keep their slot across reboots and
+// power restores instead of all publishing on their own millis() phase that starts together.
+bool statusSlotDue(uint32_t interval) {
+    static bool slotValid = false;
+    static uint64_t lastSlot = 0;
+    static uint32_t lastInterval = 0;
     static unsigned long lastStatusPublish = 0;
+
+    if (interval == 0) return false;
+    uint32_t publishSlotOffset = statusSlotOffset(publishSlotHash, interval);
+    if (interval != lastInterval) {
+        // Slots are numbered per interval, start over at the next slot of the new one
+        lastInterval = interval;
+        slotValid = false;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec >= WALL_CLOCK_VALID_SEC) {
+        uint64_t wallMs = (uint64_t)tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+        uint64_t slot = statusSlotIndex(wallMs, publishSlotOffset, interval);
+        if (!slotValid) {
+            // Wait for our own slot rather than publishing on the clock sync edge
+            slotValid = true;
+            lastSlot = slot;
+            return false;
+        }
+        if (slot == lastSlot) return false;
+        lastSlot = slot;
+        return true;
+    }
+
+    // No wall clock yet: keep the millis() cadence, phase-shifted by the same offset
     unsigned long now = millis();
-    if (now - lastStatusPublish > status_interval) { // Publish status every 5 seconds
-        String status = businessLogicHandler->getStatus();  // Use getStatus from BusinessLogicHandler
-        bool success = mqttClient.publish(statusTopic.c_str(), status.c_str());
+    if (lastStatusPublish == 0) lastStatusPublish = now + publishSlotOffset - interval;
+    if (now - lastStatusPublish > interval) {
         lastStatusPublish = now;
+        return true;
     }
+    return false;
 }
 
 // Function to connect to Wi-Fi
@@ -92,106 +187,196 @@ void setup_wifi() {
     Serial.print("Connecting to Wi-Fi: ");
     Serial.println(WIFI_SSID);
 
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-
-    int max_attempts = 20;
-    int attempt = 0;
-    while (WiFi.status() != WL_CONNECTED && attempt < max_attempts) {
-        delay(500);
-        Serial.print(".");
-        attempt++;
-    }
-
-    if (WiFi.status() == WL_CONNECTED) {
-        Serial.println("\nWi-Fi connected");
+    if (networkCache.connect(WIFI_SSID, WIFI_PASSWORD)) {
+        Serial.printf("Wi-Fi connected in %u ms (%s)\n", (unsigned)networkCache.connectMillis(),
+                      networkCache.connectedFast() ? "cached AP" : "full scan");
+        // Starts lookups for hosts not cached yet, or everything after joining through a scan
+        networkCache.refresh();
+        if (businessLogicHandler != nullptr) {
+            businessLogicHandler->setLinkStats(networkCache.connectMillis(), networkCache.connectedFast());
+        }
         // Get and format MAC address
         macAddress = getFormattedMAC();
-        commandTopic = MQTT_COMMAND_TOPIC_PREFIX + macAddress + MQTT_COMMAND_TOPIC_SUFFIX;
-        statusTopic = MQTT_STATUS_TOPIC_PREFIX + macAddress + MQTT_STATUS_TOPIC_SUFFIX;
         Serial.print("MAC Address: ");
         Serial.println(macAddress);
     } else {
-        Serial.println("\nFailed to connect to Wi-Fi");
+        Serial.println("Failed to connect to Wi-Fi");
         // Implement retry logic or enter deep sleep
     }
 }
 
-// Function to connect to MQTT broker with Last Will and Testament
+// Function to start a connection to the MQTT broker with Last Will and Testament.
+// Non-blocking: the transport connects in its own task. An attempt runs until
+// the broker answers, the transport reports a failure or MQTT_CONNECT_TIMEOUT_MS
+// passes; only then the next one is spaced by exponential backoff with jitter,
+// so a fleet coming back after a broker or grid outage does not reconnect in lockstep.
 bool connectToMQTT() {
-    while (!mqttClient.connected()) {
-        Serial.print("Connecting to MQTT broker at ");
-        Serial.print(MQTT_SERVER);
-        Serial.print(":");
-        Serial.println(MQTT_PORT);
-
-        srand(time(0));  // Seed the random number generator
-        int randomId = rand();
-        String clientId = macAddress + "-" + String(randomId);
-
-        // Define Last Will and Testament
-        aliveTopic = MQTT_ALIVE_TOPIC_PREFIX + macAddress + MQTT_ALIVE_TOPIC_SUFFIX;
-
-        const char* willMessage = "0";
-        int willQoS = 1;
-        bool willRetain = true;
-
-        // Attempt to connect with LWT
-        if (mqttClient.connect(clientId.c_str(),
-                               NULL, NULL,          // Username and password if required
-                               aliveTopic.c_str(),
-                               willQoS,
-                               willRetain,
-                               willMessage)) {
-            Serial.println("Connected to MQTT broker");
-
-            // Publish alive message upon connection
-            mqttClient.publish(aliveTopic.c_str(), "1", true);
-            Serial.print("Published to: ");
-            Serial.println(aliveTopic);
-            Serial.println("Message: 1");
-
-            // Subscribe to business logic topic
-            mqttClient.subscribe(commandTopic.c_str());
-            Serial.print("Subscribed to: ");
-            Serial.println(commandTopic);
-        } else {
-            Serial.print("Failed to connect to MQTT, rc=");
-            Serial.print(mqttClient.state());
-            Serial.println(". Trying again in 5 seconds...");
-            delay(5000);
+    static unsigned long lastAttempt = 0;
+    static unsigned long retryDelay = 0;
+    static bool racing = false;
+
+    if (mqttAttempting) {
+        // A slow TCP or TLS handshake is left to finish
+        if (mqttClient.state() == MQTT_TRANSPORT_CONNECTING) return false;
+        mqttAttempting = false;
+        Serial.print("Failed to connect to MQTT, rc=");
+        Serial.println(mqttClient.state());
+        brokers.reportFailed();
+        retryDelay = mqttAttemptFailed();
+        lastAttempt = millis();
+        return false;
+    }
+
+    if (!racing) {
+        if (mqttJitterPending) {
+            // First attempt after boot or after losing the broker: spread over MQTT_RECONNECT_JITTER_MS
+            mqttJitterPending = false;
+            lastAttempt = millis();
+            retryDelay = reconnectJitter(esp_random());
         }
+        if (millis() - lastAttempt < retryDelay) {
+            return false;
+        }
+        racing = true;
+    }
+
+    // Race the candidate brokers, polled from loop() until one answers
+    BrokerRace race = brokers.race();
+    if (race == BROKER_RACE_PENDING) return false;
+    racing = false;
+    if (race == BROKER_RACE_FAILED) {
+        retryDelay = mqttAttemptFailed();
+        lastAttempt = millis();
+        return false;
+    }
+
+    const Broker& broker = brokers.selected();
+#ifdef MQTT_CA_CERT
+    mqttClient.setServer(broker.host.c_str(), broker.port);   // TLS checks the certificate against the name
+#else
+    mqttClient.setServer(brokers.selectedAddress(), broker.port);
+#endif
+
+    Serial.print("Connecting to MQTT broker at ");
+    Serial.print(broker.host);
+    Serial.print(":");
+    Serial.println(broker.port);
+
+#if MQTT_TRANSPORT_V5
+    // The broker keeps the session under the client id, so it must survive reboots
+    String clientId = macAddress;
+#else
+    srand(time(0));  // Seed the random number generator
+    int randomId = rand();
+    String clientId = macAddress + "-" + String(randomId);
+#endif
+
+    // Define Last Will and Testament on aliveTopic
+    const char* willMessage = "0";
+    int willQoS = 1;
+    bool willRetain = true;
+
+    // Start the connection attempt with LWT
+    mqttAttempting = mqttClient.connect(clientId.c_str(),
+                                        NULL, NULL,          // Username and password if required
+                                        aliveTopic.c_str(),
+                                        willQoS,
+                                        willRetain,
+                                        willMessage);
+    if (!mqttAttempting) {
+        brokers.reportFailed();
+        retryDelay = mqttAttemptFailed();
+        lastAttempt = millis();
     }
-    return mqttClient.connected();
+    return mqttAttempting;
+}
+
+// Counts a failed attempt and returns the backoff before the next one
+unsigned long mqttAttemptFailed() {
+    unsigned long wait = reconnectDelay(mqttFailures, esp_random());
+    if (mqttFailures < 255) mqttFailures++;
+    return wait;
 }
 
-// MQTT callback function
+// Called from mqttClient.loop() once the broker accepted the connection
+void onMQTTConnected() {
+    bool resumed = mqttClient.sessionPresent();
+    Serial.printf("Connected to MQTT broker in %u ms%s\n", (unsigned)mqttClient.connectMillis(),
+                  resumed ? ", session resumed" : "");
+    if (mqttClient.tlsHandshakeMillis() > 0) {
+        Serial.printf("TLS handshake %u ms%s\n", (unsigned)mqttClient.tlsHandshakeMillis(),
+                      mqttClient.tlsSessionOffered() ? ", cached session offered" : "");
+    }
+    mqttFailures = 0;
+    mqttAttempting = false;
+    mqttJitterPending = true;
+    brokers.reportConnected(mqttClient.connectMillis());
+    if (businessLogicHandler != nullptr) {
+        businessLogicHandler->setBrokerStats(brokers.selected().host.c_str(), millis() - mqttDownSince);
+    }
+    mqttDownSince = 0;
+
+    // Publish alive message upon connection
+    mqttClient.publish(aliveTopic.c_str(), "1", 1, true, MQTT_LANE_CONTROL);
+    Serial.print("Published to: ");
+    Serial.println(aliveTopic);
+    Serial.println("Message: 1");
+
+    // Subscribe to business logic topic, unless the broker kept our subscriptions
+    if (!resumed) {
+        mqttClient.subscribe(commandTopic.c_str(), 1);
+        Serial.print("Subscribed to: ");
+        Serial.println(commandTopic);
+    }
+
+    // Subscribe to group command topics and sync the device twin
+    if (businessLogicHandler != nullptr) {
+        businessLogicHandler->onConnected(resumed);
+    }
+
+    // Initialize OTA functionality (subscribe to OTA topic)
+    if (!resumed) otaHandler.setupOTA();
+}
+
+// Called from mqttClient.loop() when a queued publish is acknowledged or given up
+void onMQTTDelivery(uint32_t token, bool delivered) {
+    if (businessLogicHandler != nullptr) businessLogicHandler->onDelivery(delivered);
+    if (!delivered) {
+        Serial.print("MQTT publish not acknowledged, token ");
+        Serial.println(token);
+    }
+}
+
+// MQTT callback function. The transport hands over a mutable, NUL-terminated
+// payload buffer that is parsed in place without copying it into a String.
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
     if (businessLogicHandler == nullptr) {
         Serial.println("Business logic handler not initialized yet.");
         return;
     }
-    
-    String topicStr = String(topic);
-    String message;
-    for (unsigned int i = 0; i < length; i++) {
-        message += (char)payload[i];
-    }
+
+    char* message = reinterpret_cast<char*>(payload);
+    uint32_t topicHash = hashString(topic);
 
     Serial.print("Main - Message arrived on topic: ");
-    Serial.println(topicStr);
-    Serial.print("Main - Message: ");
-    Serial.println(message);
+    Serial.print(topic);
+    Serial.print(", ");
+    Serial.print(length);
+    Serial.println(" bytes");
 
     // Handle OTA messages
-    if (topicStr == MQTT_FIRMWARE_UPDATE_TOPIC) {
+    if (topicHash == firmwareTopicHash && strcmp(topic, MQTT_FIRMWARE_UPDATE_TOPIC) == 0) {
         businessLogicHandler->deviceLCD.print("OTA updating...");
         otaHandler.handleOtaMessage(message);
     }
-    // Handle business logic messages
-    else if (topicStr == commandTopic) {
-        Serial.println("Main - Processing business logic command...");
-        businessLogicHandler->handleCommand(message);  // Handle the command logic
+    // Handle business logic messages, sent to this device or to one of its groups
+    else if ((topicHash == commandTopicHash && commandTopic == topic) ||
+             businessLogicHandler->isCommandTopic(topic, topicHash)) {
+        businessLogicHandler->enqueueCommand(message, length);  // Queued, runs from update()
+    }
+    // Handle desired-state updates of the device twin
+    else if (businessLogicHandler->isTwinTopic(topic, topicHash)) {
+        businessLogicHandler->handleTwinDesired(message, length);
     }
 }
 
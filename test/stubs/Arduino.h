@@ -0,0 +1,114 @@
+#ifndef ARDUINO_STUB_H
+#define ARDUINO_STUB_H
+
+// Just enough of the Arduino core for the host-side tests in [env:native]:
+// the integer types, a clock, String and Serial.
+
+#ifndef ARDUINO
+#define ARDUINO 100
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+typedef uint8_t byte;
+
+#define PI          3.1415926535897932384626433832795
+#define TWO_PI      6.283185307179586476925286766559
+#define radians(deg) ((deg) * (PI / 180.0))
+#define degrees(rad) ((rad) * (180.0 / PI))
+#define sq(x)        ((x) * (x))
+
+inline unsigned long micros() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return (unsigned long)duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+inline unsigned long millis() {
+  return micros() / 1000;
+}
+
+inline void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// Not in every C library, renamed so it never clashes with one that has it
+inline size_t hostStrlcpy(char* destination, const char* source, size_t size) {
+  size_t length = strlen(source);
+  if (size > 0) {
+    size_t copied = length < size - 1 ? length : size - 1;
+    memcpy(destination, source, copied);
+    destination[copied] = '\0';
+  }
+  return length;
+}
+#define strlcpy hostStrlcpy
+
+// The String members the libraries use
+class String {
+  public:
+    String(const char* text = "") : text(text != nullptr ? text : "") {}
+    String(const std::string& text) : text(text) {}
+
+    const char* c_str() const { return text.c_str(); }
+    unsigned int length() const { return text.length(); }
+    bool operator==(const char* other) const { return text == other; }
+    bool operator==(const String& other) const { return text == other.text; }
+    String operator+(const String& other) const { return String(text + other.text); }
+    String& operator+=(const String& other) { text += other.text; return *this; }
+
+    int indexOf(char c, unsigned int from = 0) const {
+      size_t found = text.find(c, from);
+      return found == std::string::npos ? -1 : (int)found;
+    }
+    int lastIndexOf(char c) const {
+      size_t found = text.rfind(c);
+      return found == std::string::npos ? -1 : (int)found;
+    }
+    String substring(unsigned int from, unsigned int to) const { return String(text.substr(from, to - from)); }
+    String substring(unsigned int from) const { return String(text.substr(from)); }
+    long toInt() const { return atol(text.c_str()); }
+    void trim() {
+      size_t first = text.find_first_not_of(" \t\r\n");
+      size_t last = text.find_last_not_of(" \t\r\n");
+      text = first == std::string::npos ? "" : text.substr(first, last - first + 1);
+    }
+
+  private:
+    std::string text;
+};
+
+inline String operator+(const char* left, const String& right) { return String(left) + right; }
+
+// Quiet unless a test sets verbose
+class HostSerial {
+  public:
+    bool verbose = false;
+
+    void printf(const char* format, ...) {
+      if (!verbose) return;
+      va_list args;
+      va_start(args, format);
+      vprintf(format, args);
+      va_end(args);
+    }
+    void print(const char* text) { if (verbose) fputs(text, stdout); }
+    void print(const String& text) { print(text.c_str()); }
+    void print(long value) { if (verbose) printf("%ld", value); }
+    void println(const char* text = "") { if (verbose) puts(text); }
+    void println(const String& text) { println(text.c_str()); }
+    void println(long value) { if (verbose) printf("%ld\n", value); }
+};
+
+inline HostSerial Serial;
+
+#endif // ARDUINO_STUB_H
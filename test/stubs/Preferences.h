@@ -0,0 +1,47 @@
+#ifndef PREFERENCES_STUB_H
+#define PREFERENCES_STUB_H
+
+// NVS in memory, shared by every Preferences object and lost when the test exits
+
+#include "Arduino.h"
+#include <map>
+#include <vector>
+
+class Preferences {
+  public:
+    bool begin(const char* name, bool = false) {
+      space = name;
+      return true;
+    }
+    void end() {}
+
+    size_t getBytes(const char* key, void* buffer, size_t length) {
+      auto found = storage().find(space + "/" + key);
+      if (found == storage().end() || found->second.size() > length) return 0;
+      memcpy(buffer, found->second.data(), found->second.size());
+      return found->second.size();
+    }
+    size_t putBytes(const char* key, const void* value, size_t length) {
+      const uint8_t* bytes = (const uint8_t*)value;
+      storage()[space + "/" + key].assign(bytes, bytes + length);
+      return length;
+    }
+    uint32_t getUInt(const char* key, uint32_t fallback = 0) {
+      uint32_t value;
+      return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : fallback;
+    }
+    size_t putUInt(const char* key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+    bool remove(const char* key) { return storage().erase(space + "/" + key) > 0; }
+
+    static void clearAll() { storage().clear(); }
+
+  private:
+    static std::map<std::string, std::vector<uint8_t>>& storage() {
+      static std::map<std::string, std::vector<uint8_t>> entries;
+      return entries;
+    }
+
+    std::string space;
+};
+
+#endif // PREFERENCES_STUB_H
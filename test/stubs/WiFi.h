@@ -0,0 +1,66 @@
+#ifndef WIFI_STUB_H
+#define WIFI_STUB_H
+
+// The host is already on the network: connecting always succeeds and names
+// resolve through the host's resolver, so socket code runs against real
+// local listeners.
+
+#include "Arduino.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#define WIFI_STA      1
+#define WL_CONNECTED  3
+
+// Address in network byte order, like the core's, so (uint32_t) fits s_addr
+class IPAddress {
+  public:
+    IPAddress(uint32_t address = 0) : address(address) {}
+
+    operator uint32_t() const { return address; }
+    bool fromString(const char* text) {
+      struct in_addr parsed;
+      if (inet_pton(AF_INET, text, &parsed) != 1) return false;
+      address = parsed.s_addr;
+      return true;
+    }
+    String toString() const {
+      char text[INET_ADDRSTRLEN];
+      struct in_addr raw = { address };
+      return String(inet_ntop(AF_INET, &raw, text, sizeof(text)));
+    }
+
+  private:
+    uint32_t address;
+};
+
+class WiFiClass {
+  public:
+    void persistent(bool) {}
+    void mode(int) {}
+    void config(IPAddress, IPAddress, IPAddress, IPAddress = IPAddress(), IPAddress = IPAddress()) {}
+    void begin(const char*, const char*, int32_t = 0, const uint8_t* = nullptr, bool = true) {}
+    void disconnect() {}
+    int status() const { return WL_CONNECTED; }
+    const uint8_t* BSSID() const { static const uint8_t bssid[6] = {}; return bssid; }
+    int32_t channel() const { return 1; }
+    IPAddress localIP() const { return IPAddress(htonl(INADDR_LOOPBACK)); }
+    IPAddress gatewayIP() const { return IPAddress(); }
+    IPAddress subnetMask() const { return IPAddress(); }
+    IPAddress dnsIP(uint8_t = 0) const { return IPAddress(); }
+
+    bool hostByName(const char* host, IPAddress& result) {
+      if (result.fromString(host)) return true;
+      struct addrinfo hints = {};
+      hints.ai_family = AF_INET;
+      struct addrinfo* found = nullptr;
+      if (getaddrinfo(host, nullptr, &hints, &found) != 0 || found == nullptr) return false;
+      result = IPAddress(((struct sockaddr_in*)found->ai_addr)->sin_addr.s_addr);
+      freeaddrinfo(found);
+      return true;
+    }
+};
+
+inline WiFiClass WiFi;
+
+#endif // WIFI_STUB_H
@@ -0,0 +1,41 @@
+#ifndef LWIP_DNS_STUB_H
+#define LWIP_DNS_STUB_H
+
+#include <stdint.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+// lwIP's asynchronous resolver, answered at once through the host's resolver.
+// The callback is never called: every lookup ends in ERR_OK or an error.
+
+typedef int8_t err_t;
+#define ERR_OK          0
+#define ERR_INPROGRESS -5
+#define ERR_VAL        -6
+#define ERR_ARG        -16
+
+typedef struct {
+  uint32_t addr;   // Network order, as lwIP keeps it
+} ip_addr_t;
+
+#define ip_addr_get_ip4_u32(ipaddr) ((ipaddr) != nullptr ? (ipaddr)->addr : 0)
+
+typedef void (*dns_found_callback)(const char* name, const ip_addr_t* ipaddr, void* callback_arg);
+
+inline err_t dns_gethostbyname(const char* hostname, ip_addr_t* addr, dns_found_callback, void*) {
+  if (hostname == nullptr || addr == nullptr) return ERR_ARG;
+  struct in_addr parsed;
+  if (inet_pton(AF_INET, hostname, &parsed) == 1) {
+    addr->addr = parsed.s_addr;
+    return ERR_OK;
+  }
+  struct addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  struct addrinfo* found = nullptr;
+  if (getaddrinfo(hostname, nullptr, &hints, &found) != 0 || found == nullptr) return ERR_VAL;
+  addr->addr = ((struct sockaddr_in*)found->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(found);
+  return ERR_OK;
+}
+
+#endif // LWIP_DNS_STUB_H
@@ -0,0 +1,11 @@
+#ifndef LWIP_SOCKETS_STUB_H
+#define LWIP_SOCKETS_STUB_H
+
+// lwIP's BSD socket API is the host's own
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#endif // LWIP_SOCKETS_STUB_H
@@ -0,0 +1,10 @@
+#ifndef SECRETS_STUB_H
+#define SECRETS_STUB_H
+
+// Placeholders for the host-side tests; the device build uses include/secrets.h
+#define WIFI_SSID       "native"
+#define WIFI_PASSWORD   ""
+#define MQTT_SERVER     "localhost"
+#define MQTT_PORT       1883
+
+#endif // SECRETS_STUB_H
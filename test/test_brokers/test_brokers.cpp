@@ -0,0 +1,244 @@
+#include <unity.h>
+#include <lwip/sockets.h>
+#include <fcntl.h>
+#include "BrokerSelector.h"
+
+// BrokerSelector racing real TCP connects against stand-in brokers on the
+// loopback interface. A stand-in is up (listening), down (port closed, the
+// connect is refused) or silent (accept queue full, the connect hangs like a
+// broker behind a dead route). Failover times are reported as the race sees
+// them; the MQTT CONNECT to the winner comes on top.
+
+void setUp() {}
+void tearDown() {}
+
+class StandIn {
+  public:
+    ~StandIn() { stop(); }
+
+    uint16_t port() const { return boundPort; }
+
+    void up() { listenOn(16); }
+    void down() { stop(); }
+
+    // The one queued connection fills a backlog of 0, later handshakes get no answer
+    void silent() {
+        listenOn(0);
+        filler = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        struct sockaddr_in addr = address();
+        TEST_ASSERT_EQUAL_INT(0, connect(filler, (struct sockaddr*)&addr, sizeof(addr)));
+    }
+
+    // Takes and drops the probes, as a broker would close a connection that never sends CONNECT
+    void serve() {
+        if (listener < 0 || filler >= 0) return;
+        int fd;
+        while ((fd = accept(listener, NULL, NULL)) >= 0) close(fd);
+    }
+
+  private:
+    struct sockaddr_in address() const {
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(boundPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return addr;
+    }
+
+    // Keeps its port across down() and up()
+    void listenOn(int backlog) {
+        stop();
+        listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        struct sockaddr_in addr = address();
+        TEST_ASSERT_EQUAL_INT(0, bind(listener, (struct sockaddr*)&addr, sizeof(addr)));
+        TEST_ASSERT_EQUAL_INT(0, listen(listener, backlog));
+        socklen_t length = sizeof(addr);
+        getsockname(listener, (struct sockaddr*)&addr, &length);
+        boundPort = ntohs(addr.sin_port);
+        fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    void stop() {
+        if (filler >= 0) close(filler);
+        if (listener >= 0) close(listener);
+        filler = listener = -1;
+    }
+
+    int listener = -1;
+    int filler = -1;
+    uint16_t boundPort = 0;
+};
+
+// Polls race() the way connectToMQTT() does from loop(), ms spent in elapsed
+static BrokerRace runRace(BrokerSelector& selector, StandIn* standIns, int count, unsigned long& elapsed) {
+    unsigned long started = millis();
+    BrokerRace result;
+    while ((result = selector.race()) == BROKER_RACE_PENDING) {
+        for (int i = 0; i < count; i++) standIns[i].serve();
+        delay(1);
+    }
+    elapsed = millis() - started;
+    return result;
+}
+
+static void report(const char* what, unsigned long elapsed) {
+    char line[96];
+    snprintf(line, sizeof(line), "%s: %lu ms", what, elapsed);
+    TEST_MESSAGE(line);
+}
+
+void test_single_broker_is_not_raced() {
+    NetworkCache cache;
+    BrokerSelector selector(cache);
+    selector.add("127.0.0.1", 1);   // Nothing listens there, the MQTT connect finds out
+    TEST_ASSERT_EQUAL_UINT8(1, selector.count());
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_WON, selector.race());
+    TEST_ASSERT_EQUAL_STRING("127.0.0.1", selector.selectedAddress());
+}
+
+void test_stays_on_a_healthy_current_broker() {
+    StandIn standIns[2];
+    standIns[0].up();
+    standIns[1].up();
+    NetworkCache cache;
+    BrokerSelector selector(cache);
+    selector.add("127.0.0.1", standIns[0].port());
+    selector.add("127.0.0.1", standIns[1].port());
+
+    // Both answer at once on loopback, the second never takes over
+    for (int round = 0; round < 20; round++) {
+        unsigned long elapsed;
+        TEST_ASSERT_EQUAL_INT(BROKER_RACE_WON, runRace(selector, standIns, 2, elapsed));
+        TEST_ASSERT_EQUAL_UINT16(standIns[0].port(), selector.selected().port);
+        selector.reportConnected(5);
+    }
+    TEST_ASSERT_EQUAL_UINT8(0, selector.selected().failures);
+}
+
+void test_fails_over_from_a_refusing_broker() {
+    StandIn standIns[2];
+    standIns[0].up();
+    uint16_t firstPort = standIns[0].port();
+    standIns[0].down();
+    standIns[1].up();
+    NetworkCache cache;
+    BrokerSelector selector(cache);
+    selector.add("127.0.0.1", firstPort);
+    selector.add("127.0.0.1", standIns[1].port());
+
+    unsigned long elapsed;
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_WON, runRace(selector, standIns, 2, elapsed));
+    TEST_ASSERT_EQUAL_UINT16(standIns[1].port(), selector.selected().port);
+    report("Failover from a refusing broker", elapsed);
+    TEST_ASSERT_TRUE(elapsed < 100);
+
+    // Sticky: the first broker coming back does not pull the device over
+    standIns[0].up();
+    for (int round = 0; round < 5; round++) {
+        TEST_ASSERT_EQUAL_INT(BROKER_RACE_WON, runRace(selector, standIns, 2, elapsed));
+        TEST_ASSERT_EQUAL_UINT16(standIns[1].port(), selector.selected().port);
+    }
+}
+
+// The current broker might still answer, so the faster one waits out the grace time
+void test_fails_over_from_a_silent_broker() {
+    StandIn standIns[2];
+    standIns[0].silent();
+    standIns[1].up();
+    NetworkCache cache;
+    BrokerSelector selector(cache);
+    selector.add("127.0.0.1", standIns[0].port());
+    selector.add("127.0.0.1", standIns[1].port());
+
+    unsigned long elapsed;
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_WON, runRace(selector, standIns, 2, elapsed));
+    TEST_ASSERT_EQUAL_UINT16(standIns[1].port(), selector.selected().port);
+    report("Failover from a silent broker", elapsed);
+    TEST_ASSERT_TRUE(elapsed >= BROKER_STICKY_GRACE_MS);
+    TEST_ASSERT_TRUE(elapsed < BROKER_STICKY_GRACE_MS + 150);
+}
+
+// Three brokers, two raced per attempt: the failures push the dead second
+// broker down the order, so the next race tries the third
+void test_health_scores_pick_the_next_candidate() {
+    StandIn standIns[3];
+    for (StandIn& standIn : standIns) standIn.up();
+    NetworkCache cache;
+    BrokerSelector selector(cache);
+    for (StandIn& standIn : standIns) selector.add("127.0.0.1", standIn.port());
+    unsigned long elapsed;
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_WON, runRace(selector, standIns, 3, elapsed));
+    selector.reportConnected(5);
+
+    standIns[0].down();
+    standIns[1].down();
+    unsigned long total = 0;
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_FAILED, runRace(selector, standIns, 3, elapsed));
+    total += elapsed;
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_WON, runRace(selector, standIns, 3, elapsed));
+    total += elapsed;
+    TEST_ASSERT_EQUAL_UINT16(standIns[2].port(), selector.selected().port);
+    report("Failover to the third broker, two races", total);
+    TEST_ASSERT_TRUE(total < 100);
+    TEST_ASSERT_TRUE(selector.selected().score < BROKER_FAILURE_PENALTY);
+}
+
+// A name goes through the cache's lookup, the race itself never resolves
+void test_named_broker_is_looked_up_through_the_cache() {
+    StandIn standIns[2];
+    standIns[0].up();
+    uint16_t firstPort = standIns[0].port();
+    standIns[0].down();
+    standIns[1].up();
+    NetworkCache cache;
+    BrokerSelector selector(cache);
+    selector.add("127.0.0.1", firstPort);
+    selector.add("localhost", standIns[1].port());
+    TEST_ASSERT_EQUAL_UINT32(0, (uint32_t)cache.cachedIp("localhost"));
+
+    unsigned long elapsed;
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_WON, runRace(selector, standIns, 2, elapsed));
+    TEST_ASSERT_EQUAL_STRING("localhost", selector.selected().host.c_str());
+    TEST_ASSERT_EQUAL_STRING("127.0.0.1", selector.selectedAddress());
+    TEST_ASSERT_EQUAL_STRING("127.0.0.1", cache.address("localhost"));
+}
+
+void test_no_broker_answers() {
+    StandIn standIns[2];
+    standIns[0].up();
+    standIns[1].up();
+    uint16_t ports[2] = { standIns[0].port(), standIns[1].port() };
+    standIns[0].down();
+    standIns[1].down();
+    NetworkCache cache;
+    BrokerSelector selector(cache);
+    selector.add("127.0.0.1", ports[0]);
+    selector.add("127.0.0.1", ports[1]);
+
+    // Refused everywhere: known at once
+    unsigned long elapsed;
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_FAILED, runRace(selector, standIns, 2, elapsed));
+    TEST_ASSERT_TRUE(elapsed < 100);
+
+    // Silent everywhere: given up after the race timeout
+    standIns[0].silent();
+    standIns[1].silent();
+    TEST_ASSERT_EQUAL_INT(BROKER_RACE_FAILED, runRace(selector, standIns, 2, elapsed));
+    report("Race with every broker silent", elapsed);
+    TEST_ASSERT_TRUE(elapsed >= BROKER_RACE_TIMEOUT_MS);
+    TEST_ASSERT_TRUE(elapsed < BROKER_RACE_TIMEOUT_MS + 150);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_single_broker_is_not_raced);
+    RUN_TEST(test_stays_on_a_healthy_current_broker);
+    RUN_TEST(test_fails_over_from_a_refusing_broker);
+    RUN_TEST(test_fails_over_from_a_silent_broker);
+    RUN_TEST(test_health_scores_pick_the_next_candidate);
+    RUN_TEST(test_named_broker_is_looked_up_through_the_cache);
+    RUN_TEST(test_no_broker_answers);
+    return UNITY_END();
+}
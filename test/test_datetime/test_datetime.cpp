@@ -0,0 +1,190 @@
+#include <unity.h>
+#include <time.h>
+#include <chrono>
+#include "datetime.h"
+
+// Last day a uint32_t Unix time reaches, 2106-02-07
+#define LAST_DAY (0xFFFFFFFFUL / 86400UL)
+
+void setUp() {}
+void tearDown() {}
+
+// The host C library as the reference calendar
+static struct tm utc(uint32_t unixtime) {
+  time_t t = (time_t)unixtime;
+  struct tm fields;
+  gmtime_r(&t, &fields);
+  return fields;
+}
+
+static void assertMatches(const struct tm& expected, const RTCDateTime& actual, uint32_t unixtime) {
+  char where[32];
+  snprintf(where, sizeof(where), "at %lu", (unsigned long)unixtime);
+  TEST_ASSERT_EQUAL_UINT16_MESSAGE(expected.tm_year + 1900, actual.year, where);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected.tm_mon + 1, actual.month, where);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected.tm_mday, actual.day, where);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected.tm_hour, actual.hour, where);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected.tm_min, actual.minute, where);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected.tm_sec, actual.second, where);
+  TEST_ASSERT_EQUAL_UINT8_MESSAGE(expected.tm_wday == 0 ? 7 : expected.tm_wday, actual.dayOfWeek, where);
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(unixtime, actual.unixtime, where);
+}
+
+// Year and month loops from 1970, the way the clients converted before datetime.h
+static RTCDateTime loopDateTime(uint32_t unixtime) {
+  RTCDateTime t;
+  uint32_t days = unixtime / 86400UL;
+  uint32_t seconds = unixtime % 86400UL;
+  t.year = 1970;
+  while (days >= (isLeapYearCivil(t.year) ? 366U : 365U)) {
+    days -= isLeapYearCivil(t.year) ? 366 : 365;
+    t.year++;
+  }
+  t.month = 1;
+  while (days >= daysInMonthCivil(t.year, t.month)) {
+    days -= daysInMonthCivil(t.year, t.month);
+    t.month++;
+  }
+  t.day = days + 1;
+  t.hour = seconds / 3600;
+  t.minute = seconds / 60 % 60;
+  t.second = seconds % 60;
+  t.unixtime = unixtime;
+  return t;
+}
+
+// Every day of the uint32_t range, both directions
+void test_every_day_round_trips() {
+  for (uint32_t days = 0; days <= LAST_DAY; days++) {
+    uint16_t year;
+    uint8_t month, day;
+    civilFromDays((int32_t)days, year, month, day);
+
+    struct tm expected = utc(days * 86400UL);
+    TEST_ASSERT_EQUAL_UINT16(expected.tm_year + 1900, year);
+    TEST_ASSERT_EQUAL_UINT8(expected.tm_mon + 1, month);
+    TEST_ASSERT_EQUAL_UINT8(expected.tm_mday, day);
+    TEST_ASSERT_EQUAL_INT32(days, daysFromCivil(year, month, day));
+    TEST_ASSERT_TRUE(day <= daysInMonthCivil(year, month));
+  }
+}
+
+// Every day at its first and last second and at an arbitrary second in between
+void test_every_day_unix_round_trips() {
+  uint32_t seed = 12345;
+  for (uint32_t days = 0; days <= LAST_DAY; days++) {
+    seed = seed * 1103515245UL + 12345UL;
+    const uint32_t seconds[] = { 0, 1, (uint32_t)(seed % 86400UL), 86399 };
+    for (uint32_t second : seconds) {
+      uint64_t wide = (uint64_t)days * 86400UL + second;
+      if (wide > 0xFFFFFFFFULL) break;
+      uint32_t unixtime = (uint32_t)wide;
+
+      RTCDateTime t = dateTimeFromUnix(unixtime);
+      assertMatches(utc(unixtime), t, unixtime);
+      TEST_ASSERT_EQUAL_UINT32(unixtime, unixFromDateTime(t.year, t.month, t.day, t.hour, t.minute, t.second));
+    }
+  }
+}
+
+void test_range_ends() {
+  RTCDateTime first = dateTimeFromUnix(0);
+  TEST_ASSERT_EQUAL_UINT16(1970, first.year);
+  TEST_ASSERT_EQUAL_UINT8(1, first.month);
+  TEST_ASSERT_EQUAL_UINT8(1, first.day);
+  TEST_ASSERT_EQUAL_UINT8(4, first.dayOfWeek);   // Thursday
+
+  RTCDateTime last = dateTimeFromUnix(0xFFFFFFFFUL);
+  TEST_ASSERT_EQUAL_UINT16(2106, last.year);
+  TEST_ASSERT_EQUAL_UINT8(2, last.month);
+  TEST_ASSERT_EQUAL_UINT8(7, last.day);
+  TEST_ASSERT_EQUAL_UINT8(6, last.hour);
+  TEST_ASSERT_EQUAL_UINT8(28, last.minute);
+  TEST_ASSERT_EQUAL_UINT8(15, last.second);
+  TEST_ASSERT_EQUAL_UINT32(0xFFFFFFFFUL, unixFromDateTime(2106, 2, 7, 6, 28, 15));
+}
+
+void test_leap_days() {
+  TEST_ASSERT_EQUAL_INT32(11016, daysFromCivil(2000, 2, 29));           // Divisible by 400
+  TEST_ASSERT_EQUAL_INT32(daysFromCivil(2100, 3, 1) - 1, daysFromCivil(2100, 2, 28));  // By 100, not a leap year
+  TEST_ASSERT_FALSE(isLeapYearCivil(2100));
+  TEST_ASSERT_TRUE(isLeapYearCivil(2024));
+  TEST_ASSERT_EQUAL_UINT8(29, daysInMonthCivil(2024, 2));
+  TEST_ASSERT_EQUAL_UINT8(28, daysInMonthCivil(2023, 2));
+}
+
+// A GPS without a fix reports zeros
+void test_invalid_fields_give_zero() {
+  TEST_ASSERT_EQUAL_UINT32(0, unixFromDateTime(0, 0, 0, 0, 0, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, unixFromDateTime(1969, 12, 31, 23, 59, 59));
+  TEST_ASSERT_EQUAL_UINT32(0, unixFromDateTime(2024, 0, 1, 0, 0, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, unixFromDateTime(2024, 13, 1, 0, 0, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, unixFromDateTime(2024, 1, 0, 0, 0, 0));
+  TEST_ASSERT_EQUAL_UINT32(0, unixFromDateTime(2024, 1, 32, 0, 0, 0));
+}
+
+// Running forward second by second across day, month and year ends, then
+// jumping backwards the way a clock correction does
+void test_cached_date_time_follows_the_clock() {
+  CachedDateTime calendar;
+  const uint32_t starts[] = { 0, 951782300, 1704067000, 4107542300UL, 0xFFFFFFFFUL - 1000 };
+  for (uint32_t start : starts) {
+    for (uint32_t unixtime = start; unixtime - start <= 1000; unixtime++) {
+      assertMatches(utc(unixtime), calendar.at(unixtime), unixtime);
+      assertMatches(utc(unixtime), calendar.at(unixtime), unixtime);   // Same second again
+      if (unixtime == 0xFFFFFFFFUL) break;
+    }
+  }
+  for (uint32_t unixtime = 0xFFFFFFFFUL; unixtime > 86400UL * 31; unixtime -= 86400UL * 31 + 7) {
+    assertMatches(utc(unixtime), calendar.at(unixtime), unixtime);
+  }
+}
+
+// Not a pass/fail timing: reports the cost per conversion, and only checks
+// that the closed form beats the loops it replaced
+void test_benchmark() {
+  using namespace std::chrono;
+  const uint32_t count = 200000;
+  const uint32_t step = 0xFFFFFFFFUL / count;
+  volatile uint32_t sink = 0;
+
+  steady_clock::time_point started = steady_clock::now();
+  for (uint32_t i = 0; i < count; i++) sink += dateTimeFromUnix(i * step).day;
+  double closedNs = duration<double, std::nano>(steady_clock::now() - started).count() / count;
+
+  started = steady_clock::now();
+  for (uint32_t i = 0; i < count; i++) sink += loopDateTime(i * step).day;
+  double loopNs = duration<double, std::nano>(steady_clock::now() - started).count() / count;
+
+  CachedDateTime calendar;
+  started = steady_clock::now();
+  for (uint32_t i = 0; i < count; i++) sink += calendar.at(1700000000UL + i).second;
+  double cachedNs = duration<double, std::nano>(steady_clock::now() - started).count() / count;
+
+  char report[128];
+  snprintf(report, sizeof(report), "dateTimeFromUnix %.1f ns, year/month loops %.1f ns, CachedDateTime per second %.1f ns",
+           closedNs, loopNs, cachedNs);
+  TEST_MESSAGE(report);
+  TEST_ASSERT_TRUE_MESSAGE(closedNs < loopNs, report);
+
+  // The reference loops agree with the closed form on what was timed
+  for (uint32_t i = 0; i < count; i += 97) {
+    RTCDateTime expected = loopDateTime(i * step);
+    RTCDateTime actual = dateTimeFromUnix(i * step);
+    TEST_ASSERT_EQUAL_UINT16(expected.year, actual.year);
+    TEST_ASSERT_EQUAL_UINT8(expected.month, actual.month);
+    TEST_ASSERT_EQUAL_UINT8(expected.day, actual.day);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_every_day_round_trips);
+  RUN_TEST(test_every_day_unix_round_trips);
+  RUN_TEST(test_range_ends);
+  RUN_TEST(test_leap_days);
+  RUN_TEST(test_invalid_fields_give_zero);
+  RUN_TEST(test_cached_date_time_follows_the_clock);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
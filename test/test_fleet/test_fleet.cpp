@@ -0,0 +1,203 @@
+#include <unity.h>
+#include <stdio.h>
+#include <vector>
+#include "backoff.h"
+#include "hash.h"
+
+// Simulates a fleet against the broker: how many status publishes and connection
+// attempts land in the busiest second, with the slots and jitter of main.cpp
+// and without them.
+
+void setUp() {}
+void tearDown() {}
+
+static const uint32_t FLEET_SIZE = 5000;
+static const uint32_t SECOND = 1000;
+
+// xorshift32, stands in for esp_random() so every run is the same
+static uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// MACs as getFormattedMAC() returns them: one Espressif OUI, mostly consecutive
+// serials from a few production batches
+static std::vector<uint32_t> fleetSlotHashes() {
+    std::vector<uint32_t> hashes;
+    char mac[13];
+    for (uint32_t i = 0; i < FLEET_SIZE; i++) {
+        uint32_t serial = 0x1a2b00 + (i / 1000) * 0x40000 + (i % 1000) * 4;
+        snprintf(mac, sizeof(mac), "246f28%06x", (unsigned)(serial & 0xffffff));
+        hashes.push_back(hashBytes(mac, 12));
+    }
+    return hashes;
+}
+
+static uint32_t busiestSecond(const std::vector<uint32_t>& perSecond) {
+    uint32_t peak = 0;
+    for (uint32_t count : perSecond) peak = count > peak ? count : peak;
+    return peak;
+}
+
+void test_reconnect_delay_bounds() {
+    for (uint8_t failures = 0; failures < 12; failures++) {
+        uint32_t ceiling = MQTT_RECONNECT_BASE_MS << (failures < 5 ? failures : 5);
+        if (ceiling > MQTT_RECONNECT_MAX_MS) ceiling = MQTT_RECONNECT_MAX_MS;
+        TEST_ASSERT_EQUAL_UINT32(ceiling / 2, reconnectDelay(failures, 0));
+        TEST_ASSERT_EQUAL_UINT32(ceiling, reconnectDelay(failures, ceiling / 2));
+        TEST_ASSERT_EQUAL_UINT32(ceiling / 2, reconnectDelay(failures, ceiling / 2 + 1));
+        uint32_t delay = reconnectDelay(failures, 0xffffffff);
+        TEST_ASSERT_TRUE(delay >= ceiling / 2 && delay <= ceiling);
+    }
+    TEST_ASSERT_EQUAL_UINT32(MQTT_RECONNECT_MAX_MS, reconnectDelay(255, MQTT_RECONNECT_MAX_MS / 2));
+    TEST_ASSERT_EQUAL_UINT32(0, reconnectJitter(0));
+    TEST_ASSERT_EQUAL_UINT32(MQTT_RECONNECT_JITTER_MS - 1, reconnectJitter(MQTT_RECONNECT_JITTER_MS - 1));
+    TEST_ASSERT_EQUAL_UINT32(0, reconnectJitter(MQTT_RECONNECT_JITTER_MS));
+    TEST_ASSERT_EQUAL_UINT32(999, reconnectJitter(5999, 5000));
+    TEST_ASSERT_EQUAL_UINT32(0, reconnectJitter(12345, 0));
+}
+
+// Walks one device's wall clock and checks it publishes once per interval, on its offset
+void test_slot_fires_once_per_interval_on_the_offset() {
+    const uint32_t interval = 60 * SECOND;
+    uint32_t offset = statusSlotOffset(hashString("246f281a2b00"), interval);
+    TEST_ASSERT_TRUE(offset < interval);
+    TEST_ASSERT_EQUAL_UINT32(0, statusSlotOffset(12345, 0));
+
+    uint64_t start = 1792368000000ULL;   // 2026-10-19 00:00 UTC, in ms
+    uint64_t lastSlot = statusSlotIndex(start, offset, interval);
+    uint32_t published = 0;
+    for (uint64_t now = start; now < start + 3600 * SECOND; now += 100) {
+        uint64_t slot = statusSlotIndex(now, offset, interval);
+        if (slot == lastSlot) continue;
+        lastSlot = slot;
+        published++;
+        // The first tick at or after k * interval + offset
+        TEST_ASSERT_TRUE((now - offset) % interval < 100);
+    }
+    TEST_ASSERT_EQUAL_UINT32(60, published);
+}
+
+// Status traffic after the fleet powers up together. Without slots every device
+// publishes on its own millis() phase, which is only as spread as the boot and
+// Wi-Fi join times (2 to 6 s here). With slots the MAC hash spreads them over
+// the whole interval.
+void test_status_slots_spread_the_fleet() {
+    std::vector<uint32_t> hashes = fleetSlotHashes();
+    const uint32_t intervals[] = { 10 * SECOND, 60 * SECOND, 300 * SECOND };
+    char report[128];
+    for (uint32_t interval : intervals) {
+        std::vector<uint32_t> slotted(interval / SECOND, 0);
+        std::vector<uint32_t> unslotted(interval / SECOND, 0);
+        uint32_t state = 0x2545f491;
+        for (uint32_t hash : hashes) {
+            slotted[statusSlotOffset(hash, interval) / SECOND]++;
+            uint32_t booted = 2 * SECOND + nextRandom(state) % (4 * SECOND);
+            unslotted[booted % interval / SECOND]++;
+        }
+        uint32_t mean = FLEET_SIZE / (interval / SECOND);
+        uint32_t peakSlotted = busiestSecond(slotted);
+        uint32_t peakUnslotted = busiestSecond(unslotted);
+        snprintf(report, sizeof(report), "Status every %u s: busiest second %u publishes slotted, %u unslotted (mean %u)",
+                 (unsigned)(interval / SECOND), (unsigned)peakSlotted, (unsigned)peakUnslotted, (unsigned)mean);
+        TEST_MESSAGE(report);
+        // Close to the mean, as a uniform spread would be
+        TEST_ASSERT_TRUE(peakSlotted <= 2 * mean + 10);
+        TEST_ASSERT_TRUE(peakUnslotted >= FLEET_SIZE / 5);
+        // Boot times cover a good part of a short interval, a long one they do not
+        TEST_ASSERT_TRUE(peakSlotted * (interval >= 60 * SECOND ? 5 : 2) < peakUnslotted);
+    }
+}
+
+struct OutageResult {
+    uint32_t peakAttempts;     // Connection attempts in the busiest second once the broker is back
+    uint32_t attempts;         // All attempts, including those during the outage
+    uint32_t lastConnected;    // ms after the broker came back when the last device connected
+};
+
+// The whole fleet loses the broker at 0 and it comes back at outageMs. Each
+// device retries as connectToMQTT() does: a first delay drawn over the jitter
+// window, then the jittered backoff, with the failure count taken before it is
+// incremented. Unjittered devices retry every MQTT_RECONNECT_BASE_MS, all in step.
+static OutageResult simulateOutage(uint32_t outageMs, bool jittered, uint32_t jitterMs = MQTT_RECONNECT_JITTER_MS) {
+    const uint32_t window = jitterMs + MQTT_RECONNECT_MAX_MS + 10 * SECOND;
+    std::vector<uint32_t> perSecond(window / SECOND, 0);
+    OutageResult result = { 0, 0, 0 };
+    uint32_t state = 0x9e3779b9;
+    for (uint32_t device = 0; device < FLEET_SIZE; device++) {
+        uint32_t now = jittered ? reconnectJitter(nextRandom(state), jitterMs) : 0;
+        uint8_t failures = 0;
+        while (true) {
+            result.attempts++;
+            if (now >= outageMs) {
+                uint32_t after = now - outageMs;
+                TEST_ASSERT_TRUE(after < window);
+                perSecond[after / SECOND]++;
+                result.lastConnected = after > result.lastConnected ? after : result.lastConnected;
+                break;
+            }
+            now += jittered ? reconnectDelay(failures, nextRandom(state)) : MQTT_RECONNECT_BASE_MS;
+            if (failures < 255) failures++;
+        }
+    }
+    result.peakAttempts = busiestSecond(perSecond);
+    return result;
+}
+
+// Connects per second the broker is assumed to take; the busiest second after
+// any outage has to stay below it
+#define BROKER_CONNECTS_PER_SECOND 750
+
+// A power cut (outage 0) meets only the jitter window. Short outages also meet
+// devices retrying in their first backoff steps, which the window spreads out;
+// long ones have spread the fleet through the backoff itself.
+void test_jittered_reconnects_spread_the_fleet() {
+    const uint32_t outages[] = { 0, 5 * SECOND, 30 * SECOND, 90 * SECOND, 600 * SECOND };
+    char report[160];
+    for (uint32_t outage : outages) {
+        OutageResult jittered = simulateOutage(outage, true);
+        OutageResult lockstep = simulateOutage(outage, false);
+        snprintf(report, sizeof(report),
+                 "Broker down %u s: busiest second %u connects jittered, %u in step; %u vs %u attempts, last in %u ms",
+                 (unsigned)(outage / SECOND), (unsigned)jittered.peakAttempts, (unsigned)lockstep.peakAttempts,
+                 (unsigned)jittered.attempts, (unsigned)lockstep.attempts, (unsigned)jittered.lastConnected);
+        TEST_MESSAGE(report);
+        TEST_ASSERT_EQUAL_UINT32(FLEET_SIZE, lockstep.peakAttempts);
+        TEST_ASSERT_TRUE(jittered.peakAttempts <= BROKER_CONNECTS_PER_SECOND);
+        // Backoff costs at most one capped delay of reconnect time
+        TEST_ASSERT_TRUE(jittered.lastConnected <= MQTT_RECONNECT_MAX_MS);
+        // and far fewer attempts against a broker that is down
+        if (outage >= 90 * SECOND) TEST_ASSERT_TRUE(jittered.attempts * 3 < lockstep.attempts);
+    }
+    // After a power cut the fleet arrives about evenly over the window
+    uint32_t mean = FLEET_SIZE * SECOND / MQTT_RECONNECT_JITTER_MS;
+    TEST_ASSERT_TRUE(simulateOutage(0, true).peakAttempts <= 2 * mean);
+}
+
+// A broker restart of a few seconds: the wider the window, the lower the peak
+void test_jitter_window_sets_the_peak() {
+    const uint32_t windows[] = { 2 * SECOND, 10 * SECOND, 30 * SECOND, 60 * SECOND };
+    uint32_t previous = FLEET_SIZE;
+    char report[96];
+    for (uint32_t window : windows) {
+        uint32_t peak = simulateOutage(5 * SECOND, true, window).peakAttempts;
+        snprintf(report, sizeof(report), "Jitter over %u s, broker down 5 s: busiest second %u connects",
+                 (unsigned)(window / SECOND), (unsigned)peak);
+        TEST_MESSAGE(report);
+        TEST_ASSERT_TRUE(peak < previous);
+        previous = peak;
+    }
+    TEST_ASSERT_TRUE(simulateOutage(5 * SECOND, true, 2 * SECOND).peakAttempts > BROKER_CONNECTS_PER_SECOND);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_reconnect_delay_bounds);
+    RUN_TEST(test_slot_fires_once_per_interval_on_the_offset);
+    RUN_TEST(test_status_slots_spread_the_fleet);
+    RUN_TEST(test_jittered_reconnects_spread_the_fleet);
+    RUN_TEST(test_jitter_window_sets_the_peak);
+    return UNITY_END();
+}
@@ -0,0 +1,274 @@
+#include <unity.h>
+#include <chrono>
+#include "hash.h"
+#include "CommandQueue.h"
+
+// Command ingestion before and after parsing in place: the work mqttCallback
+// and the command dispatch do around the JSON parse, per message. The parse
+// itself is ArduinoJson on both paths and is not part of this test.
+
+void setUp() {}
+void tearDown() {}
+
+static const char* const COMMAND_TOPIC = "unit/246f281a2b00/command";
+static const char* const TWIN_TOPIC = "unit/246f281a2b00/twin/desired";
+static const char* const FIRMWARE_TOPIC = "unit/firmware/update";
+static const char* const GROUP_TOPICS[] = {
+    "unit/group/district/d7/command", "unit/group/feeder/f12/command", "unit/group/cabinet/c3/command",
+};
+
+struct Message {
+    const char* topic;
+    const char* payload;
+    const char* command;     // What the JSON parse finds in "command"
+};
+
+static const Message messages[] = {
+    { COMMAND_TOPIC, "{\"command\":\"TOGGLE\",\"payload\":\"ON\",\"id\":17,\"seq\":4021}", "TOGGLE" },
+    { "unit/group/feeder/f12/command",
+      "{\"command\":\"SCHEDULE\",\"payload\":{\"hour_on\":18,\"minute_on\":5,\"hour_off\":5,\"minute_off\":45},"
+      "\"id\":\"c-88\",\"seq\":4022,\"reply_to\":\"scada/rpc/246f281a2b00\"}", "SCHEDULE" },
+    { COMMAND_TOPIC,
+      "{\"command\":\"HISTORY\",\"payload\":{\"from\":1792281600,\"to\":1792368000,\"step\":900},"
+      "\"id\":\"h-3\",\"seq\":4023,\"reply_to\":\"scada/rpc/246f281a2b00\"}", "HISTORY" },
+    { "unit/broadcast/command", "{\"command\":\"GET_STATUS\",\"seq\":4024}", "GET_STATUS" },
+};
+
+#define MESSAGE_COUNT (sizeof(messages) / sizeof(messages[0]))
+
+// Heap blocks taken by the old path's Strings
+static uint32_t allocations = 0;
+
+// The parts of the Arduino core String the old path used, growing the way
+// WString.cpp does: a small buffer inside the object, then a realloc to the
+// exact new length on every concat.
+class CoreString {
+  public:
+    CoreString() { inline_[0] = '\0'; }
+    explicit CoreString(const char* text) : CoreString() { append(text, strlen(text)); }
+    ~CoreString() { free(heap); }
+
+    CoreString& operator+=(char c) { append(&c, 1); return *this; }
+    bool operator==(const char* other) const { return strcmp(c_str(), other) == 0; }
+    const char* c_str() const { return heap != nullptr ? heap : inline_; }
+    size_t length() const { return len; }
+
+  private:
+    void append(const char* text, size_t count) {
+        if (len + count > INLINE_CHARS) {
+            bool moving = heap == nullptr;
+            heap = (char*)realloc(heap, len + count + 1);
+            allocations++;
+            if (moving) memcpy(heap, inline_, len + 1);
+        }
+        char* buffer = heap != nullptr ? heap : inline_;
+        memcpy(buffer + len, text, count);
+        len += count;
+        buffer[len] = '\0';
+    }
+
+    static const size_t INLINE_CHARS = 11;
+    char inline_[INLINE_CHARS + 1];
+    char* heap = nullptr;
+    size_t len = 0;
+};
+
+// What the old code wrote to Serial per command, and what it writes now
+static size_t oldSerialBytes(const Message& message) {
+    return strlen("Main - Message arrived on topic: ") + strlen(message.topic) + 2
+         + strlen("Main - Message: ") + strlen(message.payload) + 2
+         + strlen("Main - Processing business logic command...") + 2;
+}
+
+static size_t newSerialBytes(const Message& message) {
+    char length[12];
+    return strlen("Main - Message arrived on topic: ") + strlen(message.topic) + 2
+         + snprintf(length, sizeof(length), "%u", (unsigned)strlen(message.payload)) + strlen(" bytes") + 2;
+}
+
+// The old mqttCallback and handleCommand around the parse: payload copied into a
+// String a char at a time, topics and the command name compared as Strings.
+static int oldIngest(const Message& message, const CoreString& commandTopic, const CoreString& twinTopic,
+                     const CoreString* groupTopics) {
+    CoreString topicStr(message.topic);
+    CoreString payload;
+    size_t length = strlen(message.payload);
+    for (size_t i = 0; i < length; i++) payload += message.payload[i];
+
+    if (topicStr == FIRMWARE_TOPIC) return 1;
+    if (topicStr == twinTopic.c_str()) return 2;
+    bool command = topicStr == commandTopic.c_str() || topicStr == "unit/broadcast/command";
+    for (int kind = 0; kind < 3 && !command; kind++) command = groupTopics[kind] == message.topic;
+    if (!command) return 0;
+
+    CoreString commandType(message.command);
+    if (commandType == "REBOOT") return 10;
+    else if (commandType == "TOGGLE") return 11;
+    else if (commandType == "SCHEDULE") return 12;
+    else if (commandType == "AUTO") return 13;
+    else if (commandType == "HISTORY") return 14;
+    else if (commandType == "GROUPS") return 15;
+    else if (commandType == "GET_STATUS") return 16;
+    return 3;
+}
+
+// Keys as in BusinessLogicHandler::commandTable
+struct CommandKey {
+    uint32_t hash;
+    const char* name;
+};
+
+static const CommandKey commandTable[] = {
+    {hashString("TOGGLE"), "TOGGLE"},   {hashString("GET_STATUS"), "GET_STATUS"}, {hashString("REBOOT"), "REBOOT"},
+    {hashString("AUTO"), "AUTO"},       {hashString("SCHEDULE"), "SCHEDULE"},     {hashString("GROUPS"), "GROUPS"},
+    {hashString("TELEMETRY"), "TELEMETRY"}, {hashString("WEEKLY"), "WEEKLY"},     {hashString("OVERRIDE"), "OVERRIDE"},
+    {hashString("HISTORY"), "HISTORY"},
+};
+
+struct Topics {
+    uint32_t firmwareHash = hashString(FIRMWARE_TOPIC);
+    uint32_t commandHash = hashString(COMMAND_TOPIC);
+    uint32_t twinHash = hashString(TWIN_TOPIC);
+    uint32_t broadcastHash = hashString("unit/broadcast/command");
+    uint32_t groupHashes[3] = { hashString(GROUP_TOPICS[0]), hashString(GROUP_TOPICS[1]), hashString(GROUP_TOPICS[2]) };
+};
+
+// The current path: topic matched by hash with strcmp to confirm, the payload
+// copied once into a queue slot, the command found through the hashed table
+static int newIngest(const Message& message, const Topics& topics, CommandQueue& queue) {
+    const char* topic = message.topic;
+    uint32_t topicHash = hashString(topic);
+    if (topicHash == topics.firmwareHash && strcmp(topic, FIRMWARE_TOPIC) == 0) return 1;
+    bool command = (topicHash == topics.commandHash && strcmp(topic, COMMAND_TOPIC) == 0) ||
+                   (topicHash == topics.broadcastHash && strcmp(topic, "unit/broadcast/command") == 0);
+    for (int kind = 0; kind < 3 && !command; kind++) {
+        command = topicHash == topics.groupHashes[kind] && strcmp(topic, GROUP_TOPICS[kind]) == 0;
+    }
+    if (!command) return topicHash == topics.twinHash && strcmp(topic, TWIN_TOPIC) == 0 ? 2 : 0;
+
+    uint32_t commandHash = hashString(message.command);
+    QueuedCommand* slot = queue.acquire(COMMAND_PRIORITY_CONTROL);
+    if (slot == nullptr) return -1;
+    size_t length = strlen(message.payload);
+    slot->commandHash = commandHash;
+    slot->length = length;
+    memcpy(slot->payload, message.payload, length);
+    slot->payload[length] = '\0';
+
+    QueuedCommand* next = queue.next();
+    int found = 3;
+    for (const CommandKey& entry : commandTable) {
+        if (entry.hash == next->commandHash && strcmp(entry.name, message.command) == 0) {
+            found = 10 + (int)(&entry - commandTable);
+            break;
+        }
+    }
+    queue.release(next);
+    return found;
+}
+
+void test_both_paths_route_the_same() {
+    CoreString commandTopic(COMMAND_TOPIC), twinTopic(TWIN_TOPIC);
+    CoreString groupTopics[3] = { CoreString(GROUP_TOPICS[0]), CoreString(GROUP_TOPICS[1]), CoreString(GROUP_TOPICS[2]) };
+    Topics topics;
+    static CommandQueue queue;
+
+    for (const Message& message : messages) {
+        TEST_ASSERT_TRUE(oldIngest(message, commandTopic, twinTopic, groupTopics) >= 10);
+        TEST_ASSERT_TRUE(newIngest(message, topics, queue) >= 10);
+    }
+    Message twin = { TWIN_TOPIC, "{\"relay\":true}", "" };
+    TEST_ASSERT_EQUAL_INT(2, oldIngest(twin, commandTopic, twinTopic, groupTopics));
+    TEST_ASSERT_EQUAL_INT(2, newIngest(twin, topics, queue));
+    Message firmware = { FIRMWARE_TOPIC, "{\"url\":\"http://ota/fw.bin\"}", "" };
+    TEST_ASSERT_EQUAL_INT(1, newIngest(firmware, topics, queue));
+    Message stranger = { "unit/246f281a2b01/command", "{}", "" };
+    TEST_ASSERT_EQUAL_INT(0, oldIngest(stranger, commandTopic, twinTopic, groupTopics));
+    TEST_ASSERT_EQUAL_INT(0, newIngest(stranger, topics, queue));
+    TEST_ASSERT_EQUAL_UINT8(0, queue.size());
+}
+
+void test_heap_and_serial_per_command() {
+    CoreString commandTopic(COMMAND_TOPIC), twinTopic(TWIN_TOPIC);
+    CoreString groupTopics[3] = { CoreString(GROUP_TOPICS[0]), CoreString(GROUP_TOPICS[1]), CoreString(GROUP_TOPICS[2]) };
+    char report[160];
+    for (const Message& message : messages) {
+        allocations = 0;
+        oldIngest(message, commandTopic, twinTopic, groupTopics);
+        // Every payload byte past the inline buffer is one realloc
+        TEST_ASSERT_TRUE(allocations >= strlen(message.payload) - 11);
+
+        // 10 bits a byte at 115200 baud
+        size_t before = oldSerialBytes(message), after = newSerialBytes(message);
+        snprintf(report, sizeof(report), "%-10s %3u bytes: %3u heap allocations before, 0 after; Serial %u bytes (%u us) before, %u (%u us) after",
+                 message.command, (unsigned)strlen(message.payload), (unsigned)allocations,
+                 (unsigned)before, (unsigned)(before * 10 * 1000000 / 115200), (unsigned)after,
+                 (unsigned)(after * 10 * 1000000 / 115200));
+        TEST_MESSAGE(report);
+        TEST_ASSERT_TRUE(after < before);
+    }
+    // The current path only uses the fixed queue slots
+    allocations = 0;
+    Topics topics;
+    static CommandQueue queue;
+    for (const Message& message : messages) newIngest(message, topics, queue);
+    TEST_ASSERT_EQUAL_UINT32(0, allocations);
+}
+
+void test_benchmark_ingest() {
+    CoreString commandTopic(COMMAND_TOPIC), twinTopic(TWIN_TOPIC);
+    CoreString groupTopics[3] = { CoreString(GROUP_TOPICS[0]), CoreString(GROUP_TOPICS[1]), CoreString(GROUP_TOPICS[2]) };
+    Topics topics;
+    static CommandQueue queue;
+    const uint32_t rounds = 100000;
+    volatile int sink = 0;
+
+    auto started = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < rounds; i++) sink += oldIngest(messages[i % MESSAGE_COUNT], commandTopic, twinTopic, groupTopics);
+    auto middle = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < rounds; i++) sink += newIngest(messages[i % MESSAGE_COUNT], topics, queue);
+    auto finished = std::chrono::steady_clock::now();
+
+    double oldNs = std::chrono::duration<double, std::nano>(middle - started).count() / rounds;
+    double newNs = std::chrono::duration<double, std::nano>(finished - middle).count() / rounds;
+    char report[96];
+    snprintf(report, sizeof(report), "Ingest without the JSON parse: %.0f ns before, %.0f ns after", oldNs, newNs);
+    TEST_MESSAGE(report);
+    TEST_ASSERT_TRUE(newNs < oldNs);
+}
+
+// A full queue never drops a command on its own: the caller gets the one to
+// answer, and only when it ranks below the newcomer
+void test_full_queue_names_its_victim() {
+    static CommandQueue queue;
+    QueuedCommand* bulk = nullptr;
+    for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+        uint8_t priority = i == 2 ? COMMAND_PRIORITY_BULK : COMMAND_PRIORITY_CONFIG;
+        QueuedCommand* slot = queue.acquire(priority);
+        TEST_ASSERT_NOT_NULL(slot);
+        if (priority == COMMAND_PRIORITY_BULK) bulk = slot;
+    }
+    TEST_ASSERT_NULL(queue.acquire(COMMAND_PRIORITY_CONTROL));
+    TEST_ASSERT_EQUAL_UINT8(COMMAND_QUEUE_SIZE, queue.size());
+
+    TEST_ASSERT_NULL(queue.victimFor(COMMAND_PRIORITY_BULK));
+    TEST_ASSERT_EQUAL_PTR(bulk, queue.victimFor(COMMAND_PRIORITY_CONFIG));
+    TEST_ASSERT_EQUAL_PTR(bulk, queue.victimFor(COMMAND_PRIORITY_CONTROL));
+    TEST_ASSERT_TRUE(bulk->used);
+
+    queue.release(bulk);
+    QueuedCommand* control = queue.acquire(COMMAND_PRIORITY_CONTROL);
+    TEST_ASSERT_EQUAL_PTR(bulk, control);
+    TEST_ASSERT_EQUAL_PTR(control, queue.next());
+    // Only equal ranks left
+    TEST_ASSERT_NULL(queue.victimFor(COMMAND_PRIORITY_CONFIG));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_both_paths_route_the_same);
+    RUN_TEST(test_heap_and_serial_per_command);
+    RUN_TEST(test_benchmark_ingest);
+    RUN_TEST(test_full_queue_names_its_victim);
+    return UNITY_END();
+}
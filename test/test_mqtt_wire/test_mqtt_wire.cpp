@@ -0,0 +1,119 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "mqtt_wire.h"
+
+// mqttPublishSize() against PUBLISH packets encoded byte by byte as the
+// MQTT 3.1.1 and 5.0 specifications lay them out, and the bytes a status
+// publish costs with each protocol and alias state.
+
+void setUp() {}
+void tearDown() {}
+
+static void putVarint(std::vector<uint8_t>& out, uint32_t value) {
+    do {
+        uint8_t byte = value % 128;
+        value /= 128;
+        out.push_back(value > 0 ? byte | 0x80 : byte);
+    } while (value > 0);
+}
+
+static std::vector<uint8_t> encodePublish(const char* topic, uint32_t payloadLength, uint8_t qos,
+                                          bool v5, uint32_t expirySec, uint16_t alias) {
+    std::vector<uint8_t> body;
+    uint16_t topicLength = strlen(topic);
+    body.push_back(topicLength >> 8);
+    body.push_back(topicLength & 0xff);
+    body.insert(body.end(), topic, topic + topicLength);
+    if (qos > 0) {
+        body.push_back(0x12);   // Packet identifier
+        body.push_back(0x34);
+    }
+    if (v5) {
+        std::vector<uint8_t> properties;
+        if (expirySec > 0) {
+            properties.push_back(0x02);   // Message Expiry Interval
+            for (int shift = 24; shift >= 0; shift -= 8) properties.push_back(expirySec >> shift);
+        }
+        if (alias > 0) {
+            properties.push_back(0x23);   // Topic Alias
+            properties.push_back(alias >> 8);
+            properties.push_back(alias & 0xff);
+        }
+        putVarint(body, properties.size());
+        body.insert(body.end(), properties.begin(), properties.end());
+    }
+    body.insert(body.end(), payloadLength, 'x');
+
+    std::vector<uint8_t> packet;
+    packet.push_back(0x30 | (qos << 1));
+    putVarint(packet, body.size());
+    packet.insert(packet.end(), body.begin(), body.end());
+    return packet;
+}
+
+void test_varint_size() {
+    TEST_ASSERT_EQUAL_UINT32(1, mqttVarintSize(0));
+    TEST_ASSERT_EQUAL_UINT32(1, mqttVarintSize(127));
+    TEST_ASSERT_EQUAL_UINT32(2, mqttVarintSize(128));
+    TEST_ASSERT_EQUAL_UINT32(2, mqttVarintSize(16383));
+    TEST_ASSERT_EQUAL_UINT32(3, mqttVarintSize(16384));
+    TEST_ASSERT_EQUAL_UINT32(3, mqttVarintSize(2097151));
+    TEST_ASSERT_EQUAL_UINT32(4, mqttVarintSize(2097152));
+}
+
+// Every combination, with payloads around the remaining length steps
+void test_matches_encoded_packets() {
+    const char* topics[] = { "", "a", "unit/246f281a2b00/status" };
+    const uint32_t payloads[] = { 0, 1, 95, 96, 97, 120, 121, 125, 126, 127, 128, 600, 2048, 16370, 16400 };
+    char where[96];
+    for (const char* topic : topics) {
+        for (uint32_t payload : payloads) {
+            for (uint8_t qos = 0; qos <= 1; qos++) {
+                for (int v5 = 0; v5 <= 1; v5++) {
+                    for (uint32_t expiry : { 0u, 120u }) {
+                        for (uint16_t alias : { (uint16_t)0, (uint16_t)1 }) {
+                            if (!v5 && (expiry > 0 || alias > 0)) continue;
+                            snprintf(where, sizeof(where), "topic %u payload %u qos %u v5 %d expiry %u alias %u",
+                                     (unsigned)strlen(topic), (unsigned)payload, qos, v5, (unsigned)expiry, alias);
+                            size_t expected = encodePublish(topic, payload, qos, v5, expiry, alias).size();
+                            TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected,
+                                mqttPublishSize(strlen(topic), payload, qos, v5, expiry, alias), where);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// A status publish: full topic on 3.1.1 QoS1, on MQTT 5 the first QoS0 publish
+// announces the alias with the topic and later ones carry the alias only
+void test_status_publish_bytes() {
+    const char* topic = "unit/246f281a2b00/status";
+    const uint32_t expiry = 120;   // Two 60 s intervals
+    char report[160];
+    for (uint32_t payload : { 64u, 480u }) {
+        uint32_t v311 = encodePublish(topic, payload, 1, false, 0, 0).size();
+        uint32_t v5Qos1 = encodePublish(topic, payload, 1, true, expiry, 0).size();
+        uint32_t announce = encodePublish(topic, payload, 0, true, expiry, 1).size();
+        uint32_t aliased = encodePublish("", payload, 0, true, expiry, 1).size();
+        snprintf(report, sizeof(report),
+                 "Status of %u bytes: 3.1.1 QoS1 %u, MQTT 5 QoS1 %u, QoS0 announcing the alias %u, aliased %u",
+                 (unsigned)payload, (unsigned)v311, (unsigned)v5Qos1, (unsigned)announce, (unsigned)aliased);
+        TEST_MESSAGE(report);
+        // No topic or packet identifier, a property length, expiry and alias instead
+        TEST_ASSERT_EQUAL_UINT32(v311 - strlen(topic) - 2 + 1 + 5 + 3, aliased);
+        TEST_ASSERT_TRUE(aliased < v311);
+        TEST_ASSERT_TRUE(aliased < v5Qos1);
+    }
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_varint_size);
+    RUN_TEST(test_matches_encoded_packets);
+    RUN_TEST(test_status_publish_bytes);
+    return UNITY_END();
+}
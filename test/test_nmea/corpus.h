@@ -0,0 +1,52 @@
+#ifndef NMEA_CORPUS_H
+#define NMEA_CORPUS_H
+
+// Seed sentences for the NMEA tests: what the receivers we have seen send,
+// plus the damaged lines a noisy UART produces. The fuzz test mutates these.
+struct NmeaSample {
+    const char* sentence;
+    bool        updates;      // Expected result of NmeaParser::parse()
+};
+
+static const NmeaSample nmeaCorpus[] = {
+    // u-blox NEO-6M, GPS only
+    { "$GPRMC,083559.00,A,4717.11437,N,00833.91522,E,0.004,77.52,091202,,,A*57\r\n", true },
+    { "$GPGGA,092725.00,4717.11399,N,00833.91590,E,1,08,1.01,499.6,M,48.0,M,,*5B\r\n", true },
+    { "$GPVTG,77.52,T,,M,0.004,N,0.008,K,A*06\r\n", false },
+    { "$GPGSA,A,3,23,29,07,08,09,18,26,28,,,,,1.94,1.18,1.54*0D\r\n", false },
+    { "$GPGSV,3,1,10,23,38,230,44,29,71,156,47,07,29,116,41,08,09,081,36*7F\r\n", false },
+    { "$GPGLL,4717.11364,N,00833.91565,E,092321.00,A,A*60\r\n", false },
+    // u-blox M8, multi-GNSS talker
+    { "$GNRMC,103520.00,A,1045.75732,N,10639.61032,E,0.523,123.45,191026,,,A*72\r\n", true },
+    { "$GNGGA,103520.00,1045.75732,N,10639.61032,E,1,12,0.92,8.4,M,-2.1,M,,*52\r\n", true },
+    { "$GLGSV,2,1,07,65,42,037,30,71,24,318,27,72,55,265,33,73,19,093,25*69\r\n", false },
+    { "$GAGSV,1,1,03,02,44,270,31,11,21,053,,12,67,143,29*54\r\n", false },
+    // BeiDou talker, DGPS fix
+    { "$BDGGA,103521.00,1045.75740,N,10639.61040,E,2,09,1.20,8.6,M,-2.1,M,,*5F\r\n", true },
+    // SiRF: three decimal time, southern and western hemisphere, below sea level
+    { "$GPRMC,161229.487,A,3723.2475,S,12158.3416,W,0.13,309.62,120598,,*0D\r\n", true },
+    { "$GPGGA,002153.000,3342.6618,S,11751.3858,W,1,10,1.2,-27.0,M,-34.2,M,,0000*6E\r\n", true },
+    // No fix yet
+    { "$GPRMC,000012.00,V,,,,,,,191026,,,N*73\r\n", false },
+    { "$GPGGA,000012.00,,,,,0,00,99.99,,,,,,*65\r\n", false },
+    // Standing still, no course
+    { "$GPRMC,104000.00,A,1045.75700,N,10639.61000,E,0.000,,191026,,,A*77\r\n", true },
+    // Lower-case checksum
+    { "$GPGGA,104001.00,1045.75700,N,10639.61000,E,1,08,1.40,9.0,M,-2.1,M,,*4d\r\n", true },
+    // Bad checksum
+    { "$GPRMC,104002.00,A,1045.75700,N,10639.61000,E,0.000,,191026,,,A*00\r\n", false },
+    // Malformed latitude
+    { "$GPRMC,104003.00,A,10x5.75700,N,10639.61000,E,0.000,,191026,,,A*38\r\n", false },
+    // Minutes out of range
+    { "$GPGGA,104004.00,1065.75700,N,10639.61000,E,1,07,1.40,9.0,M,-2.1,M,,*45\r\n", false },
+    // More terms than the table has
+    { "$GPGGA,104005.00,1045.75700,N,10639.61000,E,1,07,1.40,9.0,M,-2.1,M,,,,,,,*6A\r\n", true },
+    // Cut off mid-sentence
+    { "$GPRMC,104006.00,A,1045.757\r\n", false },
+    // Altitude past what an int64 holds once scaled, with a valid checksum
+    { "$GPGGA,104007.00,1045.75700,N,10639.61000,E,1,08,1.40,92233720368547758.08,M,-2.1,M,,*77\r\n", false },
+};
+
+#define NMEA_CORPUS_SIZE (sizeof(nmeaCorpus) / sizeof(nmeaCorpus[0]))
+
+#endif // NMEA_CORPUS_H
@@ -0,0 +1,284 @@
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "NmeaParser.h"
+#include "TinyGPS.h"
+#include "corpus.h"
+
+void setUp() {}
+void tearDown() {}
+
+// Sentence generation
+
+static uint8_t checksumOf(const char* begin, const char* end) {
+    uint8_t checksum = 0;
+    for (const char* p = begin; p < end; p++) checksum ^= (uint8_t)*p;
+    return checksum;
+}
+
+// "$" talker body "*hh\r\n"
+static std::string sentence(const char* talker, const char* body) {
+    std::string text = std::string("$") + talker + body;
+    char tail[8];
+    snprintf(tail, sizeof(tail), "*%02X\r\n", checksumOf(text.c_str() + 1, text.c_str() + text.size()));
+    return text + tail;
+}
+
+// ddmm.mmmmm (dddmm.mmmmm for longitude) and the hemisphere letter
+static std::string angle(double degrees, int degreeDigits, char positive, char negative) {
+    int64_t minutes = llround(fabs(degrees) * 60 * 100000);   // Minutes * 1e5
+    char text[24];
+    snprintf(text, sizeof(text), "%0*d%02d.%05d,%c", degreeDigits, (int)(minutes / 6000000),
+             (int)(minutes % 6000000 / 100000), (int)(minutes % 100000), degrees < 0 ? negative : positive);
+    return text;
+}
+
+// One second of a receiver at 1 Hz: RMC, VTG, GGA, GSA, three GSV and GLL.
+// The first epochs have no fix, the track crosses midnight and, halfway,
+// the equator and the prime meridian's antipode so every hemisphere shows up.
+static std::vector<std::string> replayStream(const char* talker, int epochs) {
+    std::vector<std::string> stream;
+    for (int i = 0; i < epochs; i++) {
+        int clock = (86340 + i) % 86400;
+        char time[16], date[8];
+        snprintf(time, sizeof(time), "%02d%02d%02d.00", clock / 3600, clock / 60 % 60, clock % 60);
+        snprintf(date, sizeof(date), "%s", 86340 + i < 86400 ? "191026" : "201026");
+
+        bool fix = i >= 3;
+        double latitude  = i < epochs / 2 ? 10.762622 + i * 3e-5 : -34.6037 - i * 2e-5;
+        double longitude = i < epochs / 2 ? 106.660172 - i * 2e-5 : -58.3816 + i * 1e-5;
+        std::string lat = fix ? angle(latitude, 2, 'N', 'S') : ",";
+        std::string lon = fix ? angle(longitude, 3, 'E', 'W') : ",";
+
+        int decimetres = (i * 13) % 4000 - 500;
+        char body[160];
+        snprintf(body, sizeof(body), "RMC,%s,%c,%s,%s,%u.%03u,%u.%02u,%s,,,%c", time, fix ? 'A' : 'V',
+                 lat.c_str(), lon.c_str(), (i * 37) % 20000 / 1000, (i * 37) % 1000,
+                 (i * 1237) % 36000 / 100, (i * 1237) % 100, date, fix ? 'A' : 'N');
+        stream.push_back(sentence(talker, body));
+        snprintf(body, sizeof(body), "VTG,%u.%02u,T,,M,0.%03u,N,0.%03u,K,A",
+                 (i * 1237) % 36000 / 100, (i * 1237) % 100, (i * 37) % 1000, (i * 37) % 1000);
+        stream.push_back(sentence(talker, body));
+        snprintf(body, sizeof(body), "GGA,%s,%s,%s,%d,%02d,%d.%02d,%s%d.%d,M,-2.1,M,,", time,
+                 lat.c_str(), lon.c_str(), fix ? 1 : 0, fix ? 4 + i % 9 : 0, (60 + i % 200) / 100,
+                 (60 + i % 200) % 100, decimetres < 0 ? "-" : "", abs(decimetres) / 10, abs(decimetres) % 10);
+        stream.push_back(sentence(talker, body));
+        stream.push_back(sentence(talker, "GSA,A,3,23,29,07,08,09,18,26,28,,,,,1.94,1.18,1.54"));
+        stream.push_back(sentence(talker, "GSV,3,1,10,23,38,230,44,29,71,156,47,07,29,116,41,08,09,081,36"));
+        stream.push_back(sentence(talker, "GSV,3,2,10,09,23,313,42,18,34,068,43,26,53,023,44,28,05,297,31"));
+        stream.push_back(sentence(talker, "GSV,3,3,10,30,01,258,,32,11,190,"));
+        stream.push_back(sentence(talker, ("GLL," + lat + "," + lon + "," + time + ",A,A").c_str()));
+    }
+    return stream;
+}
+
+static bool feed(TinyGPS& tiny, const std::string& text) {
+    bool valid = false;
+    for (char c : text) valid |= tiny.encode(c);
+    return valid;
+}
+
+static bool isType(const std::string& text, const char* type) {
+    return text.size() > 7 && text.compare(3, 3, type) == 0;
+}
+
+// Our fix against TinyGPS after the same sentence. TinyGPS keeps millionths
+// of a degree, rounded; we keep 1e-7 degrees, truncated.
+static void assertSameFix(const NmeaFix& fix, TinyGPS& tiny, const std::string& text) {
+    long latitude, longitude;
+    tiny.get_position(&latitude, &longitude);
+    TEST_ASSERT_INT_WITHIN_MESSAGE(10, latitude * 10L, fix.latitude, text.c_str());
+    TEST_ASSERT_INT_WITHIN_MESSAGE(10, longitude * 10L, fix.longitude, text.c_str());
+    if (isType(text, "RMC")) {
+        unsigned long date, time;
+        tiny.get_datetime(&date, &time);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(date, fix.date, text.c_str());
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(time, fix.time, text.c_str());
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(tiny.speed(), fix.speed, text.c_str());
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(tiny.course(), fix.course, text.c_str());
+    } else {
+        TEST_ASSERT_EQUAL_INT32_MESSAGE(tiny.altitude(), fix.altitude, text.c_str());
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(tiny.hdop(), fix.hdop, text.c_str());
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(tiny.satellites(), fix.satellites, text.c_str());
+    }
+}
+
+void test_corpus_outcomes() {
+    NmeaParser parser;
+    for (size_t i = 0; i < NMEA_CORPUS_SIZE; i++) {
+        const char* text = nmeaCorpus[i].sentence;
+        TEST_ASSERT_EQUAL_MESSAGE(nmeaCorpus[i].updates, parser.parse(text, strlen(text), i + 1), text);
+    }
+    TEST_ASSERT_EQUAL_UINT32(12, parser.passed());
+    TEST_ASSERT_EQUAL_UINT32(5, parser.failed());
+    TEST_ASSERT_EQUAL_UINT32(6, parser.ignored());
+}
+
+void test_corpus_values() {
+    NmeaParser parser;
+    const char* rmc = nmeaCorpus[11].sentence;   // SiRF, S and W
+    const char* gga = nmeaCorpus[12].sentence;
+    TEST_ASSERT_TRUE(parser.parse(rmc, strlen(rmc), 1000));
+    TEST_ASSERT_TRUE(parser.parse(gga, strlen(gga), 2000));
+
+    const NmeaFix& fix = parser.fix();
+    TEST_ASSERT_EQUAL_INT32(-337110300, fix.latitude);       // From the GGA, the later sentence
+    TEST_ASSERT_EQUAL_INT32(-1178564300, fix.longitude);
+    TEST_ASSERT_EQUAL_INT32(-2700, fix.altitude);
+    TEST_ASSERT_EQUAL_UINT16(120, fix.hdop);
+    TEST_ASSERT_EQUAL_UINT8(10, fix.satellites);
+    TEST_ASSERT_EQUAL_UINT32(16122948, fix.time);            // Third decimal dropped
+    TEST_ASSERT_EQUAL_UINT32(120598, fix.date);
+    TEST_ASSERT_EQUAL_UINT32(13, fix.speed);
+    TEST_ASSERT_EQUAL_UINT32(30962, fix.course);
+    TEST_ASSERT_EQUAL_STRING("GP", fix.talker);
+    TEST_ASSERT_EQUAL_INT32(1000, parser.timeFixUs());
+    TEST_ASSERT_EQUAL_INT32(2000, parser.positionFixUs());
+    TEST_ASSERT_EQUAL_INT32(2000, parser.qualityFixUs());
+
+    RTCDateTime time;
+    uint8_t hundredths;
+    TEST_ASSERT_TRUE(parser.dateTime(time, hundredths));
+    TEST_ASSERT_EQUAL_UINT16(1998, time.year);
+    TEST_ASSERT_EQUAL_UINT8(5, time.month);
+    TEST_ASSERT_EQUAL_UINT8(12, time.day);
+    TEST_ASSERT_EQUAL_UINT8(16, time.hour);
+    TEST_ASSERT_EQUAL_UINT8(12, time.minute);
+    TEST_ASSERT_EQUAL_UINT8(29, time.second);
+    TEST_ASSERT_EQUAL_UINT8(48, hundredths);
+
+    const char* beidou = nmeaCorpus[10].sentence;
+    TEST_ASSERT_TRUE(parser.parse(beidou, strlen(beidou), 3000));
+    TEST_ASSERT_EQUAL_STRING("BD", parser.fix().talker);
+    TEST_ASSERT_EQUAL_UINT8(2, parser.fix().quality);
+    TEST_ASSERT_EQUAL_UINT32(16122948, parser.fix().time);   // Time only comes from RMC
+}
+
+// The GP stream through both parsers, sentence by sentence; a multi-GNSS
+// receiver's GN stream must give us what the GP stream gives TinyGPS
+void test_matches_tinygps_on_replay() {
+    std::vector<std::string> gps = replayStream("GP", 600);
+    std::vector<std::string> gnss = replayStream("GN", 600);
+    NmeaParser parser, multi;
+    TinyGPS tiny;
+    int compared = 0;
+    for (size_t i = 0; i < gps.size(); i++) {
+        const std::string& text = gps[i];
+        bool ours = parser.parse(text.c_str(), text.size(), i + 1);
+        bool theirs = feed(tiny, text);
+        TEST_ASSERT_EQUAL_MESSAGE(theirs, ours, text.c_str());
+        TEST_ASSERT_EQUAL_MESSAGE(ours, multi.parse(gnss[i].c_str(), gnss[i].size(), i + 1), gnss[i].c_str());
+        if (!ours) continue;
+        assertSameFix(parser.fix(), tiny, text);
+        assertSameFix(multi.fix(), tiny, text);
+        compared++;
+    }
+    TEST_ASSERT_EQUAL_INT(2 * (600 - 3), compared);
+    TEST_ASSERT_EQUAL_UINT32(0, parser.failed());
+}
+
+// Mutated corpus sentences, about half with the checksum repaired so the
+// damage reaches the term conversions. Whatever comes in, every sentence is
+// counted exactly once, nothing without a matching checksum is accepted and
+// a rejected sentence leaves the fix alone (bar the GGA fix quality).
+void test_fuzz() {
+    std::vector<std::string> seeds;
+    for (size_t i = 0; i < NMEA_CORPUS_SIZE; i++) seeds.push_back(nmeaCorpus[i].sentence);
+    std::vector<std::string> generated = replayStream("GN", 12);
+    seeds.insert(seeds.end(), generated.begin(), generated.end());
+
+    static const char alphabet[] = "$*,.-0123456789ABCDEFNSEWVMabcf\r\n";
+    uint32_t seed = 0x2545F491;
+    auto random = [&seed](uint32_t range) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed % range;
+    };
+
+    NmeaParser parser;
+    uint32_t accepted = 0;
+    for (uint32_t round = 0; round < 200000; round++) {
+        std::string text = seeds[random(seeds.size())];
+        for (uint32_t m = 0, count = 1 + random(4); m < count && !text.empty(); m++) {
+            size_t at = random(text.size());
+            switch (random(5)) {
+                case 0: text[at] ^= (char)(1 << random(8)); break;
+                case 1: text[at] = alphabet[random(sizeof(alphabet) - 1)]; break;
+                case 2: text.erase(at, 1); break;
+                case 3: text.insert(at, 1, alphabet[random(sizeof(alphabet) - 1)]); break;
+                default: text.resize(at); break;
+            }
+        }
+        size_t star = text.rfind('*');
+        if (random(2) == 0 && !text.empty() && text[0] == '$' && star != std::string::npos && star + 2 < text.size()) {
+            char hex[3];
+            snprintf(hex, sizeof(hex), "%02X", checksumOf(text.c_str() + 1, text.c_str() + star));
+            text[star + 1] = hex[0];
+            text[star + 2] = hex[1];
+        }
+
+        // Exactly sized, so a read past the end shows up under a sanitizer
+        std::vector<char> buffer(text.begin(), text.end());
+        NmeaFix before = parser.fix();
+        uint32_t counted = parser.passed() + parser.failed() + parser.ignored();
+        bool updated = parser.parse(buffer.data(), buffer.size(), round + 1);
+        TEST_ASSERT_EQUAL_UINT32(counted + 1, parser.passed() + parser.failed() + parser.ignored());
+
+        NmeaFix after = parser.fix();
+        if (!updated) {
+            before.quality = after.quality = 0;
+            TEST_ASSERT_EQUAL_MEMORY_MESSAGE(&before, &after, sizeof(NmeaFix), text.c_str());
+            continue;
+        }
+        accepted++;
+        TEST_ASSERT_TRUE_MESSAGE(isType(text, "RMC") || isType(text, "GGA"), text.c_str());
+        size_t end = text.find('*');
+        TEST_ASSERT_TRUE_MESSAGE(end != std::string::npos && end + 2 < text.size(), text.c_str());
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02X", checksumOf(text.c_str() + 1, text.c_str() + end));
+        TEST_ASSERT_TRUE_MESSAGE(strncasecmp(hex, text.c_str() + end + 1, 2) == 0, text.c_str());
+        TEST_ASSERT_TRUE_MESSAGE(labs(after.latitude) < 1810000000L && labs(after.longitude) < 1810000000L, text.c_str());
+    }
+    char report[64];
+    snprintf(report, sizeof(report), "%u of 200000 mutated sentences accepted", (unsigned)accepted);
+    TEST_MESSAGE(report);
+    TEST_ASSERT_GREATER_THAN(0, accepted);
+}
+
+// Throughput of the same recorded hour through both parsers, reported and
+// not tied to a threshold beyond being no slower than TinyGPS
+void test_replay_benchmark() {
+    using namespace std::chrono;
+    std::vector<std::string> stream = replayStream("GP", 3600);
+    size_t bytes = 0;
+    for (const std::string& text : stream) bytes += text.size();
+
+    NmeaParser parser;
+    volatile uint32_t sink = 0;
+    steady_clock::time_point started = steady_clock::now();
+    for (size_t i = 0; i < stream.size(); i++) sink += parser.parse(stream[i].c_str(), stream[i].size(), i + 1);
+    double oursSeconds = duration<double>(steady_clock::now() - started).count();
+
+    TinyGPS tiny;
+    started = steady_clock::now();
+    for (const std::string& text : stream) sink += feed(tiny, text);
+    double tinySeconds = duration<double>(steady_clock::now() - started).count();
+
+    char report[160];
+    snprintf(report, sizeof(report), "%u sentences, %u bytes: NmeaParser %.0f sentences/s, TinyGPS %.0f sentences/s",
+             (unsigned)stream.size(), (unsigned)bytes, stream.size() / oursSeconds, stream.size() / tinySeconds);
+    TEST_MESSAGE(report);
+    TEST_ASSERT_TRUE_MESSAGE(oursSeconds <= tinySeconds, report);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_corpus_outcomes);
+    RUN_TEST(test_corpus_values);
+    RUN_TEST(test_matches_tinygps_on_replay);
+    RUN_TEST(test_fuzz);
+    RUN_TEST(test_replay_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,366 @@
+#include <unity.h>
+#include <vector>
+#include "ScheduleEngine.h"
+#include "datetime.h"
+
+static const uint32_t MINUTE = 60;
+static const uint32_t HOUR   = 3600;
+static const uint32_t DAY    = 86400;
+
+void setUp() {}
+void tearDown() {}
+
+static uint32_t at(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute) {
+    return unixFromDateTime(year, month, day, hour, minute, 0);
+}
+
+static ScheduleTime clockAt(uint8_t hour, uint8_t minute) {
+    return { SCHEDULE_REF_CLOCK, (int16_t)(hour * 60 + minute), 0 };
+}
+
+static ScheduleTime sun(uint8_t ref, int16_t offset, int16_t fallback) {
+    return { ref, fallback, offset };
+}
+
+// Brute force reference: the configuration kept as plain lists, the state
+// worked out from scratch for a single instant
+
+struct Reference {
+    std::vector<ScheduleWindow> windows;
+    std::vector<ScheduleException> exceptions;
+    std::vector<ScheduleOverride> overrides;
+    const SunTable* table = nullptr;
+
+    int32_t minuteOf(const ScheduleTime& time, uint32_t day) const {
+        if (time.ref == SCHEDULE_REF_CLOCK || table == nullptr) return time.minute;
+        RTCDateTime date = dateTimeFromUnix(day * DAY);
+        uint16_t index = SunTable::dayOfYear(date.year, date.month, date.day);
+        uint16_t event = time.ref == SCHEDULE_REF_DUSK ? table->dusk(index) : table->dawn(index);
+        if (event == SUN_NEVER_LIGHT) return time.ref == SCHEDULE_REF_DUSK ? 0 : 1440;
+        if (event == SUN_NEVER_DARK) return SCHEDULE_NO_EVENT;
+        return event + time.offset;
+    }
+
+    uint8_t program(uint32_t day) const {
+        RTCDateTime date = dateTimeFromUnix(day * DAY);
+        int yearly = -1;
+        for (const ScheduleException& exception : exceptions) {
+            if (exception.month != date.month || exception.day != date.day) continue;
+            if (exception.year == date.year) return exception.program;
+            if (exception.year == 0 && yearly < 0) yearly = exception.program;
+        }
+        return yearly >= 0 ? yearly : date.dayOfWeek;
+    }
+
+    bool stateAt(uint32_t now, bool& on) const {
+        const ScheduleOverride* winner = nullptr;
+        for (const ScheduleOverride& entry : overrides) {
+            if (entry.start <= now && now < entry.end && (winner == nullptr || entry.priority > winner->priority)) winner = &entry;
+        }
+        bool scheduled = false;
+        uint32_t today = now / DAY;
+        for (uint32_t day = today - 1; day <= today; day++) {
+            uint8_t p = program(day);
+            if (p == SCHEDULE_DAY_ON) {
+                scheduled |= day == today;
+                continue;
+            }
+            if (p == SCHEDULE_DAY_OFF) continue;
+            for (const ScheduleWindow& window : windows) {
+                if ((window.days & (1 << (p - 1))) == 0) continue;
+                int32_t on = minuteOf(window.on, day), off = minuteOf(window.off, day);
+                if (on == SCHEDULE_NO_EVENT || off == SCHEDULE_NO_EVENT) continue;
+                if (off <= on) off += 1440;
+                int64_t start = (int64_t)day * DAY + on * 60, end = (int64_t)day * DAY + off * 60;
+                scheduled |= start <= now && now < end;
+            }
+        }
+        on = winner != nullptr ? winner->state : scheduled;
+        return winner != nullptr || !windows.empty() || !exceptions.empty();
+    }
+};
+
+static uint32_t random32(uint32_t& seed) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static ScheduleTime randomTime(uint32_t& seed) {
+    ScheduleTime time;
+    time.ref = random32(seed) % 4 == 0 ? 1 + random32(seed) % 2 : SCHEDULE_REF_CLOCK;
+    time.minute = random32(seed) % 1440;
+    time.offset = (int16_t)(random32(seed) % 121) - 60;
+    return time;
+}
+
+// Random configurations walked minute by minute through 2026, with the clock
+// occasionally jumping an hour or more either way. Every minute has to agree
+// with the reference, and nextTransition() may never lie beyond a change.
+static void walkYear(const SunTable* table, uint32_t seed, long& evaluations) {
+    ScheduleEngine engine;
+    Reference reference;
+    engine.setSunTable(table);
+    reference.table = table;
+
+    uint32_t windows = random32(seed) % 6;
+    for (uint32_t i = 0; i < windows; i++) {
+        ScheduleWindow window = { (uint8_t)(1 + random32(seed) % 127), randomTime(seed), randomTime(seed) };
+        TEST_ASSERT_TRUE(engine.addWindow(window));
+        reference.windows.push_back(window);
+    }
+    uint32_t exceptions = random32(seed) % 8;
+    for (uint32_t i = 0; i < exceptions; i++) {
+        ScheduleException exception = { (uint16_t)(random32(seed) % 2 ? 0 : 2026), (uint8_t)(1 + random32(seed) % 12),
+                                        (uint8_t)(1 + random32(seed) % 28), (uint8_t)(random32(seed) % 9) };
+        TEST_ASSERT_TRUE(engine.addException(exception));
+        reference.exceptions.push_back(exception);
+    }
+    uint32_t yearStart = at(2026, 1, 1, 0, 0);
+    uint32_t overrides = random32(seed) % 5;
+    for (uint32_t i = 0; i < overrides; i++) {
+        ScheduleOverride entry;
+        entry.start = yearStart + random32(seed) % (365 * DAY);
+        entry.end = entry.start + MINUTE + random32(seed) % (3 * DAY);
+        entry.priority = i;
+        entry.state = random32(seed) % 2;
+        TEST_ASSERT_TRUE(engine.addOverride(entry));
+        reference.overrides.push_back(entry);
+    }
+
+    char where[64];
+    uint32_t promised = 0;        // No change before this, as last reported
+    bool lastApplies = false, lastOn = false;
+    uint32_t lastNext = 0;
+    for (int64_t now = yearStart; now < yearStart + 365 * (int64_t)DAY; now += MINUTE) {
+        bool on, expectedOn;
+        bool applies = engine.stateAt((uint32_t)now, on);
+        bool expectedApplies = reference.stateAt((uint32_t)now, expectedOn);
+        snprintf(where, sizeof(where), "seed %u at %lld", (unsigned)seed, (long long)now);
+        TEST_ASSERT_EQUAL_MESSAGE(expectedApplies, applies, where);
+        if (applies) TEST_ASSERT_EQUAL_MESSAGE(expectedOn, on, where);
+
+        if ((uint32_t)now < promised && (applies != lastApplies || on != lastOn)) {
+            TEST_FAIL_MESSAGE(where);   // Changed before the reported transition
+        }
+        TEST_ASSERT_TRUE_MESSAGE(engine.nextTransition() > (uint32_t)now, where);
+        if (engine.nextTransition() != lastNext) evaluations++;
+        lastNext = engine.nextTransition();
+        promised = engine.nextTransition();
+        lastApplies = applies;
+        lastOn = on;
+
+        if (random32(seed) % 20000 == 0) {
+            now += (random32(seed) % 2 ? 1 : -1) * (int64_t)HOUR * (1 + random32(seed) % 3);
+            promised = 0;
+        }
+    }
+}
+
+void test_year_walk_matches_brute_force() {
+    SunTable table;
+    table.build(21.0278f, 105.8342f, 7 * 3600, 2026);
+    long evaluations = 0;
+    for (uint32_t config = 1; config <= 24; config++) {
+        walkYear(config % 2 ? &table : nullptr, config * 2654435761UL, evaluations);
+    }
+    char report[96];
+    snprintf(report, sizeof(report), "%ld evaluations for %ld stateAt() calls", evaluations, 24L * 365 * 1440);
+    TEST_MESSAGE(report);
+    TEST_ASSERT_LESS_THAN(24L * 365 * 1440 / 20, evaluations);
+}
+
+// 22:00 to 02:00 starting Mondays only: on into Tuesday morning, not Monday morning
+void test_window_across_midnight() {
+    ScheduleEngine engine;
+    ScheduleWindow window = { 0x01, clockAt(22, 0), clockAt(2, 0) };
+    TEST_ASSERT_TRUE(engine.addWindow(window));
+
+    bool on;
+    uint32_t monday = at(2026, 10, 19, 0, 0);
+    TEST_ASSERT_TRUE(engine.stateAt(monday + 1 * HOUR, on));
+    TEST_ASSERT_FALSE(on);
+    TEST_ASSERT_EQUAL_UINT32(monday + 22 * HOUR, engine.nextTransition());
+
+    engine.stateAt(monday + 22 * HOUR, on);
+    TEST_ASSERT_TRUE(on);
+    TEST_ASSERT_EQUAL_UINT32(monday + 26 * HOUR, engine.nextTransition());
+    engine.stateAt(monday + 25 * HOUR, on);
+    TEST_ASSERT_TRUE(on);
+    engine.stateAt(monday + 26 * HOUR, on);
+    TEST_ASSERT_FALSE(on);
+    TEST_ASSERT_EQUAL_UINT32(monday + 7 * DAY + 22 * HOUR, engine.nextTransition());
+
+    // Touching windows merge into one run: no transition at midnight
+    ScheduleWindow morning = { 0x02, clockAt(2, 0), clockAt(6, 0) };
+    TEST_ASSERT_TRUE(engine.addWindow(morning));
+    engine.stateAt(monday + 23 * HOUR, on);
+    TEST_ASSERT_TRUE(on);
+    TEST_ASSERT_EQUAL_UINT32(monday + 30 * HOUR, engine.nextTransition());
+}
+
+void test_exceptions() {
+    ScheduleEngine engine;
+    ScheduleWindow evenings = { SCHEDULE_ALL_DAYS & ~0x40, clockAt(18, 0), clockAt(23, 0) };   // Not Sundays
+    TEST_ASSERT_TRUE(engine.addWindow(evenings));
+    ScheduleException christmas = { 0, 12, 25, SCHEDULE_DAY_OFF };
+    ScheduleException thisChristmas = { 2026, 12, 25, SCHEDULE_DAY_ON };   // Exact year beats yearly
+    ScheduleException newYear = { 0, 1, 1, SCHEDULE_DAY_OFF };
+    ScheduleException sundayAsMonday = { 2026, 11, 1, 1 };
+    TEST_ASSERT_TRUE(engine.addException(christmas));
+    TEST_ASSERT_TRUE(engine.addException(thisChristmas));
+    TEST_ASSERT_TRUE(engine.addException(newYear));
+    TEST_ASSERT_TRUE(engine.addException(sundayAsMonday));
+    TEST_ASSERT_FALSE(engine.addException({ 0, 13, 1, SCHEDULE_DAY_OFF }));
+    TEST_ASSERT_FALSE(engine.addException({ 0, 1, 1, 9 }));
+
+    bool on;
+    engine.stateAt(at(2026, 12, 25, 3, 0), on);
+    TEST_ASSERT_TRUE(on);
+    TEST_ASSERT_EQUAL_UINT32(at(2026, 12, 26, 0, 0), engine.nextTransition());    // The whole day, instead of the windows
+    engine.stateAt(at(2027, 12, 25, 19, 0), on);
+    TEST_ASSERT_FALSE(on);
+    engine.stateAt(at(2027, 1, 1, 19, 0), on);
+    TEST_ASSERT_FALSE(on);
+    engine.stateAt(at(2026, 11, 1, 19, 0), on);          // A Sunday running Monday's windows
+    TEST_ASSERT_TRUE(on);
+    engine.stateAt(at(2026, 11, 8, 19, 0), on);
+    TEST_ASSERT_FALSE(on);
+
+    // An overnight window belongs to its first day: it still ends after midnight into an off day
+    ScheduleWindow night = { SCHEDULE_ALL_DAYS, clockAt(23, 0), clockAt(1, 0) };
+    TEST_ASSERT_TRUE(engine.addWindow(night));
+    engine.stateAt(at(2027, 1, 1, 0, 30), on);
+    TEST_ASSERT_TRUE(on);
+    engine.stateAt(at(2027, 1, 1, 23, 30), on);
+    TEST_ASSERT_FALSE(on);
+}
+
+void test_overrides() {
+    ScheduleEngine engine;
+    ScheduleWindow evenings = { SCHEDULE_ALL_DAYS, clockAt(18, 0), clockAt(23, 0) };
+    TEST_ASSERT_TRUE(engine.addWindow(evenings));
+    uint32_t day = at(2026, 10, 19, 0, 0);
+
+    ScheduleOverride maintenance = { day + 19 * HOUR, day + 20 * HOUR, 1, false };
+    ScheduleOverride event = { day + 19 * HOUR + 30 * MINUTE, day + 19 * HOUR + 45 * MINUTE, 2, true };
+    TEST_ASSERT_TRUE(engine.addOverride(maintenance));
+    TEST_ASSERT_TRUE(engine.addOverride(event));
+    TEST_ASSERT_FALSE(engine.addOverride({ day, day, 3, true }));
+
+    bool on;
+    engine.stateAt(day + 18 * HOUR, on);
+    TEST_ASSERT_TRUE(on);
+    TEST_ASSERT_EQUAL_UINT32(day + 19 * HOUR, engine.nextTransition());
+    engine.stateAt(day + 19 * HOUR, on);
+    TEST_ASSERT_FALSE(on);
+    TEST_ASSERT_EQUAL_UINT32(day + 19 * HOUR + 30 * MINUTE, engine.nextTransition());
+    engine.stateAt(day + 19 * HOUR + 30 * MINUTE, on);
+    TEST_ASSERT_TRUE(on);                               // Higher priority wins
+    engine.stateAt(day + 19 * HOUR + 50 * MINUTE, on);
+    TEST_ASSERT_FALSE(on);
+
+    // Finished overrides are dropped, and count as an edit so they get saved
+    uint32_t revision = engine.revision();
+    engine.stateAt(day + 21 * HOUR, on);
+    TEST_ASSERT_TRUE(on);
+    TEST_ASSERT_EQUAL_UINT8(0, engine.overrides());
+    TEST_ASSERT_TRUE(engine.revision() != revision);
+
+    // Same priority replaces
+    TEST_ASSERT_TRUE(engine.addOverride({ day + 22 * HOUR, day + 23 * HOUR, 1, false }));
+    TEST_ASSERT_TRUE(engine.addOverride({ day + 22 * HOUR, day + 23 * HOUR, 1, true }));
+    TEST_ASSERT_EQUAL_UINT8(1, engine.overrides());
+    for (uint8_t priority = 2; priority <= SCHEDULE_MAX_OVERRIDES; priority++) {
+        TEST_ASSERT_TRUE(engine.addOverride({ day + 22 * HOUR, day + 23 * HOUR, priority, true }));
+    }
+    TEST_ASSERT_FALSE(engine.addOverride({ day + 22 * HOUR, day + 23 * HOUR, 9, true }));
+
+    // Only an override, no windows: still applies
+    ScheduleEngine lone;
+    bool applies = lone.stateAt(day, on);
+    TEST_ASSERT_FALSE(applies);
+    TEST_ASSERT_TRUE(lone.addOverride({ day + HOUR, day + 2 * HOUR, 0, true }));
+    TEST_ASSERT_FALSE(lone.stateAt(day, on));
+    TEST_ASSERT_TRUE(lone.stateAt(day + HOUR, on));
+    TEST_ASSERT_TRUE(on);
+}
+
+// Dusk to dawn in Longyearbyen: on all day in the polar night, never in the
+// midnight sun, and switching at twilight in between
+void test_polar_sentinels() {
+    SunTable table;
+    table.build(78.2232f, 15.6267f, 3600, 2026);
+    ScheduleEngine engine;
+    engine.setSunTable(&table);
+    ScheduleWindow night = { SCHEDULE_ALL_DAYS, sun(SCHEDULE_REF_DUSK, 0, 18 * 60), sun(SCHEDULE_REF_DAWN, 0, 6 * 60) };
+    TEST_ASSERT_TRUE(engine.addWindow(night));
+
+    bool on;
+    engine.stateAt(at(2026, 12, 21, 12, 0), on);
+    TEST_ASSERT_TRUE(on);
+    engine.stateAt(at(2026, 6, 21, 0, 0), on);
+    TEST_ASSERT_FALSE(on);
+    engine.stateAt(at(2026, 6, 21, 12, 0), on);
+    TEST_ASSERT_FALSE(on);
+
+    uint16_t march = SunTable::dayOfYear(2026, 3, 10);
+    TEST_ASSERT_TRUE(table.dusk(march) < 1440);
+    uint32_t day = at(2026, 3, 10, 0, 0);
+    engine.stateAt(day + 12 * HOUR, on);
+    TEST_ASSERT_FALSE(on);
+    TEST_ASSERT_EQUAL_UINT32(day + table.dusk(march) * MINUTE, engine.nextTransition());
+
+    // Without a table the fallback clock minutes apply
+    engine.setSunTable(nullptr);
+    engine.stateAt(at(2026, 6, 21, 19, 0), on);
+    TEST_ASSERT_TRUE(on);
+}
+
+// A clock stepped back re-evaluates even though the cached span looks valid
+void test_clock_jumps_back() {
+    ScheduleEngine engine;
+    ScheduleWindow evenings = { SCHEDULE_ALL_DAYS, clockAt(18, 0), clockAt(23, 0) };
+    TEST_ASSERT_TRUE(engine.addWindow(evenings));
+    uint32_t day = at(2026, 10, 19, 0, 0);
+    bool on;
+    engine.stateAt(day + 19 * HOUR, on);
+    TEST_ASSERT_TRUE(on);
+    engine.stateAt(day + 17 * HOUR, on);
+    TEST_ASSERT_FALSE(on);
+    TEST_ASSERT_EQUAL_UINT32(day + 18 * HOUR, engine.nextTransition());
+}
+
+void test_restore() {
+    ScheduleEngine engine;
+    ScheduleWindow evenings = { SCHEDULE_ALL_DAYS, clockAt(18, 0), clockAt(23, 0) };
+    TEST_ASSERT_TRUE(engine.addWindow(evenings));
+    TEST_ASSERT_TRUE(engine.addException({ 0, 12, 25, SCHEDULE_DAY_OFF }));
+
+    ScheduleEngine copy;
+    TEST_ASSERT_TRUE(copy.restore(engine.data()));
+    TEST_ASSERT_EQUAL_UINT8(1, copy.windows());
+    TEST_ASSERT_EQUAL_UINT8(1, copy.exceptions());
+    bool on;
+    copy.stateAt(at(2026, 12, 24, 19, 0), on);
+    TEST_ASSERT_TRUE(on);
+    copy.stateAt(at(2026, 12, 25, 19, 0), on);
+    TEST_ASSERT_FALSE(on);
+
+    ScheduleData broken = engine.data();
+    broken.windowCount = SCHEDULE_MAX_WINDOWS + 1;
+    TEST_ASSERT_FALSE(copy.restore(broken));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_year_walk_matches_brute_force);
+    RUN_TEST(test_window_across_midnight);
+    RUN_TEST(test_exceptions);
+    RUN_TEST(test_overrides);
+    RUN_TEST(test_polar_sentinels);
+    RUN_TEST(test_clock_jumps_back);
+    RUN_TEST(test_restore);
+    return UNITY_END();
+}
@@ -0,0 +1,174 @@
+#include <unity.h>
+#include "SunTable.h"
+#include "datetime.h"
+
+void setUp() {}
+void tearDown() {}
+
+// Reference civil twilight: the NOAA solar calculator spreadsheet in double
+// precision, Julian centuries with all polynomial terms, iterated on the
+// event time until it settles. Returns 0, or the SUN_NEVER_* the table
+// should hold when the event does not happen.
+static uint16_t referenceEvent(double latitude, double longitude, int32_t days, bool rising, double& minutes) {
+    const double rad = M_PI / 180.0;
+    minutes = 720.0;
+    for (int pass = 0; pass < 5; pass++) {
+        double julian = 2440587.5 + days + minutes / 1440.0;
+        double t = (julian - 2451545.0) / 36525.0;
+        double meanLongitude = fmod(280.46646 + t * (36000.76983 + t * 0.0003032), 360.0);
+        double meanAnomaly = 357.52911 + t * (35999.05029 - 0.0001537 * t);
+        double eccentricity = 0.016708634 - t * (0.000042037 + 0.0000001267 * t);
+        double centre = sin(meanAnomaly * rad) * (1.914602 - t * (0.004817 + 0.000014 * t))
+                      + sin(2 * meanAnomaly * rad) * (0.019993 - 0.000101 * t)
+                      + sin(3 * meanAnomaly * rad) * 0.000289;
+        double node = 125.04 - 1934.136 * t;
+        double apparent = meanLongitude + centre - 0.00569 - 0.00478 * sin(node * rad);
+        double meanObliquity = 23 + (26 + (21.448 - t * (46.815 + t * (0.00059 - t * 0.001813))) / 60) / 60;
+        double obliquity = meanObliquity + 0.00256 * cos(node * rad);
+        double declination = asin(sin(obliquity * rad) * sin(apparent * rad));
+        double y = tan(obliquity * rad / 2);
+        y *= y;
+        double equation = 4 / rad * (y * sin(2 * meanLongitude * rad) - 2 * eccentricity * sin(meanAnomaly * rad)
+                        + 4 * eccentricity * y * sin(meanAnomaly * rad) * cos(2 * meanLongitude * rad)
+                        - 0.5 * y * y * sin(4 * meanLongitude * rad) - 1.25 * eccentricity * eccentricity * sin(2 * meanAnomaly * rad));
+        double cosHourAngle = cos(96.0 * rad) / (cos(latitude * rad) * cos(declination))
+                            - tan(latitude * rad) * tan(declination);
+        if (cosHourAngle < -1.0) return SUN_NEVER_DARK;
+        if (cosHourAngle > 1.0) return SUN_NEVER_LIGHT;
+        double hourAngle = acos(cosHourAngle) / rad;
+        minutes = 720.0 - 4.0 * (longitude + (rising ? hourAngle : -hourAngle)) - equation;
+    }
+    return 0;
+}
+
+// Minutes between two times of day, the short way round midnight
+static double apart(double a, double b) {
+    double difference = fmod(fabs(a - b), 1440.0);
+    return difference > 720.0 ? 1440.0 - difference : difference;
+}
+
+struct Site {
+    const char* name;
+    float       latitude;
+    float       longitude;
+    int32_t     zoneOffset;   // Seconds, as LOCAL_TIME_OFFSET
+};
+
+// Every day of the year against the reference, within a minute. Where the
+// reference has no event the table must hold the same sentinel; around the days the
+// polar state changes the two may disagree by a day, so those are skipped.
+// worst collects the largest difference seen.
+static void checkYear(const Site& site, uint16_t year, int& polarDays, double& worst) {
+    SunTable table;
+    table.build(site.latitude, site.longitude, site.zoneOffset, year);
+    TEST_ASSERT_TRUE(table.validFor(year));
+
+    int32_t firstDay = daysFromCivil(year, 1, 1);
+    uint16_t length = isLeapYearCivil(year) ? 366 : 365;
+    char where[64];
+    for (uint16_t day = 0; day < length; day++) {
+        snprintf(where, sizeof(where), "%s %u day %u", site.name, (unsigned)year, (unsigned)day);
+        double dawn, dusk;
+        uint16_t polar = referenceEvent(site.latitude, site.longitude, firstDay + day, true, dawn);
+        if (polar == 0) polar = referenceEvent(site.latitude, site.longitude, firstDay + day, false, dusk);
+        bool nearChange = false;
+        for (int32_t other = -1; other <= 1; other += 2) {
+            double ignored;
+            if (referenceEvent(site.latitude, site.longitude, firstDay + day + other, true, ignored) != polar) nearChange = true;
+        }
+        if (nearChange) continue;
+
+        if (polar != 0) {
+            polarDays++;
+            TEST_ASSERT_EQUAL_UINT16_MESSAGE(polar, table.dawn(day), where);
+            TEST_ASSERT_EQUAL_UINT16_MESSAGE(polar, table.dusk(day), where);
+            continue;
+        }
+        TEST_ASSERT_TRUE_MESSAGE(table.dawn(day) < 1440 && table.dusk(day) < 1440, where);
+        double zone = site.zoneOffset / 60.0;
+        TEST_ASSERT_TRUE_MESSAGE(apart(table.dawn(day), dawn + zone) <= 1.0, where);
+        TEST_ASSERT_TRUE_MESSAGE(apart(table.dusk(day), dusk + zone) <= 1.0, where);
+        worst = fmax(worst, fmax(apart(table.dawn(day), dawn + zone), apart(table.dusk(day), dusk + zone)));
+    }
+}
+
+void test_matches_reference_away_from_the_poles() {
+    const Site sites[] = {
+        { "Ho Chi Minh City", 10.7626f, 106.6602f, 7 * 3600 },
+        { "Quito", -0.1807f, -78.4678f, -5 * 3600 },
+        { "London", 51.5072f, -0.1276f, 0 },
+        { "Sydney", -33.8688f, 151.2093f, 10 * 3600 },
+        { "Stockholm", 59.3293f, 18.0686f, 3600 },
+    };
+    double worst = 0;
+    for (const Site& site : sites) {
+        int polarDays = 0;
+        checkYear(site, 2026, polarDays, worst);
+        checkYear(site, 2028, polarDays, worst);   // Leap year
+        TEST_ASSERT_EQUAL_INT(0, polarDays);
+    }
+    char report[64];
+    snprintf(report, sizeof(report), "Largest difference from the reference %.2f minutes", worst);
+    TEST_MESSAGE(report);
+}
+
+// Reykjavik has white nights around midsummer; Longyearbyen also has polar night
+void test_matches_reference_near_the_poles() {
+    const Site reykjavik = { "Reykjavik", 64.1466f, -21.9426f, 0 };
+    const Site longyearbyen = { "Longyearbyen", 78.2232f, 15.6267f, 3600 };
+    int polarDays = 0;
+    double worst = 0;
+    checkYear(reykjavik, 2026, polarDays, worst);
+    TEST_ASSERT_GREATER_THAN(20, polarDays);
+    polarDays = 0;
+    checkYear(longyearbyen, 2026, polarDays, worst);
+    TEST_ASSERT_GREATER_THAN(150, polarDays);
+}
+
+void test_polar_sentinels() {
+    SunTable table;
+    table.build(78.2232f, 15.6267f, 3600, 2026);
+    uint16_t midsummer = SunTable::dayOfYear(2026, 6, 21);
+    uint16_t midwinter = SunTable::dayOfYear(2026, 12, 21);
+    TEST_ASSERT_EQUAL_UINT16(SUN_NEVER_DARK, table.dawn(midsummer));
+    TEST_ASSERT_EQUAL_UINT16(SUN_NEVER_DARK, table.dusk(midsummer));
+    TEST_ASSERT_EQUAL_UINT16(SUN_NEVER_LIGHT, table.dawn(midwinter));
+    TEST_ASSERT_EQUAL_UINT16(SUN_NEVER_LIGHT, table.dusk(midwinter));
+
+    // Tromsø: midnight sun in June, but civil twilight at noon through the polar night
+    table.build(69.6492f, 18.9553f, 3600, 2026);
+    TEST_ASSERT_EQUAL_UINT16(SUN_NEVER_DARK, table.dawn(midsummer));
+    TEST_ASSERT_TRUE(table.dawn(midwinter) < table.dusk(midwinter));
+    TEST_ASSERT_TRUE(table.dusk(midwinter) < 1440);
+}
+
+void test_year_bookkeeping() {
+    SunTable table;
+    TEST_ASSERT_EQUAL_UINT16(0, table.year());
+    TEST_ASSERT_FALSE(table.validFor(0));
+    TEST_ASSERT_FALSE(table.validFor(2026));
+
+    table.build(10.7626f, 106.6602f, 7 * 3600, 2026);
+    TEST_ASSERT_TRUE(table.validFor(2026));
+    TEST_ASSERT_FALSE(table.validFor(2027));
+    // Common years repeat 31 December in the last slot
+    TEST_ASSERT_EQUAL_UINT16(table.dawn(364), table.dawn(365));
+    TEST_ASSERT_EQUAL_UINT16(table.dusk(364), table.dusk(365));
+
+    TEST_ASSERT_EQUAL_UINT16(0, SunTable::dayOfYear(2026, 1, 1));
+    TEST_ASSERT_EQUAL_UINT16(59, SunTable::dayOfYear(2026, 3, 1));
+    TEST_ASSERT_EQUAL_UINT16(60, SunTable::dayOfYear(2028, 3, 1));
+    TEST_ASSERT_EQUAL_UINT16(365, SunTable::dayOfYear(2028, 12, 31));
+
+    table.clear();
+    TEST_ASSERT_FALSE(table.validFor(2026));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_matches_reference_away_from_the_poles);
+    RUN_TEST(test_matches_reference_near_the_poles);
+    RUN_TEST(test_polar_sentinels);
+    RUN_TEST(test_year_bookkeeping);
+    return UNITY_END();
+}